@@ -0,0 +1,449 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "AuditLogsProxy.h"
+#include "Helpers.h"
+#include "StudiesExport.h"
+#include "StudiesFindCache.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+static const size_t MAX_CACHED_PAGES = 100;
+
+// The GET arguments of '/auth/audit-logs' that filter the logs
+static const char* const FILTERS[] = {
+  "user-id",
+  "resource-id",
+  "action",
+  "from-timestamp",
+  "to-timestamp"
+};
+
+static const char* const CSV_COLUMNS[] = {
+  "Timestamp",
+  "SourcePlugin",
+  "UserId",
+  "UserName",
+  "ResourceType",
+  "ResourceId",
+  "Action",
+  "LogData"
+};
+
+
+// A cursor is only valid for the filters it has been generated for
+static std::string ComputeFiltersHash(const AuditLogsProxy::Filters& filters)
+{
+  Json::Value json = Json::objectValue;
+  for (AuditLogsProxy::Filters::const_iterator it = filters.begin(); it != filters.end(); ++it)
+  {
+    json[it->first] = it->second;
+  }
+
+  std::string serialized, hash;
+  OrthancPlugins::WriteFastJson(serialized, json);
+  Orthanc::Toolbox::ComputeMD5(hash, serialized);
+
+  return hash;
+}
+
+
+static void DecodeCursor(Json::Value& cursor,
+                         const std::string& encoded,
+                         const std::string& filtersHash)
+{
+  std::string decoded;
+
+  try
+  {
+    Orthanc::Toolbox::DecodeBase64(decoded, encoded);
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid cursor");
+  }
+
+  if (!OrthancPlugins::ReadJson(cursor, decoded) ||
+      !cursor.isObject() ||
+      cursor["Filters"].asString() != filtersHash)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid cursor or cursor used with other filters");
+  }
+}
+
+
+static std::string EncodeCursor(const Json::Value& cursor)
+{
+  std::string serialized, encoded;
+  OrthancPlugins::WriteFastJson(serialized, cursor);
+  Orthanc::Toolbox::EncodeBase64(encoded, serialized);
+
+  return encoded;
+}
+
+
+static void AppendArgument(std::string& uri,
+                           const std::string& key,
+                           const std::string& value)
+{
+  std::string encoded;
+  Orthanc::Toolbox::UriEncode(encoded, value);
+
+  uri += (uri.find('?') == std::string::npos ? "?" : "&");
+  uri += key + "=" + encoded;
+}
+
+
+// Identifies the last log of a page, that must be the first log of the next page
+static std::string ComputeLogHash(const Json::Value& log)
+{
+  std::string serialized, hash;
+  OrthancPlugins::WriteFastJson(serialized, log);
+  Orthanc::Toolbox::ComputeMD5(hash, serialized);
+
+  return hash;
+}
+
+
+AuditLogsProxy::AuditLogsProxy(unsigned int pageSize,
+                               unsigned int exportPageSize,
+                               unsigned int maxAge,
+                               bool isDescending) :
+  pageSize_(pageSize),
+  exportPageSize_(exportPageSize),
+  maxAge_(maxAge),
+  isDescending_(isDescending)
+{
+}
+
+
+void AuditLogsProxy::GetFilters(Filters& filters,
+                                const OrthancPluginHttpRequest* request)
+{
+  filters.clear();
+
+  for (size_t i = 0; i < sizeof(FILTERS) / sizeof(FILTERS[0]); i++)
+  {
+    std::string value;
+    if (OrthancPlugins::LookupHttpGetArgument(value, request, FILTERS[i]) &&
+        !value.empty())
+    {
+      filters[FILTERS[i]] = value;
+    }
+  }
+}
+
+
+void AuditLogsProxy::LoadPage(Json::Value& logs,
+                              std::string& nextCursor,
+                              const Filters& filters,
+                              const std::string& cursor,
+                              unsigned int limit,
+                              const OrthancPlugins::HttpHeaders& headers) const
+{
+  if (limit == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  const std::string filtersHash = ComputeFiltersHash(filters);
+
+  Filters arguments = filters;
+  uint64_t since = 0;
+  uint64_t previousSkip = 0;
+  std::string cursorTimestamp;
+  std::string cursorLogHash;
+
+  if (!cursor.empty())
+  {
+    // seek to the timestamp of the last log of the previous page, and only skip the logs of
+    // the previous page that share this timestamp, except the last one that is loaded again
+    Json::Value decoded;
+    DecodeCursor(decoded, cursor, filtersHash);
+
+    cursorTimestamp = decoded["Timestamp"].asString();
+    cursorLogHash = decoded["Last"].asString();
+    previousSkip = decoded["Skip"].asUInt64();
+
+    if (previousSkip == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid cursor");
+    }
+
+    since = previousSkip - 1;
+    arguments[isDescending_ ? "to-timestamp" : "from-timestamp"] = cursorTimestamp;
+  }
+
+  const unsigned int overlap = (cursor.empty() ? 0 : 1);
+
+  std::string uri = "/auth/audit-logs";
+  for (Filters::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+  {
+    AppendArgument(uri, it->first, it->second);
+  }
+
+  AppendArgument(uri, "log-data-format", "json");
+  AppendArgument(uri, "since", boost::lexical_cast<std::string>(since));
+  AppendArgument(uri, "limit", boost::lexical_cast<std::string>(overlap + limit + 1));  // one more log to know if there are more logs
+
+  Json::Value loaded;
+  if (!OrthancPlugins::RestApiGet(loaded, uri, headers, true) ||
+      loaded.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to get the audit logs");
+  }
+
+  // The cursor assumes that the timestamp bounds are inclusive and that the logs are ordered by
+  // timestamp in the configured direction, in an order that does not change for the logs that share
+  // a timestamp.  The first log must thus be the last log of the previous page.
+  if (overlap > 0 &&
+      (loaded.size() == 0 ||
+       ComputeLogHash(loaded[0]) != cursorLogHash))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                    "The audit logs have changed since the previous page or are not paged as expected");
+  }
+
+  logs = Json::arrayValue;
+  for (Json::Value::ArrayIndex i = overlap; i < loaded.size() && i < overlap + limit + 1; i++)
+  {
+    const std::string previous = (i > 0 ? loaded[i - 1]["Timestamp"].asString() : "");
+    const std::string current = loaded[i]["Timestamp"].asString();
+
+    if (i > 0 &&
+        (isDescending_ ? current > previous : current < previous))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "The audit logs are not ordered as configured by 'AuditLogsProxy.Order'");
+    }
+
+    logs.append(loaded[i]);
+  }
+
+  const bool isComplete = (logs.size() <= limit);
+  if (!isComplete)
+  {
+    logs.resize(limit);
+  }
+
+  nextCursor.clear();
+
+  if (!isComplete)
+  {
+    const std::string lastTimestamp = logs[limit - 1]["Timestamp"].asString();
+
+    uint64_t skip = 0;
+    for (Json::Value::ArrayIndex i = limit; i > 0 && logs[i - 1]["Timestamp"].asString() == lastTimestamp; i--)
+    {
+      skip++;
+    }
+
+    if (lastTimestamp == cursorTimestamp)
+    {
+      skip += previousSkip;  // the whole page has the same timestamp as the previous one
+    }
+
+    Json::Value next;
+    next["Filters"] = filtersHash;
+    next["Timestamp"] = lastTimestamp;
+    next["Skip"] = static_cast<Json::UInt64>(skip);
+    next["Last"] = ComputeLogHash(logs[limit - 1]);
+
+    nextCursor = EncodeCursor(next);
+  }
+}
+
+
+void AuditLogsProxy::GetPage(Json::Value& answer,
+                             const Filters& filters,
+                             const std::string& cursor,
+                             const OrthancPlugins::HttpHeaders& headers)
+{
+  std::string key;
+
+  if (cursor.empty() && maxAge_ > 0)
+  {
+    Json::Value request = Json::objectValue;
+    for (Filters::const_iterator it = filters.begin(); it != filters.end(); ++it)
+    {
+      request[it->first] = it->second;
+    }
+
+    key = StudiesFindCache::GetKey(request, headers);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    CachedPages::const_iterator found = cachedPages_.find(key);
+    if (found != cachedPages_.end() &&
+        boost::posix_time::microsec_clock::universal_time() < found->second.expiration_)
+    {
+      answer = found->second.answer_;
+      return;
+    }
+  }
+
+  Json::Value logs;
+  std::string nextCursor;
+  LoadPage(logs, nextCursor, filters, cursor, pageSize_, headers);
+
+  answer = Json::objectValue;
+  answer["Logs"] = logs;
+
+  if (!nextCursor.empty())
+  {
+    answer["Cursor"] = nextCursor;
+  }
+
+  if (!key.empty())
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (CachedPages::iterator it = cachedPages_.begin(); it != cachedPages_.end(); )
+    {
+      if (it->second.expiration_ <= now)
+      {
+        cachedPages_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    if (cachedPages_.size() < MAX_CACHED_PAGES)
+    {
+      CachedPage& page = cachedPages_[key];
+      page.answer_ = answer;
+      page.expiration_ = now + boost::posix_time::seconds(maxAge_);
+    }
+  }
+}
+
+
+static void FormatCsvPage(std::string& target,
+                          const Json::Value& logs)
+{
+  for (Json::Value::ArrayIndex i = 0; i < logs.size(); i++)
+  {
+    const Json::Value& log = logs[i];
+
+    for (size_t c = 0; c < sizeof(CSV_COLUMNS) / sizeof(CSV_COLUMNS[0]); c++)
+    {
+      if (c > 0)
+      {
+        target += ',';
+      }
+
+      std::string value;
+      if (std::string(CSV_COLUMNS[c]) == "LogData")
+      {
+        if (log.isMember("JsonLogData") && !log["JsonLogData"].isNull())
+        {
+          OrthancPlugins::WriteFastJson(value, log["JsonLogData"]);
+          value = Orthanc::Toolbox::StripSpaces(value);  // remove the trailing newline
+        }
+      }
+      else if (log.isMember(CSV_COLUMNS[c]) && log[CSV_COLUMNS[c]].isConvertibleTo(Json::stringValue))
+      {
+        value = log[CSV_COLUMNS[c]].asString();
+      }
+
+      StudiesExport::AppendCsvValue(target, value);
+    }
+
+    target += "\r\n";
+  }
+}
+
+
+void AuditLogsProxy::AnswerCsv(OrthancPluginRestOutput* output,
+                               const Filters& filters,
+                               const OrthancPlugins::HttpHeaders& headers)
+{
+  // the first page is loaded before the answer is started, such that an invalid request gets an error status
+  Json::Value logs;
+  std::string nextCursor;
+  LoadPage(logs, nextCursor, filters, "", exportPageSize_, headers);
+
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (OrthancPluginStartMultipartAnswer(context, output, "mixed", "text/csv") != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Unable to start the multipart answer");
+  }
+
+  std::string part;
+
+  for (size_t c = 0; c < sizeof(CSV_COLUMNS) / sizeof(CSV_COLUMNS[0]); c++)
+  {
+    if (c > 0)
+    {
+      part += ',';
+    }
+
+    part += CSV_COLUMNS[c];
+  }
+
+  part += "\r\n";
+
+  for (;;)
+  {
+    FormatCsvPage(part, logs);
+
+    if (OrthancPluginSendMultipartItem(context, output, part.c_str(), part.size()) != OrthancPluginErrorCode_Success)
+    {
+      return;  // the client has most probably closed the connection
+    }
+
+    if (nextCursor.empty())
+    {
+      return;
+    }
+
+    part.clear();
+
+    try
+    {
+      const std::string cursor = nextCursor;
+      LoadPage(logs, nextCursor, filters, cursor, exportPageSize_, headers);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while exporting the audit logs: " << e.What();
+      StudiesExport::SendErrorPart(output, e.What());
+      return;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "OE2: Error while exporting the audit logs: " << e.what();
+      StudiesExport::SendErrorPart(output, e.what());
+      return;
+    }
+  }
+}
@@ -0,0 +1,94 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+
+
+// Pages the audit logs of the authorization plugin ('/auth/audit-logs') such that the audit logs
+// page does not download all the matching logs at once.  The pages are chained through a cursor
+// on the timestamp of the last log (the offset is only used for the logs that share this timestamp)
+// such that the cost of a page does not grow with its position.  The authorization plugin does not
+// tell how it orders the logs: it is provided by the configuration ('isDescending') and checked on
+// each page.  Each page also loads the last log of the previous page again to check that the
+// timestamp bounds are inclusive and that the logs sharing a timestamp keep their order, otherwise
+// the page fails instead of skipping logs.  The first page of each filter and user is kept 'maxAge'
+// seconds since it is the one that is loaded each time the page is opened.
+class AuditLogsProxy : public boost::noncopyable
+{
+public:
+  typedef std::map<std::string, std::string>  Filters;
+
+private:
+  struct CachedPage
+  {
+    Json::Value               answer_;
+    boost::posix_time::ptime  expiration_;
+  };
+
+  typedef std::map<std::string, CachedPage>  CachedPages;
+
+  boost::mutex   mutex_;
+  CachedPages    cachedPages_;
+  unsigned int   pageSize_;
+  unsigned int   exportPageSize_;
+  unsigned int   maxAge_;       // in seconds
+  bool           isDescending_; // the order of the logs answered by the authorization plugin
+
+  void LoadPage(Json::Value& logs,
+                std::string& nextCursor,
+                const Filters& filters,
+                const std::string& cursor,
+                unsigned int limit,
+                const OrthancPlugins::HttpHeaders& headers) const;
+
+public:
+  AuditLogsProxy(unsigned int pageSize,
+                 unsigned int exportPageSize,
+                 unsigned int maxAge,
+                 bool isDescending);
+
+  // Keeps the filters of the GET arguments that are forwarded to the authorization plugin
+  static void GetFilters(Filters& filters,
+                         const OrthancPluginHttpRequest* request);
+
+  // Fills 'answer' with {"Logs": [...], "Cursor": "..."}.  The cursor is absent once all the logs
+  // have been returned.  The 'headers' are forwarded such that the authorization plugin checks the
+  // permissions of the user.
+  void GetPage(Json::Value& answer,
+               const Filters& filters,
+               const std::string& cursor,
+               const OrthancPlugins::HttpHeaders& headers);
+
+  // Answers all the logs as CSV in a 'multipart/mixed' stream with one part per page of 'exportPageSize'
+  // logs, sent as soon as the page has been loaded.  Only one page is kept in memory at a time.
+  void AnswerCsv(OrthancPluginRestOutput* output,
+                 const Filters& filters,
+                 const OrthancPlugins::HttpHeaders& headers);
+};
@@ -0,0 +1,373 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "BackgroundStudiesIndex.h"
+
+#include <Logging.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+static const size_t SCAN_PAGE_SIZE = 1000;
+static const unsigned int MAX_SCAN_ATTEMPTS = 3;
+
+
+BackgroundStudiesIndex::BackgroundStudiesIndex(const std::string& name,
+                                               size_t maxBatchSize) :
+  name_(name),
+  maxBatchSize_(maxBatchSize),
+  isRunning_(false),
+  isBroken_(false)
+{
+}
+
+
+BackgroundStudiesIndex::~BackgroundStudiesIndex()
+{
+  Stop();
+}
+
+
+void BackgroundStudiesIndex::Start()
+{
+  boost::mutex::scoped_lock lock(changesMutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+    worker_ = boost::thread(Worker, this);
+  }
+}
+
+
+void BackgroundStudiesIndex::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+    isRunning_ = false;
+  }
+
+  changesAvailable_.notify_all();
+
+  if (worker_.joinable())
+  {
+    worker_.join();
+  }
+}
+
+
+bool BackgroundStudiesIndex::IsHandledChange(OrthancPluginChangeType changeType) const
+{
+  return (changeType == OrthancPluginChangeType_NewStudy ||
+          changeType == OrthancPluginChangeType_StableStudy ||
+          changeType == OrthancPluginChangeType_Deleted);
+}
+
+
+void BackgroundStudiesIndex::SignalChange(OrthancPluginChangeType changeType,
+                                          OrthancPluginResourceType resourceType,
+                                          const std::string& resourceId)
+{
+  if (resourceType == OrthancPluginResourceType_Study &&
+      IsHandledChange(changeType))
+  {
+    PushChange(resourceId, changeType == OrthancPluginChangeType_Deleted, changeType == OrthancPluginChangeType_StableStudy);
+  }
+}
+
+
+void BackgroundStudiesIndex::PushChange(const std::string& studyId,
+                                        bool isDeleted,
+                                        bool areLabelsChanging)
+{
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+
+    if (isBroken_)
+    {
+      return;
+    }
+
+    Change change;
+    change.studyId_ = studyId;
+    change.isDeleted_ = isDeleted;
+    change.areLabelsChanging_ = areLabelsChanging;
+    changes_.push_back(change);
+  }
+
+  changesAvailable_.notify_one();
+}
+
+
+bool BackgroundStudiesIndex::IsRunning()
+{
+  boost::mutex::scoped_lock lock(changesMutex_);
+  return isRunning_;
+}
+
+
+void BackgroundStudiesIndex::GetPendingChanges(std::vector<Change>& changes)
+{
+  boost::mutex::scoped_lock lock(changesMutex_);
+  changes.assign(changes_.begin(), changes_.end());
+}
+
+
+bool BackgroundStudiesIndex::ApplyPendingChanges()
+{
+  std::vector<Change> changes;
+
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+    changes.assign(changes_.begin(), changes_.end());
+    changes_.clear();
+  }
+
+  bool hasDeletedStudy = false;
+
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    hasDeletedStudy |= changes[i].isDeleted_;
+  }
+
+  if (!changes.empty())
+  {
+    ApplyChanges(changes);
+  }
+
+  return hasDeletedStudy;
+}
+
+
+void BackgroundStudiesIndex::SchedulePeriodicTask(const boost::posix_time::ptime& time)
+{
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+    nextPeriodicTask_ = time;
+  }
+
+  changesAvailable_.notify_one();
+}
+
+
+void BackgroundStudiesIndex::ApplyChange(const Change& /*change*/)
+{
+  throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+}
+
+
+void BackgroundStudiesIndex::ApplyChanges(const std::vector<Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    ApplyChange(changes[i]);
+  }
+}
+
+
+void BackgroundStudiesIndex::AddScannedStudy(const std::string& /*studyId*/,
+                                             const Json::Value& /*study*/)
+{
+  throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+}
+
+
+void BackgroundStudiesIndex::ClearScannedStudies()
+{
+  throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+}
+
+
+void BackgroundStudiesIndex::Worker(BackgroundStudiesIndex* that)
+{
+  try
+  {
+    that->Build();
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "OE2: Error while building the " << that->name_ << ", it will not be used: " << e.What();
+
+    boost::mutex::scoped_lock lock(that->changesMutex_);
+    that->isBroken_ = true;
+    that->changes_.clear();
+    return;
+  }
+
+  for (;;)
+  {
+    std::vector<Change> changes;
+    bool mustRunPeriodicTask = false;
+
+    {
+      boost::mutex::scoped_lock lock(that->changesMutex_);
+
+      for (;;)
+      {
+        if (!that->isRunning_)
+        {
+          return;
+        }
+
+        if (!that->nextPeriodicTask_.is_not_a_date_time() &&
+            boost::posix_time::microsec_clock::universal_time() >= that->nextPeriodicTask_)
+        {
+          that->nextPeriodicTask_ = boost::posix_time::ptime();
+          mustRunPeriodicTask = true;
+          break;
+        }
+
+        if (!that->changes_.empty())
+        {
+          while (!that->changes_.empty() &&
+                 changes.size() < that->maxBatchSize_)
+          {
+            changes.push_back(that->changes_.front());
+            that->changes_.pop_front();
+          }
+
+          break;
+        }
+
+        if (that->nextPeriodicTask_.is_not_a_date_time())
+        {
+          that->changesAvailable_.wait(lock);
+        }
+        else
+        {
+          that->changesAvailable_.timed_wait(lock, that->nextPeriodicTask_);
+        }
+      }
+    }
+
+    try
+    {
+      if (mustRunPeriodicTask)
+      {
+        that->RunPeriodicTask();
+      }
+      else
+      {
+        that->ApplyChanges(changes);
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while updating the " << that->name_ << ": " << e.What();
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "OE2: Error while updating the " << that->name_ << ": " << e.what();
+    }
+  }
+}
+
+
+bool BackgroundStudiesIndex::ScanStudiesPages(const std::string& arguments)
+{
+  for (size_t since = 0; ; since += SCAN_PAGE_SIZE)
+  {
+    if (!IsRunning())
+    {
+      return false;
+    }
+
+    Json::Value studies;
+    if (!OrthancPlugins::RestApiGet(studies, "/studies?expand" + arguments + "&since=" + boost::lexical_cast<std::string>(since) +
+                                    "&limit=" + boost::lexical_cast<std::string>(SCAN_PAGE_SIZE), false) ||
+        studies.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the studies");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      if (studies[i].isObject() &&
+          studies[i].isMember("ID") &&
+          studies[i]["ID"].isString())
+      {
+        AddScannedStudy(studies[i]["ID"].asString(), studies[i]);
+      }
+    }
+
+    if (studies.size() < SCAN_PAGE_SIZE)
+    {
+      return true;
+    }
+  }
+}
+
+
+bool BackgroundStudiesIndex::ScanStudies(const std::string& arguments)
+{
+  for (unsigned int attempt = 1; ; attempt++)
+  {
+    if (!ScanStudiesPages(arguments))
+    {
+      return false;
+    }
+
+    const bool hasDeletedStudy = ApplyPendingChanges();
+
+    size_t scannedCount = 0;
+    size_t storedCount = 0;
+    bool isCountDifferent = false;
+
+    if (GetScannedStudiesCount(scannedCount))
+    {
+      Json::Value statistics;
+      if (!OrthancPlugins::RestApiGet(statistics, "/statistics", false) ||
+          !statistics.isMember("CountStudies"))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to count the studies");
+      }
+
+      storedCount = statistics["CountStudies"].asUInt();
+      isCountDifferent = (scannedCount != storedCount);
+    }
+
+    if (!hasDeletedStudy &&
+        !isCountDifferent)
+    {
+      return true;
+    }
+    else if (attempt == MAX_SCAN_ATTEMPTS)
+    {
+      if (isCountDifferent)
+      {
+        LOG(WARNING) << "OE2: The " << name_ << " might be incomplete: " << scannedCount << " studies are indexed, "
+                     << storedCount << " are stored";
+      }
+      else
+      {
+        LOG(WARNING) << "OE2: The " << name_ << " might be incomplete: studies keep being deleted while it is built";
+      }
+
+      return true;
+    }
+    else
+    {
+      LOG(INFO) << "OE2: The studies have changed during the scan, the " << name_ << " is built again";
+      ClearScannedStudies();
+    }
+  }
+}
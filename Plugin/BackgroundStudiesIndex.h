@@ -0,0 +1,132 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <vector>
+
+
+// Base class of the in-memory indexes of the studies that are built in the background when Orthanc
+// starts and that are then updated from the changes of the studies.  SignalChange() is called from
+// the changes callback of Orthanc, in which no REST call nor database access is allowed: the changes
+// are only queued, and they are applied by a worker thread.  The changes that are received while the
+// index is being built stay in the queue and are applied afterwards.  The derived classes must call
+// Stop() in their destructor, since the worker calls their virtual methods.
+class BackgroundStudiesIndex : public boost::noncopyable
+{
+protected:
+  struct Change
+  {
+    std::string  studyId_;
+    bool         isDeleted_;
+    bool         areLabelsChanging_;   // the labels might still be set by a Lua script, a plugin or an HTTP request
+  };
+
+private:
+  std::string                         name_;           // for the logs
+  size_t                              maxBatchSize_;   // the maximum number of changes given to ApplyChanges()
+  boost::mutex                        changesMutex_;
+  boost::condition_variable           changesAvailable_;
+  std::deque<Change>                  changes_;
+  bool                                isRunning_;
+  bool                                isBroken_;       // true if the index could not be built
+  boost::posix_time::ptime            nextPeriodicTask_;
+  boost::thread                       worker_;
+
+  static void Worker(BackgroundStudiesIndex* that);
+
+  // returns false if the index has been stopped
+  bool ScanStudiesPages(const std::string& arguments);
+
+protected:
+  BackgroundStudiesIndex(const std::string& name,
+                         size_t maxBatchSize);
+
+  // By default, the new, stable and deleted studies
+  virtual bool IsHandledChange(OrthancPluginChangeType changeType) const;
+
+  void PushChange(const std::string& studyId,
+                  bool isDeleted,
+                  bool areLabelsChanging);
+
+  bool IsRunning();
+
+  // The changes that are queued and not applied yet
+  void GetPendingChanges(std::vector<Change>& changes);
+
+  // Applies the queued changes right now (from the worker thread).  Returns true if a study has
+  // been deleted.
+  bool ApplyPendingChanges();
+
+  // RunPeriodicTask() is called once by the worker at 'time', with priority over the changes
+  void SchedulePeriodicTask(const boost::posix_time::ptime& time);
+
+  // Loads all the studies (GET /studies?expand, followed by the 'arguments') by pages and gives them to
+  // AddScannedStudy().  The pages are read with an offset: if a study is deleted meanwhile, the next
+  // ones move to the previous page and one of them may be skipped -> the studies are scanned again
+  // (at most 3 times) if a study has been deleted during the scan or if GetScannedStudiesCount()
+  // differs from the number of studies in Orthanc.  Returns false if the index has been stopped.
+  bool ScanStudies(const std::string& arguments);
+
+  // Builds the index (called once by the worker before the changes are applied).  If this throws,
+  // the index is never used.
+  virtual void Build() = 0;
+
+  virtual void ApplyChange(const Change& change);
+
+  // By default, calls ApplyChange() for each change
+  virtual void ApplyChanges(const std::vector<Change>& changes);
+
+  virtual void RunPeriodicTask()
+  {
+  }
+
+  // The three following methods must be implemented by the indexes that call ScanStudies()
+  virtual void AddScannedStudy(const std::string& studyId,
+                               const Json::Value& study);
+
+  virtual void ClearScannedStudies();
+
+  // Returns false if the number of studies in the index cannot be compared with the database
+  virtual bool GetScannedStudiesCount(size_t& /*count*/)
+  {
+    return false;
+  }
+
+public:
+  virtual ~BackgroundStudiesIndex();
+
+  void Start();
+
+  void Stop();
+
+  // Called when Orthanc reports a change on a resource
+  void SignalChange(OrthancPluginChangeType changeType,
+                    OrthancPluginResourceType resourceType,
+                    const std::string& resourceId);
+};
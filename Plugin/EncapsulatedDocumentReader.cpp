@@ -0,0 +1,354 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "EncapsulatedDocumentReader.h"
+
+#include <Toolbox.h>
+
+#include <stdint.h>
+
+
+static const char* const MIME_TYPE_PDF = "application/pdf";
+static const char* const MIME_TYPE_STL = "model/stl";
+
+static const char* const ENCAPSULATED_PDF_STORAGE = "1.2.840.10008.5.1.4.1.1.104.1";
+static const char* const ENCAPSULATED_STL_STORAGE = "1.2.840.10008.5.1.4.1.1.104.3";
+
+static const char* const IMPLICIT_VR_LITTLE_ENDIAN = "1.2.840.10008.1.2";
+
+// the tags that are appended after the dataset created by Orthanc (they must be the last ones)
+static const uint16_t ENCAPSULATED_DOCUMENT_GROUP = 0x0042;
+static const uint16_t ENCAPSULATED_DOCUMENT = 0x0011;
+static const uint16_t MIME_TYPE_OF_ENCAPSULATED_DOCUMENT = 0x0012;
+static const uint16_t ENCAPSULATED_DOCUMENT_LENGTH = 0x0015;
+
+
+static void WriteUInt16(std::string& target,
+                        uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void WriteUInt32(std::string& target,
+                        uint32_t value)
+{
+  WriteUInt16(target, static_cast<uint16_t>(value & 0xffff));
+  WriteUInt16(target, static_cast<uint16_t>(value >> 16));
+}
+
+
+static void PatchUInt32(std::string& target,
+                        size_t offset,
+                        uint32_t value)
+{
+  std::string encoded;
+  WriteUInt32(encoded, value);
+  target.replace(offset, 4, encoded);
+}
+
+
+// Writes the header of an element and returns the position of its length
+static size_t WriteElementHeader(std::string& target,
+                                 bool isExplicitVR,
+                                 uint16_t group,
+                                 uint16_t element,
+                                 const char* vr,
+                                 uint32_t length)
+{
+  WriteUInt16(target, group);
+  WriteUInt16(target, element);
+
+  if (isExplicitVR)
+  {
+    target.append(vr, 2);
+
+    if (std::string(vr) == "OB")
+    {
+      WriteUInt16(target, 0);  // reserved
+    }
+    else
+    {
+      // short form of the length (LO and UL)
+      WriteUInt16(target, static_cast<uint16_t>(length));
+      return target.size() - 2;
+    }
+  }
+
+  WriteUInt32(target, length);
+  return target.size() - 4;
+}
+
+
+// Reads the transfer syntax in the File Meta Information of a DICOM file (always in Explicit VR Little Endian)
+static std::string GetTransferSyntax(const std::string& dicom)
+{
+  size_t position = 132;
+
+  while (position + 8 <= dicom.size())
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(dicom.c_str()) + position;
+    const uint16_t group = static_cast<uint16_t>(p[0] | (p[1] << 8));
+    const uint16_t element = static_cast<uint16_t>(p[2] | (p[3] << 8));
+    const std::string vr(dicom, position + 4, 2);
+
+    if (group != 0x0002)
+    {
+      break;
+    }
+
+    size_t length, offset;
+    if (vr == "OB" || vr == "UN" || vr == "UT" || vr == "SQ")
+    {
+      if (position + 12 > dicom.size())
+      {
+        break;
+      }
+
+      length = (p[8] | (p[9] << 8) | (p[10] << 16) | (static_cast<uint32_t>(p[11]) << 24));
+      offset = position + 12;
+    }
+    else
+    {
+      length = static_cast<size_t>(p[6] | (p[7] << 8));
+      offset = position + 8;
+    }
+
+    if (element == 0x0010 &&
+        offset + length <= dicom.size())
+    {
+      std::string transferSyntax = dicom.substr(offset, length);
+
+      while (!transferSyntax.empty() &&
+             (transferSyntax[transferSyntax.size() - 1] == '\0' ||
+              transferSyntax[transferSyntax.size() - 1] == ' '))
+      {
+        transferSyntax.resize(transferSyntax.size() - 1);
+      }
+
+      return transferSyntax;
+    }
+
+    position = offset + length;
+  }
+
+  throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot read the transfer syntax of the created DICOM file");
+}
+
+
+// The elements of the document are appended after the dataset created by Orthanc -> this dataset
+// must not contain a tag that comes after (0042,0011) in the ascending order of the tags
+static void CheckTagPrecedesDocument(const std::string& name)
+{
+  OrthancPluginDictionaryEntry entry;
+  if (OrthancPluginLookupDictionary(OrthancPlugins::GetGlobalContext(), &entry, name.c_str()) != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unknown DICOM tag in the tags of the series: " + name);
+  }
+
+  if (entry.group > ENCAPSULATED_DOCUMENT_GROUP ||
+      (entry.group == ENCAPSULATED_DOCUMENT_GROUP && entry.element >= ENCAPSULATED_DOCUMENT))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
+                                    "The tags of an encapsulated document must precede (0042,0011): " + name);
+  }
+}
+
+
+// Derives a DICOM UID from a random UUID ("2.25." followed by the decimal value of the UUID)
+static std::string GenerateDicomUid()
+{
+  std::string uuid = Orthanc::Toolbox::GenerateUuid();
+
+  std::vector<uint8_t> digits;  // base-16 digits, most significant first
+  for (size_t i = 0; i < uuid.size(); i++)
+  {
+    if (uuid[i] != '-')
+    {
+      const char c = uuid[i];
+      digits.push_back(static_cast<uint8_t>(c >= 'a' ? c - 'a' + 10 : (c >= 'A' ? c - 'A' + 10 : c - '0')));
+    }
+  }
+
+  std::string decimal;
+
+  for (;;)
+  {
+    // divide the number by 10
+    unsigned int remainder = 0;
+    bool isZero = true;
+
+    for (size_t i = 0; i < digits.size(); i++)
+    {
+      const unsigned int value = remainder * 16 + digits[i];
+      digits[i] = static_cast<uint8_t>(value / 10);
+      remainder = value % 10;
+      isZero &= (digits[i] == 0);
+    }
+
+    decimal.insert(decimal.begin(), static_cast<char>('0' + remainder));
+
+    if (isZero)
+    {
+      return "2.25." + decimal;
+    }
+  }
+}
+
+
+EncapsulatedDocumentReader::EncapsulatedDocumentReader(const std::string& studyId,
+                                                       const std::string& mimeType,
+                                                       const Json::Value& tags,
+                                                       size_t expectedSize) :
+  documentOffset_(0),
+  lengthOffset_(0),
+  mimeType_(mimeType)
+{
+  if (!IsSupportedMimeType(mimeType))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unsupported type of encapsulated document: " + mimeType);
+  }
+
+  if (!tags.isObject())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The tags of the series must be a JSON object");
+  }
+
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyId, false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown study: " + studyId);
+  }
+
+  // same as the 'Parent' option of /tools/create-dicom: the patient and study tags come from the study
+  Json::Value dataset = tags;
+  dataset["SpecificCharacterSet"] = "ISO_IR 192";  // the tags of the Orthanc API are in UTF-8
+
+  const Json::Value* modules[2] = { &study["PatientMainDicomTags"], &study["MainDicomTags"] };
+  for (size_t i = 0; i < 2; i++)
+  {
+    const std::vector<std::string> names = modules[i]->getMemberNames();
+    for (size_t j = 0; j < names.size(); j++)
+    {
+      dataset[names[j]] = (*modules[i]) [names[j]];
+    }
+  }
+
+  if (mimeType_ == MIME_TYPE_PDF)
+  {
+    dataset["SOPClassUID"] = ENCAPSULATED_PDF_STORAGE;
+    dataset["ConversionType"] = "WSD";
+    dataset["BurnedInAnnotation"] = "YES";
+  }
+  else
+  {
+    dataset["SOPClassUID"] = ENCAPSULATED_STL_STORAGE;
+    dataset["FrameOfReferenceUID"] = GenerateDicomUid();
+  }
+
+  if (!dataset.isMember("DocumentTitle"))
+  {
+    dataset["DocumentTitle"] = "";
+  }
+
+  const std::vector<std::string> names = dataset.getMemberNames();
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    CheckTagPrecedesDocument(names[i]);
+  }
+
+  std::string json;
+  OrthancPlugins::WriteFastJson(json, dataset);
+
+  // the SeriesInstanceUID and SOPInstanceUID are generated by Orthanc
+  OrthancPlugins::MemoryBuffer header;
+  OrthancPluginErrorCode code = OrthancPluginCreateDicom(OrthancPlugins::GetGlobalContext(), *header, json.c_str(), NULL,
+                                                         OrthancPluginCreateDicomFlags_GenerateIdentifiers);
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(static_cast<Orthanc::ErrorCode>(code), "Cannot create the DICOM header of the encapsulated document");
+  }
+
+  dicom_.reserve(header.GetSize() + expectedSize + 64);
+  dicom_.assign(reinterpret_cast<const char*>(header.GetData()), header.GetSize());
+
+  isExplicitVR_ = (GetTransferSyntax(dicom_) != IMPLICIT_VR_LITTLE_ENDIAN);
+
+  // the length of the document is only known at the end of the upload
+  lengthOffset_ = WriteElementHeader(dicom_, isExplicitVR_, ENCAPSULATED_DOCUMENT_GROUP, ENCAPSULATED_DOCUMENT, "OB", 0);
+  documentOffset_ = dicom_.size();
+}
+
+
+bool EncapsulatedDocumentReader::IsSupportedMimeType(const std::string& mimeType)
+{
+  return (mimeType == MIME_TYPE_PDF ||
+          mimeType == MIME_TYPE_STL);
+}
+
+
+void EncapsulatedDocumentReader::AddChunk(const void* data,
+                                          size_t size)
+{
+  dicom_.append(reinterpret_cast<const char*>(data), size);
+}
+
+
+void EncapsulatedDocumentReader::Execute(OrthancPluginRestOutput* output)
+{
+  const size_t documentSize = dicom_.size() - documentOffset_;
+
+  if (documentSize == 0 ||
+      documentSize >= 0xfffffffe)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Invalid size of the encapsulated document");
+  }
+
+  // the values must have an even length
+  if (documentSize % 2 == 1)
+  {
+    dicom_.push_back('\0');
+  }
+
+  PatchUInt32(dicom_, lengthOffset_, static_cast<uint32_t>(dicom_.size() - documentOffset_));
+
+  std::string mimeType = mimeType_;
+  if (mimeType.size() % 2 == 1)
+  {
+    mimeType.push_back(' ');
+  }
+
+  WriteElementHeader(dicom_, isExplicitVR_, ENCAPSULATED_DOCUMENT_GROUP, MIME_TYPE_OF_ENCAPSULATED_DOCUMENT, "LO", static_cast<uint32_t>(mimeType.size()));
+  dicom_.append(mimeType);
+
+  WriteElementHeader(dicom_, isExplicitVR_, ENCAPSULATED_DOCUMENT_GROUP, ENCAPSULATED_DOCUMENT_LENGTH, "UL", 4);
+  WriteUInt32(dicom_, static_cast<uint32_t>(documentSize));
+
+  Json::Value answer;
+  if (!OrthancPlugins::RestApiPost(answer, "/instances", dicom_, false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Orthanc has rejected the encapsulated document");
+  }
+
+  OrthancPlugins::AnswerJson(answer, output);
+}
@@ -0,0 +1,54 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+// Builds an encapsulated document instance (PDF or STL) in a new series of a study while
+// the document is received as a raw binary body.  The DICOM header is created first, then
+// the chunks of the document are directly appended to the DICOM file such that the document
+// is only stored once in memory (no base64 encoding and no JSON parsing as in /tools/create-dicom).
+class EncapsulatedDocumentReader : public OrthancPlugins::IChunkedRequestReader
+{
+private:
+  std::string  dicom_;
+  size_t       documentOffset_;   // the position of the document in 'dicom_'
+  size_t       lengthOffset_;     // the position of the length of the EncapsulatedDocument element
+  std::string  mimeType_;
+  bool         isExplicitVR_;
+
+public:
+  // 'tags' are the tags of the new series, 'expectedSize' is only used to preallocate the memory
+  EncapsulatedDocumentReader(const std::string& studyId,
+                             const std::string& mimeType,
+                             const Json::Value& tags,
+                             size_t expectedSize);
+
+  static bool IsSupportedMimeType(const std::string& mimeType);
+
+  virtual void AddChunk(const void* data,
+                        size_t size);
+
+  virtual void Execute(OrthancPluginRestOutput* output);
+};
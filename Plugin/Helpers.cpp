@@ -45,6 +45,22 @@ namespace OrthancPlugins
     }
   }
 
+  bool LookupHttpGetArgument(std::string& value,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& key)
+  {
+    for (uint32_t i = 0; i < request->getCount; ++i)
+    {
+      if (key == request->getKeys[i])
+      {
+        value = request->getValues[i];
+        return true;
+      }
+    }
+
+    return false;
+  }
+
   void ForwardToWebService(OrthancPluginRestOutput* output,
                           const OrthancPluginHttpRequest* request,
                           const Orthanc::WebServiceParameters& webServiceParameters,
@@ -34,4 +34,8 @@ namespace OrthancPlugins
                           const Orthanc::WebServiceParameters& webServiceParameters,
                           const std::string& webServiceUrl);
 
+  bool LookupHttpGetArgument(std::string& value,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& key);
+
 }
\ No newline at end of file
@@ -0,0 +1,329 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "JobsMonitor.h"
+
+#include <Logging.h>
+
+
+static const size_t MAX_REMOVED_JOBS = 1000;
+
+
+JobsMonitor::JobsMonitor(unsigned int pollingPeriod,
+                         unsigned int idleTimeout,
+                         unsigned int maxWaitingClients) :
+  sequence_(0),
+  oldestSequence_(0),
+  refreshCount_(0),
+  waitingClients_(0),
+  isRunning_(false),
+  mustRefresh_(false),
+  pollingPeriod_(pollingPeriod),
+  idleTimeout_(idleTimeout),
+  maxWaitingClients_(maxWaitingClients)
+{
+}
+
+
+JobsMonitor::~JobsMonitor()
+{
+  Stop();
+}
+
+
+void JobsMonitor::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+    worker_ = boost::thread(Worker, this);
+  }
+}
+
+
+void JobsMonitor::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRunning_ = false;
+  }
+
+  wakeUpWorker_.notify_all();
+  jobsChanged_.notify_all();
+
+  if (worker_.joinable())
+  {
+    worker_.join();
+  }
+}
+
+
+void JobsMonitor::SignalJobChange()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    mustRefresh_ = true;
+  }
+
+  wakeUpWorker_.notify_one();
+}
+
+
+bool JobsMonitor::IsIdle() const
+{
+  return (lastClientActivity_.is_not_a_date_time() ||
+          boost::posix_time::microsec_clock::universal_time() - lastClientActivity_ > boost::posix_time::seconds(idleTimeout_));
+}
+
+
+void JobsMonitor::Worker(JobsMonitor* that)
+{
+  for (;;)
+  {
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      // don't poll the jobs registry if nobody is listening
+      while (that->isRunning_ && !that->mustRefresh_ && that->IsIdle())
+      {
+        that->wakeUpWorker_.wait(lock);
+      }
+
+      if (!that->isRunning_)
+      {
+        return;
+      }
+
+      that->mustRefresh_ = false;
+    }
+
+    try
+    {
+      that->Refresh();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while monitoring the jobs: " << e.What();
+    }
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      if (that->isRunning_ && !that->mustRefresh_)
+      {
+        that->wakeUpWorker_.timed_wait(lock, boost::posix_time::milliseconds(that->pollingPeriod_));
+      }
+    }
+  }
+}
+
+
+void JobsMonitor::Refresh()
+{
+  Json::Value jobs;
+  if (!OrthancPlugins::RestApiGet(jobs, "/jobs?expand", false) ||
+      jobs.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the jobs");
+  }
+
+  bool hasChanged = false;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::set<std::string> currentJobs;
+
+    for (Json::Value::ArrayIndex i = 0; i < jobs.size(); i++)
+    {
+      Json::Value& job = jobs[i];
+      if (!job.isObject() || !job.isMember("ID"))
+      {
+        continue;
+      }
+
+      const std::string jobId = job["ID"].asString();
+      currentJobs.insert(jobId);
+
+      bool isModified = true;
+
+      Jobs::iterator found = jobs_.find(jobId);
+      if (found != jobs_.end() && !found->second.content_.isNull())
+      {
+        // the "Timestamp" changes at each call, this is not a job modification
+        Json::Value previous = found->second.content_;
+        previous["Timestamp"] = job["Timestamp"];
+        isModified = (previous != job);
+      }
+
+      if (isModified)
+      {
+        JobEntry& entry = jobs_[jobId];
+        entry.sequence_ = ++sequence_;
+        entry.content_ = job;
+        hasChanged = true;
+      }
+    }
+
+    for (Jobs::iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+    {
+      if (!it->second.content_.isNull() &&
+          currentJobs.find(it->first) == currentJobs.end())
+      {
+        it->second.sequence_ = ++sequence_;
+        it->second.content_ = Json::nullValue;
+        hasChanged = true;
+      }
+    }
+
+    if (hasChanged)
+    {
+      PurgeRemovedJobs();
+    }
+
+    refreshCount_++;
+  }
+
+  jobsChanged_.notify_all();
+}
+
+
+void JobsMonitor::PurgeRemovedJobs()
+{
+  // keep a bounded history of the removed jobs; the clients that are
+  // older than this history will receive a full snapshot of the jobs
+  std::map<uint64_t, std::string> removedJobs;
+
+  for (Jobs::const_iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+  {
+    if (it->second.content_.isNull())
+    {
+      removedJobs[it->second.sequence_] = it->first;
+    }
+  }
+
+  for (std::map<uint64_t, std::string>::const_iterator it = removedJobs.begin();
+       removedJobs.size() > MAX_REMOVED_JOBS && it != removedJobs.end(); )
+  {
+    oldestSequence_ = it->first;
+    jobs_.erase(it->second);
+    removedJobs.erase(it++);
+  }
+}
+
+
+bool JobsMonitor::CollectChanges(Json::Value& answer,
+                                 uint64_t since,
+                                 const std::set<std::string>& jobsIds) const
+{
+  bool isReset = (since == 0 || since < oldestSequence_ || since > sequence_);
+
+  answer = Json::objectValue;
+  answer["Sequence"] = static_cast<Json::UInt64>(sequence_);
+  answer["Reset"] = isReset;
+  answer["Jobs"] = Json::arrayValue;
+  answer["Removed"] = Json::arrayValue;
+
+  for (Jobs::const_iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+  {
+    if (!jobsIds.empty() && jobsIds.find(it->first) == jobsIds.end())
+    {
+      continue;
+    }
+
+    if (isReset)
+    {
+      if (!it->second.content_.isNull())
+      {
+        answer["Jobs"].append(it->second.content_);
+      }
+    }
+    else if (it->second.sequence_ > since)
+    {
+      if (it->second.content_.isNull())
+      {
+        answer["Removed"].append(it->first);
+      }
+      else
+      {
+        answer["Jobs"].append(it->second.content_);
+      }
+    }
+  }
+
+  return isReset || answer["Jobs"].size() > 0 || answer["Removed"].size() > 0;
+}
+
+
+void JobsMonitor::GetChanges(Json::Value& answer,
+                             uint64_t since,
+                             const std::set<std::string>& jobsIds,
+                             unsigned int wait)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  if (IsIdle())
+  {
+    // the snapshot might be outdated, wait for the worker to refresh it
+    lastClientActivity_ = now;
+    mustRefresh_ = true;
+    wakeUpWorker_.notify_one();
+
+    const uint64_t expectedRefresh = refreshCount_ + 1;
+    const boost::posix_time::ptime refreshTimeout = now + boost::posix_time::seconds(5);
+
+    while (isRunning_ && refreshCount_ < expectedRefresh)
+    {
+      if (!jobsChanged_.timed_wait(lock, refreshTimeout))
+      {
+        break;
+      }
+    }
+  }
+
+  lastClientActivity_ = now;
+
+  if (waitingClients_ >= maxWaitingClients_)
+  {
+    wait = 0;  // answer at once, the client will call again after its own delay
+  }
+
+  const boost::posix_time::ptime timeout = now + boost::posix_time::seconds(wait);
+
+  waitingClients_++;
+
+  while (!CollectChanges(answer, since, jobsIds))
+  {
+    if (!isRunning_ ||
+        wait == 0 ||
+        !jobsChanged_.timed_wait(lock, timeout))
+    {
+      break;
+    }
+  }
+
+  waitingClients_--;
+}
@@ -0,0 +1,99 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <set>
+
+
+// Keeps a snapshot of the Orthanc jobs registry.  The snapshot is refreshed by
+// a single thread that is shared by all the clients (and only while clients are
+// listening).  Each modification of a job is tagged with a sequence number such
+// that the clients only receive the jobs that have changed since their last call.
+class JobsMonitor : public boost::noncopyable
+{
+private:
+  struct JobEntry
+  {
+    uint64_t     sequence_;
+    Json::Value  content_;   // null if the job has been removed from the registry
+  };
+
+  typedef std::map<std::string, JobEntry>  Jobs;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  jobsChanged_;
+  boost::condition_variable  wakeUpWorker_;
+  Jobs                       jobs_;
+  uint64_t                   sequence_;
+  uint64_t                   oldestSequence_;   // the deltas before this sequence number are not available anymore
+  uint64_t                   refreshCount_;
+  unsigned int               waitingClients_;
+  bool                       isRunning_;
+  bool                       mustRefresh_;
+  boost::posix_time::ptime   lastClientActivity_;
+  boost::thread              worker_;
+  unsigned int               pollingPeriod_;    // in milliseconds
+  unsigned int               idleTimeout_;      // in seconds
+  unsigned int               maxWaitingClients_;
+
+  static void Worker(JobsMonitor* that);
+
+  bool IsIdle() const;
+
+  void Refresh();
+
+  void PurgeRemovedJobs();
+
+  bool CollectChanges(Json::Value& answer,
+                      uint64_t since,
+                      const std::set<std::string>& jobsIds) const;
+
+public:
+  JobsMonitor(unsigned int pollingPeriod,
+              unsigned int idleTimeout,
+              unsigned int maxWaitingClients);
+
+  ~JobsMonitor();
+
+  void Start();
+
+  void Stop();
+
+  // called when Orthanc reports a job-related change
+  void SignalJobChange();
+
+  // Fills 'answer' with the jobs that have changed since the 'since' sequence number
+  // (restricted to 'jobsIds' if not empty).  If nothing has changed, waits up to
+  // 'wait' seconds for a change to happen, unless 'maxWaitingClients' clients are
+  // already waiting (each of them holds one HTTP thread of Orthanc).
+  void GetChanges(Json::Value& answer,
+                  uint64_t since,
+                  const std::set<std::string>& jobsIds,
+                  unsigned int wait);
+};
@@ -0,0 +1,489 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "LabelsIndex.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+
+static const size_t REBUILD_PAGE_SIZE = 1000;
+static const size_t MAX_DIRTY_STUDIES = 1000;
+
+
+LabelsIndex::LabelsIndex(unsigned int fullRefreshPeriod) :
+  BackgroundStudiesIndex("labels index", 1),
+  fullRefreshPeriod_(fullRefreshPeriod),
+  generation_(0),
+  hasTooManyDirtyStudies_(false),
+  tooManyDirtyStudiesGeneration_(0),
+  isReady_(false)
+{
+}
+
+
+LabelsIndex::~LabelsIndex()
+{
+  Stop();
+}
+
+
+bool LabelsIndex::IsHandledChange(OrthancPluginChangeType changeType) const
+{
+  // the labels might be set while the study is received or right after (e.g. by a Lua script)
+  return (changeType == OrthancPluginChangeType_StableStudy ||
+          changeType == OrthancPluginChangeType_Deleted);
+}
+
+
+void LabelsIndex::SignalLabelsModification(const std::string& studyId)
+{
+  PushChange(studyId, false, true);
+}
+
+
+void LabelsIndex::Build()
+{
+  // the index is built by the first periodic rebuild, such that a failure is retried later
+  SchedulePeriodicTask(boost::posix_time::microsec_clock::universal_time());
+}
+
+
+void LabelsIndex::RunPeriodicTask()
+{
+  SchedulePeriodicTask(boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(fullRefreshPeriod_));
+  Rebuild();
+}
+
+
+void LabelsIndex::Rebuild()
+{
+  unsigned int generation;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    generation_++;
+    generation = generation_;
+  }
+
+  Json::Value allLabels;
+  if (!OrthancPlugins::RestApiGet(allLabels, "/tools/labels", false) ||
+      allLabels.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the labels");
+  }
+
+  // the index is rebuilt from scratch, which also compacts the interned IDs of the deleted studies
+  std::map<std::string, uint32_t> ids;
+  std::vector<std::string> studyInstanceUids;
+  Labels labels;
+
+  for (Json::Value::ArrayIndex i = 0; i < allLabels.size(); i++)
+  {
+    const std::string label = allLabels[i].asString();
+    RoaringBitmap& bitmap = labels[label];
+
+    for (size_t since = 0; ; since += REBUILD_PAGE_SIZE)
+    {
+      if (!IsRunning())
+      {
+        return;
+      }
+
+      Json::Value find;
+      find["Level"] = "Study";
+      find["Query"] = Json::objectValue;
+      find["Expand"] = true;
+      find["Labels"].append(label);
+      find["LabelsConstraint"] = "All";
+      find["Since"] = static_cast<Json::UInt64>(since);
+      find["Limit"] = static_cast<Json::UInt64>(REBUILD_PAGE_SIZE);
+
+      Json::Value studies;
+      if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, false) ||
+          studies.type() != Json::arrayValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies with label " + label);
+      }
+
+      for (Json::Value::ArrayIndex j = 0; j < studies.size(); j++)
+      {
+        const std::string studyId = studies[j]["ID"].asString();
+
+        std::map<std::string, uint32_t>::const_iterator found = ids.find(studyId);
+        if (found == ids.end())
+        {
+          const uint32_t id = static_cast<uint32_t>(studyInstanceUids.size());
+          ids[studyId] = id;
+          studyInstanceUids.push_back(studies[j]["MainDicomTags"]["StudyInstanceUID"].asString());
+          bitmap.Add(id);
+        }
+        else
+        {
+          bitmap.Add(found->second);
+        }
+      }
+
+      if (studies.size() < REBUILD_PAGE_SIZE)
+      {
+        break;
+      }
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  ids_.swap(ids);
+  studyInstanceUids_.swap(studyInstanceUids);
+  labels_.swap(labels);
+
+  // a study is only clean once a whole rebuild has started after it was marked and the next one
+  // (i.e. this one) has read its labels again, which leaves a full period to the request that
+  // modified its labels
+  for (std::map<std::string, DirtyStudy>::iterator it = dirtyStudies_.begin(); it != dirtyStudies_.end(); )
+  {
+    if (it->second.generation_ + 1 < generation)
+    {
+      dirtyStudies_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  if (tooManyDirtyStudiesGeneration_ + 1 < generation &&
+      dirtyStudies_.size() < MAX_DIRTY_STUDIES)
+  {
+    hasTooManyDirtyStudies_ = false;
+  }
+
+  if (!isReady_)
+  {
+    LOG(WARNING) << "OE2: The labels index contains " << labels_.size() << " labels on " << ids_.size() << " studies";
+    isReady_ = true;
+  }
+}
+
+
+void LabelsIndex::RemoveStudy(const std::string& studyId)
+{
+  // the mutex must be locked by the caller
+  std::map<std::string, uint32_t>::iterator found = ids_.find(studyId);
+
+  if (found != ids_.end())
+  {
+    for (Labels::iterator it = labels_.begin(); it != labels_.end(); ++it)
+    {
+      it->second.Remove(found->second);
+    }
+
+    studyInstanceUids_[found->second].clear();
+    ids_.erase(found);
+  }
+
+  dirtyStudies_.erase(studyId);
+}
+
+
+void LabelsIndex::SetStudyLabels(const std::string& studyId,
+                                 const Json::Value& study)
+{
+  // the mutex must be locked by the caller
+  std::set<std::string> studyLabels;
+  if (study.isMember("Labels") &&
+      study["Labels"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < study["Labels"].size(); i++)
+    {
+      studyLabels.insert(study["Labels"][i].asString());
+    }
+  }
+
+  std::map<std::string, uint32_t>::const_iterator found = ids_.find(studyId);
+
+  if (found == ids_.end() &&
+      studyLabels.empty())
+  {
+    return;  // only the studies with labels are interned
+  }
+
+  uint32_t id;
+  if (found == ids_.end())
+  {
+    id = static_cast<uint32_t>(studyInstanceUids_.size());
+    ids_[studyId] = id;
+    studyInstanceUids_.push_back(study["MainDicomTags"]["StudyInstanceUID"].asString());
+  }
+  else
+  {
+    id = found->second;
+  }
+
+  for (std::set<std::string>::const_iterator it = studyLabels.begin(); it != studyLabels.end(); ++it)
+  {
+    labels_[*it].Add(id);
+  }
+
+  for (Labels::iterator it = labels_.begin(); it != labels_.end(); ++it)
+  {
+    if (studyLabels.find(it->first) == studyLabels.end())
+    {
+      it->second.Remove(id);
+    }
+  }
+}
+
+
+void LabelsIndex::ApplyChange(const Change& change)
+{
+  Json::Value study;
+  const bool exists = (!change.isDeleted_ &&
+                       OrthancPlugins::RestApiGet(study, "/studies/" + change.studyId_, false));
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!exists)
+  {
+    RemoveStudy(change.studyId_);
+    return;
+  }
+
+  SetStudyLabels(change.studyId_, study);
+
+  if (change.areLabelsChanging_)
+  {
+    if (dirtyStudies_.find(change.studyId_) != dirtyStudies_.end() ||
+        dirtyStudies_.size() < MAX_DIRTY_STUDIES)
+    {
+      DirtyStudy& dirty = dirtyStudies_[change.studyId_];
+      dirty.studyInstanceUid_ = study["MainDicomTags"]["StudyInstanceUID"].asString();
+      dirty.generation_ = generation_;
+    }
+    else
+    {
+      if (!hasTooManyDirtyStudies_)
+      {
+        LOG(WARNING) << "OE2: Too many modifications of the labels since the last rebuild of the labels index, "
+                     << "the labels are handled by the Orthanc database until the next rebuilds";
+        hasTooManyDirtyStudies_ = true;
+      }
+
+      tooManyDirtyStudiesGeneration_ = generation_;
+    }
+  }
+}
+
+
+bool LabelsIndex::RefreshDirtyStudies()
+{
+  std::vector<Change> pendingChanges;
+  GetPendingChanges(pendingChanges);
+
+  std::vector<std::string> studyInstanceUids;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isReady_ ||
+        hasTooManyDirtyStudies_)
+    {
+      return false;
+    }
+
+    // the changes that are still queued are not known here -> fall back to the database
+    for (size_t i = 0; i < pendingChanges.size(); i++)
+    {
+      if (pendingChanges[i].areLabelsChanging_ &&
+          dirtyStudies_.find(pendingChanges[i].studyId_) == dirtyStudies_.end())
+      {
+        return false;
+      }
+    }
+
+    studyInstanceUids.reserve(dirtyStudies_.size());
+    for (std::map<std::string, DirtyStudy>::const_iterator it = dirtyStudies_.begin(); it != dirtyStudies_.end(); ++it)
+    {
+      studyInstanceUids.push_back(it->second.studyInstanceUid_);
+    }
+  }
+
+  if (studyInstanceUids.empty())
+  {
+    return true;
+  }
+
+  // read the current labels of all the dirty studies from the database at once
+  std::string uids;
+  Orthanc::Toolbox::JoinStrings(uids, studyInstanceUids, "\\");
+
+  Json::Value find;
+  find["Level"] = "Study";
+  find["Query"]["StudyInstanceUID"] = uids;
+  find["Expand"] = true;
+
+  Json::Value studies;
+  if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, false) ||
+      studies.type() != Json::arrayValue)
+  {
+    LOG(WARNING) << "OE2: Unable to read the labels of the modified studies, falling back to the database";
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::set<std::string> existing;
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    const std::string studyId = studies[i]["ID"].asString();
+    existing.insert(studyId);
+
+    if (dirtyStudies_.find(studyId) != dirtyStudies_.end())
+    {
+      SetStudyLabels(studyId, studies[i]);
+    }
+  }
+
+  std::vector<std::string> deleted;
+  for (std::map<std::string, DirtyStudy>::const_iterator it = dirtyStudies_.begin(); it != dirtyStudies_.end(); ++it)
+  {
+    if (existing.find(it->first) == existing.end())
+    {
+      deleted.push_back(it->first);
+    }
+  }
+
+  for (size_t i = 0; i < deleted.size(); i++)
+  {
+    RemoveStudy(deleted[i]);
+  }
+
+  return true;
+}
+
+
+void LabelsIndex::GetLabelsBitmap(RoaringBitmap& target,
+                                  const std::set<std::string>& labels,
+                                  bool isAll) const
+{
+  // the mutex must be locked by the caller
+  target.Clear();
+
+  for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+  {
+    Labels::const_iterator found = labels_.find(*it);
+
+    if (found == labels_.end())
+    {
+      if (isAll)
+      {
+        target.Clear();
+        return;
+      }
+    }
+    else if (isAll && it != labels.begin())
+    {
+      target.And(found->second);
+    }
+    else
+    {
+      target.Or(found->second);
+    }
+  }
+}
+
+
+bool LabelsIndex::LookupStudies(std::vector<std::string>& studyInstanceUids,
+                                const std::set<std::string>& labels,
+                                const std::string& constraint,
+                                size_t maxResults)
+{
+  studyInstanceUids.clear();
+
+  if (labels.empty() ||
+      (constraint != "All" && constraint != "Any"))
+  {
+    return false;
+  }
+
+  if (!RefreshDirtyStudies())
+  {
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isReady_)
+  {
+    return false;
+  }
+
+  RoaringBitmap bitmap;
+  GetLabelsBitmap(bitmap, labels, constraint == "All");
+
+  if (bitmap.GetCardinality() > maxResults)
+  {
+    return false;
+  }
+
+  std::vector<uint32_t> ids;
+  bitmap.GetValues(ids);
+
+  studyInstanceUids.reserve(ids.size());
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    studyInstanceUids.push_back(studyInstanceUids_[ids[i]]);
+  }
+
+  return true;
+}
+
+
+bool LabelsIndex::CountStudies(Json::Value& counts,
+                               const std::set<std::string>* authorizedLabels)
+{
+  if (!RefreshDirtyStudies())
+  {
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isReady_)
+  {
+    return false;
+  }
+
+  counts = Json::objectValue;
+
+  for (Labels::const_iterator it = labels_.begin(); it != labels_.end(); ++it)
+  {
+    // the studies that have an authorized label are all visible to the user
+    if (authorizedLabels == NULL ||
+        authorizedLabels->find(it->first) != authorizedLabels->end())
+    {
+      counts[it->first] = static_cast<Json::UInt64>(it->second.GetCardinality());
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,107 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+#include "RoaringBitmap.h"
+
+#include <map>
+#include <set>
+
+
+// Keeps, for each label, the set of the studies that have this label as a roaring bitmap of
+// interned study IDs, such that the label constraints of the study list (All/Any) and the number
+// of studies per label are computed in memory.  The index is built in the background when Orthanc
+// starts.  Since Orthanc does not report the modifications of the labels as changes, the studies
+// whose labels might have changed since the last rebuild (the targets of PUT/DELETE
+// /studies/{id}/labels/{label} and the newly stable studies, whose labels might be set meanwhile
+// by a Lua script or another plugin) are marked as "dirty": their labels are read again from the
+// database before each lookup.  The index is entirely rebuilt periodically to catch the other
+// modifications (e.g. Lua scripts or other plugins that label older studies).
+class LabelsIndex : public BackgroundStudiesIndex
+{
+private:
+  typedef std::map<std::string, RoaringBitmap>  Labels;
+
+  struct DirtyStudy
+  {
+    std::string   studyInstanceUid_;
+    unsigned int  generation_;   // the number of rebuilds that had started when the study was marked
+  };
+
+  boost::mutex                        mutex_;
+  unsigned int                        fullRefreshPeriod_;   // in seconds
+  unsigned int                        generation_;          // the number of rebuilds that have started
+
+  std::map<std::string, uint32_t>     ids_;                 // Orthanc ID -> interned ID
+  std::vector<std::string>            studyInstanceUids_;   // interned ID -> StudyInstanceUID (empty if deleted)
+  Labels                              labels_;
+  std::map<std::string, DirtyStudy>   dirtyStudies_;        // Orthanc ID -> dirty study
+  bool                                hasTooManyDirtyStudies_;
+  unsigned int                        tooManyDirtyStudiesGeneration_;
+  bool                                isReady_;             // false until the index has been built
+
+  void Rebuild();
+
+  void RemoveStudy(const std::string& studyId);
+
+  void SetStudyLabels(const std::string& studyId,
+                      const Json::Value& study);
+
+  bool RefreshDirtyStudies();
+
+  void GetLabelsBitmap(RoaringBitmap& target,
+                       const std::set<std::string>& labels,
+                       bool isAll) const;
+
+protected:
+  virtual bool IsHandledChange(OrthancPluginChangeType changeType) const;
+
+  virtual void Build();
+
+  // rebuilds the whole index
+  virtual void RunPeriodicTask();
+
+  virtual void ApplyChange(const Change& change);
+
+public:
+  explicit LabelsIndex(unsigned int fullRefreshPeriod);
+
+  virtual ~LabelsIndex();
+
+  // Called when an HTTP request is about to modify the labels of a study (the request has not been
+  // processed yet -> the study is marked as dirty)
+  void SignalLabelsModification(const std::string& studyId);
+
+  // Returns false if the index is not ready, if there are too many dirty studies, if the constraint
+  // is not "All" or "Any", or if more than 'maxResults' studies match the labels
+  bool LookupStudies(std::vector<std::string>& studyInstanceUids,
+                     const std::set<std::string>& labels,
+                     const std::string& constraint,
+                     size_t maxResults);
+
+  // Counts the studies of each label (only the 'authorizedLabels' if not NULL).  Returns false if
+  // the index is not ready or if there are too many dirty studies.
+  bool CountStudies(Json::Value& counts,
+                    const std::set<std::string>* authorizedLabels);
+};
@@ -0,0 +1,198 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PatientStudiesIndex.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+
+static const char KEY_SEPARATOR = '\x01';
+
+
+PatientStudiesIndex::PatientStudiesIndex(const std::vector<std::string>& tags) :
+  BackgroundStudiesIndex("index of the patients of the studies", 1),
+  tags_(tags),
+  isReady_(false)
+{
+}
+
+
+PatientStudiesIndex::~PatientStudiesIndex()
+{
+  Stop();
+}
+
+
+void PatientStudiesIndex::Build()
+{
+  if (ScanStudies(""))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isReady_ = true;
+  }
+}
+
+
+void PatientStudiesIndex::ClearScannedStudies()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  studies_.clear();
+  patients_.clear();
+}
+
+
+void PatientStudiesIndex::ApplyChange(const Change& change)
+{
+  Json::Value study;
+
+  if (!change.isDeleted_ &&
+      OrthancPlugins::RestApiGet(study, "/studies/" + change.studyId_, false))
+  {
+    AddScannedStudy(change.studyId_, study);
+  }
+  else
+  {
+    // the study might have been deleted in the meantime
+    boost::mutex::scoped_lock lock(mutex_);
+    RemoveStudyInternal(change.studyId_);
+  }
+}
+
+
+bool PatientStudiesIndex::ComputeKey(std::string& key,
+                                     const Json::Value& study) const
+{
+  // same matching as the /tools/find of the study details: the values are matched exactly, except
+  // the person names that are case-insensitive (default "CaseSensitivePN" configuration of Orthanc)
+  key.clear();
+
+  for (size_t i = 0; i < tags_.size(); i++)
+  {
+    const Json::Value* value = NULL;
+
+    if (study["PatientMainDicomTags"].isMember(tags_[i]))
+    {
+      value = &study["PatientMainDicomTags"][tags_[i]];
+    }
+    else if (study["MainDicomTags"].isMember(tags_[i]))
+    {
+      value = &study["MainDicomTags"][tags_[i]];
+    }
+
+    if (value == NULL ||
+        !value->isString())
+    {
+      return false;
+    }
+
+    std::string s = Orthanc::Toolbox::StripSpaces(value->asString());
+    if (s.empty() ||
+        s.find_first_of("*?\\") != std::string::npos)
+    {
+      // an empty value matches all the patients, the others are not matched exactly
+      return false;
+    }
+
+    if (tags_[i] == "PatientName")
+    {
+      Orthanc::Toolbox::ToUpperCase(s);
+    }
+
+    if (i > 0)
+    {
+      key += KEY_SEPARATOR;
+    }
+
+    key += s;
+  }
+
+  return !tags_.empty();
+}
+
+
+void PatientStudiesIndex::AddScannedStudy(const std::string& studyId,
+                                          const Json::Value& study)
+{
+  std::string key;
+  const bool hasKey = ComputeKey(key, study);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  RemoveStudyInternal(studyId);
+
+  if (hasKey)
+  {
+    studies_[studyId] = key;
+    patients_[key].insert(studyId);
+  }
+}
+
+
+void PatientStudiesIndex::RemoveStudyInternal(const std::string& studyId)
+{
+  std::map<std::string, std::string>::iterator found = studies_.find(studyId);
+  if (found != studies_.end())
+  {
+    Patients::iterator patient = patients_.find(found->second);
+    if (patient != patients_.end())
+    {
+      patient->second.erase(studyId);
+
+      if (patient->second.empty())
+      {
+        patients_.erase(patient);
+      }
+    }
+
+    studies_.erase(found);
+  }
+}
+
+
+bool PatientStudiesIndex::CountPatientStudies(Json::Value& counts,
+                                              const std::vector<std::string>& studiesIds)
+{
+  counts = Json::objectValue;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isReady_)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < studiesIds.size(); i++)
+  {
+    std::map<std::string, std::string>::const_iterator found = studies_.find(studiesIds[i]);
+    if (found != studies_.end())
+    {
+      Patients::const_iterator patient = patients_.find(found->second);
+      if (patient != patients_.end())
+      {
+        counts[studiesIds[i]] = static_cast<Json::UInt64>(patient->second.size());
+      }
+    }
+  }
+
+  return true;
+}
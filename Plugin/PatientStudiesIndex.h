@@ -0,0 +1,77 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+
+// Links each study to a normalized key of its patient, made of the values of the tags that identify
+// the studies of the same patient ("UiOptions.ShowSamePatientStudiesFilter"), such that the number of
+// studies of the patient of any study is known without querying the database.  The studies are loaded
+// by a background scan when Orthanc starts and are then updated from the changes.  Only the main DICOM
+// tags of the patients and studies are used.  The studies that lack one of these tags, or whose values
+// could not be matched exactly by /tools/find (empty values, wildcards, lists of values), have no key:
+// their count must be computed by the database.
+class PatientStudiesIndex : public BackgroundStudiesIndex
+{
+private:
+  typedef std::map<std::string, std::set<std::string> >  Patients;
+
+  boost::mutex                        mutex_;
+  std::vector<std::string>            tags_;
+  std::map<std::string, std::string>  studies_;    // Orthanc ID of the study -> patient key
+  Patients                            patients_;   // patient key -> Orthanc IDs of the studies
+  bool                                isReady_;
+
+  // returns false if the study cannot be indexed
+  bool ComputeKey(std::string& key,
+                  const Json::Value& study) const;
+
+  // the mutex must be locked by the caller
+  void RemoveStudyInternal(const std::string& studyId);
+
+protected:
+  virtual void Build();
+
+  virtual void ApplyChange(const Change& change);
+
+  virtual void AddScannedStudy(const std::string& studyId,
+                               const Json::Value& study);
+
+  virtual void ClearScannedStudies();
+
+public:
+  explicit PatientStudiesIndex(const std::vector<std::string>& tags);
+
+  virtual ~PatientStudiesIndex();
+
+  // Fills 'counts' with, for each of the 'studiesIds', the number of studies of the same patient
+  // (including the study itself).  The studies that are not indexed are not in 'counts'.  Returns
+  // false if the index is not ready yet.
+  bool CountPatientStudies(Json::Value& counts,
+                           const std::vector<std::string>& studiesIds);
+};
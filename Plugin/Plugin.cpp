@@ -21,7 +21,26 @@
  **/
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "AuditLogsProxy.h"
+#include "EncapsulatedDocumentReader.h"
 #include "Helpers.h"
+#include "JobsMonitor.h"
+#include "LabelsIndex.h"
+#include "PatientStudiesIndex.h"
+#include "PredefinedFilters.h"
+#include "RecentStudiesIndex.h"
+#include "RemoteQueries.h"
+#include "RemoteQueriesCache.h"
+#include "RemoteStudiesCounter.h"
+#include "ResumableUploads.h"
+#include "StudiesExport.h"
+#include "StudiesFacets.h"
+#include "StudiesFindCache.h"
+#include "StudiesFinder.h"
+#include "StudiesTextIndex.h"
+#include "SeriesThumbnails.h"
+#include "StudySummaries.h"
+#include "UploadPipeline.h"
 
 #include <Logging.h>
 #include <SystemToolbox.h>
@@ -31,6 +50,9 @@
 
 #include <EmbeddedResources.h>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
 #define ORTHANC_PLUGIN_NAME  "orthanc-explorer-2"
 
 // we are using Orthanc 1.11.0 API (RequestedTags in tools/find)
@@ -49,6 +71,7 @@ bool openInOhifV3IsExplicitelyDisabled = false;
 bool enableShares_ = false;
 bool isReadOnly_ = false;
 bool hasAuditLogs_ = false;
+std::list<std::string> authTokenGetArguments_;  // the GET arguments in which the authorization plugin looks for a token
 std::string customCssPath_;
 std::string theme_ = "light";
 std::string customLogoPath_;
@@ -56,6 +79,28 @@ std::string customLogoUrl_;
 std::string customFavIconPath_;
 std::string customTitle_;
 
+std::unique_ptr<JobsMonitor> jobsMonitor_;
+std::unique_ptr<StudySummaries> studySummaries_;
+std::unique_ptr<SeriesThumbnails> seriesThumbnails_;
+std::unique_ptr<UploadPipeline> uploadPipeline_;
+std::unique_ptr<ResumableUploads> resumableUploads_;
+boost::shared_ptr<RemoteQueriesCache> remoteQueriesCache_;  // shared with the remote query threads
+std::unique_ptr<RemoteQueries::QueriesPool> remoteQueriesPool_;
+unsigned int federatedFindMaxTargets_ = 0;
+std::unique_ptr<RemoteStudiesCounter> remoteStudiesCounter_;
+unsigned int remoteStudiesCountMaxWait_ = 10;
+std::unique_ptr<StudiesTextIndex> studiesTextIndex_;
+std::unique_ptr<RecentStudiesIndex> recentStudiesIndex_;
+StudiesFinderIndexes studiesFinderIndexes_;
+std::unique_ptr<StudiesFindCache> studiesFindCache_;
+std::unique_ptr<StudiesFacets> studiesFacets_;
+std::unique_ptr<LabelsIndex> labelsIndex_;
+std::unique_ptr<PredefinedFilters> predefinedFilters_;
+std::unique_ptr<PatientStudiesIndex> patientStudiesIndex_;
+unsigned int jobsEventsMaxWait_ = 20;
+unsigned int studiesExportPageSize_ = 0;  // 0 if the export of the study list is disabled
+std::unique_ptr<AuditLogsProxy> auditLogsProxy_;
+
 enum CustomFilesPath
 {
   CustomFilesPath_Logo,
@@ -350,6 +395,11 @@ void ReadConfiguration()
     orthancFullConfiguration_->GetSection(authPluginConfiguration, "Authorization");
 
     hasAuditLogs_ = authPluginConfiguration.GetBooleanValue("EnableAuditLogs", false);
+
+    if (!authPluginConfiguration.LookupListOfStrings(authTokenGetArguments_, "TokenGetArguments", true))
+    {
+      authTokenGetArguments_.clear();
+    }
   }
 }
 
@@ -623,6 +673,195 @@ void UpdateUiOptions(Json::Value& uiOption, const std::list<std::string>& permis
   uiOption = uiOption.asBool() && hasPermission;
 }
 
+// Checks the permissions from the user profile (only if the authorization plugin provides user profiles)
+static bool HasAnyPermission(const OrthancPluginHttpRequest* request, const std::string& anyOfPermissions)
+{
+  if (!hasUserProfile_)
+  {
+    return true;
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  Json::Value userProfile;
+  if (!OrthancPlugins::RestApiGet(userProfile, "/auth/user/profile", headers, true))
+  {
+    return false;
+  }
+
+  std::list<std::string> permissions;
+  Orthanc::SerializationToolbox::ReadListOfStrings(permissions, userProfile, "permissions");
+
+  Json::Value hasPermission = true;
+  UpdateUiOptions(hasPermission, permissions, anyOfPermissions);
+
+  return hasPermission.asBool();
+}
+
+// The inbox page is opened by external partners with an 'inbox-link' token that is not associated
+// with a user profile -> these partners are accepted for the resumable uploads if their token is valid
+static bool CanUploadToInbox(const OrthancPluginHttpRequest* request)
+{
+  if (HasAnyPermission(request, "all|upload"))
+  {
+    return true;
+  }
+
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    std::string key(request->headersKeys[i]);
+    Orthanc::Toolbox::ToLowerCase(key);
+
+    if (key == "token")
+    {
+      Json::Value body;
+      body["TokenKey"] = "token";
+      body["TokenValue"] = request->headersValues[i];
+
+      Json::Value decoded;
+      return (OrthancPlugins::RestApiPost(decoded, "/auth/tokens/decode", body, false) &&
+              decoded.isObject() &&
+              !decoded.isMember("ErrorCode") &&
+              decoded.isMember("TokenType") &&
+              decoded["TokenType"].asString() == "inbox-link");
+    }
+  }
+
+  return false;
+}
+
+
+// The links opened in a new tab (e.g. the instant links) carry their token in a GET argument instead of
+// the HTTP headers -> this token is forwarded with the access checks
+static void AppendTokenGetArguments(std::string& uri,
+                                    const OrthancPluginHttpRequest* request)
+{
+  for (std::list<std::string>::const_iterator it = authTokenGetArguments_.begin(); it != authTokenGetArguments_.end(); ++it)
+  {
+    std::string value;
+    if (OrthancPlugins::LookupHttpGetArgument(value, request, *it) &&
+        !value.empty())
+    {
+      std::string encoded;
+      Orthanc::Toolbox::UriEncode(encoded, value);
+
+      uri += (uri.find('?') == std::string::npos ? "?" : "&");
+      uri += *it + "=" + encoded;
+    }
+  }
+}
+
+
+// Checks that the user can access a study (only if the authorization plugin provides user profiles since
+// the plugin routes are not filtered by the authorization plugin the same way as the Orthanc routes)
+static bool CanAccessStudy(const OrthancPluginHttpRequest* request, const std::string& studyId)
+{
+  if (!hasUserProfile_)
+  {
+    return true;
+  }
+
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyId, false))
+  {
+    return false;
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  Json::Value query;
+  query["Level"] = "Study";
+  query["Query"]["StudyInstanceUID"] = study["MainDicomTags"]["StudyInstanceUID"];
+
+  std::string uri = "/tools/find";
+  AppendTokenGetArguments(uri, request);
+
+  Json::Value studies;
+  return (OrthancPlugins::RestApiPost(studies, uri, query, headers, true) &&
+          studies.isArray() &&
+          studies.size() > 0);
+}
+
+// The routes that are called for each series of a study (e.g. the thumbnails) only check the
+// access to the study once per user: the granted accesses are kept for a short time
+static const unsigned int STUDY_ACCESS_CACHE_DURATION = 60;   // in seconds
+static const size_t STUDY_ACCESS_CACHE_SIZE = 10000;
+static boost::mutex studyAccessCacheMutex_;
+static std::map<std::string, boost::posix_time::ptime> studyAccessCache_;   // key -> expiration
+
+static bool CanAccessStudyCached(const OrthancPluginHttpRequest* request, const std::string& studyId)
+{
+  OrthancPlugins::HttpHeaders headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  // the access granted to a token in a GET argument must not be granted to the requests without it
+  std::string tokens;
+  AppendTokenGetArguments(tokens, request);
+
+  Json::Value study;
+  study["Study"] = studyId;
+  study["Tokens"] = tokens;
+  const std::string key = StudiesFindCache::GetKey(study, headers);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  {
+    boost::mutex::scoped_lock lock(studyAccessCacheMutex_);
+
+    std::map<std::string, boost::posix_time::ptime>::const_iterator found = studyAccessCache_.find(key);
+    if (found != studyAccessCache_.end() &&
+        now < found->second)
+    {
+      return true;
+    }
+  }
+
+  if (!CanAccessStudy(request, studyId))
+  {
+    return false;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(studyAccessCacheMutex_);
+
+    if (studyAccessCache_.size() >= STUDY_ACCESS_CACHE_SIZE)
+    {
+      for (std::map<std::string, boost::posix_time::ptime>::iterator it = studyAccessCache_.begin(); it != studyAccessCache_.end(); )
+      {
+        if (it->second <= now)
+        {
+          studyAccessCache_.erase(it++);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    if (studyAccessCache_.size() < STUDY_ACCESS_CACHE_SIZE)
+    {
+      studyAccessCache_[key] = now + boost::posix_time::seconds(STUDY_ACCESS_CACHE_DURATION);
+    }
+  }
+
+  return true;
+}
+
+static bool CanAccessSeries(const OrthancPluginHttpRequest* request, const std::string& seriesId)
+{
+  if (!hasUserProfile_)
+  {
+    return true;
+  }
+
+  Json::Value series;
+  return (OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false) &&
+          CanAccessStudyCached(request, series["ParentStudy"].asString()));
+}
+
 static Orthanc::WebServiceParameters emailServer_;
 
 void GetEmailTemplates(OrthancPluginRestOutput* output,
@@ -746,6 +985,7 @@ void GetOE2Configuration(OrthancPluginRestOutput* output,
         UpdateUiOptions(uiOptions["EnableAddSeries"], permissions, "all|upload");
         UpdateUiOptions(uiOptions["EnableDicomModalities"], permissions, "all|q-r-remote-modalities");
         UpdateUiOptions(uiOptions["EnableDicomWebServers"], permissions, "all|q-r-remote-modalities");
+        UpdateUiOptions(uiOptions["EnableOrthancPeersSearch"], permissions, "all|q-r-remote-modalities");
         UpdateUiOptions(uiOptions["EnableDeleteResources"], permissions, "all|delete");
         UpdateUiOptions(uiOptions["EnableDownloadZip"], permissions, "all|download");
         UpdateUiOptions(uiOptions["EnableDownloadDicomDir"], permissions, "all|download");
@@ -787,6 +1027,27 @@ void GetOE2Configuration(OrthancPluginRestOutput* output,
 
     uiOptions["EnableAuditLogs"] = uiOptions["EnableAuditLogs"].asBool() && hasAuditLogs_;
 
+    Json::Value& capabilities = oe2Configuration["Capabilities"];
+    capabilities["HasJobsEvents"] = (jobsMonitor_.get() != NULL);
+    capabilities["HasStudiesFind"] = true;
+    capabilities["HasStudySummaries"] = (studySummaries_.get() != NULL);
+    capabilities["HasStudyReports"] = (studySummaries_.get() != NULL);
+    capabilities["HasSeriesThumbnails"] = (seriesThumbnails_.get() != NULL);
+    capabilities["HasMultipartUpload"] = (uploadPipeline_.get() != NULL);
+    capabilities["HasInstancesLookup"] = (uploadPipeline_.get() != NULL);
+    capabilities["HasResumableUploads"] = (resumableUploads_.get() != NULL);
+    capabilities["HasBinaryAddSeries"] = true;
+    capabilities["HasFederatedFind"] = true;
+    capabilities["HasRemoteQueriesCache"] = (remoteQueriesCache_.get() != NULL);
+    capabilities["HasRemoteStudiesCount"] = (remoteStudiesCounter_.get() != NULL);
+    capabilities["HasStudiesTextIndex"] = (studiesTextIndex_.get() != NULL);
+    capabilities["HasStudiesFacets"] = (studiesFacets_.get() != NULL);
+    capabilities["HasLabelsIndex"] = (labelsIndex_.get() != NULL);
+    capabilities["HasPredefinedFiltersIndex"] = (predefinedFilters_.get() != NULL);
+    capabilities["HasPatientStudiesIndex"] = (patientStudiesIndex_.get() != NULL);
+    capabilities["HasStudiesExport"] = (studiesExportPageSize_ > 0);
+    capabilities["HasAuditLogsProxy"] = (auditLogsProxy_.get() != NULL);
+
     std::string answer = oe2Configuration.toStyledString();
     OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
   }
@@ -814,102 +1075,1423 @@ void GetOE2PreLoginConfiguration(OrthancPluginRestOutput* output,
   }
 }
 
-
-static bool DisplayPerformanceWarning(OrthancPluginContext* context)
+void GetJobsEvents(OrthancPluginRestOutput* output,
+                   const char* /*url*/,
+                   const OrthancPluginHttpRequest* request)
 {
-  (void) DisplayPerformanceWarning;   // Disable warning about unused function
-  OrthancPluginLogWarning(context, "Performance warning in Orthanc Explorer 2: "
-                          "Non-release build, runtime debug assertions are turned on");
-  return true;
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    std::set<std::string> jobsIds;
+    uint64_t since = 0;
+    unsigned int wait = 0;
+
+    std::string argument;
+    if (OrthancPlugins::LookupHttpGetArgument(argument, request, "jobs"))
+    {
+      std::vector<std::string> tokens;
+      Orthanc::Toolbox::TokenizeString(tokens, argument, ',');
+
+      for (size_t i = 0; i < tokens.size(); ++i)
+      {
+        if (!tokens[i].empty())
+        {
+          jobsIds.insert(tokens[i]);
+        }
+      }
+    }
+
+    if (OrthancPlugins::LookupHttpGetArgument(argument, request, "since"))
+    {
+      since = boost::lexical_cast<uint64_t>(argument);
+    }
+
+    if (OrthancPlugins::LookupHttpGetArgument(argument, request, "wait"))
+    {
+      wait = std::min(boost::lexical_cast<unsigned int>(argument), jobsEventsMaxWait_);
+    }
+
+    // the whole jobs list is only available to the users who can access the jobs page (job ids are not guessable)
+    if (jobsIds.empty() && !HasAnyPermission(request, "admin-permissions"))
+    {
+      OrthancPluginSendHttpStatusCode(context, output, 403);
+      return;
+    }
+
+    Json::Value answer;
+    jobsMonitor_->GetChanges(answer, since, jobsIds, wait);
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
 }
 
 
-static void CheckRootUrlIsValid(const std::string& value, const std::string& name, bool allowEmpty)
+void FindStudies(OrthancPluginRestOutput* output,
+                 const char* /*url*/,
+                 const OrthancPluginHttpRequest* request)
 {
-  if (allowEmpty && value.size() == 0)
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
   {
-    return;
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
   }
-
-  if (value.size() < 1 ||
-      value[0] != '/' ||
-      value[value.size() - 1] != '/')
+  else
   {
-    OrthancPlugins::LogError("Orthanc-Explorer 2: '" + name + "' configuration shall start with a '/' and end with a '/': " + value);
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+    }
+
+    OrthancPlugins::HttpHeaders headers;
+    OrthancPlugins::GetHttpHeaders(headers, request);
+
+    Json::Value answer;
+
+    if (studiesFindCache_.get() != NULL)
+    {
+      studiesFindCache_->Find(answer, body, headers, studiesFinderIndexes_);
+    }
+    else
+    {
+      FindStudiesColumnar(answer, body, headers, studiesFinderIndexes_);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
   }
 }
 
-OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
-                                        OrthancPluginResourceType resourceType,
-                                        const char* resourceId)
+
+// Returns false if the user has access to all the labels
+static bool GetAuthorizedLabels(std::set<std::string>& authorizedLabels,
+                                const OrthancPluginHttpRequest* request)
 {
-  try
+  authorizedLabels.clear();
+
+  if (!hasUserProfile_)
   {
-    if (changeType == OrthancPluginChangeType_OrthancStarted)
+    return false;
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  Json::Value userProfile;
+  if (!OrthancPlugins::RestApiGet(userProfile, "/auth/user/profile", headers, true))
+  {
+    return true;  // no access at all
+  }
+
+  std::list<std::string> labels;
+  Orthanc::SerializationToolbox::ReadListOfStrings(labels, userProfile, "authorized-labels");
+
+  for (std::list<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+  {
+    if (*it == "*")
     {
-      // this can not be performed during plugin initialization because it is accessing the DB -> must be done when Orthanc has just started
-      pluginsConfiguration_ = GetPluginsConfiguration(hasUserProfile_);
+      authorizedLabels.clear();
+      return false;
     }
+
+    authorizedLabels.insert(*it);
   }
-  catch (Orthanc::OrthancException& e)
+
+  return true;
+}
+
+
+// Returns true only if the user is known to have access to all the studies: the counts of the
+// in-memory indexes include all the studies
+static bool HasAccessToAllStudies(const OrthancPluginHttpRequest* request)
+{
+  if (!pluginsConfiguration_.isMember("authorization") ||
+      !pluginsConfiguration_["authorization"]["Enabled"].asBool())
   {
-    LOG(ERROR) << "Exception: " << e.What();
-    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    return true;
+  }
+  else if (!hasUserProfile_)
+  {
+    return false;  // the access might be restricted by the tokens, which are unknown here
+  }
+  else
+  {
+    std::set<std::string> authorizedLabels;
+    return !GetAuthorizedLabels(authorizedLabels, request);
   }
-
-  return OrthancPluginErrorCode_Success;
 }
 
 
-extern "C"
+// Counts the studies behind each choice of the modality, date and label filters of the study list
+void GetStudiesFacets(OrthancPluginRestOutput* output,
+                      const char* /*url*/,
+                      const OrthancPluginHttpRequest* request)
 {
-  ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
   {
-    assert(DisplayPerformanceWarning(context));
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
 
-    OrthancPlugins::SetGlobalContext(context);
-    
-    Orthanc::Logging::InitializePluginContext(context);
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      !body.isObject())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+  }
 
-    Orthanc::Logging::EnableInfoLevel(true);
+  Json::Value answer;
+  answer["Available"] = false;
 
+  // like the predefined filters, the counts are only given to the users that have access to all the studies
+  if (!HasAccessToAllStudies(request))
+  {
+    OrthancPlugins::AnswerJson(answer, output);
+    return;
+  }
 
-    /* Check the version of the Orthanc core */
-    if (!OrthancPlugins::CheckMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
-                                                    ORTHANC_CORE_MINIMAL_MINOR,
-                                                    ORTHANC_CORE_MINIMAL_REVISION))
+  // the filters on the text fields can only be taken into account through the text index
+  Json::Value textQuery = Json::objectValue;
+  bool isSupported = true;
+
+  if (body.isMember("Query") &&
+      body["Query"].isObject())
+  {
+    const std::vector<std::string> tags = body["Query"].getMemberNames();
+    for (size_t i = 0; i < tags.size(); i++)
     {
-      OrthancPlugins::ReportMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
-                                                  ORTHANC_CORE_MINIMAL_MINOR,
-                                                  ORTHANC_CORE_MINIMAL_REVISION);
-      return -1;
+      if (!body["Query"][tags[i]].isString())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The value of " + tags[i] + " in Query must be a string");
+      }
+
+      const std::string value = body["Query"][tags[i]].asString();
+      StudiesTextIndex::Field field;
+
+      if (tags[i] == "StudyDate" ||
+          tags[i] == "ModalitiesInStudy" ||
+          value.empty() ||
+          value == "*")
+      {
+        continue;
+      }
+      else if (studiesTextIndex_.get() != NULL &&
+               StudiesTextIndex::LookupField(field, tags[i]))
+      {
+        textQuery[tags[i]] = value;
+      }
+      else
+      {
+        isSupported = false;
+      }
     }
+  }
 
-    OrthancPlugins::SetDescription(ORTHANC_PLUGIN_NAME, "Advanced User Interface for Orthanc");
+  std::vector<std::string> studyInstanceUids;
+  if (isSupported &&
+      textQuery.size() > 0 &&
+      !studiesTextIndex_->LookupStudies(studyInstanceUids, textQuery, studiesFinderIndexes_.maxIndexedStudies_))
+  {
+    isSupported = false;
+  }
 
-    try
+  if (isSupported)
+  {
+    if (studiesFacets_->ComputeFacets(answer, body,
+                                      textQuery.size() > 0 ? &studyInstanceUids : NULL))
     {
-      ReadConfiguration();
+      answer["Available"] = true;
+    }
+  }
 
-      if (pluginJsonConfiguration_["Enable"].asBool())
-      {
-        oe2BaseUrl_ = pluginJsonConfiguration_["Root"].asString();
+  OrthancPlugins::AnswerJson(answer, output);
+}
 
-        CheckRootUrlIsValid(oe2BaseUrl_, "Root", false);
 
-        OrthancPlugins::LogWarning("Root URI to the Orthanc-Explorer 2 application: " + oe2BaseUrl_);
+// Counts the studies of each label the user has access to
+void GetLabelsStudiesCount(OrthancPluginRestOutput* output,
+                           const char* /*url*/,
+                           const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
 
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
 
-        OrthancPlugins::RegisterRestCallback
-          <ServeCustomCss>
-          (oe2BaseUrl_ + "app/customizable/custom.css", true);
+  std::set<std::string> authorizedLabels;
+  const bool isRestricted = GetAuthorizedLabels(authorizedLabels, request);
 
-        if (!customLogoPath_.empty())
-        {
-          OrthancPlugins::RegisterRestCallback
-            <ServeCustomFile<CustomFilesPath_Logo> >
-            (oe2BaseUrl_ + "app/customizable/custom-logo", true);
+  Json::Value counts;
+  if (!labelsIndex_->CountStudies(counts, isRestricted ? &authorizedLabels : NULL))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The labels index is not ready yet");
+  }
+
+  OrthancPlugins::AnswerJson(counts, output);
+}
+
+
+// Streams all the studies that match the current filters of the study list, with the columns of the study list
+void ExportStudies(OrthancPluginRestOutput* output,
+                   const char* /*url*/,
+                   const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+  }
+
+  std::string format = "csv";
+  OrthancPlugins::LookupHttpGetArgument(format, request, "format");
+
+  std::vector<std::string> columns;
+  const Json::Value& studyListColumns = pluginJsonConfiguration_["UiOptions"]["StudyListColumns"];
+  for (Json::Value::ArrayIndex i = 0; i < studyListColumns.size(); i++)
+  {
+    columns.push_back(studyListColumns[i].asString());
+  }
+
+  OrthancPlugins::HttpHeaders headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  StudiesExport::AnswerExport(output, body, headers, studiesFinderIndexes_, columns,
+                              StudiesExport::StringToFormat(format), studiesExportPageSize_);
+}
+
+
+// Pages the audit logs of the authorization plugin (or streams them as CSV with '?format=csv')
+void GetAuditLogs(OrthancPluginRestOutput* output,
+                  const char* /*url*/,
+                  const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  AuditLogsProxy::Filters filters;
+  AuditLogsProxy::GetFilters(filters, request);
+
+  // the permissions are checked by the authorization plugin when the headers are forwarded
+  OrthancPlugins::HttpHeaders headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  std::string format;
+  if (OrthancPlugins::LookupHttpGetArgument(format, request, "format") &&
+      format == "csv")
+  {
+    auditLogsProxy_->AnswerCsv(output, filters, headers);
+  }
+  else
+  {
+    std::string cursor;
+    OrthancPlugins::LookupHttpGetArgument(cursor, request, "cursor");
+
+    Json::Value answer;
+    auditLogsProxy_->GetPage(answer, filters, cursor, headers);
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+// Counts the studies of the patient of each study of a page of the study list
+void CountSamePatientStudies(OrthancPluginRestOutput* output,
+                             const char* /*url*/,
+                             const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      !body.isObject() ||
+      !body.isMember("Studies") ||
+      !body["Studies"].isArray())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with a 'Studies' array");
+  }
+
+  std::vector<std::string> studiesIds;
+  for (Json::Value::ArrayIndex i = 0; i < body["Studies"].size(); i++)
+  {
+    studiesIds.push_back(body["Studies"][i].asString());
+  }
+
+  Json::Value counts = Json::objectValue;
+
+  // the counts include all the studies -> the users who might not have access to all the studies,
+  // and the studies that are not indexed yet, are counted by the database on the client side
+  if (HasAccessToAllStudies(request))
+  {
+    patientStudiesIndex_->CountPatientStudies(counts, studiesIds);
+  }
+
+  OrthancPlugins::AnswerJson(counts, output);
+}
+
+
+// Lists the predefined filters of the study list with their date keywords evaluated for today
+void GetPredefinedFilters(OrthancPluginRestOutput* output,
+                          const char* /*url*/,
+                          const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  Json::Value filters;
+
+  if (predefinedFilters_.get() != NULL)
+  {
+    // the counts include all the studies -> not for the users who might not have access to all the studies
+    predefinedFilters_->GetFilters(filters, HasAccessToAllStudies(request));
+  }
+  else
+  {
+    PredefinedFilters::EvaluateFilters(filters, pluginJsonConfiguration_["UiOptions"]["PredefinedFilters"]);
+  }
+
+  OrthancPlugins::AnswerJson(filters, output);
+}
+
+
+// Orthanc does not report the modifications of the labels as changes -> detect them from the HTTP requests
+static int32_t FilterIncomingHttpRequest(OrthancPluginHttpMethod method,
+                                         const char* uri,
+                                         const char* /*ip*/,
+                                         uint32_t /*headersCount*/,
+                                         const char* const* /*headersKeys*/,
+                                         const char* const* /*headersValues*/,
+                                         uint32_t /*getArgumentsCount*/,
+                                         const char* const* /*getArgumentsKeys*/,
+                                         const char* const* /*getArgumentsValues*/)
+{
+  if (method == OrthancPluginHttpMethod_Put ||
+      method == OrthancPluginHttpMethod_Delete)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, uri, '/');
+
+    // "/studies/{id}/labels/{label}"
+    if (tokens.size() == 5 &&
+        tokens[0].empty() &&
+        tokens[1] == "studies" &&
+        tokens[3] == "labels")
+    {
+      if (labelsIndex_.get() != NULL)
+      {
+        labelsIndex_->SignalLabelsModification(tokens[2]);
+      }
+
+      if (predefinedFilters_.get() != NULL)
+      {
+        predefinedFilters_->SignalLabelsModification(tokens[2]);
+      }
+
+      if (studiesFindCache_.get() != NULL)
+      {
+        // the request has not been processed yet: a query that is running meanwhile might still
+        // cache the previous labels, but only during 'MaxAge'
+        studiesFindCache_->SignalChange();
+      }
+    }
+  }
+
+  return 1;  // this filter never forbids a request
+}
+
+
+// Suggests the values of a text field (e.g. the PatientNames that contain 'value') while the user types a filter
+static const size_t AUTOCOMPLETE_STUDIES_PER_VALUE = 10;
+
+void AutocompleteStudies(OrthancPluginRestOutput* output,
+                         const char* /*url*/,
+                         const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  std::string tag, value, argument;
+  StudiesTextIndex::Field field;
+
+  if (!OrthancPlugins::LookupHttpGetArgument(tag, request, "tag") ||
+      !OrthancPlugins::LookupHttpGetArgument(value, request, "value") ||
+      !StudiesTextIndex::LookupField(field, tag))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The 'tag' argument must be PatientName, PatientID, AccessionNumber or StudyDescription and the 'value' argument is required");
+  }
+
+  size_t limit = 10;
+  if (OrthancPlugins::LookupHttpGetArgument(argument, request, "limit"))
+  {
+    try
+    {
+      limit = std::max(1, std::min(100, boost::lexical_cast<int>(argument)));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid value for 'limit': " + argument);
+    }
+  }
+
+  Json::Value answer = Json::arrayValue;
+
+  const std::string pattern = "*" + value + "*";
+
+  Json::Value query;
+  query[tag] = pattern;
+
+  std::vector<std::string> studyInstanceUids;
+  if (value.find_first_of("*?\\") == std::string::npos &&
+      studiesTextIndex_->LookupStudies(studyInstanceUids, query, studiesFinderIndexes_.maxIndexedStudies_) &&
+      !studyInstanceUids.empty())
+  {
+    // go through /tools/find with the user headers such that only the studies the user has access to are suggested
+    std::string uids;
+    Orthanc::Toolbox::JoinStrings(uids, studyInstanceUids, "\\");
+
+    Json::Value find;
+    find["Level"] = "Study";
+    find["Expand"] = true;
+    find["CaseSensitive"] = false;
+    find["Query"] = query;
+    find["Query"]["StudyInstanceUID"] = uids;
+    find["Limit"] = static_cast<Json::UInt>(limit * AUTOCOMPLETE_STUDIES_PER_VALUE);  // many studies share the same value
+
+    OrthancPlugins::HttpHeaders headers;
+    OrthancPlugins::GetHttpHeaders(headers, request);
+
+    Json::Value studies;
+    if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, headers, true) ||
+        studies.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies");
+    }
+
+    const char* group = (field == StudiesTextIndex::Field_PatientName || field == StudiesTextIndex::Field_PatientID ?
+                         "PatientMainDicomTags" : "MainDicomTags");
+
+    std::set<std::string> values;
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      if (studies[i].isMember(group) &&
+          studies[i][group].isMember(tag) &&
+          studies[i][group][tag].isString() &&
+          !studies[i][group][tag].asString().empty())
+      {
+        values.insert(studies[i][group][tag].asString());
+      }
+    }
+
+    for (std::set<std::string>::const_iterator it = values.begin(); it != values.end() && answer.size() < limit; ++it)
+    {
+      answer.append(*it);
+    }
+  }
+
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void GetStudySummary(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string studyId = request->groups[0];
+
+    Json::Value summary;
+    if (!CanAccessStudy(request, studyId) ||
+        !studySummaries_->Get(summary, studyId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown study: " + studyId);
+    }
+
+    OrthancPlugins::AnswerJson(summary, output);
+  }
+}
+
+
+// Streams a PDF report of a study.  By default, the most recent report is returned,
+// another report of the study can be selected with the "instance" GET argument.
+void GetStudyReport(OrthancPluginRestOutput* output,
+                    const char* /*url*/,
+                    const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string studyId = request->groups[0];
+
+    Json::Value summary;
+    if (!CanAccessStudy(request, studyId) ||
+        !studySummaries_->Get(summary, studyId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown study: " + studyId);
+    }
+
+    std::string requestedInstance;
+    OrthancPlugins::LookupHttpGetArgument(requestedInstance, request, "instance");
+
+    std::string instanceId;
+    std::string instanceDate;
+
+    const Json::Value& reports = summary["PdfReports"];
+    for (Json::Value::ArrayIndex i = 0; i < reports.size(); i++)
+    {
+      const std::string reportId = reports[i]["ID"].asString();
+      const std::string reportDate = reports[i]["SeriesDate"].asString();
+
+      if (requestedInstance.empty() ? (instanceId.empty() || reportDate >= instanceDate) : (reportId == requestedInstance))
+      {
+        instanceId = reportId;
+        instanceDate = reportDate;
+      }
+    }
+
+    if (instanceId.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "No PDF report in study: " + studyId);
+    }
+
+    OrthancPlugins::MemoryBuffer pdf;
+    if (!pdf.RestApiGet("/instances/" + instanceId + "/pdf", false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unable to extract the PDF report from instance: " + instanceId);
+    }
+
+    OrthancPluginAnswerBuffer(context, output, reinterpret_cast<const char*>(pdf.GetData()), pdf.GetSize(), "application/pdf");
+  }
+}
+
+
+void GetSeriesThumbnail(OrthancPluginRestOutput* output,
+                        const char* /*url*/,
+                        const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string seriesId = request->groups[0];
+
+    std::string jpeg;
+    if (!CanAccessSeries(request, seriesId) ||
+        !seriesThumbnails_->Get(jpeg, seriesId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "No thumbnail for series: " + seriesId);
+    }
+
+    OrthancPluginAnswerBuffer(context, output, jpeg.c_str(), jpeg.size(), "image/jpeg");
+  }
+}
+
+
+void GetStudyThumbnails(OrthancPluginRestOutput* output,
+                        const char* /*url*/,
+                        const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string studyId = request->groups[0];
+
+    if (!CanAccessStudy(request, studyId) ||
+        !seriesThumbnails_->AnswerStudyThumbnails(output, studyId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown study: " + studyId);
+    }
+  }
+}
+
+
+void LookupInstances(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    // the lookup is done by the plugin -> only the users who can upload may know which instances exist
+    if (!HasAnyPermission(request, "all|upload"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        !body.isObject() ||
+        !body.isMember("SOPInstanceUIDs") ||
+        !body["SOPInstanceUIDs"].isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with a 'SOPInstanceUIDs' array");
+    }
+
+    std::set<std::string> sopInstanceUids;
+    for (Json::Value::ArrayIndex i = 0; i < body["SOPInstanceUIDs"].size(); i++)
+    {
+      if (body["SOPInstanceUIDs"][i].isString())
+      {
+        sopInstanceUids.insert(body["SOPInstanceUIDs"][i].asString());
+      }
+    }
+
+    Json::Value answer;
+    UploadPipeline::LookupStoredInstances(answer["Instances"], sopInstanceUids);
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+void GetUploadProgress(OrthancPluginRestOutput* output,
+                       const char* /*url*/,
+                       const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    if (!HasAnyPermission(request, "all|upload"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::ArrayIndex since = 0;
+
+    std::string argument;
+    if (OrthancPlugins::LookupHttpGetArgument(argument, request, "since"))
+    {
+      try
+      {
+        since = boost::lexical_cast<Json::ArrayIndex>(argument);
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid value for 'since': " + argument);
+      }
+    }
+
+    Json::Value answer;
+    if (uploadPipeline_->GetProgress(answer, request->groups[0], since))
+    {
+      OrthancPlugins::AnswerJson(answer, output);
+    }
+    else
+    {
+      // the upload has not started yet or is already complete
+      OrthancPluginSendHttpStatusCode(context, output, 404);
+    }
+  }
+}
+
+
+static RemoteQueries::Target ParseRemoteTarget(const Json::Value& target)
+{
+  if (!target.isObject() ||
+      !target.isMember("Type") ||
+      !target.isMember("Name"))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Each target must have a 'Type' and a 'Name'");
+  }
+
+  RemoteQueries::Target result;
+  result.type_ = RemoteQueries::StringToTargetType(target["Type"].asString());
+  result.name_ = target["Name"].asString();
+  result.timeout_ = target.isMember("Timeout") ? target["Timeout"].asUInt() : 0;
+  return result;
+}
+
+
+void FederatedFind(OrthancPluginRestOutput* output,
+                   const char* /*url*/,
+                   const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    if (!HasAnyPermission(request, "all|q-r-remote-modalities"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        !body.isObject() ||
+        !body.isMember("Targets") ||
+        !body["Targets"].isArray() ||
+        !body.isMember("Query") ||
+        !body["Query"].isObject())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with a 'Targets' array and a 'Query' object");
+    }
+
+    if (body["Targets"].size() > federatedFindMaxTargets_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Too many targets in a federated search (the maximum is " +
+                                      boost::lexical_cast<std::string>(federatedFindMaxTargets_) + ")");
+    }
+
+    // the answers of the targets are matched by type and name -> a target can only be queried once
+    std::vector<RemoteQueries::Target> targets;
+    std::set<std::string> targetKeys;
+    for (Json::Value::ArrayIndex i = 0; i < body["Targets"].size(); i++)
+    {
+      targets.push_back(ParseRemoteTarget(body["Targets"][i]));
+
+      const std::string key = std::string(RemoteQueries::TargetTypeToString(targets.back().type_)) + ":" + targets.back().name_;
+      if (!targetKeys.insert(key).second)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Duplicated target in a federated search: " + key);
+      }
+    }
+
+    const std::string level = body.isMember("Level") ? body["Level"].asString() : "Study";
+    const unsigned int limit = body.isMember("Limit") ? body["Limit"].asUInt() : 0;
+    const unsigned int timeout = body.isMember("Timeout") ? body["Timeout"].asUInt() : 30;
+    const bool refresh = body.isMember("Refresh") && body["Refresh"].asBool();
+
+    RemoteQueries::AnswerFederatedFind(output, *remoteQueriesPool_, targets, level, body["Query"], limit, timeout, remoteQueriesCache_, refresh);
+  }
+}
+
+
+void RemoteQuery(OrthancPluginRestOutput* output,
+                 const char* /*url*/,
+                 const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    if (!HasAnyPermission(request, "all|q-r-remote-modalities"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        !body.isObject() ||
+        !body.isMember("Query") ||
+        !body["Query"].isObject())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with a 'Type', a 'Name' and a 'Query' object");
+    }
+
+    const RemoteQueries::Target target = ParseRemoteTarget(body);
+    const std::string level = body.isMember("Level") ? body["Level"].asString() : "Study";
+    const unsigned int limit = body.isMember("Limit") ? body["Limit"].asUInt() : 0;
+    const unsigned int timeout = (target.timeout_ != 0 ? target.timeout_ : 30);
+    const bool refresh = body.isMember("Refresh") && body["Refresh"].asBool();
+
+    Json::Value answer;
+    answer["Cached"] = remoteQueriesCache_->Query(answer["Answers"], target, level, body["Query"], limit, timeout, refresh);
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+static const Json::ArrayIndex MAX_REMOTE_STUDIES_COUNT_PATIENTS = 1000;
+
+void GetRemoteStudiesCount(OrthancPluginRestOutput* output,
+                           const char* /*url*/,
+                           const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    if (!HasAnyPermission(request, "all|q-r-remote-modalities"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        !body.isObject() ||
+        !body.isMember("PatientIDs") ||
+        !body["PatientIDs"].isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with a 'PatientIDs' array");
+    }
+
+    if (body["PatientIDs"].size() > MAX_REMOTE_STUDIES_COUNT_PATIENTS)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Too many PatientIDs in a single request (the maximum is " +
+                                      boost::lexical_cast<std::string>(MAX_REMOTE_STUDIES_COUNT_PATIENTS) + ")");
+    }
+
+    std::set<std::string> patientIds;
+    for (Json::Value::ArrayIndex i = 0; i < body["PatientIDs"].size(); i++)
+    {
+      if (body["PatientIDs"][i].isString() &&
+          !body["PatientIDs"][i].asString().empty())
+      {
+        patientIds.insert(body["PatientIDs"][i].asString());
+      }
+    }
+
+    const unsigned int wait = std::min(body.isMember("Wait") ? body["Wait"].asUInt() : 0, remoteStudiesCountMaxWait_);
+
+    Json::Value answer;
+    remoteStudiesCounter_->GetCounts(answer, patientIds, wait);
+    answer["Archive"] = remoteStudiesCounter_->GetArchive().name_;
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+OrthancPlugins::IChunkedRequestReader* CreateAddSeriesReader(const char* /*url*/,
+                                                             const OrthancPluginHttpRequest* request)
+{
+  const std::string studyId = request->groups[0];
+
+  if (!HasAnyPermission(request, "all|upload") ||
+      !CanAccessStudy(request, studyId))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+  }
+
+  // the document is the raw body, the tags of the new series are in a header (base64 of a JSON object in UTF-8)
+  std::string mimeType;
+  Json::Value tags = Json::objectValue;
+  uint64_t contentLength = 0;
+
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    std::string key(request->headersKeys[i]);
+    Orthanc::Toolbox::ToLowerCase(key);
+
+    if (key == "content-type")
+    {
+      mimeType = Orthanc::Toolbox::StripSpaces(request->headersValues[i]);
+      Orthanc::Toolbox::ToLowerCase(mimeType);
+    }
+    else if (key == "content-length")
+    {
+      Orthanc::SerializationToolbox::ParseUnsignedInteger64(contentLength, request->headersValues[i]);
+    }
+    else if (key == "x-series-tags")
+    {
+      std::string decoded;
+      Orthanc::Toolbox::DecodeBase64(decoded, request->headersValues[i]);
+
+      if (!OrthancPlugins::ReadJson(tags, decoded))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The X-Series-Tags header must contain a JSON object");
+      }
+    }
+  }
+
+  return new EncapsulatedDocumentReader(studyId, mimeType, tags, static_cast<size_t>(contentLength));
+}
+
+
+void CreateResumableUpload(OrthancPluginRestOutput* output,
+                           const char* /*url*/,
+                           const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    if (!CanUploadToInbox(request))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+    }
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        !body.isObject() ||
+        !body.isMember("Size") ||
+        !body["Size"].isUInt64())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object with the 'Size' of the file");
+    }
+
+    Json::Value status;
+    resumableUploads_->Create(status, body["Size"].asUInt64(), body.isMember("Filename") ? body["Filename"].asString() : "");
+
+    OrthancPlugins::AnswerJson(status, output);
+  }
+}
+
+
+void HandleResumableUpload(OrthancPluginRestOutput* output,
+                           const char* /*url*/,
+                           const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (!CanUploadToInbox(request))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+  }
+
+  const std::string uploadId = request->groups[0];
+
+  if (request->method == OrthancPluginHttpMethod_Get)
+  {
+    // the client asks for the offset from which it must resume
+    Json::Value status;
+    if (!resumableUploads_->GetStatus(status, uploadId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown resumable upload: " + uploadId);
+    }
+
+    OrthancPlugins::AnswerJson(status, output);
+  }
+  else if (request->method == OrthancPluginHttpMethod_Post)
+  {
+    uint64_t offset = 0;
+    bool hasOffset = false;
+
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      std::string key(request->headersKeys[i]);
+      Orthanc::Toolbox::ToLowerCase(key);
+
+      if (key == "upload-offset")
+      {
+        hasOffset = Orthanc::SerializationToolbox::ParseUnsignedInteger64(offset, request->headersValues[i]);
+      }
+    }
+
+    if (!hasOffset)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Missing or invalid 'Upload-Offset' header");
+    }
+
+    Json::Value status;
+    if (resumableUploads_->Append(status, uploadId, offset, request->body, request->bodySize))
+    {
+      OrthancPlugins::AnswerJson(status, output);
+    }
+    else
+    {
+      // the offset of the client is outdated -> 409 Conflict with the actual offset (as in tus)
+      std::string answer;
+      OrthancPlugins::WriteFastJson(answer, status);
+      OrthancPluginSendHttpStatus(context, output, 409, answer.c_str(), answer.size());
+    }
+  }
+  else if (request->method == OrthancPluginHttpMethod_Delete)
+  {
+    resumableUploads_->Remove(uploadId);
+    OrthancPlugins::AnswerString("{}", "application/json", output);
+  }
+  else
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET,POST,DELETE");
+  }
+}
+
+
+OrthancPlugins::IChunkedRequestReader* CreateUploadReader(const char* /*url*/,
+                                                          const OrthancPluginHttpRequest* request)
+{
+  // the files are stored by the plugin -> the authorization plugin does not see the POST /instances
+  if (!HasAnyPermission(request, "all|upload"))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+  }
+
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    std::string key(request->headersKeys[i]);
+    Orthanc::Toolbox::ToLowerCase(key);
+
+    if (key == "content-type")
+    {
+      std::string contentType(request->headersValues[i]);
+      Orthanc::Toolbox::ToLowerCase(contentType);
+
+      if (boost::starts_with(contentType, "application/zip") ||
+          boost::starts_with(contentType, "application/x-zip-compressed"))
+      {
+        // a single ZIP archive that is inflated while it is received
+        std::string progressId;
+        OrthancPlugins::LookupHttpGetArgument(progressId, request, "progress");
+
+        return new ZipUploadReader(*uploadPipeline_, progressId);
+      }
+    }
+  }
+
+  return new MultipartUploadReader(*uploadPipeline_, request);
+}
+
+
+static bool DisplayPerformanceWarning(OrthancPluginContext* context)
+{
+  (void) DisplayPerformanceWarning;   // Disable warning about unused function
+  OrthancPluginLogWarning(context, "Performance warning in Orthanc Explorer 2: "
+                          "Non-release build, runtime debug assertions are turned on");
+  return true;
+}
+
+
+static void CheckRootUrlIsValid(const std::string& value, const std::string& name, bool allowEmpty)
+{
+  if (allowEmpty && value.size() == 0)
+  {
+    return;
+  }
+
+  if (value.size() < 1 ||
+      value[0] != '/' ||
+      value[value.size() - 1] != '/')
+  {
+    OrthancPlugins::LogError("Orthanc-Explorer 2: '" + name + "' configuration shall start with a '/' and end with a '/': " + value);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                        OrthancPluginResourceType resourceType,
+                                        const char* resourceId)
+{
+  try
+  {
+    if (changeType == OrthancPluginChangeType_OrthancStarted)
+    {
+      // this can not be performed during plugin initialization because it is accessing the DB -> must be done when Orthanc has just started
+      pluginsConfiguration_ = GetPluginsConfiguration(hasUserProfile_);
+
+      if (jobsMonitor_.get() != NULL)
+      {
+        jobsMonitor_->Start();
+      }
+
+      if (studySummaries_.get() != NULL)
+      {
+        studySummaries_->Start();
+      }
+
+      if (seriesThumbnails_.get() != NULL)
+      {
+        seriesThumbnails_->Start();
+      }
+
+      if (uploadPipeline_.get() != NULL)
+      {
+        uploadPipeline_->Start();
+      }
+
+      if (remoteQueriesPool_.get() != NULL)
+      {
+        remoteQueriesPool_->Start();
+      }
+
+      if (resumableUploads_.get() != NULL)
+      {
+        resumableUploads_->RemoveExpiredUploads();
+      }
+
+      if (remoteStudiesCounter_.get() != NULL)
+      {
+        remoteStudiesCounter_->Start();
+      }
+
+      if (studiesTextIndex_.get() != NULL)
+      {
+        studiesTextIndex_->Start();
+      }
+
+      if (recentStudiesIndex_.get() != NULL)
+      {
+        recentStudiesIndex_->Start();
+      }
+
+      if (studiesFacets_.get() != NULL)
+      {
+        studiesFacets_->Start();
+      }
+
+      if (labelsIndex_.get() != NULL)
+      {
+        labelsIndex_->Start();
+      }
+
+      if (predefinedFilters_.get() != NULL)
+      {
+        predefinedFilters_->Start();
+      }
+
+      if (patientStudiesIndex_.get() != NULL)
+      {
+        patientStudiesIndex_->Start();
+      }
+    }
+    else if (changeType == OrthancPluginChangeType_OrthancStopped)
+    {
+      if (jobsMonitor_.get() != NULL)
+      {
+        jobsMonitor_->Stop();
+      }
+
+      if (studySummaries_.get() != NULL)
+      {
+        studySummaries_->Stop();
+      }
+
+      if (seriesThumbnails_.get() != NULL)
+      {
+        seriesThumbnails_->Stop();
+      }
+
+      if (uploadPipeline_.get() != NULL)
+      {
+        uploadPipeline_->Stop();
+      }
+
+      if (remoteQueriesPool_.get() != NULL)
+      {
+        remoteQueriesPool_->Stop();
+      }
+
+      if (remoteStudiesCounter_.get() != NULL)
+      {
+        remoteStudiesCounter_->Stop();
+      }
+
+      if (studiesTextIndex_.get() != NULL)
+      {
+        studiesTextIndex_->Stop();
+      }
+
+      if (recentStudiesIndex_.get() != NULL)
+      {
+        recentStudiesIndex_->Stop();
+      }
+
+      if (studiesFacets_.get() != NULL)
+      {
+        studiesFacets_->Stop();
+      }
+
+      if (labelsIndex_.get() != NULL)
+      {
+        labelsIndex_->Stop();
+      }
+
+      if (predefinedFilters_.get() != NULL)
+      {
+        predefinedFilters_->Stop();
+      }
+
+      if (patientStudiesIndex_.get() != NULL)
+      {
+        patientStudiesIndex_->Stop();
+      }
+    }
+    else if (changeType == OrthancPluginChangeType_JobSubmitted ||
+             changeType == OrthancPluginChangeType_JobSuccess ||
+             changeType == OrthancPluginChangeType_JobFailure)
+    {
+      if (jobsMonitor_.get() != NULL)
+      {
+        jobsMonitor_->SignalJobChange();
+      }
+    }
+    else
+    {
+      if (studySummaries_.get() != NULL)
+      {
+        studySummaries_->SignalChange(changeType, resourceType, resourceId);
+
+        if (changeType == OrthancPluginChangeType_StableStudy)
+        {
+          studySummaries_->Schedule(resourceId);
+        }
+      }
+
+      if (seriesThumbnails_.get() != NULL &&
+          changeType == OrthancPluginChangeType_StableSeries)
+      {
+        seriesThumbnails_->Schedule(resourceId);
+      }
+
+      if (studiesTextIndex_.get() != NULL)
+      {
+        studiesTextIndex_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (recentStudiesIndex_.get() != NULL)
+      {
+        recentStudiesIndex_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (studiesFacets_.get() != NULL)
+      {
+        studiesFacets_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (labelsIndex_.get() != NULL)
+      {
+        labelsIndex_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (predefinedFilters_.get() != NULL)
+      {
+        predefinedFilters_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (patientStudiesIndex_.get() != NULL)
+      {
+        patientStudiesIndex_->SignalChange(changeType, resourceType, resourceId);
+      }
+
+      if (studiesFindCache_.get() != NULL)
+      {
+        studiesFindCache_->SignalChange();
+      }
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Exception: " << e.What();
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+
+  return OrthancPluginErrorCode_Success;
+}
+
+
+extern "C"
+{
+  ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+  {
+    assert(DisplayPerformanceWarning(context));
+
+    OrthancPlugins::SetGlobalContext(context);
+    
+    Orthanc::Logging::InitializePluginContext(context);
+
+    Orthanc::Logging::EnableInfoLevel(true);
+
+
+    /* Check the version of the Orthanc core */
+    if (!OrthancPlugins::CheckMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
+                                                    ORTHANC_CORE_MINIMAL_MINOR,
+                                                    ORTHANC_CORE_MINIMAL_REVISION))
+    {
+      OrthancPlugins::ReportMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
+                                                  ORTHANC_CORE_MINIMAL_MINOR,
+                                                  ORTHANC_CORE_MINIMAL_REVISION);
+      return -1;
+    }
+
+    OrthancPlugins::SetDescription(ORTHANC_PLUGIN_NAME, "Advanced User Interface for Orthanc");
+
+    try
+    {
+      ReadConfiguration();
+
+      if (pluginJsonConfiguration_["Enable"].asBool())
+      {
+        oe2BaseUrl_ = pluginJsonConfiguration_["Root"].asString();
+
+        CheckRootUrlIsValid(oe2BaseUrl_, "Root", false);
+
+        OrthancPlugins::LogWarning("Root URI to the Orthanc-Explorer 2 application: " + oe2BaseUrl_);
+
+
+        OrthancPlugins::RegisterRestCallback
+          <ServeCustomCss>
+          (oe2BaseUrl_ + "app/customizable/custom.css", true);
+
+        if (!customLogoPath_.empty())
+        {
+          OrthancPlugins::RegisterRestCallback
+            <ServeCustomFile<CustomFilesPath_Logo> >
+            (oe2BaseUrl_ + "app/customizable/custom-logo", true);
         }
 
         // we need to mix the "routing" between the server and the frontend (vue-router)
@@ -952,6 +2534,26 @@ extern "C"
 
         OrthancPlugins::RegisterRestCallback<GetOE2Configuration>(oe2BaseUrl_ + "api/configuration", true);
         OrthancPlugins::RegisterRestCallback<GetOE2PreLoginConfiguration>(oe2BaseUrl_ + "api/pre-login-configuration", true);
+        OrthancPlugins::RegisterRestCallback<FindStudies>(oe2BaseUrl_ + "api/studies/find", true);
+
+        if (pluginJsonConfiguration_["StudiesFindCache"]["Enable"].asBool())
+        {
+          studiesFindCache_.reset(new StudiesFindCache(pluginJsonConfiguration_["StudiesFindCache"]["MaxAge"].asUInt(),
+                                                       pluginJsonConfiguration_["StudiesFindCache"]["MaxEntries"].asUInt(),
+                                                       pluginJsonConfiguration_["StudiesFindCache"]["MaxWait"].asUInt()));
+        }
+
+        OrthancPlugins::ChunkedRestRegistration<OrthancPlugins::Internals::NullRestCallback, CreateAddSeriesReader>::Apply(oe2BaseUrl_ + "api/studies/([^/]*)/series");
+
+        {
+          const Json::Value& federatedFindConfiguration = pluginJsonConfiguration_["FederatedFind"];
+
+          remoteQueriesPool_.reset(new RemoteQueries::QueriesPool(federatedFindConfiguration["ThreadsCount"].asUInt(),
+                                                                  federatedFindConfiguration["MaxPendingQueries"].asUInt()));
+          federatedFindMaxTargets_ = federatedFindConfiguration["MaxTargets"].asUInt();
+
+          OrthancPlugins::RegisterRestCallback<FederatedFind>(oe2BaseUrl_ + "api/remote/find", true);
+        }
 
         std::string pluginRootUri = oe2BaseUrl_ + "app/";
         OrthancPlugins::SetRootUri(ORTHANC_PLUGIN_NAME, pluginRootUri);
@@ -983,6 +2585,215 @@ extern "C"
           OrthancPlugins::RegisterRestCallback<SendEmail>(oe2BaseUrl_ + "api/emails/send", true);
         }
         
+        if (pluginJsonConfiguration_["JobsEvents"]["Enable"].asBool())
+        {
+          const Json::Value& jobsEventsConfiguration = pluginJsonConfiguration_["JobsEvents"];
+          jobsEventsMaxWait_ = jobsEventsConfiguration["MaxWait"].asUInt();
+
+          jobsMonitor_.reset(new JobsMonitor(jobsEventsConfiguration["PollingPeriod"].asUInt(),
+                                             jobsEventsConfiguration["IdleTimeout"].asUInt(),
+                                             jobsEventsConfiguration["MaxWaitingClients"].asUInt()));
+
+          OrthancPlugins::RegisterRestCallback<GetJobsEvents>(oe2BaseUrl_ + "api/jobs/events", true);
+        }
+
+        if (pluginJsonConfiguration_["StudySummaries"]["Enable"].asBool())
+        {
+          const Json::Value& studySummariesConfiguration = pluginJsonConfiguration_["StudySummaries"];
+
+          bool isPersistent = studySummariesConfiguration["Persistent"].asBool();
+          if (isPersistent && !OrthancPlugins::CheckMinimalOrthancVersion(1, 12, 8))
+          {
+            LOG(WARNING) << "OE2: The study summaries can not be persisted since the key-value stores require Orthanc 1.12.8";
+            isPersistent = false;
+          }
+
+          studySummaries_.reset(new StudySummaries(studySummariesConfiguration["CacheSize"].asUInt(),
+                                                   studySummariesConfiguration["ThreadsCount"].asUInt(),
+                                                   isPersistent));
+
+          OrthancPlugins::RegisterRestCallback<GetStudySummary>(oe2BaseUrl_ + "api/studies/([^/]*)/summary", true);
+          OrthancPlugins::RegisterRestCallback<GetStudyReport>(oe2BaseUrl_ + "api/studies/([^/]*)/report", true);
+        }
+
+        if (pluginJsonConfiguration_["SeriesThumbnails"]["Enable"].asBool())
+        {
+          const Json::Value& seriesThumbnailsConfiguration = pluginJsonConfiguration_["SeriesThumbnails"];
+
+          seriesThumbnails_.reset(new SeriesThumbnails(seriesThumbnailsConfiguration["Size"].asUInt(),
+                                                       seriesThumbnailsConfiguration["AttachmentType"].asUInt(),
+                                                       seriesThumbnailsConfiguration["ThreadsCount"].asUInt()));
+
+          OrthancPlugins::RegisterRestCallback<GetSeriesThumbnail>(oe2BaseUrl_ + "api/series/([^/]*)/thumbnail", true);
+          OrthancPlugins::RegisterRestCallback<GetStudyThumbnails>(oe2BaseUrl_ + "api/studies/([^/]*)/thumbnails", true);
+        }
+
+        if (pluginJsonConfiguration_["MultipartUpload"]["Enable"].asBool())
+        {
+          const Json::Value& multipartUploadConfiguration = pluginJsonConfiguration_["MultipartUpload"];
+
+          uploadPipeline_.reset(new UploadPipeline(multipartUploadConfiguration["ThreadsCount"].asUInt(),
+                                                   multipartUploadConfiguration["MaxPendingFiles"].asUInt(),
+                                                   static_cast<uint64_t>(multipartUploadConfiguration["MaxZipEntrySize"].asUInt()) * 1024 * 1024));
+
+          OrthancPlugins::ChunkedRestRegistration<OrthancPlugins::Internals::NullRestCallback, CreateUploadReader>::Apply(oe2BaseUrl_ + "api/instances");
+          OrthancPlugins::RegisterRestCallback<LookupInstances>(oe2BaseUrl_ + "api/instances/lookup", true);
+          OrthancPlugins::RegisterRestCallback<GetUploadProgress>(oe2BaseUrl_ + "api/instances/progress/([^/]*)", true);
+        }
+
+        if (pluginJsonConfiguration_["ResumableUploads"]["Enable"].asBool())
+        {
+          const Json::Value& resumableUploadsConfiguration = pluginJsonConfiguration_["ResumableUploads"];
+
+          std::string directory;
+          if (resumableUploadsConfiguration["Directory"].isString())
+          {
+            directory = resumableUploadsConfiguration["Directory"].asString();
+          }
+          else
+          {
+            directory = (boost::filesystem::temp_directory_path() / "orthanc-explorer-2-uploads").string();
+          }
+
+          resumableUploads_.reset(new ResumableUploads(directory,
+                                                       static_cast<uint64_t>(resumableUploadsConfiguration["MaxFileSize"].asUInt()) * 1024 * 1024,
+                                                       resumableUploadsConfiguration["ExpirationDelay"].asUInt() * 3600));
+
+          OrthancPlugins::RegisterRestCallback<CreateResumableUpload>(oe2BaseUrl_ + "api/uploads", true);
+          OrthancPlugins::RegisterRestCallback<HandleResumableUpload>(oe2BaseUrl_ + "api/uploads/([^/]*)", true);
+        }
+
+        if (pluginJsonConfiguration_["RemoteQueriesCache"]["Enable"].asBool())
+        {
+          const Json::Value& remoteQueriesCacheConfiguration = pluginJsonConfiguration_["RemoteQueriesCache"];
+
+          remoteQueriesCache_.reset(new RemoteQueriesCache(remoteQueriesCacheConfiguration["TTL"].asUInt(),
+                                                           remoteQueriesCacheConfiguration["MaxEntries"].asUInt()));
+
+          OrthancPlugins::RegisterRestCallback<RemoteQuery>(oe2BaseUrl_ + "api/remote/query", true);
+        }
+
+        if (pluginJsonConfiguration_["RemoteStudiesCount"]["Enable"].asBool())
+        {
+          const Json::Value& remoteStudiesCountConfiguration = pluginJsonConfiguration_["RemoteStudiesCount"];
+
+          RemoteQueries::Target archive;
+          archive.type_ = RemoteQueries::StringToTargetType(remoteStudiesCountConfiguration["Type"].asString());
+          archive.name_ = remoteStudiesCountConfiguration["Name"].asString();
+          archive.timeout_ = 0;
+
+          if (archive.name_.empty())
+          {
+            LOG(ERROR) << "OE2: `OrthancExplorer2.RemoteStudiesCount.Name` must be defined to count the studies on a remote archive";
+            return -1;
+          }
+
+          remoteStudiesCountMaxWait_ = remoteStudiesCountConfiguration["MaxWait"].asUInt();
+          remoteStudiesCounter_.reset(new RemoteStudiesCounter(archive,
+                                                               remoteStudiesCountConfiguration["TTL"].asUInt(),
+                                                               remoteStudiesCountConfiguration["BatchSize"].asUInt(),
+                                                               remoteStudiesCountConfiguration["MaxEntries"].asUInt(),
+                                                               remoteStudiesCountConfiguration["SupportsMultipleValues"].asBool()));
+
+          OrthancPlugins::RegisterRestCallback<GetRemoteStudiesCount>(oe2BaseUrl_ + "api/patients/remote-studies-count", true);
+        }
+
+        if (pluginJsonConfiguration_["StudiesTextIndex"]["Enable"].asBool())
+        {
+          studiesTextIndex_.reset(new StudiesTextIndex);
+          studiesFinderIndexes_.textIndex_ = studiesTextIndex_.get();
+          studiesFinderIndexes_.maxIndexedStudies_ = pluginJsonConfiguration_["StudiesTextIndex"]["MaxStudies"].asUInt();
+
+          OrthancPlugins::RegisterRestCallback<AutocompleteStudies>(oe2BaseUrl_ + "api/studies/autocomplete", true);
+        }
+
+        if (pluginJsonConfiguration_["RecentStudiesIndex"]["Enable"].asBool())
+        {
+          recentStudiesIndex_.reset(new RecentStudiesIndex(pluginJsonConfiguration_["RecentStudiesIndex"]["MaxStudies"].asUInt()));
+          studiesFinderIndexes_.recentStudies_ = recentStudiesIndex_.get();
+        }
+
+        if (pluginJsonConfiguration_["StudiesFacets"]["Enable"].asBool())
+        {
+          studiesFacets_.reset(new StudiesFacets(pluginJsonConfiguration_["StudiesFacets"]["LabelsRefreshPeriod"].asUInt()));
+
+          OrthancPlugins::RegisterRestCallback<GetStudiesFacets>(oe2BaseUrl_ + "api/studies/facets", true);
+        }
+
+        if (pluginJsonConfiguration_["LabelsIndex"]["Enable"].asBool())
+        {
+          labelsIndex_.reset(new LabelsIndex(pluginJsonConfiguration_["LabelsIndex"]["FullRefreshPeriod"].asUInt()));
+          studiesFinderIndexes_.labelsIndex_ = labelsIndex_.get();
+          studiesFinderIndexes_.maxLabelsStudies_ = pluginJsonConfiguration_["LabelsIndex"]["MaxStudies"].asUInt();
+
+          OrthancPlugins::RegisterRestCallback<GetLabelsStudiesCount>(oe2BaseUrl_ + "api/labels/studies-count", true);
+        }
+
+        {
+          const Json::Value& definitions = pluginJsonConfiguration_["UiOptions"]["PredefinedFilters"];
+
+          if (pluginJsonConfiguration_["PredefinedFiltersIndex"]["Enable"].asBool() &&
+              definitions.size() > 0)
+          {
+            predefinedFilters_.reset(new PredefinedFilters(definitions,
+                                                           pluginJsonConfiguration_["PredefinedFiltersIndex"]["MaxStudies"].asUInt(),
+                                                           pluginJsonConfiguration_["PredefinedFiltersIndex"]["FullRefreshPeriod"].asUInt()));
+            studiesFinderIndexes_.predefinedFilters_ = predefinedFilters_.get();
+          }
+          else
+          {
+            Json::Value filters;
+            PredefinedFilters::EvaluateFilters(filters, definitions);  // to report the invalid definitions at startup
+          }
+
+          OrthancPlugins::RegisterRestCallback<GetPredefinedFilters>(oe2BaseUrl_ + "api/predefined-filters", true);
+        }
+
+        if (pluginJsonConfiguration_["StudiesExport"]["Enable"].asBool())
+        {
+          studiesExportPageSize_ = std::max(1u, pluginJsonConfiguration_["StudiesExport"]["PageSize"].asUInt());
+
+          OrthancPlugins::RegisterRestCallback<ExportStudies>(oe2BaseUrl_ + "api/studies/export", true);
+        }
+
+        if (pluginJsonConfiguration_["AuditLogsProxy"]["Enable"].asBool() &&
+            hasAuditLogs_)
+        {
+          const std::string order = pluginJsonConfiguration_["AuditLogsProxy"]["Order"].asString();
+          if (order != "Ascending" && order != "Descending")
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "AuditLogsProxy.Order must be 'Ascending' or 'Descending'");
+          }
+
+          auditLogsProxy_.reset(new AuditLogsProxy(std::max(1u, pluginJsonConfiguration_["AuditLogsProxy"]["PageSize"].asUInt()),
+                                                   std::max(1u, pluginJsonConfiguration_["AuditLogsProxy"]["ExportPageSize"].asUInt()),
+                                                   pluginJsonConfiguration_["AuditLogsProxy"]["FirstPageMaxAge"].asUInt(),
+                                                   order == "Descending"));
+
+          OrthancPlugins::RegisterRestCallback<GetAuditLogs>(oe2BaseUrl_ + "api/audit-logs", true);
+        }
+
+        if (pluginJsonConfiguration_["PatientStudiesIndex"]["Enable"].asBool())
+        {
+          std::vector<std::string> tags;
+          const Json::Value& samePatientTags = pluginJsonConfiguration_["UiOptions"]["ShowSamePatientStudiesFilter"];
+          for (Json::Value::ArrayIndex i = 0; i < samePatientTags.size(); i++)
+          {
+            tags.push_back(samePatientTags[i].asString());
+          }
+
+          patientStudiesIndex_.reset(new PatientStudiesIndex(tags));
+
+          OrthancPlugins::RegisterRestCallback<CountSamePatientStudies>(oe2BaseUrl_ + "api/studies/same-patient-count", true);
+        }
+
+        if (labelsIndex_.get() != NULL ||
+            predefinedFilters_.get() != NULL ||
+            studiesFindCache_.get() != NULL)
+        {
+          OrthancPluginRegisterIncomingHttpRequestFilter2(context, FilterIncomingHttpRequest);
+        }
+
         OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
 
         {
@@ -1019,6 +2830,23 @@ extern "C"
 
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
+    remoteQueriesPool_.reset();
+    jobsMonitor_.reset();
+    studySummaries_.reset();
+    seriesThumbnails_.reset();
+    uploadPipeline_.reset();
+    resumableUploads_.reset();
+    remoteQueriesCache_.reset();
+    remoteStudiesCounter_.reset();
+    studiesFindCache_.reset();
+    studiesFinderIndexes_ = StudiesFinderIndexes();
+    studiesTextIndex_.reset();
+    recentStudiesIndex_.reset();
+    studiesFacets_.reset();
+    labelsIndex_.reset();
+    predefinedFilters_.reset();
+    patientStudiesIndex_.reset();
+    auditLogsProxy_.reset();
   }
 
 
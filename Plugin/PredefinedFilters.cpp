@@ -0,0 +1,808 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PredefinedFilters.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/replace.hpp>
+
+#include <set>
+
+
+static const char* const LAST_UPDATE = "LastUpdate";
+static const char* const STUDY_INSTANCE_UID = "StudyInstanceUID";
+
+static const size_t BUILD_PAGE_SIZE = 1000;
+static const size_t MAX_CHANGES_PER_BATCH = 100;
+static const size_t MAX_BUILD_ATTEMPTS = 3;
+static const size_t MAX_DIRTY_STUDIES = 1000;
+
+
+static void CheckDefinition(const Json::Value& definition)
+{
+  if (!definition.isObject() ||
+      !definition.isMember("Name") ||
+      !definition["Name"].isString() ||
+      !definition.isMember("Query") ||
+      !definition["Query"].isObject() ||
+      (definition.isMember("Labels") && !definition["Labels"].isArray()) ||
+      (definition.isMember("LabelsConstraint") && !definition["LabelsConstraint"].isString()))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Each entry of 'UiOptions.PredefinedFilters' must have a 'Name' and a 'Query' object");
+  }
+
+  if (definition["Query"].isMember(STUDY_INSTANCE_UID))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The predefined filter '" + definition["Name"].asString() + "' cannot filter on the StudyInstanceUID");
+  }
+}
+
+
+static void EvaluateDefinition(Json::Value& evaluated,
+                               const Json::Value& definition,
+                               const boost::gregorian::date& today)
+{
+  evaluated = definition;
+
+  Json::Value& query = evaluated["Query"];
+  const Json::Value::Members tags = query.getMemberNames();
+
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    if (query[tags[i]].isString())
+    {
+      std::string value = query[tags[i]].asString();
+      boost::algorithm::replace_all(value, "$today", boost::gregorian::to_iso_string(today));
+      boost::algorithm::replace_all(value, "$yesterday", boost::gregorian::to_iso_string(today - boost::gregorian::days(1)));
+      boost::algorithm::replace_all(value, "$oneWeekAgo", boost::gregorian::to_iso_string(today - boost::gregorian::weeks(1)));
+      boost::algorithm::replace_all(value, "$oneMonthAgo", boost::gregorian::to_iso_string(today - boost::gregorian::months(1)));
+      boost::algorithm::replace_all(value, "$oneYearAgo", boost::gregorian::to_iso_string(today - boost::gregorian::years(1)));
+      query[tags[i]] = value;
+    }
+  }
+}
+
+
+// Keeps only the fields of a /tools/find request that define its result set, such that the request of
+// the study list can be compared with the predefined filters (the empty and '*' constraints match all)
+static void NormalizeCriteria(Json::Value& criteria,
+                              const Json::Value& find)
+{
+  criteria = Json::objectValue;
+  criteria["Query"] = Json::objectValue;
+
+  if (find["Query"].isObject())
+  {
+    const Json::Value::Members tags = find["Query"].getMemberNames();
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      const Json::Value& value = find["Query"][tags[i]];
+      if (!value.isString() ||
+          (!value.asString().empty() && value.asString() != "*"))
+      {
+        criteria["Query"][tags[i]] = value;
+      }
+    }
+  }
+
+  std::set<std::string> labels;
+  if (find["Labels"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < find["Labels"].size(); i++)
+    {
+      labels.insert(find["Labels"][i].asString());
+    }
+  }
+
+  const std::string constraint = (find.isMember("LabelsConstraint") ? find["LabelsConstraint"].asString() : "All");
+
+  if (!labels.empty() ||
+      constraint == "None")
+  {
+    criteria["Labels"] = Json::arrayValue;
+    for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+    {
+      criteria["Labels"].append(*it);
+    }
+
+    criteria["LabelsConstraint"] = constraint;
+  }
+
+  if (find.isMember("CaseSensitive"))
+  {
+    criteria["CaseSensitive"] = find["CaseSensitive"];
+  }
+}
+
+
+static void EvaluateCriteria(Json::Value& criteria,
+                             const Json::Value& definition,
+                             const boost::gregorian::date& today)
+{
+  Json::Value evaluated;
+  EvaluateDefinition(evaluated, definition, today);
+  NormalizeCriteria(criteria, evaluated);
+}
+
+
+static bool HasDateKeywords(const Json::Value& definition)
+{
+  Json::Value evaluated;
+  EvaluateDefinition(evaluated, definition, boost::gregorian::date(2000, 1, 1));
+  return (evaluated != definition);
+}
+
+
+PredefinedFilters::PredefinedFilters(const Json::Value& definitions,
+                                     size_t maxStudies,
+                                     unsigned int fullRefreshPeriod) :
+  BackgroundStudiesIndex("predefined filters", MAX_CHANGES_PER_BATCH),
+  day_(boost::gregorian::day_clock::local_day()),
+  maxStudies_(maxStudies),
+  fullRefreshPeriod_(fullRefreshPeriod),
+  generation_(0),
+  hasTooManyDirtyStudies_(false),
+  tooManyDirtyStudiesGeneration_(0)
+{
+  if (!definitions.isArray())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'UiOptions.PredefinedFilters' must be an array");
+  }
+
+  filters_.resize(definitions.size());
+
+  for (Json::Value::ArrayIndex i = 0; i < definitions.size(); i++)
+  {
+    CheckDefinition(definitions[i]);
+
+    filters_[i].definition_ = definitions[i];
+    filters_[i].hasDateKeywords_ = HasDateKeywords(definitions[i]);
+    filters_[i].isReady_ = false;
+    EvaluateCriteria(filters_[i].criteria_, definitions[i], day_);
+  }
+}
+
+
+PredefinedFilters::~PredefinedFilters()
+{
+  Stop();
+}
+
+
+bool PredefinedFilters::IsHandledChange(OrthancPluginChangeType changeType) const
+{
+  // the LastUpdate metadata might have been modified
+  return (BackgroundStudiesIndex::IsHandledChange(changeType) ||
+          changeType == OrthancPluginChangeType_UpdatedMetadata);
+}
+
+
+void PredefinedFilters::SignalLabelsModification(const std::string& studyId)
+{
+  // the HTTP request has not been processed yet -> the study is marked as dirty
+  PushChange(studyId, false, true);
+}
+
+
+void PredefinedFilters::ScheduleNextTask()
+{
+  // wake up just after midnight (at least once per hour in case the clock is adjusted)
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  const boost::posix_time::ptime midnight(boost::gregorian::day_clock::local_day() + boost::gregorian::days(1));
+
+  const boost::posix_time::ptime wakeUp = std::min(now + (midnight - boost::posix_time::second_clock::local_time()) + boost::posix_time::seconds(1),
+                                                   now + boost::posix_time::hours(1));
+
+  SchedulePeriodicTask(std::min(wakeUp, nextFullRefresh_));
+}
+
+
+void PredefinedFilters::Build()
+{
+  nextFullRefresh_ = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(fullRefreshPeriod_);
+  RebuildAll();
+  ScheduleNextTask();
+}
+
+
+void PredefinedFilters::RunPeriodicTask()
+{
+  const boost::gregorian::date today = boost::gregorian::day_clock::local_day();
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  bool isNewDay;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isNewDay = (today != day_);
+    day_ = today;
+  }
+
+  const bool mustRebuild = (now >= nextFullRefresh_);
+  if (mustRebuild)
+  {
+    nextFullRefresh_ = now + boost::posix_time::seconds(fullRefreshPeriod_);
+  }
+
+  ScheduleNextTask();
+
+  if (mustRebuild)
+  {
+    RebuildAll();
+  }
+  else if (isNewDay)
+  {
+    for (size_t i = 0; i < filters_.size(); i++)
+    {
+      if (filters_[i].hasDateKeywords_)
+      {
+        BuildFilter(i);
+      }
+    }
+  }
+}
+
+
+void PredefinedFilters::RebuildAll()
+{
+  unsigned int generation;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    generation_++;
+    generation = generation_;
+  }
+
+  for (size_t i = 0; i < filters_.size(); i++)
+  {
+    try
+    {
+      BuildFilter(i);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while loading the studies of a predefined filter: " << e.What();
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // same rule as in the LabelsIndex: a study is only clean once a whole rebuild has started after
+  // it was marked and the next one (i.e. this one) has checked it again
+  for (std::map<std::string, DirtyStudy>::iterator it = dirtyStudies_.begin(); it != dirtyStudies_.end(); )
+  {
+    if (it->second.generation_ + 1 < generation)
+    {
+      dirtyStudies_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  if (tooManyDirtyStudiesGeneration_ + 1 < generation &&
+      dirtyStudies_.size() < MAX_DIRTY_STUDIES)
+  {
+    hasTooManyDirtyStudies_ = false;
+  }
+}
+
+
+void PredefinedFilters::BuildFilter(size_t filterIndex)
+{
+  Json::Value criteria;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Filter& filter = filters_[filterIndex];
+    filter.isReady_ = false;
+    filter.results_ = ResultSet();
+    EvaluateCriteria(filter.criteria_, filter.definition_, day_);
+    criteria = filter.criteria_;
+  }
+
+  const std::string name = filters_[filterIndex].definition_["Name"].asString();
+
+  for (size_t attempt = 0; attempt < MAX_BUILD_ATTEMPTS; attempt++)
+  {
+    ResultSet results;
+
+    switch (LoadResultSet(results, criteria, name))
+    {
+      case LoadStatus_Stopped:
+      case LoadStatus_TooManyStudies:
+        return;
+
+      case LoadStatus_Moved:
+        LOG(INFO) << "OE2: Studies were deleted while loading the predefined filter '" << name << "', loading it again";
+        continue;
+
+      case LoadStatus_Success:
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        filters_[filterIndex].results_.studies_.swap(results.studies_);
+        filters_[filterIndex].results_.order_.swap(results.order_);
+        filters_[filterIndex].isReady_ = true;
+        return;
+      }
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+  LOG(WARNING) << "OE2: The studies of the predefined filter '" << name << "' keep moving, its studies are not kept "
+               << "in memory until the next rebuild";
+}
+
+
+PredefinedFilters::LoadStatus PredefinedFilters::LoadResultSet(ResultSet& results,
+                                                               const Json::Value& criteria,
+                                                               const std::string& name)
+{
+  // The pages are ordered by StudyInstanceUID and overlap by one study: if the last study of a
+  // page is not found in the next page, some studies before it have been deleted meanwhile and
+  // the pages have shifted -> some studies might have been skipped.  The studies that are added
+  // meanwhile only lead to duplicates, which are harmless.
+  std::string lastStudyId;
+
+  for (size_t since = 0; ; )
+  {
+    if (!IsRunning())
+    {
+      return LoadStatus_Stopped;
+    }
+
+    // this requires an Orthanc with "ExtendedFind" (metadata in the answers and OrderBy)
+    Json::Value find = criteria;
+    find["Level"] = "Study";
+    find["ResponseContent"].append("MainDicomTags");
+    find["ResponseContent"].append("Metadata");
+    find["Since"] = static_cast<Json::UInt64>(since);
+    find["Limit"] = static_cast<Json::UInt64>(BUILD_PAGE_SIZE);
+
+    Json::Value orderBy;
+    orderBy["Type"] = "DicomTag";
+    orderBy["Key"] = STUDY_INSTANCE_UID;
+    orderBy["Direction"] = "ASC";
+    find["OrderBy"].append(orderBy);
+
+    Json::Value studies;
+    if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, false) ||
+        studies.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies of the predefined filter " + name);
+    }
+
+    bool hasLastStudy = lastStudyId.empty();
+
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      const Json::Value& study = studies[i];
+      const std::string studyId = study["ID"].asString();
+
+      if (studyId == lastStudyId)
+      {
+        hasLastStudy = true;
+      }
+
+      const OrderKey key(study["Metadata"][LAST_UPDATE].asString(),
+                         study["MainDicomTags"][STUDY_INSTANCE_UID].asString());
+
+      std::map<std::string, OrderKey>::iterator found = results.studies_.find(studyId);
+      if (found != results.studies_.end())
+      {
+        results.order_.erase(found->second);
+      }
+
+      results.studies_[studyId] = key;
+      results.order_[key] = studyId;
+    }
+
+    if (!hasLastStudy)
+    {
+      return LoadStatus_Moved;
+    }
+
+    if (results.studies_.size() > maxStudies_)
+    {
+      LOG(WARNING) << "OE2: The predefined filter '" << name << "' matches more than " << maxStudies_
+                   << " studies, its studies are not kept in memory";
+      return LoadStatus_TooManyStudies;
+    }
+
+    if (studies.size() < BUILD_PAGE_SIZE)
+    {
+      return LoadStatus_Success;
+    }
+
+    lastStudyId = studies[studies.size() - 1]["ID"].asString();
+    since += BUILD_PAGE_SIZE - 1;
+  }
+}
+
+
+void PredefinedFilters::ApplyChanges(const std::vector<Change>& batch)
+{
+  std::map<std::string, Change> changes;   // Orthanc ID of the study -> last change
+  for (size_t i = 0; i < batch.size(); i++)
+  {
+    std::map<std::string, Change>::iterator found = changes.find(batch[i].studyId_);
+    if (found == changes.end())
+    {
+      changes[batch[i].studyId_] = batch[i];
+    }
+    else
+    {
+      found->second.isDeleted_ = batch[i].isDeleted_;
+      found->second.areLabelsChanging_ = (found->second.areLabelsChanging_ || batch[i].areLabelsChanging_);
+    }
+  }
+
+  std::vector<std::string> deletedStudies;
+  std::map<std::string, std::string> modifiedStudies;   // Orthanc ID -> StudyInstanceUID
+
+  for (std::map<std::string, Change>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+  {
+    Json::Value study;
+
+    if (!it->second.isDeleted_ &&
+        OrthancPlugins::RestApiGet(study, "/studies/" + it->first, false) &&
+        study.isMember("MainDicomTags") &&
+        study["MainDicomTags"].isMember(STUDY_INSTANCE_UID))
+    {
+      modifiedStudies[it->first] = study["MainDicomTags"][STUDY_INSTANCE_UID].asString();
+    }
+    else
+    {
+      // the study might have been deleted in the meantime
+      deletedStudies.push_back(it->first);
+    }
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < deletedStudies.size(); i++)
+    {
+      for (size_t j = 0; j < filters_.size(); j++)
+      {
+        RemoveStudy(filters_[j], deletedStudies[i]);
+      }
+
+      dirtyStudies_.erase(deletedStudies[i]);
+    }
+
+    for (std::map<std::string, std::string>::const_iterator it = modifiedStudies.begin(); it != modifiedStudies.end(); ++it)
+    {
+      if (changes.find(it->first)->second.areLabelsChanging_)
+      {
+        if (dirtyStudies_.find(it->first) != dirtyStudies_.end() ||
+            dirtyStudies_.size() < MAX_DIRTY_STUDIES)
+        {
+          DirtyStudy& dirty = dirtyStudies_[it->first];
+          dirty.studyInstanceUid_ = it->second;
+          dirty.generation_ = generation_;
+        }
+        else
+        {
+          if (!hasTooManyDirtyStudies_)
+          {
+            LOG(WARNING) << "OE2: Too many modifications of the labels since the last rebuild of the predefined filters, "
+                         << "they are handled by the Orthanc database until the next rebuilds";
+            hasTooManyDirtyStudies_ = true;
+          }
+
+          tooManyDirtyStudiesGeneration_ = generation_;
+        }
+      }
+    }
+  }
+
+  if (modifiedStudies.empty())
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < filters_.size(); i++)
+  {
+    if (!CheckStudies(i, modifiedStudies))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to check the modified studies against the predefined filters");
+    }
+  }
+}
+
+
+bool PredefinedFilters::CheckStudies(size_t filterIndex,
+                                     const std::map<std::string, std::string>& studies)
+{
+  Json::Value find;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!filters_[filterIndex].isReady_)
+    {
+      return true;
+    }
+
+    find = filters_[filterIndex].criteria_;
+  }
+
+  std::set<std::string> studyInstanceUids;
+  for (std::map<std::string, std::string>::const_iterator it = studies.begin(); it != studies.end(); ++it)
+  {
+    studyInstanceUids.insert(it->second);
+  }
+
+  std::string uids;
+  Orthanc::Toolbox::JoinStrings(uids, studyInstanceUids, "\\");
+
+  // Orthanc checks the criteria of the filter against the given studies
+  find["Level"] = "Study";
+  find["Query"][STUDY_INSTANCE_UID] = uids;
+  find["ResponseContent"].append("MainDicomTags");
+  find["ResponseContent"].append("Metadata");
+
+  Json::Value matches;
+  if (!OrthancPlugins::RestApiPost(matches, "/tools/find", find, false) ||
+      matches.type() != Json::arrayValue)
+  {
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Filter& filter = filters_[filterIndex];
+
+  if (!filter.isReady_)
+  {
+    return true;  // the result set is being built again
+  }
+
+  std::set<std::string> matchingStudies;
+  for (Json::Value::ArrayIndex i = 0; i < matches.size(); i++)
+  {
+    const std::string studyId = matches[i]["ID"].asString();
+
+    // another study with the same StudyInstanceUID is only added if it is one of the given studies
+    if (studies.find(studyId) != studies.end())
+    {
+      AddStudy(filter, studyId, matches[i]["Metadata"][LAST_UPDATE].asString(), matches[i]["MainDicomTags"][STUDY_INSTANCE_UID].asString());
+      matchingStudies.insert(studyId);
+    }
+  }
+
+  // the studies that do not match anymore (e.g. a label has been removed)
+  for (std::map<std::string, std::string>::const_iterator it = studies.begin(); it != studies.end(); ++it)
+  {
+    if (matchingStudies.find(it->first) == matchingStudies.end())
+    {
+      RemoveStudy(filter, it->first);
+    }
+  }
+
+  if (filter.results_.studies_.size() > maxStudies_)
+  {
+    LOG(WARNING) << "OE2: The predefined filter '" << filter.definition_["Name"].asString() << "' now matches more than "
+                 << maxStudies_ << " studies, its studies are not kept in memory anymore";
+    filter.isReady_ = false;
+    filter.results_ = ResultSet();
+  }
+
+  return true;
+}
+
+
+bool PredefinedFilters::RefreshDirtyStudies(size_t filterIndex)
+{
+  std::vector<Change> pendingChanges;
+  GetPendingChanges(pendingChanges);
+
+  std::map<std::string, std::string> studies;   // Orthanc ID -> StudyInstanceUID
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (hasTooManyDirtyStudies_)
+    {
+      return false;
+    }
+
+    // the dirty studies that are still queued are not known here -> fall back to the database
+    for (size_t i = 0; i < pendingChanges.size(); i++)
+    {
+      if (pendingChanges[i].areLabelsChanging_ &&
+          dirtyStudies_.find(pendingChanges[i].studyId_) == dirtyStudies_.end())
+      {
+        return false;
+      }
+    }
+
+    for (std::map<std::string, DirtyStudy>::const_iterator it = dirtyStudies_.begin(); it != dirtyStudies_.end(); ++it)
+    {
+      studies[it->first] = it->second.studyInstanceUid_;
+    }
+  }
+
+  if (studies.empty())
+  {
+    return true;
+  }
+  else if (CheckStudies(filterIndex, studies))
+  {
+    return true;
+  }
+  else
+  {
+    LOG(WARNING) << "OE2: Unable to check the modified studies against a predefined filter, falling back to the database";
+    return false;
+  }
+}
+
+
+void PredefinedFilters::AddStudy(Filter& filter,
+                                 const std::string& orthancId,
+                                 const std::string& lastUpdate,
+                                 const std::string& studyInstanceUid)
+{
+  RemoveStudy(filter, orthancId);
+
+  const OrderKey key(lastUpdate, studyInstanceUid);
+  filter.results_.studies_[orthancId] = key;
+  filter.results_.order_[key] = orthancId;
+}
+
+
+void PredefinedFilters::RemoveStudy(Filter& filter,
+                                    const std::string& orthancId)
+{
+  std::map<std::string, OrderKey>::iterator found = filter.results_.studies_.find(orthancId);
+  if (found != filter.results_.studies_.end())
+  {
+    filter.results_.order_.erase(found->second);
+    filter.results_.studies_.erase(found);
+  }
+}
+
+
+void PredefinedFilters::GetFilters(Json::Value& target,
+                                   bool includeCounts)
+{
+  // the labels of the dirty studies are checked again before counting
+  std::vector<bool> isUpToDate(filters_.size(), false);
+  if (includeCounts)
+  {
+    for (size_t i = 0; i < filters_.size(); i++)
+    {
+      isUpToDate[i] = RefreshDirtyStudies(i);
+    }
+  }
+
+  target = Json::arrayValue;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (size_t i = 0; i < filters_.size(); i++)
+  {
+    // the date keywords are evaluated for the same day as the result sets
+    Json::Value filter;
+    EvaluateDefinition(filter, filters_[i].definition_, day_);
+
+    if (includeCounts &&
+        isUpToDate[i] &&
+        filters_[i].isReady_)
+    {
+      filter["Count"] = static_cast<Json::UInt64>(filters_[i].results_.order_.size());
+    }
+
+    target.append(filter);
+  }
+}
+
+
+void PredefinedFilters::EvaluateFilters(Json::Value& target,
+                                        const Json::Value& definitions)
+{
+  if (!definitions.isArray())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'UiOptions.PredefinedFilters' must be an array");
+  }
+
+  const boost::gregorian::date today = boost::gregorian::day_clock::local_day();
+
+  target = Json::arrayValue;
+
+  for (Json::Value::ArrayIndex i = 0; i < definitions.size(); i++)
+  {
+    CheckDefinition(definitions[i]);
+
+    Json::Value filter;
+    EvaluateDefinition(filter, definitions[i], today);
+    target.append(filter);
+  }
+}
+
+
+bool PredefinedFilters::GetStudies(std::vector<std::string>& studyInstanceUids,
+                                   const Json::Value& find,
+                                   size_t since,
+                                   size_t count)
+{
+  studyInstanceUids.clear();
+
+  Json::Value criteria;
+  NormalizeCriteria(criteria, find);
+
+  size_t filterIndex = 0;
+  bool found = false;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < filters_.size() && !found; i++)
+    {
+      if (filters_[i].isReady_ &&
+          filters_[i].criteria_ == criteria)
+      {
+        filterIndex = i;
+        found = true;
+      }
+    }
+  }
+
+  if (!found ||
+      !RefreshDirtyStudies(filterIndex))
+  {
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const Filter& filter = filters_[filterIndex];
+
+  if (!filter.isReady_ ||
+      filter.criteria_ != criteria)
+  {
+    return false;  // the result set has been rebuilt meanwhile
+  }
+
+  size_t position = 0;
+  for (Order::const_iterator it = filter.results_.order_.begin();
+       it != filter.results_.order_.end() && studyInstanceUids.size() < count; ++it, position++)
+  {
+    if (position >= since)
+    {
+      studyInstanceUids.push_back(it->first.second);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,165 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+
+#include <map>
+#include <vector>
+
+
+// Keeps the result sets of the predefined filters of the study list ("UiOptions.PredefinedFilters") in
+// memory such that selecting one of these filters does not need to search the database.  Each result set
+// is ordered like the default study list (LastUpdate metadata in descending order, then StudyInstanceUID).
+// The result sets are built when Orthanc starts and are then updated from the changes: the new and modified
+// studies are checked against the filters by Orthanc itself (a /tools/find restricted to their
+// StudyInstanceUIDs).  As in the LabelsIndex, the studies whose labels might still be modified are marked
+// as dirty and checked again before each lookup, and the result sets are entirely rebuilt periodically.
+// The date keywords ($today, $yesterday, $oneWeekAgo, $oneMonthAgo, $oneYearAgo) are evaluated again at
+// midnight and the result sets of the filters that use them are then rebuilt.
+class PredefinedFilters : public BackgroundStudiesIndex
+{
+private:
+  typedef std::pair<std::string, std::string>  OrderKey;   // LastUpdate, StudyInstanceUID
+
+  // same ordering as the RecentStudiesIndex
+  struct MostRecentFirst
+  {
+    bool operator() (const OrderKey& a,
+                     const OrderKey& b) const
+    {
+      return (a.first != b.first ? a.first > b.first : a.second < b.second);
+    }
+  };
+
+  typedef std::map<OrderKey, std::string, MostRecentFirst>  Order;
+
+  struct ResultSet
+  {
+    std::map<std::string, OrderKey>  studies_;   // Orthanc ID -> position in the ordering
+    Order                            order_;     // position in the ordering -> Orthanc ID
+  };
+
+  struct Filter
+  {
+    Json::Value  definition_;        // as in the configuration, with the date keywords
+    Json::Value  criteria_;          // normalized criteria, with the date keywords evaluated for 'day_'
+    bool         hasDateKeywords_;
+    bool         isReady_;           // false while the result set is being built or if it is too large
+    ResultSet    results_;
+  };
+
+  struct DirtyStudy
+  {
+    std::string   studyInstanceUid_;
+    unsigned int  generation_;   // the number of rebuilds that had started when the study was marked
+  };
+
+  enum LoadStatus
+  {
+    LoadStatus_Success,
+    LoadStatus_Stopped,
+    LoadStatus_TooManyStudies,
+    LoadStatus_Moved           // studies have been deleted while paging
+  };
+
+  boost::mutex                        mutex_;
+  std::vector<Filter>                 filters_;
+  boost::gregorian::date              day_;              // the day for which the date keywords have been evaluated
+  size_t                              maxStudies_;
+  unsigned int                        fullRefreshPeriod_;   // in seconds
+  boost::posix_time::ptime            nextFullRefresh_;
+  unsigned int                        generation_;          // the number of rebuilds that have started
+  std::map<std::string, DirtyStudy>   dirtyStudies_;        // Orthanc ID -> dirty study
+  bool                                hasTooManyDirtyStudies_;
+  unsigned int                        tooManyDirtyStudiesGeneration_;
+
+  void ScheduleNextTask();
+
+  void RebuildAll();
+
+  void BuildFilter(size_t filterIndex);
+
+  LoadStatus LoadResultSet(ResultSet& results,
+                           const Json::Value& criteria,
+                           const std::string& name);
+
+  // Checks the given studies (Orthanc ID -> StudyInstanceUID) against the criteria of the filter.
+  // Returns false if Orthanc could not be queried.
+  bool CheckStudies(size_t filterIndex,
+                    const std::map<std::string, std::string>& studies);
+
+  // Returns false if the dirty studies cannot be checked, in which case the database must be used
+  bool RefreshDirtyStudies(size_t filterIndex);
+
+  // the mutex must be locked by the caller
+  static void AddStudy(Filter& filter,
+                       const std::string& orthancId,
+                       const std::string& lastUpdate,
+                       const std::string& studyInstanceUid);
+
+  // the mutex must be locked by the caller
+  static void RemoveStudy(Filter& filter,
+                          const std::string& orthancId);
+
+protected:
+  virtual bool IsHandledChange(OrthancPluginChangeType changeType) const;
+
+  virtual void Build();
+
+  // rebuilds the result sets periodically, and the ones with date keywords at midnight
+  virtual void RunPeriodicTask();
+
+  virtual void ApplyChanges(const std::vector<Change>& batch);
+
+public:
+  // Throws if the definitions are invalid
+  PredefinedFilters(const Json::Value& definitions,
+                    size_t maxStudies,
+                    unsigned int fullRefreshPeriod);
+
+  virtual ~PredefinedFilters();
+
+  // Called when a label of the study is about to be modified through the REST API
+  void SignalLabelsModification(const std::string& studyId);
+
+  // Fills 'target' with the definitions of the filters, with the date keywords evaluated for today
+  // and, if 'includeCounts' is true, the number of matching studies (for the ready result sets)
+  void GetFilters(Json::Value& target,
+                  bool includeCounts);
+
+  // Same as GetFilters() without the counts, for the filters that are not kept in memory.  Throws if the
+  // definitions are invalid.
+  static void EvaluateFilters(Json::Value& target,
+                              const Json::Value& definitions);
+
+  // Gets the StudyInstanceUIDs of the studies [since, since + count[ of the result set whose criteria
+  // ('Query', 'Labels', 'LabelsConstraint' and 'CaseSensitive') are the same as the ones of the
+  // /tools/find request 'find'.  Returns false if no ready result set matches these criteria.
+  bool GetStudies(std::vector<std::string>& studyInstanceUids,
+                  const Json::Value& find,
+                  size_t since,
+                  size_t count);
+};
@@ -0,0 +1,203 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RecentStudiesIndex.h"
+
+#include <Logging.h>
+
+
+static const char* const LAST_UPDATE = "LastUpdate";
+
+
+RecentStudiesIndex::RecentStudiesIndex(size_t maxStudies) :
+  BackgroundStudiesIndex("index of the recent studies", 1),
+  maxStudies_(maxStudies),
+  isReady_(false),
+  isWholeDatabase_(false)
+{
+}
+
+
+RecentStudiesIndex::~RecentStudiesIndex()
+{
+  Stop();
+}
+
+
+bool RecentStudiesIndex::IsHandledChange(OrthancPluginChangeType changeType) const
+{
+  // the LastUpdate metadata might have been modified
+  return (BackgroundStudiesIndex::IsHandledChange(changeType) ||
+          changeType == OrthancPluginChangeType_UpdatedMetadata);
+}
+
+
+void RecentStudiesIndex::Build()
+{
+  // this requires an Orthanc with "ExtendedFind" (ordering on metadata)
+  Json::Value find;
+  find["Level"] = "Study";
+  find["Query"] = Json::objectValue;
+  find["Limit"] = static_cast<Json::UInt64>(maxStudies_);
+  find["ResponseContent"].append("MainDicomTags");
+  find["ResponseContent"].append("Metadata");
+
+  Json::Value orderBy;
+  orderBy["Type"] = "Metadata";
+  orderBy["Key"] = LAST_UPDATE;
+  orderBy["Direction"] = "DESC";
+  find["OrderBy"].append(orderBy);
+
+  Json::Value studies;
+  if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, false) ||
+      studies.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the most recent studies");
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    const Json::Value& study = studies[i];
+
+    if (study.isMember("ID") &&
+        study.isMember("Metadata") &&
+        study["Metadata"].isMember(LAST_UPDATE) &&
+        study.isMember("MainDicomTags") &&
+        study["MainDicomTags"].isMember("StudyInstanceUID"))
+    {
+      const OrderKey key(study["Metadata"][LAST_UPDATE].asString(),
+                         study["MainDicomTags"]["StudyInstanceUID"].asString());
+      studies_[study["ID"].asString()] = key;
+      order_[key] = study["ID"].asString();
+    }
+  }
+
+  isWholeDatabase_ = (studies.size() < maxStudies_);
+  isReady_ = true;
+}
+
+
+void RecentStudiesIndex::ApplyChange(const Change& change)
+{
+  if (change.isDeleted_)
+  {
+    RemoveStudy(change.studyId_);
+    return;
+  }
+
+  Json::Value study;
+  std::string lastUpdate;
+
+  if (OrthancPlugins::RestApiGet(study, "/studies/" + change.studyId_, false) &&
+      study.isMember("MainDicomTags") &&
+      study["MainDicomTags"].isMember("StudyInstanceUID") &&
+      OrthancPlugins::RestApiGetString(lastUpdate, "/studies/" + change.studyId_ + "/metadata/" + LAST_UPDATE, false))
+  {
+    AddStudy(change.studyId_, lastUpdate, study["MainDicomTags"]["StudyInstanceUID"].asString());
+  }
+  else
+  {
+    // the study has been deleted in the meantime
+    RemoveStudy(change.studyId_);
+  }
+}
+
+
+void RecentStudiesIndex::AddStudy(const std::string& orthancId,
+                                  const std::string& lastUpdate,
+                                  const std::string& studyInstanceUid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, OrderKey>::iterator found = studies_.find(orthancId);
+  if (found != studies_.end())
+  {
+    order_.erase(found->second);
+    studies_.erase(found);
+  }
+
+  const OrderKey key(lastUpdate, studyInstanceUid);
+
+  if (!isWholeDatabase_ &&
+      !order_.empty() &&
+      MostRecentFirst() (order_.rbegin()->first, key))
+  {
+    // older than all the indexed studies: there might be studies in-between in the database
+    return;
+  }
+
+  studies_[orthancId] = key;
+  order_[key] = orthancId;
+
+  while (studies_.size() > maxStudies_)
+  {
+    Order::iterator oldest = order_.end();
+    --oldest;
+
+    studies_.erase(oldest->second);
+    order_.erase(oldest);
+    isWholeDatabase_ = false;
+  }
+}
+
+
+void RecentStudiesIndex::RemoveStudy(const std::string& orthancId)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, OrderKey>::iterator found = studies_.find(orthancId);
+  if (found != studies_.end())
+  {
+    order_.erase(found->second);
+    studies_.erase(found);
+  }
+}
+
+
+bool RecentStudiesIndex::GetStudies(std::vector<std::string>& studyInstanceUids,
+                                    size_t since,
+                                    size_t count)
+{
+  studyInstanceUids.clear();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isReady_ ||
+      (!isWholeDatabase_ && since + count > order_.size()))
+  {
+    return false;
+  }
+
+  size_t position = 0;
+  for (Order::const_iterator it = order_.begin();
+       it != order_.end() && studyInstanceUids.size() < count; ++it, position++)
+  {
+    if (position >= since)
+    {
+      studyInstanceUids.push_back(it->first.second);
+    }
+  }
+
+  return true;
+}
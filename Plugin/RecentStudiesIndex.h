@@ -0,0 +1,85 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+
+#include <map>
+
+
+// Keeps the StudyInstanceUIDs of the most recently updated studies, ordered like the default
+// study list (LastUpdate metadata in descending order, then StudyInstanceUID), such that the
+// first pages of the study list do not need an ORDER BY on the metadata in the database.  The
+// index is seeded from the database when Orthanc starts and is then updated from the changes
+// (new, stable, modified and deleted studies).  At any time, it contains the exact first studies
+// of the ordering (or all the studies if the database is smaller than the index).
+class RecentStudiesIndex : public BackgroundStudiesIndex
+{
+private:
+  typedef std::pair<std::string, std::string>  OrderKey;   // LastUpdate, StudyInstanceUID
+
+  // same ordering as the study list: the most recent first (the ties are broken by
+  // api/studies/find with the StudyInstanceUID in ascending order)
+  struct MostRecentFirst
+  {
+    bool operator() (const OrderKey& a,
+                     const OrderKey& b) const
+    {
+      return (a.first != b.first ? a.first > b.first : a.second < b.second);
+    }
+  };
+
+  typedef std::map<OrderKey, std::string, MostRecentFirst>  Order;
+
+  boost::mutex                        mutex_;
+  std::map<std::string, OrderKey>     studies_;          // Orthanc ID -> position in the ordering
+  Order                               order_;            // position in the ordering -> Orthanc ID
+  size_t                              maxStudies_;
+  bool                                isReady_;          // false until the index has been seeded
+  bool                                isWholeDatabase_;  // true if the index contains all the studies
+
+  void AddStudy(const std::string& orthancId,
+                const std::string& lastUpdate,
+                const std::string& studyInstanceUid);
+
+  void RemoveStudy(const std::string& orthancId);
+
+protected:
+  virtual bool IsHandledChange(OrthancPluginChangeType changeType) const;
+
+  // seeds the index from the database
+  virtual void Build();
+
+  virtual void ApplyChange(const Change& change);
+
+public:
+  explicit RecentStudiesIndex(size_t maxStudies);
+
+  virtual ~RecentStudiesIndex();
+
+  // Gets the StudyInstanceUIDs of the studies [since, since + count[ in the ordering.  Returns false
+  // if the index is not ready or does not contain these studies.
+  bool GetStudies(std::vector<std::string>& studyInstanceUids,
+                  size_t since,
+                  size_t count);
+};
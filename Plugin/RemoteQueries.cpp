@@ -0,0 +1,760 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RemoteQueries.h"
+
+#include "RemoteQueriesCache.h"
+
+#include <Logging.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+
+
+namespace RemoteQueries
+{
+  TargetType StringToTargetType(const std::string& type)
+  {
+    if (type == "dicom")
+    {
+      return TargetType_DicomModality;
+    }
+    else if (type == "dicom-web")
+    {
+      return TargetType_DicomWebServer;
+    }
+    else if (type == "peer")
+    {
+      return TargetType_OrthancPeer;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown type of remote source: " + type);
+    }
+  }
+
+
+  const char* TargetTypeToString(TargetType type)
+  {
+    switch (type)
+    {
+      case TargetType_DicomModality:
+        return "dicom";
+
+      case TargetType_DicomWebServer:
+        return "dicom-web";
+
+      case TargetType_OrthancPeer:
+        return "peer";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  bool IsConfiguredTarget(const Target& target)
+  {
+    switch (target.type_)
+    {
+      case TargetType_DicomModality:
+      case TargetType_DicomWebServer:
+      {
+        Json::Value names;
+        if (!OrthancPlugins::RestApiGet(names, (target.type_ == TargetType_DicomModality ? "/modalities" : "/dicom-web/servers"), false) ||
+            !names.isArray())
+        {
+          return false;
+        }
+
+        for (Json::Value::ArrayIndex i = 0; i < names.size(); i++)
+        {
+          if (names[i].isString() &&
+              names[i].asString() == target.name_)
+          {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      case TargetType_OrthancPeer:
+      {
+        OrthancPlugins::OrthancPeers peers;
+
+        size_t index;
+        return peers.LookupName(index, target.name_);
+      }
+
+      default:
+        return false;
+    }
+  }
+
+
+  static std::string GetIdentifierTag(const std::string& level)
+  {
+    if (level == "Patient")
+    {
+      return "PatientID";
+    }
+    else if (level == "Study")
+    {
+      return "StudyInstanceUID";
+    }
+    else if (level == "Series")
+    {
+      return "SeriesInstanceUID";
+    }
+    else if (level == "Instance")
+    {
+      return "SOPInstanceUID";
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown query level: " + level);
+    }
+  }
+
+
+  static void QueryDicomModality(Json::Value& answers,
+                                 const std::string& modality,
+                                 const std::string& level,
+                                 const Json::Value& query,
+                                 unsigned int timeout)
+  {
+    Json::Value body;
+    body["Level"] = level;
+    body["Query"] = query;
+    body["Timeout"] = timeout;
+
+    Json::Value queryResponse;
+    if (!OrthancPlugins::RestApiPost(queryResponse, "/modalities/" + modality + "/query", body, false) ||
+        !queryResponse.isMember("ID"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "C-FIND failed on modality " + modality);
+    }
+
+    const std::string queryId = queryResponse["ID"].asString();
+    const bool success = OrthancPlugins::RestApiGet(answers, "/queries/" + queryId + "/answers?expand&simplify", false);
+
+    // the answers have been retrieved, no need to keep the query in Orthanc
+    OrthancPlugins::RestApiDelete("/queries/" + queryId, false);
+
+    if (!success)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Cannot read the C-FIND answers of modality " + modality);
+    }
+  }
+
+
+  static void QueryDicomWebServer(Json::Value& answers,
+                                  const std::string& server,
+                                  const std::string& level,
+                                  const Json::Value& query,
+                                  unsigned int limit)
+  {
+    Json::Value arguments = query;
+    std::string uri;
+
+    // same URIs as the UI (the parent UIDs are part of the URI)
+    if (level == "Study")
+    {
+      uri = "/studies";
+    }
+    else if (level == "Series")
+    {
+      uri = "/studies/" + query["StudyInstanceUID"].asString() + "/series";
+      arguments.removeMember("StudyInstanceUID");
+    }
+    else if (level == "Instance")
+    {
+      uri = "/studies/" + query["StudyInstanceUID"].asString() + "/series/" + query["SeriesInstanceUID"].asString() + "/instances";
+      arguments.removeMember("StudyInstanceUID");
+      arguments.removeMember("SeriesInstanceUID");
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "DICOMweb servers can not be queried at the level: " + level);
+    }
+
+    if (limit != 0)
+    {
+      arguments["limit"] = boost::lexical_cast<std::string>(limit);
+    }
+
+    arguments["fuzzymatching"] = "true";
+
+    Json::Value body;
+    body["Uri"] = uri;
+    body["Arguments"] = arguments;
+
+    Json::Value response;
+    if (!OrthancPlugins::RestApiPost(response, "/dicom-web/servers/" + server + "/qido", body, false) ||
+        !response.isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "QIDO-RS failed on DICOMweb server " + server);
+    }
+
+    answers = Json::arrayValue;
+
+    for (Json::Value::ArrayIndex i = 0; i < response.size(); i++)
+    {
+      Json::Value answer = Json::objectValue;
+
+      const std::vector<std::string> tags = response[i].getMemberNames();
+      for (size_t j = 0; j < tags.size(); j++)
+      {
+        const Json::Value& tag = response[i][tags[j]];
+        if (tag.isMember("Name") &&
+            tag.isMember("Value") &&
+            tag["Value"].isString())
+        {
+          answer[tag["Name"].asString()] = tag["Value"];
+        }
+      }
+
+      answers.append(answer);
+    }
+  }
+
+
+  static void QueryOrthancPeer(Json::Value& answers,
+                               const std::string& peer,
+                               const std::string& level,
+                               const Json::Value& query,
+                               unsigned int limit,
+                               unsigned int timeout)
+  {
+    OrthancPlugins::OrthancPeers peers;
+
+    size_t index;
+    if (!peers.LookupName(index, peer))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown Orthanc peer: " + peer);
+    }
+
+    // the peer is another Orthanc -> the query is a tools/find whose tags are flattened
+    Json::Value body;
+    body["Level"] = level;
+    body["Query"] = Json::objectValue;
+    body["RequestedTags"] = Json::arrayValue;
+    body["Expand"] = true;
+
+    if (limit != 0)
+    {
+      body["Limit"] = limit;
+    }
+
+    const std::vector<std::string> tags = query.getMemberNames();
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      if (!query[tags[i]].asString().empty())
+      {
+        body["Query"][tags[i]] = query[tags[i]];
+      }
+
+      body["RequestedTags"].append(tags[i]);
+    }
+
+    std::string serialized;
+    OrthancPlugins::WriteFastJson(serialized, body);
+
+    Json::Value response;
+    if (!peers.DoPost(response, index, "/tools/find", serialized, OrthancPlugins::HttpHeaders(), timeout) ||
+        !response.isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Cannot query the Orthanc peer " + peer);
+    }
+
+    answers = Json::arrayValue;
+
+    for (Json::Value::ArrayIndex i = 0; i < response.size(); i++)
+    {
+      Json::Value answer = Json::objectValue;
+
+      const char* fields[] = { "PatientMainDicomTags", "MainDicomTags", "RequestedTags" };
+      for (size_t j = 0; j < 3; j++)
+      {
+        const Json::Value& source = response[i][fields[j]];
+        if (source.isObject())
+        {
+          const std::vector<std::string> names = source.getMemberNames();
+          for (size_t k = 0; k < names.size(); k++)
+          {
+            answer[names[k]] = source[names[k]];
+          }
+        }
+      }
+
+      answers.append(answer);
+    }
+  }
+
+
+  void Query(Json::Value& answers,
+             const Target& target,
+             const std::string& level,
+             const Json::Value& query,
+             unsigned int limit,
+             unsigned int timeout)
+  {
+    // the names are provided by the clients and are part of the URIs
+    if (!IsConfiguredTarget(target))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                      "Unknown remote source: " + std::string(TargetTypeToString(target.type_)) + " " + target.name_);
+    }
+
+    switch (target.type_)
+    {
+      case TargetType_DicomModality:
+        QueryDicomModality(answers, target.name_, level, query, timeout);
+        break;
+
+      case TargetType_DicomWebServer:
+        QueryDicomWebServer(answers, target.name_, level, query, limit);
+        break;
+
+      case TargetType_OrthancPeer:
+        QueryOrthancPeer(answers, target.name_, level, query, limit, timeout);
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  // The results of the targets, shared between the HTTP thread and the query threads (that
+  // might outlive the HTTP request if a target does not respect the timeout)
+  class ResultsQueue : public boost::noncopyable
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  resultAvailable_;
+    std::deque<Json::Value*>   results_;
+    bool                       isAbandoned_;
+
+  public:
+    ResultsQueue() :
+      isAbandoned_(false)
+    {
+    }
+
+    ~ResultsQueue()
+    {
+      for (std::deque<Json::Value*>::iterator it = results_.begin(); it != results_.end(); ++it)
+      {
+        delete *it;
+      }
+    }
+
+    void Push(Json::Value* result)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        results_.push_back(result);
+      }
+
+      resultAvailable_.notify_one();
+    }
+
+    Json::Value* Pop(const boost::posix_time::ptime& deadline)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (results_.empty())
+      {
+        if (!resultAvailable_.timed_wait(lock, deadline))
+        {
+          return NULL;
+        }
+      }
+
+      Json::Value* result = results_.front();
+      results_.pop_front();
+      return result;
+    }
+
+    // the HTTP request has been answered -> the queries that have not started yet are skipped
+    void Abandon()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isAbandoned_ = true;
+    }
+
+    bool IsAbandoned()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return isAbandoned_;
+    }
+  };
+
+
+  struct QueriesPool::Job
+  {
+    boost::shared_ptr<ResultsQueue>        queue_;
+    Target                                 target_;
+    std::string                            level_;
+    Json::Value                            query_;
+    unsigned int                           limit_;
+    unsigned int                           timeout_;
+    boost::shared_ptr<RemoteQueriesCache>  cache_;
+    bool                                   refresh_;
+  };
+
+
+  static void RunQuery(boost::shared_ptr<ResultsQueue> queue,
+                       const Target& target,
+                       const std::string& level,
+                       const Json::Value& query,
+                       unsigned int limit,
+                       unsigned int timeout,
+                       boost::shared_ptr<RemoteQueriesCache> cache,
+                       bool refresh)
+  {
+    std::unique_ptr<Json::Value> result(new Json::Value);
+    (*result) ["Type"] = TargetTypeToString(target.type_);
+    (*result) ["Name"] = target.name_;
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    try
+    {
+      bool cached = false;
+
+      if (cache.get() != NULL)
+      {
+        cached = cache->Query((*result) ["Answers"], target, level, query, limit, timeout, refresh);
+      }
+      else
+      {
+        Query((*result) ["Answers"], target, level, query, limit, timeout);
+      }
+
+      (*result) ["Cached"] = cached;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "OE2: Error while querying " << target.name_ << ": " << e.What();
+      (*result) ["Answers"] = Json::arrayValue;
+      (*result) ["Error"] = e.What();
+    }
+    catch (std::exception& e)
+    {
+      LOG(WARNING) << "OE2: Error while querying " << target.name_ << ": " << e.what();
+      (*result) ["Answers"] = Json::arrayValue;
+      (*result) ["Error"] = e.what();
+    }
+
+    // the latency of each source is displayed by the UI
+    (*result) ["Duration"] = static_cast<Json::Int64>(
+      (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds());
+
+    queue->Push(result.release());
+  }
+
+
+  QueriesPool::QueriesPool(unsigned int threadsCount,
+                           size_t maxPendingQueries) :
+    maxPendingQueries_(maxPendingQueries),
+    isRunning_(false),
+    threadsCount_(threadsCount)
+  {
+    if (threadsCount_ == 0 ||
+        maxPendingQueries_ == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  QueriesPool::~QueriesPool()
+  {
+    Stop();
+  }
+
+
+  void QueriesPool::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isRunning_)
+    {
+      isRunning_ = true;
+
+      for (unsigned int i = 0; i < threadsCount_; i++)
+      {
+        workers_.push_back(new boost::thread(Worker, this));
+      }
+    }
+  }
+
+
+  void QueriesPool::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRunning_ = false;
+    }
+
+    queueNotEmpty_.notify_all();
+
+    // the running queries are not interrupted: this waits for their own timeout
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+
+    workers_.clear();
+
+    for (std::deque<Job*>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+    {
+      delete *it;
+    }
+
+    queue_.clear();
+  }
+
+
+  void QueriesPool::Worker(QueriesPool* that)
+  {
+    for (;;)
+    {
+      std::unique_ptr<Job> job;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (that->isRunning_ && that->queue_.empty())
+        {
+          that->queueNotEmpty_.wait(lock);
+        }
+
+        if (!that->isRunning_)
+        {
+          return;
+        }
+
+        job.reset(that->queue_.front());
+        that->queue_.pop_front();
+      }
+
+      if (!job->queue_->IsAbandoned())
+      {
+        RunQuery(job->queue_, job->target_, job->level_, job->query_, job->limit_, job->timeout_, job->cache_, job->refresh_);
+      }
+    }
+  }
+
+
+  bool QueriesPool::Enqueue(const boost::shared_ptr<ResultsQueue>& queue,
+                            const Target& target,
+                            const std::string& level,
+                            const Json::Value& query,
+                            unsigned int limit,
+                            unsigned int timeout,
+                            const boost::shared_ptr<RemoteQueriesCache>& cache,
+                            bool refresh)
+  {
+    std::unique_ptr<Job> job(new Job);
+    job->queue_ = queue;
+    job->target_ = target;
+    job->level_ = level;
+    job->query_ = query;
+    job->limit_ = limit;
+    job->timeout_ = timeout;
+    job->cache_ = cache;
+    job->refresh_ = refresh;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!isRunning_ ||
+          queue_.size() >= maxPendingQueries_)
+      {
+        return false;
+      }
+
+      queue_.push_back(job.release());
+    }
+
+    queueNotEmpty_.notify_one();
+    return true;
+  }
+
+
+  // Abandons the pending queries once the HTTP request has been answered, whatever the exit path
+  class ResultsQueueGuard : public boost::noncopyable
+  {
+  private:
+    ResultsQueue&  queue_;
+
+  public:
+    explicit ResultsQueueGuard(ResultsQueue& queue) :
+      queue_(queue)
+    {
+    }
+
+    ~ResultsQueueGuard()
+    {
+      queue_.Abandon();
+    }
+  };
+
+
+  void AnswerFederatedFind(OrthancPluginRestOutput* output,
+                           QueriesPool& pool,
+                           const std::vector<Target>& targets,
+                           const std::string& level,
+                           const Json::Value& query,
+                           unsigned int limit,
+                           unsigned int timeout,
+                           boost::shared_ptr<RemoteQueriesCache> cache,
+                           bool refresh)
+  {
+    const std::string identifierTag = GetIdentifierTag(level);
+
+    boost::shared_ptr<ResultsQueue> queue(new ResultsQueue);
+    ResultsQueueGuard guard(*queue);
+
+    unsigned int maxTimeout = timeout;
+
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+      const unsigned int targetTimeout = (targets[i].timeout_ != 0 ? targets[i].timeout_ : timeout);
+      maxTimeout = std::max(maxTimeout, targetTimeout);
+
+      if (!pool.Enqueue(queue, targets[i], level, query, limit, targetTimeout, cache, refresh))
+      {
+        std::unique_ptr<Json::Value> result(new Json::Value);
+        (*result) ["Type"] = TargetTypeToString(targets[i].type_);
+        (*result) ["Name"] = targets[i].name_;
+        (*result) ["Answers"] = Json::arrayValue;
+        (*result) ["Error"] = "Too many pending remote queries";
+        (*result) ["Duration"] = 0;
+        queue->Push(result.release());
+      }
+    }
+
+    OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+    if (OrthancPluginStartMultipartAnswer(context, output, "mixed", "application/json") != OrthancPluginErrorCode_Success)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Unable to start the multipart answer");
+    }
+
+    // a little margin such that the targets that enforce the timeout themselves can report their error
+    const boost::posix_time::ptime deadline = (boost::posix_time::microsec_clock::universal_time() +
+                                               boost::posix_time::seconds(maxTimeout + 2));
+
+    std::set<std::string> sentIdentifiers;
+    std::set<std::string> pendingTargets;
+
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+      pendingTargets.insert(std::string(TargetTypeToString(targets[i].type_)) + ":" + targets[i].name_);
+    }
+
+    while (!pendingTargets.empty())
+    {
+      std::unique_ptr<Json::Value> result(queue->Pop(deadline));
+
+      if (result.get() == NULL)
+      {
+        break;  // timeout
+      }
+
+      pendingTargets.erase((*result) ["Type"].asString() + ":" + (*result) ["Name"].asString());
+
+      // only send the answers that have not been sent by another target yet
+      Json::Value part;
+      part["Type"] = (*result) ["Type"];
+      part["Name"] = (*result) ["Name"];
+      part["Answers"] = Json::arrayValue;
+      part["Duplicates"] = Json::arrayValue;
+      part["Cached"] = (*result) ["Cached"].asBool();
+      part["Duration"] = (*result) ["Duration"];
+
+      if (result->isMember("Error"))
+      {
+        part["Error"] = (*result) ["Error"];
+      }
+
+      const Json::Value& answers = (*result) ["Answers"];
+      for (Json::Value::ArrayIndex i = 0; i < answers.size(); i++)
+      {
+        const std::string identifier = answers[i][identifierTag].asString();
+
+        if (identifier.empty() ||
+            sentIdentifiers.find(identifier) == sentIdentifiers.end())
+        {
+          sentIdentifiers.insert(identifier);
+          part["Answers"].append(answers[i]);
+        }
+        else
+        {
+          part["Duplicates"].append(identifier);
+        }
+      }
+
+      std::string serialized;
+      OrthancPlugins::WriteFastJson(serialized, part);
+
+      if (OrthancPluginSendMultipartItem(context, output, serialized.c_str(), serialized.size()) != OrthancPluginErrorCode_Success)
+      {
+        return;  // the client has most probably closed the connection
+      }
+    }
+
+    for (std::set<std::string>::const_iterator it = pendingTargets.begin(); it != pendingTargets.end(); ++it)
+    {
+      const size_t separator = it->find(':');
+
+      Json::Value part;
+      part["Type"] = it->substr(0, separator);
+      part["Name"] = it->substr(separator + 1);
+      part["Answers"] = Json::arrayValue;
+      part["Duplicates"] = Json::arrayValue;
+      part["Error"] = "Timeout";
+
+      std::string serialized;
+      OrthancPlugins::WriteFastJson(serialized, part);
+
+      if (OrthancPluginSendMultipartItem(context, output, serialized.c_str(), serialized.size()) != OrthancPluginErrorCode_Success)
+      {
+        return;
+      }
+    }
+  }
+}
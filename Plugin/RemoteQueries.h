@@ -0,0 +1,128 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <vector>
+
+class RemoteQueriesCache;
+
+
+// Queries several remote sources (DICOM modalities, DICOMweb servers and Orthanc peers) at
+// the same time.  The answers of all the sources are converted to the same simplified format
+// as '/queries/{id}/answers?expand&simplify'.
+namespace RemoteQueries
+{
+  enum TargetType
+  {
+    TargetType_DicomModality,
+    TargetType_DicomWebServer,
+    TargetType_OrthancPeer
+  };
+
+  struct Target
+  {
+    TargetType    type_;
+    std::string   name_;
+    unsigned int  timeout_;   // in seconds, 0 to use the timeout of the whole query
+  };
+
+  TargetType StringToTargetType(const std::string& type);
+
+  const char* TargetTypeToString(TargetType type);
+
+  // Checks that the target is declared in the configuration of Orthanc ('DicomModalities',
+  // 'DicomWeb.Servers' or 'OrthancPeers'), such that its name can be used in the URIs
+  bool IsConfiguredTarget(const Target& target);
+
+  class ResultsQueue;
+
+  // The threads that run the queries of the federated searches.  The pool is owned by the
+  // plugin such that no query is still running after OrthancPluginFinalize(), and the number
+  // of pending queries is bounded.
+  class QueriesPool : public boost::noncopyable
+  {
+  private:
+    struct Job;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    queueNotEmpty_;
+    std::deque<Job*>             queue_;
+    size_t                       maxPendingQueries_;
+    bool                         isRunning_;
+    unsigned int                 threadsCount_;
+    std::vector<boost::thread*>  workers_;
+
+    static void Worker(QueriesPool* that);
+
+  public:
+    QueriesPool(unsigned int threadsCount,
+                size_t maxPendingQueries);
+
+    ~QueriesPool();
+
+    void Start();
+
+    void Stop();
+
+    // returns false if there are too many pending queries
+    bool Enqueue(const boost::shared_ptr<ResultsQueue>& queue,
+                 const Target& target,
+                 const std::string& level,
+                 const Json::Value& query,
+                 unsigned int limit,
+                 unsigned int timeout,
+                 const boost::shared_ptr<RemoteQueriesCache>& cache,
+                 bool refresh);
+  };
+
+  // Runs a single query (blocking), throws if the target can not be queried.  'limit' is
+  // ignored by the DICOM modalities (0 means no limit).
+  void Query(Json::Value& answers,
+             const Target& target,
+             const std::string& level,
+             const Json::Value& query,
+             unsigned int limit,
+             unsigned int timeout);
+
+  // Runs the query against all the targets concurrently in the 'pool' and answers a 'multipart/mixed'
+  // stream with one JSON part per target, sent as soon as the target has answered (or has failed), with
+  // the duration of its query in milliseconds.  The answers that have already been sent by another target
+  // are only referenced by their UID.  The queries go through the 'cache' if it is not NULL (it is
+  // shared with the query threads that might outlive the HTTP request).  The 'targets' must be distinct
+  // since the answers are matched with the targets by their type and name.
+  void AnswerFederatedFind(OrthancPluginRestOutput* output,
+                           QueriesPool& pool,
+                           const std::vector<Target>& targets,
+                           const std::string& level,
+                           const Json::Value& query,
+                           unsigned int limit,
+                           unsigned int timeout,
+                           boost::shared_ptr<RemoteQueriesCache> cache,
+                           bool refresh);
+}
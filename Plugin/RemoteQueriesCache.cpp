@@ -0,0 +1,212 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RemoteQueriesCache.h"
+
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+static const unsigned int WAIT_MARGIN = 2;  // in seconds
+
+
+RemoteQueriesCache::RemoteQueriesCache(unsigned int ttl,
+                                       size_t maxEntries) :
+  ttl_(ttl),
+  maxEntries_(maxEntries)
+{
+}
+
+
+std::string RemoteQueriesCache::GetKey(const RemoteQueries::Target& target,
+                                       const std::string& level,
+                                       const Json::Value& query,
+                                       unsigned int limit)
+{
+  // the members of a JSON object are sorted -> the same filters always give the same key
+  Json::Value normalized = Json::objectValue;
+
+  const std::vector<std::string> tags = query.getMemberNames();
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    if (query[tags[i]].isString())
+    {
+      normalized[tags[i]] = Orthanc::Toolbox::StripSpaces(query[tags[i]].asString());
+    }
+    else
+    {
+      normalized[tags[i]] = query[tags[i]];
+    }
+  }
+
+  std::string serialized;
+  OrthancPlugins::WriteFastJson(serialized, normalized);
+
+  return (std::string(RemoteQueries::TargetTypeToString(target.type_)) + "|" + target.name_ + "|" + level + "|" +
+          boost::lexical_cast<std::string>(limit) + "|" + serialized);
+}
+
+
+void RemoteQueriesCache::RemoveEntries(const boost::posix_time::ptime& now)
+{
+  // the mutex must be locked by the caller
+  for (Entries::iterator it = entries_.begin(); it != entries_.end(); )
+  {
+    if (!it->second->isPending_ &&
+        it->second->expiration_ <= now)
+    {
+      entries_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  // if the cache is still full, remove the entries that expire first
+  while (entries_.size() >= maxEntries_)
+  {
+    Entries::iterator oldest = entries_.end();
+
+    for (Entries::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+      if (!it->second->isPending_ &&
+          (oldest == entries_.end() || it->second->expiration_ < oldest->second->expiration_))
+      {
+        oldest = it;
+      }
+    }
+
+    if (oldest == entries_.end())
+    {
+      break;  // only pending queries
+    }
+
+    entries_.erase(oldest);
+  }
+}
+
+
+void RemoteQueriesCache::CompleteQuery(const std::string& key,
+                                       boost::shared_ptr<Entry> entry,
+                                       const Json::Value& answers,
+                                       const std::string& error,
+                                       bool hasError)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    entry->isPending_ = false;
+    entry->hasError_ = hasError;
+    entry->error_ = error;
+    entry->answers_ = answers;
+    entry->expiration_ = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(ttl_);
+
+    if (hasError)
+    {
+      // the errors are only shared with the queries that were waiting, they are not cached
+      Entries::iterator found = entries_.find(key);
+      if (found != entries_.end() &&
+          found->second == entry)
+      {
+        entries_.erase(found);
+      }
+    }
+  }
+
+  queryCompleted_.notify_all();
+}
+
+
+bool RemoteQueriesCache::Query(Json::Value& answers,
+                               const RemoteQueries::Target& target,
+                               const std::string& level,
+                               const Json::Value& query,
+                               unsigned int limit,
+                               unsigned int timeout,
+                               bool refresh)
+{
+  const std::string key = GetKey(target, level, query, limit);
+
+  boost::shared_ptr<Entry> entry;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    Entries::iterator found = entries_.find(key);
+    if (found != entries_.end() &&
+        (found->second->isPending_ || (!refresh && now < found->second->expiration_)))
+    {
+      // an identical query is running (the answers will be fresh, even if 'refresh' is true) or has been cached
+      entry = found->second;
+
+      // the running query has the same timeout: if it has not completed by then (plus a small margin), the
+      // remote source is not answering and querying it again would not help
+      const boost::posix_time::ptime deadline = now + boost::posix_time::seconds(timeout + WAIT_MARGIN);
+
+      while (entry->isPending_)
+      {
+        if (!queryCompleted_.timed_wait(lock, deadline))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                          "Timeout while waiting for an identical query on " + target.name_);
+        }
+      }
+
+      if (entry->hasError_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, entry->error_);
+      }
+
+      answers = entry->answers_;
+      return true;
+    }
+
+    RemoveEntries(now);
+
+    entry.reset(new Entry);
+    entry->isPending_ = true;
+    entry->hasError_ = false;
+    entries_[key] = entry;
+  }
+
+  try
+  {
+    RemoteQueries::Query(answers, target, level, query, limit, timeout);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    CompleteQuery(key, entry, Json::nullValue, e.What(), true);
+    throw;
+  }
+  catch (std::exception& e)
+  {
+    CompleteQuery(key, entry, Json::nullValue, e.what(), true);
+    throw;
+  }
+
+  CompleteQuery(key, entry, answers, "", false);
+  return false;
+}
@@ -0,0 +1,85 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "RemoteQueries.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+
+
+// Keeps the answers of the remote queries during a short time such that the same query (e.g. while
+// the user refines the filters of the study list) does not reach the remote source again.  The
+// identical queries that are received while the first one is running wait for its answers instead
+// of querying the remote source in parallel.
+class RemoteQueriesCache : public boost::noncopyable
+{
+private:
+  struct Entry
+  {
+    bool                      isPending_;
+    bool                      hasError_;
+    std::string               error_;
+    Json::Value               answers_;
+    boost::posix_time::ptime  expiration_;
+  };
+
+  typedef std::map<std::string, boost::shared_ptr<Entry> >  Entries;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  queryCompleted_;
+  Entries                    entries_;
+  unsigned int               ttl_;          // in seconds
+  size_t                     maxEntries_;
+
+  static std::string GetKey(const RemoteQueries::Target& target,
+                            const std::string& level,
+                            const Json::Value& query,
+                            unsigned int limit);
+
+  void RemoveEntries(const boost::posix_time::ptime& now);
+
+  void CompleteQuery(const std::string& key,
+                     boost::shared_ptr<Entry> entry,
+                     const Json::Value& answers,
+                     const std::string& error,
+                     bool hasError);
+
+public:
+  RemoteQueriesCache(unsigned int ttl,
+                     size_t maxEntries);
+
+  // Same as RemoteQueries::Query().  Returns true if the answers come from the cache (or from an
+  // identical query that was already running).  If 'refresh' is true, the cached answers are ignored
+  // and replaced by the new ones.
+  bool Query(Json::Value& answers,
+             const RemoteQueries::Target& target,
+             const std::string& level,
+             const Json::Value& query,
+             unsigned int limit,
+             unsigned int timeout,
+             bool refresh);
+};
@@ -0,0 +1,337 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RemoteStudiesCounter.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+#include <vector>
+
+
+static const unsigned int QUERY_TIMEOUT = 30;      // seconds
+static const unsigned int ERROR_RETRY_DELAY = 60;  // seconds
+
+
+RemoteStudiesCounter::RemoteStudiesCounter(const RemoteQueries::Target& archive,
+                                           unsigned int ttl,
+                                           size_t batchSize,
+                                           size_t maxEntries,
+                                           bool supportsMultipleValues) :
+  isRunning_(false),
+  archive_(archive),
+  ttl_(ttl),
+  batchSize_(std::max<size_t>(1, batchSize)),
+  maxEntries_(std::max<size_t>(1, maxEntries)),
+  isGroupingPatients_(archive.type_ == RemoteQueries::TargetType_OrthancPeer ||
+                      (archive.type_ == RemoteQueries::TargetType_DicomModality && supportsMultipleValues))
+{
+}
+
+
+RemoteStudiesCounter::~RemoteStudiesCounter()
+{
+  Stop();
+}
+
+
+void RemoteStudiesCounter::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+    worker_ = boost::thread(Worker, this);
+  }
+}
+
+
+void RemoteStudiesCounter::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRunning_ = false;
+  }
+
+  wakeUpWorker_.notify_all();
+  countsChanged_.notify_all();
+
+  if (worker_.joinable())
+  {
+    worker_.join();
+  }
+}
+
+
+static bool IsGroupable(const std::string& patientId)
+{
+  // these characters would be interpreted as separators or wildcards by the archive
+  return (patientId.find('\\') == std::string::npos &&
+          patientId.find('*') == std::string::npos &&
+          patientId.find('?') == std::string::npos);
+}
+
+
+void RemoteStudiesCounter::QueryStudies(std::map<std::string, int>& counts,
+                                        const std::string& patientIds)
+{
+  Json::Value query;
+  query["PatientID"] = patientIds;
+  query["StudyInstanceUID"] = "";
+
+  Json::Value answers;
+  RemoteQueries::Query(answers, archive_, "Study", query, 0 /* no limit */, QUERY_TIMEOUT);
+
+  std::set<std::string> studies;
+
+  for (Json::Value::ArrayIndex i = 0; i < answers.size(); i++)
+  {
+    const std::string patientId = answers[i]["PatientID"].asString();
+    const std::string studyInstanceUid = answers[i]["StudyInstanceUID"].asString();
+
+    // some archives return the same study more than once
+    if (counts.find(patientId) != counts.end() &&
+        studies.insert(studyInstanceUid).second)
+    {
+      counts[patientId]++;
+    }
+  }
+}
+
+
+void RemoteStudiesCounter::CountStudies(std::map<std::string, int>& counts,
+                                        const std::set<std::string>& patientIds)
+{
+  for (std::set<std::string>::const_iterator it = patientIds.begin(); it != patientIds.end(); ++it)
+  {
+    counts[*it] = 0;
+  }
+
+  if (isGroupingPatients_)
+  {
+    // a single query for all the patients of the batch (multiple values matching)
+    std::string joinedIds;
+    for (std::set<std::string>::const_iterator it = patientIds.begin(); it != patientIds.end(); ++it)
+    {
+      if (!joinedIds.empty())
+      {
+        joinedIds += "\\";
+      }
+
+      joinedIds += *it;
+    }
+
+    QueryStudies(counts, joinedIds);
+  }
+  else
+  {
+    for (std::set<std::string>::const_iterator it = patientIds.begin(); it != patientIds.end(); ++it)
+    {
+      QueryStudies(counts, *it);
+    }
+  }
+}
+
+
+void RemoteStudiesCounter::Worker(RemoteStudiesCounter* that)
+{
+  for (;;)
+  {
+    std::set<std::string> batch;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (that->isRunning_ && that->pendingPatients_.empty())
+      {
+        that->wakeUpWorker_.wait(lock);
+      }
+
+      if (!that->isRunning_)
+      {
+        return;
+      }
+
+      while (!that->pendingPatients_.empty() &&
+             batch.size() < that->batchSize_)
+      {
+        batch.insert(*that->pendingPatients_.begin());
+        that->pendingPatients_.erase(that->pendingPatients_.begin());
+      }
+    }
+
+    std::map<std::string, int> counts;
+
+    try
+    {
+      that->CountStudies(counts, batch);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while counting the studies on " << that->archive_.name_ << ": " << e.What();
+
+      for (std::set<std::string>::const_iterator it = batch.begin(); it != batch.end(); ++it)
+      {
+        counts[*it] = -1;
+      }
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "OE2: Error while counting the studies on " << that->archive_.name_ << ": " << e.what();
+
+      for (std::set<std::string>::const_iterator it = batch.begin(); it != batch.end(); ++it)
+      {
+        counts[*it] = -1;
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      for (std::map<std::string, int>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+      {
+        CountEntry& entry = that->counts_[it->first];
+        entry.count_ = it->second;
+        entry.lastAccess_ = now;
+
+        // retry the failed queries sooner
+        entry.expiration_ = now + boost::posix_time::seconds(it->second >= 0 ? that->ttl_ : std::min(that->ttl_, ERROR_RETRY_DELAY));
+      }
+
+      // the new counts are the most recently used ones -> they are kept for the clients that are waiting
+      that->RemoveEntries(now);
+    }
+
+    that->countsChanged_.notify_all();
+  }
+}
+
+
+void RemoteStudiesCounter::RemoveEntries(const boost::posix_time::ptime& now)
+{
+  // the mutex must be locked by the caller
+  for (Counts::iterator it = counts_.begin(); it != counts_.end(); )
+  {
+    if (it->second.expiration_ <= now)
+    {
+      counts_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  // keep the memory bounded by removing the least recently used counts, down to the limit
+  if (counts_.size() > maxEntries_)
+  {
+    std::vector<std::pair<boost::posix_time::ptime, std::string> > accesses;
+    accesses.reserve(counts_.size());
+
+    for (Counts::const_iterator it = counts_.begin(); it != counts_.end(); ++it)
+    {
+      accesses.push_back(std::make_pair(it->second.lastAccess_, it->first));
+    }
+
+    const size_t excess = counts_.size() - maxEntries_;
+    std::nth_element(accesses.begin(), accesses.begin() + excess, accesses.end());
+
+    for (size_t i = 0; i < excess; i++)
+    {
+      counts_.erase(accesses[i].second);
+    }
+  }
+}
+
+
+bool RemoteStudiesCounter::CollectCounts(Json::Value& answer,
+                                         const std::set<std::string>& patientIds,
+                                         const boost::posix_time::ptime& now)
+{
+  // the mutex must be locked by the caller
+  answer = Json::objectValue;
+  answer["Counts"] = Json::objectValue;
+  answer["Pending"] = Json::arrayValue;
+
+  bool isMissing = false;
+
+  for (std::set<std::string>::const_iterator it = patientIds.begin(); it != patientIds.end(); ++it)
+  {
+    Counts::iterator found = counts_.find(*it);
+
+    if (!IsGroupable(*it))
+    {
+      answer["Counts"][*it] = Json::nullValue;
+    }
+    else if (found != counts_.end() &&
+             found->second.expiration_ > now)
+    {
+      found->second.lastAccess_ = now;
+
+      if (found->second.count_ >= 0)
+      {
+        answer["Counts"][*it] = found->second.count_;
+      }
+      else
+      {
+        answer["Counts"][*it] = Json::nullValue;
+      }
+    }
+    else
+    {
+      answer["Pending"].append(*it);
+
+      // if too many patients are pending, this one will be scheduled when the client asks again
+      if (pendingPatients_.size() < maxEntries_ &&
+          pendingPatients_.insert(*it).second)
+      {
+        wakeUpWorker_.notify_one();
+      }
+
+      isMissing = true;
+    }
+  }
+
+  return !isMissing;
+}
+
+
+void RemoteStudiesCounter::GetCounts(Json::Value& answer,
+                                     const std::set<std::string>& patientIds,
+                                     unsigned int wait)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const boost::posix_time::ptime timeout = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(wait);
+
+  while (!CollectCounts(answer, patientIds, boost::posix_time::microsec_clock::universal_time()))
+  {
+    if (!isRunning_ ||
+        !countsChanged_.timed_wait(lock, timeout))
+    {
+      break;
+    }
+  }
+}
@@ -0,0 +1,103 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "RemoteQueries.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <set>
+
+
+// Counts the studies of each patient on a remote archive.  The counts are computed by a single
+// background thread that takes the PatientIDs requested by the clients by batches.  The PatientIDs of
+// a batch are grouped in a single query (PatientID=id1\id2) if the archive supports the matching of
+// multiple values, otherwise one query is sent per patient.  The counts are kept in memory during a
+// TTL such that the study list can display them without querying the archive for each row.
+class RemoteStudiesCounter : public boost::noncopyable
+{
+private:
+  struct CountEntry
+  {
+    int                       count_;        // -1 if the archive could not be queried
+    boost::posix_time::ptime  expiration_;
+    boost::posix_time::ptime  lastAccess_;   // the least recently used counts are removed first
+  };
+
+  typedef std::map<std::string, CountEntry>  Counts;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  countsChanged_;
+  boost::condition_variable  wakeUpWorker_;
+  Counts                     counts_;
+  std::set<std::string>      pendingPatients_;
+  bool                       isRunning_;
+  boost::thread              worker_;
+  RemoteQueries::Target      archive_;
+  unsigned int               ttl_;          // in seconds
+  size_t                     batchSize_;
+  size_t                     maxEntries_;
+  bool                       isGroupingPatients_;
+
+  static void Worker(RemoteStudiesCounter* that);
+
+  void QueryStudies(std::map<std::string, int>& counts,
+                    const std::string& patientIds);
+
+  void CountStudies(std::map<std::string, int>& counts,
+                    const std::set<std::string>& patientIds);
+
+  void RemoveEntries(const boost::posix_time::ptime& now);
+
+  bool CollectCounts(Json::Value& answer,
+                     const std::set<std::string>& patientIds,
+                     const boost::posix_time::ptime& now);
+
+public:
+  // 'supportsMultipleValues' is only used for the DICOM modalities: the Orthanc peers always support
+  // the matching of multiple values and QIDO-RS never does
+  RemoteStudiesCounter(const RemoteQueries::Target& archive,
+                       unsigned int ttl,
+                       size_t batchSize,
+                       size_t maxEntries,
+                       bool supportsMultipleValues);
+
+  ~RemoteStudiesCounter();
+
+  const RemoteQueries::Target& GetArchive() const
+  {
+    return archive_;
+  }
+
+  void Start();
+
+  void Stop();
+
+  // Fills 'answer' with the counts that are available and schedules the missing ones.  If some
+  // counts are missing, waits up to 'wait' seconds for them to be computed.
+  void GetCounts(Json::Value& answer,
+                 const std::set<std::string>& patientIds,
+                 unsigned int wait);
+};
@@ -0,0 +1,426 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "ResumableUploads.h"
+#include "UploadPipeline.h"
+#include "ZipStreamReader.h"
+
+#include <Logging.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+static const size_t COMMIT_BLOCK_SIZE = 1024 * 1024;
+static const char* const STATUS_EXTENSION = ".json";
+static const char* const CONTENT_EXTENSION = ".part";
+static const char* const RESULT_EXTENSION = ".result";
+static const uint64_t LARGE_FILE_SIZE = 64 * 1024 * 1024;
+
+
+// Prevents the concurrent modifications of the same upload (e.g. a client that resumes
+// while its previous request is still being processed)
+class ResumableUploads::BusyUpload : public boost::noncopyable
+{
+private:
+  ResumableUploads&  that_;
+  std::string        uploadId_;
+
+public:
+  BusyUpload(ResumableUploads& that,
+             const std::string& uploadId) :
+    that_(that),
+    uploadId_(uploadId)
+  {
+    boost::mutex::scoped_lock lock(that_.mutex_);
+
+    if (that_.busyUploads_.find(uploadId_) != that_.busyUploads_.end())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The upload is already being modified: " + uploadId_);
+    }
+
+    that_.busyUploads_.insert(uploadId_);
+  }
+
+  ~BusyUpload()
+  {
+    boost::mutex::scoped_lock lock(that_.mutex_);
+    that_.busyUploads_.erase(uploadId_);
+  }
+};
+
+
+// Stores the entries of a ZIP archive one by one while it is read from the disk
+class ZipCommitHandler : public ZipStreamReader::IHandler
+{
+private:
+  Json::Value&  result_;
+
+public:
+  explicit ZipCommitHandler(Json::Value& result) :
+    result_(result)
+  {
+  }
+
+  virtual void HandleEntry(const std::string& filename,
+                           const void* content,
+                           size_t size)
+  {
+    Json::Value entry;
+    UploadPipeline::Store(entry, std::string(reinterpret_cast<const char*>(content), size));
+
+    if (entry["Success"].asBool())
+    {
+      for (Json::Value::ArrayIndex i = 0; i < entry["Instances"].size(); i++)
+      {
+        result_["Instances"].append(entry["Instances"][i]);
+      }
+    }
+    else
+    {
+      LOG(WARNING) << "OE2: Ignoring a ZIP entry of a resumable upload (" << filename << "): " << entry["Error"].asString();
+    }
+  }
+
+  virtual void HandleRejectedEntry(const std::string& filename,
+                                   const std::string& error)
+  {
+    LOG(WARNING) << "OE2: Rejecting a ZIP entry of a resumable upload (" << filename << "): " << error;
+  }
+};
+
+
+ResumableUploads::ResumableUploads(const std::string& directory,
+                                   uint64_t maxFileSize,
+                                   unsigned int expirationDelay) :
+  directory_(directory),
+  maxFileSize_(maxFileSize),
+  expirationDelay_(expirationDelay)
+{
+  Orthanc::SystemToolbox::MakeDirectory(directory_);
+}
+
+
+std::string ResumableUploads::GetPath(const std::string& uploadId,
+                                      const std::string& extension) const
+{
+  // the identifiers are provided by the clients -> make sure they can not point outside of the directory
+  if (!Orthanc::Toolbox::IsUuid(uploadId))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Invalid upload identifier: " + uploadId);
+  }
+
+  return (boost::filesystem::path(directory_) / (uploadId + extension)).string();
+}
+
+
+bool ResumableUploads::GetStatus(Json::Value& status,
+                                 const std::string& uploadId) const
+{
+  const std::string statusPath = GetPath(uploadId, STATUS_EXTENSION);
+  const std::string contentPath = GetPath(uploadId, CONTENT_EXTENSION);
+  const std::string resultPath = GetPath(uploadId, RESULT_EXTENSION);
+
+  // the result of a committed upload is kept until the upload expires such that a client
+  // that has not received the answer of its last chunk can still get it
+  if (Orthanc::SystemToolbox::IsRegularFile(resultPath))
+  {
+    std::string content;
+    Orthanc::SystemToolbox::ReadFile(content, resultPath);
+
+    if (!OrthancPlugins::ReadJson(status, content))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Corrupted resumable upload: " + uploadId);
+    }
+
+    return true;
+  }
+
+  if (!Orthanc::SystemToolbox::IsRegularFile(statusPath) ||
+      !Orthanc::SystemToolbox::IsRegularFile(contentPath))
+  {
+    return false;
+  }
+
+  std::string content;
+  Orthanc::SystemToolbox::ReadFile(content, statusPath);
+
+  if (!OrthancPlugins::ReadJson(status, content))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Corrupted resumable upload: " + uploadId);
+  }
+
+  // the offset is the size of the staged file such that it survives a restart of Orthanc
+  status["Offset"] = static_cast<Json::UInt64>(Orthanc::SystemToolbox::GetFileSize(contentPath));
+  status["IsComplete"] = false;
+
+  // a complete upload that is not busy has been interrupted while it was being stored (e.g. by a
+  // restart of Orthanc): the client commits it again by appending an empty chunk
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    status["IsBusy"] = (busyUploads_.find(uploadId) != busyUploads_.end());
+  }
+
+  return true;
+}
+
+
+void ResumableUploads::RemoveFiles(const std::string& uploadId)
+{
+  boost::system::error_code error;
+  boost::filesystem::remove(GetPath(uploadId, CONTENT_EXTENSION), error);
+  boost::filesystem::remove(GetPath(uploadId, STATUS_EXTENSION), error);
+  boost::filesystem::remove(GetPath(uploadId, RESULT_EXTENSION), error);
+}
+
+
+void ResumableUploads::RemoveExpiredUploads()
+{
+  const std::time_t now = std::time(NULL);
+
+  std::set<std::string> expiredUploads;
+
+  boost::system::error_code error;
+  for (boost::filesystem::directory_iterator it(directory_, error), end; !error && it != end; it.increment(error))
+  {
+    const boost::filesystem::path& path = it->path();
+
+    if ((path.extension().string() == CONTENT_EXTENSION ||
+         path.extension().string() == RESULT_EXTENSION) &&
+        Orthanc::Toolbox::IsUuid(path.stem().string()))
+    {
+      boost::system::error_code timeError;
+      const std::time_t lastWrite = boost::filesystem::last_write_time(path, timeError);
+
+      if (!timeError &&
+          now - lastWrite > static_cast<std::time_t>(expirationDelay_))
+      {
+        expiredUploads.insert(path.stem().string());
+      }
+    }
+  }
+
+  for (std::set<std::string>::const_iterator it = expiredUploads.begin(); it != expiredUploads.end(); ++it)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (busyUploads_.find(*it) != busyUploads_.end())
+      {
+        continue;
+      }
+    }
+
+    LOG(WARNING) << "OE2: Removing an expired resumable upload: " << *it;
+    RemoveFiles(*it);
+  }
+}
+
+
+void ResumableUploads::Create(Json::Value& status,
+                              uint64_t size,
+                              const std::string& filename)
+{
+  if (size > maxFileSize_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "The file is too large for a resumable upload");
+  }
+
+  RemoveExpiredUploads();
+
+  const std::string uploadId = Orthanc::Toolbox::GenerateUuid();
+
+  status = Json::objectValue;
+  status["ID"] = uploadId;
+  status["Size"] = static_cast<Json::UInt64>(size);
+  status["Filename"] = filename;
+
+  std::string serialized;
+  OrthancPlugins::WriteFastJson(serialized, status);
+
+  Orthanc::SystemToolbox::WriteFile(std::string(), GetPath(uploadId, CONTENT_EXTENSION));
+  Orthanc::SystemToolbox::WriteFile(serialized, GetPath(uploadId, STATUS_EXTENSION));
+
+  status["Offset"] = 0;
+}
+
+
+bool ResumableUploads::Append(Json::Value& status,
+                              const std::string& uploadId,
+                              uint64_t offset,
+                              const void* data,
+                              size_t size)
+{
+  BusyUpload busy(*this, uploadId);
+
+  if (!GetStatus(status, uploadId))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown resumable upload: " + uploadId);
+  }
+
+  const uint64_t currentOffset = status["Offset"].asUInt64();
+  const uint64_t expectedSize = status["Size"].asUInt64();
+
+  if (status["IsComplete"].asBool())
+  {
+    // the last chunk is sent again because its answer has been lost -> answer the same result
+    return (offset + size == expectedSize);
+  }
+
+  if (offset != currentOffset)
+  {
+    return false;
+  }
+
+  if (offset + size > expectedSize)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "The chunk exceeds the declared size of the upload");
+  }
+
+  const std::string contentPath = GetPath(uploadId, CONTENT_EXTENSION);
+
+  if (size > 0)
+  {
+    boost::filesystem::ofstream f(contentPath, std::ios::out | std::ios::binary | std::ios::app);
+    f.write(reinterpret_cast<const char*>(data), size);
+    f.close();
+
+    if (!f.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Unable to write a resumable upload: " + uploadId);
+    }
+  }
+
+  status["Offset"] = static_cast<Json::UInt64>(offset + size);
+  status.removeMember("IsBusy");
+
+  if (offset + size == expectedSize)
+  {
+    // the file is complete -> store it in Orthanc, then replace the staged file by the result
+    try
+    {
+      Commit(status, contentPath);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while storing a resumable upload: " << e.What();
+      status["Success"] = false;
+      status["Error"] = e.What();
+    }
+
+    status["IsComplete"] = true;
+
+    std::string serialized;
+    OrthancPlugins::WriteFastJson(serialized, status);
+    Orthanc::SystemToolbox::WriteFile(serialized, GetPath(uploadId, RESULT_EXTENSION));
+
+    boost::system::error_code error;
+    boost::filesystem::remove(contentPath, error);
+    boost::filesystem::remove(GetPath(uploadId, STATUS_EXTENSION), error);
+  }
+  else
+  {
+    status["IsComplete"] = false;
+  }
+
+  return true;
+}
+
+
+void ResumableUploads::Remove(const std::string& uploadId)
+{
+  BusyUpload busy(*this, uploadId);
+  RemoveFiles(uploadId);
+}
+
+
+void ResumableUploads::Commit(Json::Value& result,
+                              const std::string& path)
+{
+  boost::filesystem::ifstream f(path, std::ios::in | std::ios::binary);
+
+  std::string block(COMMIT_BLOCK_SIZE, '\0');
+  f.read(&block[0], block.size());
+  block.resize(static_cast<size_t>(f.gcount()));
+
+  if (block.size() >= 4 &&
+      block.compare(0, 4, "PK\x03\x04") == 0)
+  {
+    // a ZIP archive is inflated while it is read such that it is never fully loaded in memory
+    result["Instances"] = Json::arrayValue;
+
+    ZipCommitHandler handler(result);
+    ZipStreamReader reader(handler, maxFileSize_);
+
+    while (!block.empty())
+    {
+      reader.AddChunk(block.c_str(), block.size());
+
+      block.resize(COMMIT_BLOCK_SIZE);
+      f.read(&block[0], block.size());
+      block.resize(static_cast<size_t>(f.gcount()));
+    }
+
+    reader.CloseStream();
+
+    result["Success"] = (result["Instances"].size() > 0);
+
+    if (result["Instances"].size() == 0)
+    {
+      result["Error"] = "No valid DICOM files found in ZIP";
+    }
+  }
+  else if (block.size() < 132 ||
+           block.compare(128, 4, "DICM") != 0)
+  {
+    // only the DICOM files are accepted by Orthanc -> do not load the other files
+    result["Success"] = false;
+    result["Error"] = "Not a DICOM file nor a ZIP archive";
+  }
+  else
+  {
+    // POST /instances needs the whole file in memory: the file is read block by block directly
+    // in its final buffer, and the large files are stored one at a time to bound the memory
+    const uint64_t size = Orthanc::SystemToolbox::GetFileSize(path);
+
+    std::unique_ptr<boost::mutex::scoped_lock> largeFileLock;
+    if (size > LARGE_FILE_SIZE)
+    {
+      largeFileLock.reset(new boost::mutex::scoped_lock(largeFilesMutex_));
+    }
+
+    std::string content;
+    content.reserve(static_cast<size_t>(size));
+
+    while (!block.empty())
+    {
+      content.append(block);
+
+      block.resize(COMMIT_BLOCK_SIZE);
+      f.read(&block[0], block.size());
+      block.resize(static_cast<size_t>(f.gcount()));
+    }
+
+    UploadPipeline::Store(result, content);
+  }
+}
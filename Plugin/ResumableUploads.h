@@ -0,0 +1,84 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/thread.hpp>
+
+#include <set>
+
+
+// Uploads that can be resumed after a network failure (this is a simplified version of
+// the tus protocol).  The client declares the size of the file, then appends chunks at
+// the offset that is known by the server.  The file is staged on the disk and is only
+// stored in Orthanc once it has been fully received.  The result of the commit is kept
+// such that a client that has lost the answer of its last chunk can get it again.  The
+// uploads that have not been updated during 'expirationDelay' are discarded.
+class ResumableUploads : public boost::noncopyable
+{
+private:
+  mutable boost::mutex   mutex_;
+  boost::mutex           largeFilesMutex_;
+  std::set<std::string>  busyUploads_;   // the uploads that are currently being appended or stored
+  std::string            directory_;
+  uint64_t               maxFileSize_;
+  unsigned int           expirationDelay_;  // in seconds
+
+  class BusyUpload;
+
+  std::string GetPath(const std::string& uploadId,
+                      const std::string& extension) const;
+
+  void RemoveFiles(const std::string& uploadId);
+
+  // the inflated entries of a ZIP archive are limited to the maximum size of an uploaded file
+  void Commit(Json::Value& result,
+              const std::string& path);
+
+public:
+  ResumableUploads(const std::string& directory,
+                   uint64_t maxFileSize,
+                   unsigned int expirationDelay);
+
+  void RemoveExpiredUploads();
+
+  void Create(Json::Value& status,
+              uint64_t size,
+              const std::string& filename);
+
+  // returns false if the upload does not exist (or has expired)
+  bool GetStatus(Json::Value& status,
+                 const std::string& uploadId) const;
+
+  // Returns false if 'offset' is not the current offset of the upload, in which case
+  // 'status' contains the offset from which the client must resume.  When the last
+  // chunk is received, the file is stored in Orthanc and 'status' contains the result.
+  bool Append(Json::Value& status,
+              const std::string& uploadId,
+              uint64_t offset,
+              const void* data,
+              size_t size);
+
+  void Remove(const std::string& uploadId);
+};
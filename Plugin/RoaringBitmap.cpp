@@ -0,0 +1,444 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RoaringBitmap.h"
+
+#include <algorithm>
+#include <iterator>
+
+
+static const uint32_t MAX_ARRAY_SIZE = 4096;
+static const size_t BITMAP_WORDS = 65536 / 64;
+
+
+static uint32_t PopCount(uint64_t x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<uint32_t>((x * 0x0101010101010101ULL) >> 56);
+}
+
+
+static bool IsBitSet(const std::vector<uint64_t>& bitmap,
+                     uint16_t value)
+{
+  return (bitmap[value / 64] & (static_cast<uint64_t>(1) << (value % 64))) != 0;
+}
+
+
+void RoaringBitmap::Container::ConvertToBitmap()
+{
+  bitmap_.assign(BITMAP_WORDS, 0);
+
+  for (size_t i = 0; i < array_.size(); i++)
+  {
+    bitmap_[array_[i] / 64] |= (static_cast<uint64_t>(1) << (array_[i] % 64));
+  }
+
+  std::vector<uint16_t>().swap(array_);
+}
+
+
+void RoaringBitmap::Container::ConvertToArray()
+{
+  std::vector<uint16_t> array;
+  array.reserve(cardinality_);
+
+  for (size_t w = 0; w < bitmap_.size(); w++)
+  {
+    for (uint64_t word = bitmap_[w]; word != 0; word &= word - 1)
+    {
+      uint16_t bit = 0;
+      while ((word & (static_cast<uint64_t>(1) << bit)) == 0)
+      {
+        bit++;
+      }
+
+      array.push_back(static_cast<uint16_t>(w * 64 + bit));
+    }
+  }
+
+  array_.swap(array);
+  std::vector<uint64_t>().swap(bitmap_);
+}
+
+
+void RoaringBitmap::Container::Normalize()
+{
+  if (IsBitmap())
+  {
+    cardinality_ = 0;
+    for (size_t w = 0; w < bitmap_.size(); w++)
+    {
+      cardinality_ += PopCount(bitmap_[w]);
+    }
+
+    if (cardinality_ <= MAX_ARRAY_SIZE)
+    {
+      ConvertToArray();
+    }
+  }
+  else
+  {
+    cardinality_ = static_cast<uint32_t>(array_.size());
+
+    if (cardinality_ > MAX_ARRAY_SIZE)
+    {
+      ConvertToBitmap();
+    }
+  }
+}
+
+
+void RoaringBitmap::Container::Add(uint16_t value)
+{
+  if (IsBitmap())
+  {
+    if (!IsBitSet(bitmap_, value))
+    {
+      bitmap_[value / 64] |= (static_cast<uint64_t>(1) << (value % 64));
+      cardinality_++;
+    }
+  }
+  else
+  {
+    std::vector<uint16_t>::iterator it = std::lower_bound(array_.begin(), array_.end(), value);
+    if (it == array_.end() || *it != value)
+    {
+      array_.insert(it, value);
+      cardinality_++;
+
+      if (cardinality_ > MAX_ARRAY_SIZE)
+      {
+        ConvertToBitmap();
+      }
+    }
+  }
+}
+
+
+void RoaringBitmap::Container::Remove(uint16_t value)
+{
+  if (IsBitmap())
+  {
+    if (IsBitSet(bitmap_, value))
+    {
+      bitmap_[value / 64] &= ~(static_cast<uint64_t>(1) << (value % 64));
+      cardinality_--;
+
+      if (cardinality_ <= MAX_ARRAY_SIZE)
+      {
+        ConvertToArray();
+      }
+    }
+  }
+  else
+  {
+    std::vector<uint16_t>::iterator it = std::lower_bound(array_.begin(), array_.end(), value);
+    if (it != array_.end() && *it == value)
+    {
+      array_.erase(it);
+      cardinality_--;
+    }
+  }
+}
+
+
+bool RoaringBitmap::Container::Contains(uint16_t value) const
+{
+  if (IsBitmap())
+  {
+    return IsBitSet(bitmap_, value);
+  }
+  else
+  {
+    return std::binary_search(array_.begin(), array_.end(), value);
+  }
+}
+
+
+void RoaringBitmap::Container::And(const Container& other)
+{
+  if (IsBitmap() && other.IsBitmap())
+  {
+    for (size_t w = 0; w < BITMAP_WORDS; w++)
+    {
+      bitmap_[w] &= other.bitmap_[w];
+    }
+  }
+  else if (IsBitmap())
+  {
+    // the result is at most as large as the array of 'other'
+    std::vector<uint16_t> array;
+    for (size_t i = 0; i < other.array_.size(); i++)
+    {
+      if (IsBitSet(bitmap_, other.array_[i]))
+      {
+        array.push_back(other.array_[i]);
+      }
+    }
+
+    array_.swap(array);
+    std::vector<uint64_t>().swap(bitmap_);
+  }
+  else if (other.IsBitmap())
+  {
+    std::vector<uint16_t> array;
+    for (size_t i = 0; i < array_.size(); i++)
+    {
+      if (IsBitSet(other.bitmap_, array_[i]))
+      {
+        array.push_back(array_[i]);
+      }
+    }
+
+    array_.swap(array);
+  }
+  else
+  {
+    std::vector<uint16_t> array;
+    std::set_intersection(array_.begin(), array_.end(), other.array_.begin(), other.array_.end(), std::back_inserter(array));
+    array_.swap(array);
+  }
+
+  Normalize();
+}
+
+
+void RoaringBitmap::Container::Or(const Container& other)
+{
+  if (!IsBitmap() && !other.IsBitmap())
+  {
+    std::vector<uint16_t> array;
+    std::set_union(array_.begin(), array_.end(), other.array_.begin(), other.array_.end(), std::back_inserter(array));
+    array_.swap(array);
+  }
+  else
+  {
+    if (!IsBitmap())
+    {
+      ConvertToBitmap();
+    }
+
+    if (other.IsBitmap())
+    {
+      for (size_t w = 0; w < BITMAP_WORDS; w++)
+      {
+        bitmap_[w] |= other.bitmap_[w];
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < other.array_.size(); i++)
+      {
+        bitmap_[other.array_[i] / 64] |= (static_cast<uint64_t>(1) << (other.array_[i] % 64));
+      }
+    }
+  }
+
+  Normalize();
+}
+
+
+void RoaringBitmap::Container::AndNot(const Container& other)
+{
+  if (IsBitmap())
+  {
+    if (other.IsBitmap())
+    {
+      for (size_t w = 0; w < BITMAP_WORDS; w++)
+      {
+        bitmap_[w] &= ~other.bitmap_[w];
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < other.array_.size(); i++)
+      {
+        bitmap_[other.array_[i] / 64] &= ~(static_cast<uint64_t>(1) << (other.array_[i] % 64));
+      }
+    }
+  }
+  else if (other.IsBitmap())
+  {
+    std::vector<uint16_t> array;
+    for (size_t i = 0; i < array_.size(); i++)
+    {
+      if (!IsBitSet(other.bitmap_, array_[i]))
+      {
+        array.push_back(array_[i]);
+      }
+    }
+
+    array_.swap(array);
+  }
+  else
+  {
+    std::vector<uint16_t> array;
+    std::set_difference(array_.begin(), array_.end(), other.array_.begin(), other.array_.end(), std::back_inserter(array));
+    array_.swap(array);
+  }
+
+  Normalize();
+}
+
+
+void RoaringBitmap::Container::GetValues(std::vector<uint32_t>& target,
+                                         uint32_t high) const
+{
+  if (IsBitmap())
+  {
+    for (size_t w = 0; w < bitmap_.size(); w++)
+    {
+      for (uint64_t word = bitmap_[w]; word != 0; word &= word - 1)
+      {
+        uint32_t bit = 0;
+        while ((word & (static_cast<uint64_t>(1) << bit)) == 0)
+        {
+          bit++;
+        }
+
+        target.push_back((high << 16) | static_cast<uint32_t>(w * 64 + bit));
+      }
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < array_.size(); i++)
+    {
+      target.push_back((high << 16) | array_[i]);
+    }
+  }
+}
+
+
+void RoaringBitmap::Add(uint32_t value)
+{
+  containers_[static_cast<uint16_t>(value >> 16)].Add(static_cast<uint16_t>(value & 0xffff));
+}
+
+
+void RoaringBitmap::Remove(uint32_t value)
+{
+  Containers::iterator found = containers_.find(static_cast<uint16_t>(value >> 16));
+  if (found != containers_.end())
+  {
+    found->second.Remove(static_cast<uint16_t>(value & 0xffff));
+
+    if (found->second.GetCardinality() == 0)
+    {
+      containers_.erase(found);
+    }
+  }
+}
+
+
+bool RoaringBitmap::Contains(uint32_t value) const
+{
+  Containers::const_iterator found = containers_.find(static_cast<uint16_t>(value >> 16));
+  return (found != containers_.end() &&
+          found->second.Contains(static_cast<uint16_t>(value & 0xffff)));
+}
+
+
+uint64_t RoaringBitmap::GetCardinality() const
+{
+  uint64_t cardinality = 0;
+  for (Containers::const_iterator it = containers_.begin(); it != containers_.end(); ++it)
+  {
+    cardinality += it->second.GetCardinality();
+  }
+
+  return cardinality;
+}
+
+
+void RoaringBitmap::And(const RoaringBitmap& other)
+{
+  for (Containers::iterator it = containers_.begin(); it != containers_.end(); )
+  {
+    Containers::const_iterator found = other.containers_.find(it->first);
+    if (found != other.containers_.end())
+    {
+      it->second.And(found->second);
+    }
+
+    if (found == other.containers_.end() ||
+        it->second.GetCardinality() == 0)
+    {
+      containers_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+void RoaringBitmap::Or(const RoaringBitmap& other)
+{
+  for (Containers::const_iterator it = other.containers_.begin(); it != other.containers_.end(); ++it)
+  {
+    Containers::iterator found = containers_.find(it->first);
+    if (found == containers_.end())
+    {
+      containers_[it->first] = it->second;
+    }
+    else
+    {
+      found->second.Or(it->second);
+    }
+  }
+}
+
+
+void RoaringBitmap::AndNot(const RoaringBitmap& other)
+{
+  for (Containers::iterator it = containers_.begin(); it != containers_.end(); )
+  {
+    Containers::const_iterator found = other.containers_.find(it->first);
+    if (found != other.containers_.end())
+    {
+      it->second.AndNot(found->second);
+    }
+
+    if (it->second.GetCardinality() == 0)
+    {
+      containers_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+void RoaringBitmap::GetValues(std::vector<uint32_t>& target) const
+{
+  for (Containers::const_iterator it = containers_.begin(); it != containers_.end(); ++it)
+  {
+    it->second.GetValues(target, it->first);
+  }
+}
@@ -0,0 +1,113 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+
+// Compressed set of 32-bit integers (roaring bitmap): the integers are grouped by their 16 high
+// bits and each group is stored either as a sorted array of its 16 low bits (up to 4096 values)
+// or as a bitmap of 65536 bits.  The set operations are thus performed one group at a time, with
+// the cheapest algorithm for the two representations.
+class RoaringBitmap
+{
+private:
+  class Container
+  {
+  private:
+    std::vector<uint16_t>  array_;    // sorted, used if 'bitmap_' is empty
+    std::vector<uint64_t>  bitmap_;   // 1024 words, or empty
+    uint32_t               cardinality_;
+
+    void ConvertToBitmap();
+
+    void ConvertToArray();
+
+    void Normalize();
+
+  public:
+    Container() :
+      cardinality_(0)
+    {
+    }
+
+    bool IsBitmap() const
+    {
+      return !bitmap_.empty();
+    }
+
+    uint32_t GetCardinality() const
+    {
+      return cardinality_;
+    }
+
+    void Add(uint16_t value);
+
+    void Remove(uint16_t value);
+
+    bool Contains(uint16_t value) const;
+
+    void And(const Container& other);
+
+    void Or(const Container& other);
+
+    void AndNot(const Container& other);
+
+    void GetValues(std::vector<uint32_t>& target,
+                   uint32_t high) const;
+  };
+
+  typedef std::map<uint16_t, Container>  Containers;
+
+  Containers  containers_;
+
+public:
+  void Clear()
+  {
+    containers_.clear();
+  }
+
+  bool IsEmpty() const
+  {
+    return containers_.empty();
+  }
+
+  void Add(uint32_t value);
+
+  void Remove(uint32_t value);
+
+  bool Contains(uint32_t value) const;
+
+  uint64_t GetCardinality() const;
+
+  void And(const RoaringBitmap& other);
+
+  void Or(const RoaringBitmap& other);
+
+  void AndNot(const RoaringBitmap& other);
+
+  // Appends the values in ascending order
+  void GetValues(std::vector<uint32_t>& target) const;
+};
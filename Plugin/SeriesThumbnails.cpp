@@ -0,0 +1,306 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "SeriesThumbnails.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+
+// Stored instead of a JPEG for the series that have no image, such that they are not rendered
+// again at each request.  A new thumbnail is generated when the series becomes stable again.
+static const char* const NO_THUMBNAIL = "no-thumbnail";
+
+
+SeriesThumbnails::SeriesThumbnails(unsigned int size,
+                                   unsigned int attachmentType,
+                                   unsigned int threadsCount) :
+  isRunning_(false),
+  threadsCount_(threadsCount),
+  size_(size),
+  attachmentType_(attachmentType)
+{
+  if (size_ == 0 ||
+      threadsCount_ == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  if (attachmentType_ < 1024 ||
+      attachmentType_ > 65535)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The attachment type of the thumbnails must be a user-defined content type (between 1024 and 65535)");
+  }
+}
+
+
+SeriesThumbnails::~SeriesThumbnails()
+{
+  Stop();
+}
+
+
+void SeriesThumbnails::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+}
+
+
+void SeriesThumbnails::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRunning_ = false;
+  }
+
+  pendingChanged_.notify_all();
+
+  for (size_t i = 0; i < workers_.size(); i++)
+  {
+    if (workers_[i]->joinable())
+    {
+      workers_[i]->join();
+    }
+
+    delete workers_[i];
+  }
+
+  workers_.clear();
+}
+
+
+void SeriesThumbnails::Worker(SeriesThumbnails* that)
+{
+  for (;;)
+  {
+    std::string seriesId;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (that->isRunning_ && that->pending_.empty())
+      {
+        that->pendingChanged_.wait(lock);
+      }
+
+      if (!that->isRunning_)
+      {
+        return;
+      }
+
+      seriesId = that->pending_.front();
+      that->pending_.pop_front();
+      that->pendingSet_.erase(seriesId);
+    }
+
+    try
+    {
+      std::string jpeg;
+      that->Generate(jpeg, seriesId);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while generating the thumbnail of series " << seriesId << ": " << e.What();
+    }
+  }
+}
+
+
+std::string SeriesThumbnails::GetAttachmentUri(const std::string& seriesId) const
+{
+  return "/series/" + seriesId + "/attachments/" + boost::lexical_cast<std::string>(attachmentType_);
+}
+
+
+bool SeriesThumbnails::Generate(std::string& jpeg,
+                                const std::string& seriesId)
+{
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false) ||
+      !series.isMember("Instances") ||
+      series["Instances"].size() == 0)
+  {
+    return false;
+  }
+
+  // the middle instance is usually more representative than the first one (e.g. a slice in the middle of a CT)
+  const Json::Value& instances = series["Instances"];
+  const std::string instanceId = instances[instances.size() / 2].asString();
+
+  // Orthanc applies the windowing and resizes the frame (keeping its aspect ratio) before encoding it
+  const std::string size = boost::lexical_cast<std::string>(size_);
+
+  OrthancPlugins::HttpHeaders headers;
+  headers["Accept"] = "image/jpeg";
+
+  OrthancPlugins::MemoryBuffer rendered;
+  const bool isImage = rendered.RestApiGet("/instances/" + instanceId + "/frames/0/rendered?width=" + size + "&height=" + size + "&smooth=1", headers, false);
+
+  if (isImage)
+  {
+    rendered.ToString(jpeg);
+  }
+  else
+  {
+    jpeg.clear();  // not an image (e.g. a PDF or a structured report)
+  }
+
+  OrthancPlugins::MemoryBuffer answer;
+  if (!answer.RestApiPut(GetAttachmentUri(seriesId), isImage ? jpeg : std::string(NO_THUMBNAIL), false))
+  {
+    LOG(WARNING) << "OE2: Unable to store the thumbnail of series " << seriesId;
+  }
+
+  return isImage;
+}
+
+
+bool SeriesThumbnails::Get(std::string& jpeg,
+                           const std::string& seriesId)
+{
+  OrthancPlugins::MemoryBuffer stored;
+  if (stored.RestApiGet(GetAttachmentUri(seriesId) + "/data", false))
+  {
+    stored.ToString(jpeg);
+    return (jpeg != NO_THUMBNAIL);
+  }
+
+  return Generate(jpeg, seriesId);
+}
+
+
+static bool IsBeforeInStudy(const Json::Value& a,
+                            const Json::Value& b)
+{
+  // SeriesNumber is an integer string that might be missing or empty
+  int numberA = 0, numberB = 0;
+
+  try
+  {
+    numberA = boost::lexical_cast<int>(Orthanc::Toolbox::StripSpaces(a["MainDicomTags"]["SeriesNumber"].asString()));
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+  }
+
+  try
+  {
+    numberB = boost::lexical_cast<int>(Orthanc::Toolbox::StripSpaces(b["MainDicomTags"]["SeriesNumber"].asString()));
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+  }
+
+  return numberA < numberB;
+}
+
+
+bool SeriesThumbnails::AnswerStudyThumbnails(OrthancPluginRestOutput* output,
+                                             const std::string& studyId)
+{
+  Json::Value answer;
+  if (!OrthancPlugins::RestApiGet(answer, "/studies/" + studyId + "/series?expand", false) ||
+      answer.type() != Json::arrayValue)
+  {
+    return false;
+  }
+
+  std::vector<Json::Value> series;
+  for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+  {
+    series.push_back(answer[i]);
+  }
+
+  std::stable_sort(series.begin(), series.end(), IsBeforeInStudy);
+
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (OrthancPluginStartMultipartAnswer(context, output, "related", "image/jpeg") != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Unable to start the multipart answer");
+  }
+
+  // each part is sent as soon as its thumbnail is available such that the client can display it progressively
+  for (size_t i = 0; i < series.size(); i++)
+  {
+    const std::string seriesId = series[i]["ID"].asString();
+
+    std::string jpeg;
+
+    try
+    {
+      if (!Get(jpeg, seriesId))
+      {
+        continue;  // not an image series
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      // the answer has already started, it is too late to report an error
+      LOG(ERROR) << "OE2: Error while generating the thumbnail of series " << seriesId << ": " << e.What();
+      continue;
+    }
+
+    const char* keys[] = { "Content-Location" };
+    const char* values[] = { seriesId.c_str() };
+
+    if (OrthancPluginSendMultipartItem2(context, output, jpeg.c_str(), jpeg.size(), 1, keys, values) != OrthancPluginErrorCode_Success)
+    {
+      // the client has most probably closed the connection
+      break;
+    }
+  }
+
+  return true;
+}
+
+
+void SeriesThumbnails::Schedule(const std::string& seriesId)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!pendingSet_.insert(seriesId).second)
+    {
+      return;  // already scheduled
+    }
+
+    pending_.push_back(seriesId);
+  }
+
+  pendingChanged_.notify_one();
+}
@@ -0,0 +1,83 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <set>
+#include <vector>
+
+
+// Generates a JPEG thumbnail of a representative frame of each series.  The
+// thumbnails are stored as an attachment of the series such that they are kept
+// in the Orthanc storage area (and deleted together with the series).  They are
+// generated by a pool of background threads when a series becomes stable, or on
+// demand if they are missing.
+class SeriesThumbnails : public boost::noncopyable
+{
+private:
+  boost::mutex                 mutex_;
+  boost::condition_variable    pendingChanged_;
+  std::deque<std::string>      pending_;
+  std::set<std::string>        pendingSet_;
+  bool                         isRunning_;
+  unsigned int                 threadsCount_;
+  std::vector<boost::thread*>  workers_;
+  unsigned int                 size_;             // in pixels
+  unsigned int                 attachmentType_;   // a user-defined content type
+
+  static void Worker(SeriesThumbnails* that);
+
+  std::string GetAttachmentUri(const std::string& seriesId) const;
+
+public:
+  SeriesThumbnails(unsigned int size,
+                   unsigned int attachmentType,
+                   unsigned int threadsCount);
+
+  ~SeriesThumbnails();
+
+  void Start();
+
+  void Stop();
+
+  // Returns false if the series does not contain any image (this is also stored such that the
+  // series is not rendered again until it becomes stable again)
+  bool Generate(std::string& jpeg,
+                const std::string& seriesId);
+
+  // Returns the stored thumbnail, or generates it if missing
+  bool Get(std::string& jpeg,
+           const std::string& seriesId);
+
+  // Streams the thumbnails of all the series of a study in a multipart answer, ordered by SeriesNumber.
+  // Returns false if the study does not exist.
+  bool AnswerStudyThumbnails(OrthancPluginRestOutput* output,
+                             const std::string& studyId);
+
+  // Generates the thumbnail in the background (called when the series becomes stable)
+  void Schedule(const std::string& seriesId);
+};
@@ -0,0 +1,282 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudiesExport.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+
+
+namespace StudiesExport
+{
+  static const char* const TAGS_GROUPS[] = { "MainDicomTags", "PatientMainDicomTags", "RequestedTags" };
+  static const size_t TAGS_GROUPS_COUNT = sizeof(TAGS_GROUPS) / sizeof(TAGS_GROUPS[0]);
+
+
+  Format StringToFormat(const std::string& format)
+  {
+    if (format == "csv")
+    {
+      return Format_Csv;
+    }
+    else if (format == "ndjson")
+    {
+      return Format_NdJson;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown export format: " + format);
+    }
+  }
+
+
+  static std::string GetTag(const Json::Value& study,
+                            const std::string& tag)
+  {
+    for (size_t i = 0; i < TAGS_GROUPS_COUNT; i++)
+    {
+      const Json::Value& group = study[TAGS_GROUPS[i]];
+      if (group.isObject() &&
+          group.isMember(tag) &&
+          group[tag].isString())
+      {
+        return group[tag].asString();
+      }
+    }
+
+    return "";
+  }
+
+
+  // Same values as the columns of the study list
+  static std::string GetColumnValue(const Json::Value& study,
+                                    const std::string& column)
+  {
+    if (column == "modalities")
+    {
+      return GetTag(study, "ModalitiesInStudy");
+    }
+    else if (column == "seriesCount")
+    {
+      return GetTag(study, "NumberOfStudyRelatedSeries");
+    }
+    else if (column == "instancesCount")
+    {
+      return GetTag(study, "NumberOfStudyRelatedInstances");
+    }
+    else if (column == "seriesAndInstancesCount")
+    {
+      return GetTag(study, "NumberOfStudyRelatedSeries") + "/" + GetTag(study, "NumberOfStudyRelatedInstances");
+    }
+    else
+    {
+      return GetTag(study, column);
+    }
+  }
+
+
+  void AppendCsvValue(std::string& target,
+                      const std::string& value)
+  {
+    if (value.find_first_of(",\"\r\n") == std::string::npos)
+    {
+      target += value;
+    }
+    else
+    {
+      target += '"';
+      for (size_t i = 0; i < value.size(); i++)
+      {
+        if (value[i] == '"')
+        {
+          target += '"';  // quotes are doubled
+        }
+        target += value[i];
+      }
+      target += '"';
+    }
+  }
+
+
+  static void FormatPage(std::string& target,
+                         const Json::Value& studies,
+                         const std::vector<std::string>& columns,
+                         Format format)
+  {
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      if (format == Format_Csv)
+      {
+        for (size_t c = 0; c < columns.size(); c++)
+        {
+          if (c > 0)
+          {
+            target += ',';
+          }
+
+          AppendCsvValue(target, GetColumnValue(studies[i], columns[c]));
+        }
+
+        target += "\r\n";
+      }
+      else
+      {
+        Json::Value row;
+        row["ID"] = studies[i]["ID"];
+
+        for (size_t c = 0; c < columns.size(); c++)
+        {
+          row[columns[c]] = GetColumnValue(studies[i], columns[c]);
+        }
+
+        std::string serialized;
+        OrthancPlugins::WriteFastJson(serialized, row);
+        target += serialized;
+
+        if (target.empty() || target[target.size() - 1] != '\n')
+        {
+          target += '\n';
+        }
+      }
+    }
+  }
+
+
+  void SendErrorPart(OrthancPluginRestOutput* output,
+                     const std::string& message)
+  {
+    // a line break would end the header of the part
+    std::string error = message;
+    std::replace(error.begin(), error.end(), '\r', ' ');
+    std::replace(error.begin(), error.end(), '\n', ' ');
+
+    const char* keys[] = { "X-Export-Error" };
+    const char* values[] = { error.c_str() };
+    OrthancPluginSendMultipartItem2(OrthancPlugins::GetGlobalContext(), output, "", 0, 1, keys, values);
+  }
+
+
+  void AnswerExport(OrthancPluginRestOutput* output,
+                    const Json::Value& request,
+                    const OrthancPlugins::HttpHeaders& headers,
+                    const StudiesFinderIndexes& indexes,
+                    const std::vector<std::string>& columns,
+                    Format format,
+                    unsigned int pageSize)
+  {
+    if (!request.isObject())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+    }
+
+    Json::Value page = request;
+    page["Limit"] = pageSize;
+    page.removeMember("Cursor");
+
+    if (!HasKeysetCursor(page))
+    {
+      // with an offset cursor, the studies that are updated during the export would move across the
+      // pages if they were ordered by LastUpdate (and be exported twice or missed) -> order by a key
+      // that does not change
+      Json::Value orderBy;
+      orderBy["Type"] = "DicomTag";
+      orderBy["Key"] = "StudyInstanceUID";
+      orderBy["Direction"] = "ASC";
+
+      page["OrderBy"] = Json::arrayValue;
+      page["OrderBy"].append(orderBy);
+    }
+
+    // the special columns of the study list are computed from these tags
+    page["RequestedTags"] = Json::arrayValue;
+    page["RequestedTags"].append("ModalitiesInStudy");
+    page["RequestedTags"].append("NumberOfStudyRelatedSeries");
+    page["RequestedTags"].append("NumberOfStudyRelatedInstances");
+
+    // the first page is loaded before the answer is started, such that an invalid request gets an error status
+    Json::Value studies;
+    std::string nextCursor;
+    FindStudiesWithCursor(studies, nextCursor, page, headers, indexes);
+
+    OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+    if (OrthancPluginStartMultipartAnswer(context, output, "mixed",
+                                          format == Format_Csv ? "text/csv" : "application/x-ndjson") != OrthancPluginErrorCode_Success)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Unable to start the multipart answer");
+    }
+
+    std::string part;
+
+    if (format == Format_Csv)
+    {
+      for (size_t c = 0; c < columns.size(); c++)
+      {
+        if (c > 0)
+        {
+          part += ',';
+        }
+
+        AppendCsvValue(part, columns[c]);
+      }
+
+      part += "\r\n";
+    }
+
+    for (;;)
+    {
+      FormatPage(part, studies, columns, format);
+
+      if (!part.empty() &&
+          OrthancPluginSendMultipartItem(context, output, part.c_str(), part.size()) != OrthancPluginErrorCode_Success)
+      {
+        return;  // the client has most probably closed the connection
+      }
+
+      if (nextCursor.empty())
+      {
+        return;
+      }
+
+      part.clear();
+      page["Cursor"] = nextCursor;
+
+      try
+      {
+        FindStudiesWithCursor(studies, nextCursor, page, headers, indexes);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "OE2: Error while exporting the studies: " << e.What();
+        SendErrorPart(output, e.What());
+        return;
+      }
+      catch (std::exception& e)
+      {
+        LOG(ERROR) << "OE2: Error while exporting the studies: " << e.what();
+        SendErrorPart(output, e.what());
+        return;
+      }
+    }
+  }
+}
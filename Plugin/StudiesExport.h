@@ -0,0 +1,68 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "StudiesFinder.h"
+
+#include <string>
+#include <vector>
+
+
+// Exports the whole result set of a study list request, with the columns of the study list
+// ("UiOptions.StudyListColumns"), for instance to audit the content of the archive.
+namespace StudiesExport
+{
+  enum Format
+  {
+    Format_Csv,
+    Format_NdJson
+  };
+
+  Format StringToFormat(const std::string& format);
+
+  // Appends a CSV field, quoted if needed (RFC 4180)
+  void AppendCsvValue(std::string& target,
+                      const std::string& value);
+
+  // Once a multipart export has started, reports an error in an empty part whose 'X-Export-Error'
+  // header contains the message (without its line breaks), such that the client does not mistake
+  // the truncated export for a complete one
+  void SendErrorPart(OrthancPluginRestOutput* output,
+                     const std::string& message);
+
+  // Runs the request (same fields as FindStudiesColumnar() except 'Limit' and 'Cursor') page by page
+  // and answers a 'multipart/mixed' stream with one part per page of 'pageSize' studies, sent as soon
+  // as the page has been loaded.  Only one page is kept in memory at a time.  In CSV, the first part
+  // starts with the header line.  The 'headers' are forwarded to Orthanc such that the authorization
+  // plugin can filter the studies the user has access to.  Unless the request is paged by a keyset
+  // (see HasKeysetCursor()), the studies are exported in the order of their StudyInstanceUID such that
+  // the updates made during the export do not move them across the pages.  If a page fails once the
+  // answer has started, an empty part with an 'X-Export-Error' header ends the stream.
+  void AnswerExport(OrthancPluginRestOutput* output,
+                    const Json::Value& request,
+                    const OrthancPlugins::HttpHeaders& headers,
+                    const StudiesFinderIndexes& indexes,
+                    const std::vector<std::string>& columns,
+                    Format format,
+                    unsigned int pageSize);
+}
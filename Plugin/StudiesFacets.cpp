@@ -0,0 +1,801 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudiesFacets.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+
+static const size_t LABELS_PAGE_SIZE = 10000;
+static const size_t MAX_MODALITIES = 64;
+
+
+static size_t PopCount(uint64_t x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<size_t>((x * 0x0101010101010101ULL) >> 56);
+}
+
+
+StudiesFacets::Bitset::Bitset(size_t size) :
+  words_((size + 63) / 64, 0)
+{
+}
+
+
+void StudiesFacets::Bitset::Resize(size_t size)
+{
+  words_.resize((size + 63) / 64, 0);
+}
+
+
+void StudiesFacets::Bitset::Set(size_t index,
+                                bool value)
+{
+  if (index / 64 >= words_.size())
+  {
+    words_.resize(index / 64 + 1, 0);
+  }
+
+  if (value)
+  {
+    words_[index / 64] |= (static_cast<uint64_t>(1) << (index % 64));
+  }
+  else
+  {
+    words_[index / 64] &= ~(static_cast<uint64_t>(1) << (index % 64));
+  }
+}
+
+
+void StudiesFacets::Bitset::Fill(bool value)
+{
+  std::fill(words_.begin(), words_.end(), (value ? ~static_cast<uint64_t>(0) : 0));
+}
+
+
+void StudiesFacets::Bitset::And(const Bitset& other)
+{
+  for (size_t i = 0; i < words_.size(); i++)
+  {
+    words_[i] &= (i < other.words_.size() ? other.words_[i] : 0);
+  }
+}
+
+
+void StudiesFacets::Bitset::Or(const Bitset& other)
+{
+  if (other.words_.size() > words_.size())
+  {
+    words_.resize(other.words_.size(), 0);
+  }
+
+  for (size_t i = 0; i < other.words_.size(); i++)
+  {
+    words_[i] |= other.words_[i];
+  }
+}
+
+
+void StudiesFacets::Bitset::AndNot(const Bitset& other)
+{
+  for (size_t i = 0; i < words_.size() && i < other.words_.size(); i++)
+  {
+    words_[i] &= ~other.words_[i];
+  }
+}
+
+
+size_t StudiesFacets::Bitset::Count() const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < words_.size(); i++)
+  {
+    count += PopCount(words_[i]);
+  }
+
+  return count;
+}
+
+
+size_t StudiesFacets::Bitset::CountAnd(const Bitset& other) const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < words_.size() && i < other.words_.size(); i++)
+  {
+    count += PopCount(words_[i] & other.words_[i]);
+  }
+
+  return count;
+}
+
+
+namespace
+{
+  class ModalitiesCounter
+  {
+  private:
+    const std::vector<uint64_t>&  modalities_;
+    std::vector<size_t>           counts_;
+
+  public:
+    explicit ModalitiesCounter(const std::vector<uint64_t>& modalities) :
+      modalities_(modalities),
+      counts_(MAX_MODALITIES, 0)
+    {
+    }
+
+    void operator() (size_t slot)
+    {
+      for (uint64_t mask = modalities_[slot]; mask != 0; mask &= mask - 1)
+      {
+        size_t bit = 0;
+        while ((mask & (static_cast<uint64_t>(1) << bit)) == 0)
+        {
+          bit++;
+        }
+
+        counts_[bit]++;
+      }
+    }
+
+    size_t GetCount(size_t bit) const
+    {
+      return counts_[bit];
+    }
+  };
+
+
+  class DatesCounter
+  {
+  private:
+    const std::vector<uint32_t>&                        studyDates_;
+    const std::vector<std::pair<uint32_t, uint32_t> >&  ranges_;
+    std::map<uint32_t, size_t>                          years_;
+    std::map<uint32_t, size_t>                          months_;
+    std::vector<size_t>                                 rangesCounts_;
+
+  public:
+    DatesCounter(const std::vector<uint32_t>& studyDates,
+                 const std::vector<std::pair<uint32_t, uint32_t> >& ranges) :
+      studyDates_(studyDates),
+      ranges_(ranges),
+      rangesCounts_(ranges.size(), 0)
+    {
+    }
+
+    void operator() (size_t slot)
+    {
+      const uint32_t date = studyDates_[slot];
+      if (date != 0)
+      {
+        years_[date / 10000]++;
+        months_[date / 100]++;
+
+        for (size_t i = 0; i < ranges_.size(); i++)
+        {
+          if (ranges_[i].first <= date && date <= ranges_[i].second)
+          {
+            rangesCounts_[i]++;
+          }
+        }
+      }
+    }
+
+    void Format(Json::Value& target) const
+    {
+      target = Json::objectValue;
+      target["Years"] = Json::objectValue;
+      target["Months"] = Json::objectValue;
+      target["Ranges"] = Json::arrayValue;
+
+      for (std::map<uint32_t, size_t>::const_iterator it = years_.begin(); it != years_.end(); ++it)
+      {
+        target["Years"][boost::lexical_cast<std::string>(it->first)] = static_cast<Json::UInt64>(it->second);
+      }
+
+      for (std::map<uint32_t, size_t>::const_iterator it = months_.begin(); it != months_.end(); ++it)
+      {
+        target["Months"][boost::lexical_cast<std::string>(it->first)] = static_cast<Json::UInt64>(it->second);
+      }
+
+      for (size_t i = 0; i < rangesCounts_.size(); i++)
+      {
+        target["Ranges"].append(static_cast<Json::UInt64>(rangesCounts_[i]));
+      }
+    }
+  };
+}
+
+
+static uint32_t ParseDate(const std::string& date)
+{
+  if (date.size() != 8)
+  {
+    return 0;
+  }
+
+  for (size_t i = 0; i < date.size(); i++)
+  {
+    if (date[i] < '0' || date[i] > '9')
+    {
+      return 0;
+    }
+  }
+
+  return boost::lexical_cast<uint32_t>(date);
+}
+
+
+// "20240101", "20240101-20241231", "20240101-" or "-20241231"
+static void ParseDateRange(uint32_t& lower,
+                           uint32_t& upper,
+                           const std::string& range)
+{
+  const size_t dash = range.find('-');
+
+  if (dash == std::string::npos)
+  {
+    lower = upper = ParseDate(range);
+  }
+  else
+  {
+    lower = (dash == 0 ? 1 : ParseDate(range.substr(0, dash)));
+    upper = (dash + 1 == range.size() ? 99999999 : ParseDate(range.substr(dash + 1)));
+  }
+
+  if (lower == 0 || upper == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid date range: " + range);
+  }
+}
+
+
+static bool IsConstraint(const Json::Value& query,
+                         const char* tag)
+{
+  return (query.isMember(tag) &&
+          query[tag].isString() &&
+          !query[tag].asString().empty() &&
+          query[tag].asString() != "*");
+}
+
+
+StudiesFacets::StudiesFacets(unsigned int labelsRefreshPeriod) :
+  BackgroundStudiesIndex("facets of the studies", 1),
+  labelsRefreshPeriod_(labelsRefreshPeriod),
+  hasTooManyModalities_(false),
+  isReady_(false)
+{
+}
+
+
+StudiesFacets::~StudiesFacets()
+{
+  Stop();
+}
+
+
+void StudiesFacets::Build()
+{
+  if (ScanStudies("&requested-tags=ModalitiesInStudy"))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isReady_ = true;
+  }
+
+  SchedulePeriodicTask(boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(labelsRefreshPeriod_));
+}
+
+
+void StudiesFacets::RunPeriodicTask()
+{
+  SchedulePeriodicTask(boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(labelsRefreshPeriod_));
+  RefreshLabels();
+}
+
+
+void StudiesFacets::ClearScannedStudies()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  orthancIds_.clear();
+  studyInstanceUids_.clear();
+  studyDates_.clear();
+  modalities_.clear();
+  isUsed_ = Bitset();
+  freeSlots_.clear();
+  slots_.clear();
+  uidSlots_.clear();
+  labels_.clear();
+}
+
+
+bool StudiesFacets::GetScannedStudiesCount(size_t& count)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  count = slots_.size();
+  return true;
+}
+
+
+void StudiesFacets::RefreshLabels()
+{
+  Json::Value allLabels;
+  if (!OrthancPlugins::RestApiGet(allLabels, "/tools/labels", false) ||
+      allLabels.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the labels");
+  }
+
+  Labels labels;
+
+  for (Json::Value::ArrayIndex i = 0; i < allLabels.size(); i++)
+  {
+    const std::string label = allLabels[i].asString();
+    std::set<std::string> studiesIds;
+
+    for (size_t since = 0; ; since += LABELS_PAGE_SIZE)
+    {
+      Json::Value find;
+      find["Level"] = "Study";
+      find["Query"] = Json::objectValue;
+      find["Labels"].append(label);
+      find["LabelsConstraint"] = "All";
+      find["Since"] = static_cast<Json::UInt64>(since);
+      find["Limit"] = static_cast<Json::UInt64>(LABELS_PAGE_SIZE);
+
+      Json::Value studies;
+      if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, false) ||
+          studies.type() != Json::arrayValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies with label " + label);
+      }
+
+      for (Json::Value::ArrayIndex j = 0; j < studies.size(); j++)
+      {
+        studiesIds.insert(studies[j].asString());
+      }
+
+      if (studies.size() < LABELS_PAGE_SIZE)
+      {
+        break;
+      }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Bitset& bitset = labels[label];
+    bitset.Resize(orthancIds_.size());
+
+    for (std::set<std::string>::const_iterator it = studiesIds.begin(); it != studiesIds.end(); ++it)
+    {
+      std::map<std::string, size_t>::const_iterator found = slots_.find(*it);
+      if (found != slots_.end())
+      {
+        bitset.Set(found->second, true);
+      }
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // the slots may have been reused in the meantime by the changes -> keep their current labels
+  for (Labels::iterator it = labels.begin(); it != labels.end(); ++it)
+  {
+    it->second.And(isUsed_);
+  }
+
+  labels_.swap(labels);
+}
+
+
+void StudiesFacets::ApplyChange(const Change& change)
+{
+  if (change.isDeleted_)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    RemoveStudyInternal(change.studyId_);
+  }
+  else
+  {
+    Json::Value study;
+    if (OrthancPlugins::RestApiGet(study, "/studies/" + change.studyId_ + "?requested-tags=ModalitiesInStudy", false))
+    {
+      AddScannedStudy(change.studyId_, study);
+    }
+    else
+    {
+      // the study has been deleted in the meantime
+      boost::mutex::scoped_lock lock(mutex_);
+      RemoveStudyInternal(change.studyId_);
+    }
+  }
+}
+
+
+uint64_t StudiesFacets::GetModalitiesMask(const std::string& modalities,
+                                          bool create)
+{
+  // the mutex must be locked by the caller
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, modalities, '\\');
+
+  uint64_t mask = 0;
+
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    const std::string modality = Orthanc::Toolbox::StripSpaces(tokens[i]);
+    if (modality.empty())
+    {
+      continue;
+    }
+
+    std::vector<std::string>::const_iterator found = std::find(modalityNames_.begin(), modalityNames_.end(), modality);
+    if (found != modalityNames_.end())
+    {
+      mask |= (static_cast<uint64_t>(1) << (found - modalityNames_.begin()));
+    }
+    else if (create &&
+             modalityNames_.size() < MAX_MODALITIES)
+    {
+      modalityNames_.push_back(modality);
+      mask |= (static_cast<uint64_t>(1) << (modalityNames_.size() - 1));
+    }
+    else if (create &&
+             !hasTooManyModalities_)
+    {
+      // the counts of the modalities would be wrong from now on
+      LOG(WARNING) << "OE2: More than " << MAX_MODALITIES << " distinct modalities in the studies (" << modality
+                   << " is the first one to be ignored), the studies facets are disabled";
+      hasTooManyModalities_ = true;
+    }
+  }
+
+  return mask;
+}
+
+
+void StudiesFacets::AddScannedStudy(const std::string& orthancId,
+                                    const Json::Value& study)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  RemoveStudyInternal(orthancId);
+
+  size_t slot;
+  if (freeSlots_.empty())
+  {
+    slot = orthancIds_.size();
+    orthancIds_.push_back("");
+    studyInstanceUids_.push_back("");
+    studyDates_.push_back(0);
+    modalities_.push_back(0);
+  }
+  else
+  {
+    slot = freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+
+  orthancIds_[slot] = orthancId;
+  studyInstanceUids_[slot] = study["MainDicomTags"]["StudyInstanceUID"].asString();
+  studyDates_[slot] = ParseDate(study["MainDicomTags"]["StudyDate"].asString());
+  modalities_[slot] = GetModalitiesMask(study["RequestedTags"]["ModalitiesInStudy"].asString(), true);
+  isUsed_.Set(slot, true);
+
+  slots_[orthancId] = slot;
+  uidSlots_[studyInstanceUids_[slot]] = slot;
+
+  if (study.isMember("Labels") &&
+      study["Labels"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < study["Labels"].size(); i++)
+    {
+      labels_[study["Labels"][i].asString()].Set(slot, true);
+    }
+  }
+}
+
+
+void StudiesFacets::RemoveStudyInternal(const std::string& orthancId)
+{
+  // the mutex must be locked by the caller
+  std::map<std::string, size_t>::iterator found = slots_.find(orthancId);
+  if (found == slots_.end())
+  {
+    return;
+  }
+
+  const size_t slot = found->second;
+
+  std::map<std::string, size_t>::iterator uid = uidSlots_.find(studyInstanceUids_[slot]);
+  if (uid != uidSlots_.end() &&
+      uid->second == slot)
+  {
+    uidSlots_.erase(uid);
+  }
+
+  for (Labels::iterator it = labels_.begin(); it != labels_.end(); ++it)
+  {
+    it->second.Set(slot, false);
+  }
+
+  orthancIds_[slot].clear();
+  studyInstanceUids_[slot].clear();
+  studyDates_[slot] = 0;
+  modalities_[slot] = 0;
+  isUsed_.Set(slot, false);
+  freeSlots_.push_back(slot);
+  slots_.erase(found);
+}
+
+
+void StudiesFacets::MatchStudyDate(Bitset& target,
+                                   const std::string& range) const
+{
+  // the mutex must be locked by the caller
+  uint32_t lower, upper;
+  ParseDateRange(lower, upper, range);
+
+  target.Resize(studyDates_.size());
+  target.Fill(false);
+
+  for (size_t i = 0; i < studyDates_.size(); i++)
+  {
+    if (lower <= studyDates_[i] && studyDates_[i] <= upper)
+    {
+      target.Set(i, true);
+    }
+  }
+}
+
+
+void StudiesFacets::MatchModalities(Bitset& target,
+                                    const std::string& modalities) const
+{
+  // the mutex must be locked by the caller
+  uint64_t mask = 0;
+
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, modalities, '\\');
+
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    std::vector<std::string>::const_iterator found = std::find(modalityNames_.begin(), modalityNames_.end(), tokens[i]);
+    if (found != modalityNames_.end())
+    {
+      mask |= (static_cast<uint64_t>(1) << (found - modalityNames_.begin()));
+    }
+  }
+
+  target.Resize(modalities_.size());
+  target.Fill(false);
+
+  for (size_t i = 0; i < modalities_.size(); i++)
+  {
+    if ((modalities_[i] & mask) != 0)
+    {
+      target.Set(i, true);
+    }
+  }
+}
+
+
+void StudiesFacets::MatchLabels(Bitset& target,
+                                const std::set<std::string>& labels,
+                                const std::string& constraint) const
+{
+  // the mutex must be locked by the caller
+  target = isUsed_;
+
+  if (constraint == "All")
+  {
+    for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+    {
+      Labels::const_iterator found = labels_.find(*it);
+      if (found == labels_.end())
+      {
+        target.Fill(false);
+      }
+      else
+      {
+        target.And(found->second);
+      }
+    }
+  }
+  else
+  {
+    // "Any" or "None"
+    Bitset any(orthancIds_.size());
+
+    for (Labels::const_iterator it = labels_.begin(); it != labels_.end(); ++it)
+    {
+      if ((constraint == "None" && labels.empty()) ||  // the studies without labels
+          labels.find(it->first) != labels.end())
+      {
+        any.Or(it->second);
+      }
+    }
+
+    if (constraint == "Any")
+    {
+      target.And(any);
+    }
+    else
+    {
+      target.AndNot(any);
+    }
+  }
+}
+
+
+bool StudiesFacets::ComputeFacets(Json::Value& answer,
+                                  const Json::Value& request,
+                                  const std::vector<std::string>* studyInstanceUids)
+{
+  const Json::Value& query = request["Query"];
+
+  std::set<std::string> labels;
+  if (request.isMember("Labels") &&
+      request["Labels"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < request["Labels"].size(); i++)
+    {
+      labels.insert(request["Labels"][i].asString());
+    }
+  }
+
+  const std::string labelsConstraint = (request.isMember("LabelsConstraint") ? request["LabelsConstraint"].asString() : "All");
+  if (labelsConstraint != "All" && labelsConstraint != "Any" && labelsConstraint != "None")
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid LabelsConstraint: " + labelsConstraint);
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t> > dateRanges;
+  if (request.isMember("DateRanges") &&
+      request["DateRanges"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < request["DateRanges"].size(); i++)
+    {
+      uint32_t lower, upper;
+      ParseDateRange(lower, upper, request["DateRanges"][i].asString());
+      dateRanges.push_back(std::make_pair(lower, upper));
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isReady_ ||
+      hasTooManyModalities_)
+  {
+    return false;
+  }
+
+  const size_t size = orthancIds_.size();
+
+  // the studies that match the other filters
+  Bitset base = isUsed_;
+  base.Resize(size);
+
+  if (studyInstanceUids != NULL)
+  {
+    Bitset matching(size);
+    for (size_t i = 0; i < studyInstanceUids->size(); i++)
+    {
+      std::map<std::string, size_t>::const_iterator found = uidSlots_.find((*studyInstanceUids)[i]);
+      if (found != uidSlots_.end())
+      {
+        matching.Set(found->second, true);
+      }
+    }
+
+    base.And(matching);
+  }
+
+  Bitset dates(size), modalities(size), labelsFilter(size);
+
+  if (IsConstraint(query, "StudyDate"))
+  {
+    MatchStudyDate(dates, query["StudyDate"].asString());
+  }
+  else
+  {
+    dates = isUsed_;
+  }
+
+  if (IsConstraint(query, "ModalitiesInStudy"))
+  {
+    MatchModalities(modalities, query["ModalitiesInStudy"].asString());
+  }
+  else
+  {
+    modalities = isUsed_;
+  }
+
+  if (!labels.empty() || labelsConstraint == "None")
+  {
+    MatchLabels(labelsFilter, labels, labelsConstraint);
+  }
+  else
+  {
+    labelsFilter = isUsed_;
+  }
+
+  answer = Json::objectValue;
+
+  {
+    Bitset all = base;
+    all.And(dates);
+    all.And(modalities);
+    all.And(labelsFilter);
+    answer["Count"] = static_cast<Json::UInt64>(all.Count());
+  }
+
+  {
+    Bitset others = base;
+    others.And(dates);
+    others.And(labelsFilter);
+
+    ModalitiesCounter counter(modalities_);
+    others.Visit(counter);
+
+    answer["ModalitiesInStudy"] = Json::objectValue;
+    for (size_t i = 0; i < modalityNames_.size(); i++)
+    {
+      if (counter.GetCount(i) > 0)
+      {
+        answer["ModalitiesInStudy"][modalityNames_[i]] = static_cast<Json::UInt64>(counter.GetCount(i));
+      }
+    }
+  }
+
+  {
+    Bitset others = base;
+    others.And(modalities);
+    others.And(labelsFilter);
+
+    DatesCounter counter(studyDates_, dateRanges);
+    others.Visit(counter);
+    counter.Format(answer["StudyDate"]);
+  }
+
+  {
+    Bitset others = base;
+    others.And(dates);
+    others.And(modalities);
+
+    answer["Labels"] = Json::objectValue;
+    for (Labels::const_iterator it = labels_.begin(); it != labels_.end(); ++it)
+    {
+      answer["Labels"][it->first] = static_cast<Json::UInt64>(others.CountAnd(it->second));
+    }
+  }
+
+  return true;
+}
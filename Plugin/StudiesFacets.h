@@ -0,0 +1,159 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+
+// Keeps the attributes of all the studies that are used by the filter dropdowns of the study
+// list (StudyDate, ModalitiesInStudy and labels) in compact arrays, one value per study, such
+// that the number of studies behind each choice of these filters can be computed in memory.
+// The studies are loaded by a background scan when Orthanc starts and are then updated from the
+// changes.  Since Orthanc does not report the modifications of the labels, the labels of all the
+// studies are re-read periodically.
+class StudiesFacets : public BackgroundStudiesIndex
+{
+public:
+  // One bit per study
+  class Bitset
+  {
+  private:
+    std::vector<uint64_t>  words_;
+
+  public:
+    explicit Bitset(size_t size = 0);
+
+    void Resize(size_t size);
+
+    void Set(size_t index,
+             bool value);
+
+    bool Get(size_t index) const
+    {
+      return (index / 64 < words_.size() &&
+              (words_[index / 64] & (static_cast<uint64_t>(1) << (index % 64))) != 0);
+    }
+
+    void Fill(bool value);
+
+    void And(const Bitset& other);
+
+    void Or(const Bitset& other);
+
+    void AndNot(const Bitset& other);
+
+    size_t Count() const;
+
+    size_t CountAnd(const Bitset& other) const;
+
+    // calls 'index' for each bit that is set
+    template <typename Visitor>
+    void Visit(Visitor& visitor) const
+    {
+      for (size_t w = 0; w < words_.size(); w++)
+      {
+        for (uint64_t word = words_[w]; word != 0; word &= word - 1)
+        {
+          size_t bit = 0;
+          while ((word & (static_cast<uint64_t>(1) << bit)) == 0)
+          {
+            bit++;
+          }
+
+          visitor(w * 64 + bit);
+        }
+      }
+    }
+  };
+
+private:
+  typedef std::map<std::string, Bitset>  Labels;
+
+  boost::mutex                        mutex_;
+  unsigned int                        labelsRefreshPeriod_;  // in seconds
+
+  // the columns: one entry per study, the free slots are reused
+  std::vector<std::string>            orthancIds_;           // empty if the slot is free
+  std::vector<std::string>            studyInstanceUids_;
+  std::vector<uint32_t>               studyDates_;           // YYYYMMDD, 0 if unknown
+  std::vector<uint64_t>               modalities_;           // one bit per entry of 'modalityNames_'
+  Bitset                              isUsed_;
+  std::vector<size_t>                 freeSlots_;
+  std::map<std::string, size_t>       slots_;                // Orthanc ID -> slot
+  std::map<std::string, size_t>       uidSlots_;             // StudyInstanceUID -> slot
+  std::vector<std::string>            modalityNames_;        // at most 64 distinct modalities
+  bool                                hasTooManyModalities_; // true if a modality could not be registered
+  Labels                              labels_;
+  bool                                isReady_;              // false until the initial scan is complete
+
+  void RefreshLabels();
+
+  void RemoveStudyInternal(const std::string& orthancId);
+
+  uint64_t GetModalitiesMask(const std::string& modalities,
+                             bool create);
+
+  void MatchStudyDate(Bitset& target,
+                      const std::string& range) const;
+
+  void MatchModalities(Bitset& target,
+                       const std::string& modalities) const;
+
+  void MatchLabels(Bitset& target,
+                   const std::set<std::string>& labels,
+                   const std::string& constraint) const;
+
+protected:
+  virtual void Build();
+
+  // refreshes the labels
+  virtual void RunPeriodicTask();
+
+  virtual void ApplyChange(const Change& change);
+
+  virtual void AddScannedStudy(const std::string& orthancId,
+                               const Json::Value& study);
+
+  virtual void ClearScannedStudies();
+
+  virtual bool GetScannedStudiesCount(size_t& count);
+
+public:
+  explicit StudiesFacets(unsigned int labelsRefreshPeriod);
+
+  virtual ~StudiesFacets();
+
+  // Counts the studies of each modality, of each label and of each year, month and 'dateRanges'
+  // among the studies that match the 'Query', 'Labels' and 'LabelsConstraint' of 'request'.  As
+  // usual for facets, the counts of a filter ignore the constraint on this filter.  The caller
+  // must only call this for users that have access to all the studies.  The filters on other tags
+  // must have been resolved by the caller in 'studyInstanceUids' (NULL if there is no such filter).
+  // Returns false if the index is not ready yet or if there are more than 64 distinct modalities.
+  bool ComputeFacets(Json::Value& answer,
+                     const Json::Value& request,
+                     const std::vector<std::string>* studyInstanceUids);
+};
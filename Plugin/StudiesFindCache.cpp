@@ -0,0 +1,280 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudiesFindCache.h"
+
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+
+// The headers that do not depend on the user (the other ones, e.g. 'authorization' or 'cookie', define
+// the studies the user has access to and are part of the key)
+static const char* const IGNORED_HEADERS[] = {
+  "accept",
+  "accept-encoding",
+  "accept-language",
+  "cache-control",
+  "connection",
+  "content-length",
+  "content-type",
+  "dnt",
+  "host",
+  "origin",
+  "pragma",
+  "priority",
+  "referer",
+  "te",
+  "traceparent",
+  "user-agent",
+  "x-forwarded-for",
+  "x-request-id"
+};
+
+
+static bool IsIgnoredHeader(const std::string& header)
+{
+  std::string lower = header;
+  Orthanc::Toolbox::ToLowerCase(lower);
+
+  if (boost::starts_with(lower, "sec-"))
+  {
+    return true;
+  }
+
+  for (size_t i = 0; i < sizeof(IGNORED_HEADERS) / sizeof(IGNORED_HEADERS[0]); i++)
+  {
+    if (lower == IGNORED_HEADERS[i])
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+StudiesFindCache::StudiesFindCache(unsigned int maxAge,
+                                   size_t maxEntries,
+                                   unsigned int maxWait) :
+  generation_(0),
+  maxAge_(maxAge),
+  maxEntries_(maxEntries),
+  maxWait_(maxWait)
+{
+}
+
+
+std::string StudiesFindCache::GetKey(const Json::Value& request,
+                                     const OrthancPlugins::HttpHeaders& headers)
+{
+  // the members of a JSON object are sorted -> the same request always gives the same key
+  Json::Value key;
+  key["Request"] = request;
+  key["Headers"] = Json::objectValue;
+
+  for (OrthancPlugins::HttpHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it)
+  {
+    if (!IsIgnoredHeader(it->first))
+    {
+      key["Headers"][it->first] = it->second;
+    }
+  }
+
+  std::string serialized, hash;
+  OrthancPlugins::WriteFastJson(serialized, key);
+  Orthanc::Toolbox::ComputeSHA1(hash, serialized);
+
+  return hash;
+}
+
+
+bool StudiesFindCache::IsValid(const Entry& entry,
+                               const boost::posix_time::ptime& now) const
+{
+  // the mutex must be locked by the caller
+  return (entry.generation_ == generation_ &&
+          (entry.isPending_ || now < entry.expiration_));
+}
+
+
+void StudiesFindCache::RemoveEntries(const boost::posix_time::ptime& now)
+{
+  // the mutex must be locked by the caller
+  for (Entries::iterator it = entries_.begin(); it != entries_.end(); )
+  {
+    if (!it->second->isPending_ &&
+        !IsValid(*it->second, now))
+    {
+      entries_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  // if the cache is still full, remove the entries that expire first
+  while (entries_.size() >= maxEntries_)
+  {
+    Entries::iterator oldest = entries_.end();
+
+    for (Entries::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+      if (!it->second->isPending_ &&
+          (oldest == entries_.end() || it->second->expiration_ < oldest->second->expiration_))
+      {
+        oldest = it;
+      }
+    }
+
+    if (oldest == entries_.end())
+    {
+      break;  // only pending queries
+    }
+
+    entries_.erase(oldest);
+  }
+}
+
+
+void StudiesFindCache::CompleteQuery(const std::string& key,
+                                     boost::shared_ptr<Entry> entry,
+                                     const Json::Value& answer,
+                                     Orthanc::ErrorCode errorCode,
+                                     const std::string& error,
+                                     bool hasError)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    entry->isPending_ = false;
+    entry->hasError_ = hasError;
+    entry->errorCode_ = errorCode;
+    entry->error_ = error;
+    entry->answer_ = answer;
+    entry->expiration_ = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(maxAge_);
+
+    if (hasError)
+    {
+      // the errors are only shared with the queries that were waiting, they are not cached
+      Entries::iterator found = entries_.find(key);
+      if (found != entries_.end() &&
+          found->second == entry)
+      {
+        entries_.erase(found);
+      }
+    }
+  }
+
+  queryCompleted_.notify_all();
+}
+
+
+void StudiesFindCache::SignalChange()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  generation_++;
+}
+
+
+bool StudiesFindCache::Find(Json::Value& answer,
+                            const Json::Value& request,
+                            const OrthancPlugins::HttpHeaders& headers,
+                            const StudiesFinderIndexes& indexes)
+{
+  const std::string key = GetKey(request, headers);
+
+  boost::shared_ptr<Entry> entry;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    Entries::iterator found = entries_.find(key);
+    if (found != entries_.end() &&
+        IsValid(*found->second, now))
+    {
+      // an identical request is running or has been cached, and nothing has changed since it has started
+      boost::shared_ptr<Entry> running = found->second;  // the iterator is invalidated while waiting
+
+      const boost::posix_time::ptime deadline = now + boost::posix_time::seconds(maxWait_);
+
+      while (running->isPending_)
+      {
+        if (!queryCompleted_.timed_wait(lock, deadline))
+        {
+          break;
+        }
+      }
+
+      if (!running->isPending_)
+      {
+        if (running->hasError_)
+        {
+          throw Orthanc::OrthancException(running->errorCode_, running->error_);
+        }
+
+        answer = running->answer_;
+        return true;
+      }
+
+      // the identical request is too slow -> this one is run on its own (its answer is not cached)
+    }
+    else
+    {
+      RemoveEntries(now);
+
+      entry.reset(new Entry);
+      entry->isPending_ = true;
+      entry->hasError_ = false;
+      entry->errorCode_ = Orthanc::ErrorCode_Success;
+      entry->generation_ = generation_;  // a change during the query will make its answer outdated
+      entries_[key] = entry;
+    }
+  }
+
+  if (entry.get() == NULL)
+  {
+    FindStudiesColumnar(answer, request, headers, indexes);
+    return false;
+  }
+
+  try
+  {
+    FindStudiesColumnar(answer, request, headers, indexes);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    CompleteQuery(key, entry, Json::nullValue, e.GetErrorCode(), e.What(), true);
+    throw;
+  }
+  catch (std::exception& e)
+  {
+    CompleteQuery(key, entry, Json::nullValue, Orthanc::ErrorCode_InternalError, e.what(), true);
+    throw;
+  }
+
+  CompleteQuery(key, entry, answer, Orthanc::ErrorCode_Success, "", false);
+  return false;
+}
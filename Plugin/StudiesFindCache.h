@@ -0,0 +1,96 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "StudiesFinder.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+
+
+// Keeps the answers of api/studies/find such that the many users that open the study list on the
+// same view (e.g. the most recent studies) do not run the same query against the database.  The
+// answers are keyed by the request and by the authorization headers of the user, and are discarded
+// as soon as Orthanc reports a change (new instance, deletion, metadata...) or a label is modified
+// through the REST API.  Since the other modifications of the labels are not reported, the answers
+// are never kept more than 'maxAge' seconds.  The identical requests that are received while the first one is running wait for its
+// answer instead of querying the database in parallel, but at most 'maxWait' seconds.
+class StudiesFindCache : public boost::noncopyable
+{
+private:
+  struct Entry
+  {
+    bool                      isPending_;
+    bool                      hasError_;
+    Orthanc::ErrorCode        errorCode_;
+    std::string               error_;
+    uint64_t                  generation_;   // the generation of the changes when the query has started
+    Json::Value               answer_;
+    boost::posix_time::ptime  expiration_;
+  };
+
+  typedef std::map<std::string, boost::shared_ptr<Entry> >  Entries;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  queryCompleted_;
+  Entries                    entries_;
+  uint64_t                   generation_;    // incremented at each change reported by Orthanc
+  unsigned int               maxAge_;        // in seconds
+  size_t                     maxEntries_;
+  unsigned int               maxWait_;       // in seconds
+
+  bool IsValid(const Entry& entry,
+               const boost::posix_time::ptime& now) const;
+
+  void RemoveEntries(const boost::posix_time::ptime& now);
+
+  void CompleteQuery(const std::string& key,
+                     boost::shared_ptr<Entry> entry,
+                     const Json::Value& answer,
+                     Orthanc::ErrorCode errorCode,
+                     const std::string& error,
+                     bool hasError);
+
+public:
+  StudiesFindCache(unsigned int maxAge,
+                   size_t maxEntries,
+                   unsigned int maxWait);
+
+  // Identifies a request and the user that has sent it (through its authorization headers)
+  static std::string GetKey(const Json::Value& request,
+                            const OrthancPlugins::HttpHeaders& headers);
+
+  // Called when Orthanc reports a change on a resource (from the changes callback: only a counter
+  // is incremented)
+  void SignalChange();
+
+  // Same as FindStudiesColumnar().  Returns true if the answer comes from the cache (or from an
+  // identical request that was already running).
+  bool Find(Json::Value& answer,
+            const Json::Value& request,
+            const OrthancPlugins::HttpHeaders& headers,
+            const StudiesFinderIndexes& indexes);
+};
@@ -0,0 +1,600 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudiesFinder.h"
+
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+
+
+static const char* const STUDY_DATE = "StudyDate";
+static const char* const STUDY_INSTANCE_UID = "StudyInstanceUID";
+
+static const char* const TAGS_GROUPS[] = { "MainDicomTags", "PatientMainDicomTags", "RequestedTags" };
+static const size_t TAGS_GROUPS_COUNT = sizeof(TAGS_GROUPS) / sizeof(TAGS_GROUPS[0]);
+
+
+static bool IsStudyDateOrdering(bool& isAscending,
+                                const Json::Value& orderBy)
+{
+  if (orderBy.isArray() &&
+      orderBy.size() == 1 &&
+      orderBy[0]["Type"].asString() == "DicomTag" &&
+      orderBy[0]["Key"].asString() == STUDY_DATE)
+  {
+    isAscending = (orderBy[0]["Direction"].asString() != "DESC");
+    return true;
+  }
+
+  return false;
+}
+
+
+// Only plain dates and date ranges can be narrowed by the keyset ("20240101",
+// "20240101-20241231", "20240101-" or "-20241231")
+static bool ParseDateRange(std::string& lower,
+                           std::string& upper,
+                           const Json::Value& constraint)
+{
+  if (constraint.type() != Json::stringValue)
+  {
+    return false;
+  }
+
+  const std::string range = constraint.asString();
+  if (range.empty() ||
+      range.find_first_of("*?\\") != std::string::npos)
+  {
+    return false;
+  }
+
+  size_t separator = range.find('-');
+  if (separator == std::string::npos)
+  {
+    lower = range;
+    upper = range;
+  }
+  else
+  {
+    lower = range.substr(0, separator);
+    upper = range.substr(separator + 1);
+  }
+
+  return true;
+}
+
+
+static std::string FormatDateRange(const std::string& lower,
+                                   const std::string& upper)
+{
+  if (!lower.empty() && lower == upper)
+  {
+    return lower;
+  }
+  else
+  {
+    return lower + "-" + upper;
+  }
+}
+
+
+// A cursor is only valid for the filters it has been generated for
+static std::string ComputeFiltersHash(const Json::Value& find)
+{
+  Json::Value filters = find;
+  filters.removeMember("RequestedTags");
+
+  std::string serialized, hash;
+  OrthancPlugins::WriteFastJson(serialized, filters);
+  Orthanc::Toolbox::ComputeMD5(hash, serialized);
+
+  return hash;
+}
+
+
+static void DecodeCursor(Json::Value& cursor,
+                         const std::string& encoded,
+                         const std::string& filtersHash)
+{
+  std::string decoded;
+
+  try
+  {
+    Orthanc::Toolbox::DecodeBase64(decoded, encoded);
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid cursor");
+  }
+
+  if (!OrthancPlugins::ReadJson(cursor, decoded) ||
+      !cursor.isObject() ||
+      cursor["Filters"].asString() != filtersHash)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Invalid cursor or cursor used with other filters");
+  }
+}
+
+
+static std::string EncodeCursor(const Json::Value& cursor)
+{
+  std::string serialized, encoded;
+  OrthancPlugins::WriteFastJson(serialized, cursor);
+  Orthanc::Toolbox::EncodeBase64(encoded, serialized);
+
+  return encoded;
+}
+
+
+static void ConvertToColumns(Json::Value& answer,
+                             const Json::Value& studies)
+{
+  const Json::ArrayIndex count = studies.size();
+
+  Json::Value emptyColumn = Json::arrayValue;
+  emptyColumn.resize(count);
+
+  Json::Value& columns = answer["Columns"];
+  Json::Value& tags = answer["Tags"];
+  Json::Value& values = answer["Values"];
+
+  columns = Json::objectValue;
+  tags = Json::arrayValue;
+  values = Json::arrayValue;
+
+  std::map<std::string, Json::ArrayIndex> tagsIndex;
+  std::set<std::string> tagsGroups;
+
+  for (Json::Value::ArrayIndex i = 0; i < count; i++)
+  {
+    const Json::Value& study = studies[i];
+    if (!study.isObject())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unexpected answer from /tools/find");
+    }
+
+    const Json::Value::Members members = study.getMemberNames();
+    for (size_t m = 0; m < members.size(); m++)
+    {
+      bool isTagsGroup = false;
+
+      for (size_t g = 0; g < TAGS_GROUPS_COUNT; g++)
+      {
+        isTagsGroup |= (members[m] == TAGS_GROUPS[g]);
+      }
+
+      if (!isTagsGroup)
+      {
+        if (!columns.isMember(members[m]))
+        {
+          columns[members[m]] = emptyColumn;
+        }
+
+        columns[members[m]][i] = study[members[m]];
+      }
+    }
+
+    for (size_t g = 0; g < TAGS_GROUPS_COUNT; g++)
+    {
+      const Json::Value& group = study[TAGS_GROUPS[g]];
+      if (!group.isObject())
+      {
+        continue;
+      }
+
+      const Json::Value::Members tagsNames = group.getMemberNames();
+      for (size_t t = 0; t < tagsNames.size(); t++)
+      {
+        const std::string& tagName = tagsNames[t];
+
+        std::map<std::string, Json::ArrayIndex>::const_iterator found = tagsIndex.find(tagName);
+        Json::ArrayIndex index;
+
+        if (found == tagsIndex.end())
+        {
+          index = tags.size();
+          tagsIndex[tagName] = index;
+
+          Json::Value tag;
+          tag["Name"] = tagName;
+          tag["Groups"] = Json::arrayValue;
+          tags.append(tag);
+          values.append(emptyColumn);
+        }
+        else
+        {
+          index = found->second;
+        }
+
+        if (tagsGroups.insert(tagName + "|" + TAGS_GROUPS[g]).second)
+        {
+          tags[index]["Groups"].append(TAGS_GROUPS[g]);
+        }
+
+        values[index][i] = group[tagName];
+      }
+    }
+  }
+}
+
+
+static bool IsLastUpdateOrdering(const Json::Value& orderBy)
+{
+  return (orderBy.isArray() &&
+          orderBy.size() == 1 &&
+          orderBy[0].isObject() &&
+          orderBy[0]["Type"].asString() == "Metadata" &&
+          orderBy[0]["Key"].asString() == "LastUpdate" &&
+          orderBy[0]["Direction"].asString() == "DESC");
+}
+
+
+// The ordering is already total, StudyInstanceUID being unique
+static bool IsStudyInstanceUidOrdering(const Json::Value& orderBy)
+{
+  return (orderBy.isArray() &&
+          orderBy.size() == 1 &&
+          orderBy[0].isObject() &&
+          orderBy[0]["Type"].asString() == "DicomTag" &&
+          orderBy[0]["Key"].asString() == STUDY_INSTANCE_UID);
+}
+
+
+// The default study list: no filter, ordered by the last update of the studies
+static bool IsRecentStudiesRequest(const Json::Value& find)
+{
+  const std::vector<std::string> tags = find["Query"].getMemberNames();
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    const Json::Value& value = find["Query"][tags[i]];
+    if (!value.isString() ||
+        (!value.asString().empty() && value.asString() != "*"))
+    {
+      return false;
+    }
+  }
+
+  if (find.isMember("Labels") &&
+      (find["Labels"].size() > 0 ||
+       (find.isMember("LabelsConstraint") && find["LabelsConstraint"].asString() == "None")))
+  {
+    return false;
+  }
+
+  return IsLastUpdateOrdering(find["OrderBy"]);
+}
+
+
+// Loads the studies of a page whose StudyInstanceUIDs (and their ordering) are provided by an index
+static bool FindStudiesPage(Json::Value& studies,
+                            const Json::Value& find,
+                            const OrthancPlugins::HttpHeaders& headers,
+                            const std::vector<std::string>& studyInstanceUids)
+{
+  studies = Json::arrayValue;
+
+  if (studyInstanceUids.empty())
+  {
+    return true;
+  }
+
+  // the studies are looked up by their StudyInstanceUIDs, which does not need any ordering in the
+  // database, and go through the authorization plugin
+  std::string uids;
+  Orthanc::Toolbox::JoinStrings(uids, studyInstanceUids, "\\");
+
+  Json::Value lookup = find;
+  lookup.removeMember("OrderBy");
+  lookup.removeMember("Since");
+  lookup.removeMember("Limit");
+  lookup["Query"][STUDY_INSTANCE_UID] = uids;
+
+  Json::Value found;
+  if (!OrthancPlugins::RestApiPost(found, "/tools/find", lookup, headers, true) ||
+      found.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies");
+  }
+
+  if (found.size() != studyInstanceUids.size())
+  {
+    // some studies are not visible to this user (or the index is late) -> the page must come from the database
+    return false;
+  }
+
+  std::map<std::string, Json::ArrayIndex> positions;
+  for (Json::ArrayIndex i = 0; i < found.size(); i++)
+  {
+    positions[found[i]["MainDicomTags"][STUDY_INSTANCE_UID].asString()] = i;
+  }
+
+  for (size_t i = 0; i < studyInstanceUids.size(); i++)
+  {
+    std::map<std::string, Json::ArrayIndex>::const_iterator position = positions.find(studyInstanceUids[i]);
+    if (position == positions.end())
+    {
+      studies = Json::arrayValue;
+      return false;
+    }
+
+    studies.append(found[position->second]);
+  }
+
+  return true;
+}
+
+
+static void FindStudies(Json::Value& studies,
+                        Json::Value& find,
+                        const OrthancPlugins::HttpHeaders& headers,
+                        const StudiesFinderIndexes& indexes)
+{
+  std::vector<std::string> studyInstanceUids;
+  bool hasStudyInstanceUids = false;
+
+  if (indexes.textIndex_ != NULL &&
+      !find["Query"].isMember(STUDY_INSTANCE_UID) &&
+      indexes.textIndex_->LookupStudies(studyInstanceUids, find["Query"], indexes.maxIndexedStudies_))
+  {
+    hasStudyInstanceUids = true;
+  }
+
+  std::vector<std::string> labelsStudyInstanceUids;
+  if (indexes.labelsIndex_ != NULL &&
+      !find["Query"].isMember(STUDY_INSTANCE_UID) &&
+      find.isMember("Labels") &&
+      find["Labels"].isArray())
+  {
+    std::set<std::string> labels;
+    for (Json::Value::ArrayIndex i = 0; i < find["Labels"].size(); i++)
+    {
+      labels.insert(find["Labels"][i].asString());
+    }
+
+    const std::string constraint = (find.isMember("LabelsConstraint") ? find["LabelsConstraint"].asString() : "All");
+
+    if (indexes.labelsIndex_->LookupStudies(labelsStudyInstanceUids, labels, constraint, indexes.maxLabelsStudies_))
+    {
+      if (hasStudyInstanceUids)
+      {
+        std::sort(studyInstanceUids.begin(), studyInstanceUids.end());
+        std::sort(labelsStudyInstanceUids.begin(), labelsStudyInstanceUids.end());
+
+        std::vector<std::string> intersection;
+        std::set_intersection(studyInstanceUids.begin(), studyInstanceUids.end(),
+                              labelsStudyInstanceUids.begin(), labelsStudyInstanceUids.end(),
+                              std::back_inserter(intersection));
+        studyInstanceUids.swap(intersection);
+      }
+      else
+      {
+        studyInstanceUids.swap(labelsStudyInstanceUids);
+        hasStudyInstanceUids = true;
+      }
+    }
+  }
+
+  if (hasStudyInstanceUids)
+  {
+    if (studyInstanceUids.empty())
+    {
+      studies = Json::arrayValue;
+      return;
+    }
+
+    // the original constraints are kept: Orthanc still checks them (e.g. case sensitivity, labels)
+    // and the authorization plugin still filters the studies
+    std::string uids;
+    Orthanc::Toolbox::JoinStrings(uids, studyInstanceUids, "\\");
+    find["Query"][STUDY_INSTANCE_UID] = uids;
+  }
+
+  if (!OrthancPlugins::RestApiPost(studies, "/tools/find", find, headers, true) ||
+      studies.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to find the studies");
+  }
+}
+
+
+void FindStudiesWithCursor(Json::Value& studies,
+                           std::string& nextCursor,
+                           const Json::Value& request,
+                           const OrthancPlugins::HttpHeaders& headers,
+                           const StudiesFinderIndexes& indexes)
+{
+  if (!request.isObject() ||
+      !request.isMember("Limit") ||
+      !request["Limit"].isUInt() ||
+      request["Limit"].asUInt() == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "A strictly positive 'Limit' is required");
+  }
+
+  const unsigned int limit = request["Limit"].asUInt();
+
+  Json::Value find;
+  find["Level"] = "Study";
+  find["Expand"] = true;
+  find["Query"] = (request.isMember("Query") ? request["Query"] : Json::Value(Json::objectValue));
+
+  static const char* const FORWARDED_FIELDS[] = { "Labels", "LabelsConstraint", "OrderBy", "RequestedTags", "CaseSensitive" };
+  for (size_t i = 0; i < sizeof(FORWARDED_FIELDS) / sizeof(FORWARDED_FIELDS[0]); i++)
+  {
+    if (request.isMember(FORWARDED_FIELDS[i]))
+    {
+      find[FORWARDED_FIELDS[i]] = request[FORWARDED_FIELDS[i]];
+    }
+  }
+
+  const std::string filtersHash = ComputeFiltersHash(find);
+
+  Json::Value cursor;
+  if (request.isMember("Cursor") && request["Cursor"].isString())
+  {
+    DecodeCursor(cursor, request["Cursor"].asString(), filtersHash);
+  }
+
+  bool isAscending = true;
+  std::string lower, upper;
+  const bool isKeyset = (IsStudyDateOrdering(isAscending, find["OrderBy"]) &&
+                         ParseDateRange(lower, upper, find["Query"][STUDY_DATE]));
+
+  const bool isRecentStudies = IsRecentStudiesRequest(find);
+  const bool isLastUpdateOrdering = IsLastUpdateOrdering(find["OrderBy"]);
+
+  std::string cursorDate;
+  uint64_t since = 0;
+
+  if (isKeyset)
+  {
+    if (cursor.isMember("Date"))
+    {
+      // restart from the last returned date, skipping the studies of that date that have already been returned
+      cursorDate = cursor["Date"].asString();
+      since = cursor["Skip"].asUInt64();
+
+      if (isAscending && cursorDate > lower)
+      {
+        lower = cursorDate;
+      }
+      else if (!isAscending && (upper.empty() || cursorDate < upper))
+      {
+        upper = cursorDate;
+      }
+    }
+
+    find["Query"][STUDY_DATE] = FormatDateRange(lower, upper);
+  }
+  else if (cursor.isMember("Since"))
+  {
+    since = cursor["Since"].asUInt64();
+  }
+
+  if (find.isMember("OrderBy") && find["OrderBy"].isArray() && find["OrderBy"].size() > 0 &&
+      !IsStudyInstanceUidOrdering(find["OrderBy"]))
+  {
+    // make the ordering total such that the pages neither overlap nor miss studies
+    Json::Value tieBreaker;
+    tieBreaker["Type"] = "DicomTag";
+    tieBreaker["Key"] = STUDY_INSTANCE_UID;
+    tieBreaker["Direction"] = (isAscending ? "ASC" : "DESC");
+    find["OrderBy"].append(tieBreaker);
+  }
+
+  find["Limit"] = limit + 1;  // one more study to know if there are more studies to load
+
+  if (since > 0)
+  {
+    find["Since"] = static_cast<Json::UInt64>(since);
+  }
+
+  studies = Json::arrayValue;
+  std::vector<std::string> pageStudyInstanceUids;
+
+  if (((isRecentStudies &&
+        indexes.recentStudies_ != NULL &&
+        indexes.recentStudies_->GetStudies(pageStudyInstanceUids, since, limit + 1)) ||
+       (isLastUpdateOrdering &&
+        indexes.predefinedFilters_ != NULL &&
+        indexes.predefinedFilters_->GetStudies(pageStudyInstanceUids, find, since, limit + 1))) &&
+      FindStudiesPage(studies, find, headers, pageStudyInstanceUids))
+  {
+    // the page has been served from the index of the recent studies or from a predefined filter
+  }
+  else
+  {
+    FindStudies(studies, find, headers, indexes);
+  }
+
+  const bool isComplete = (studies.size() <= limit);
+  if (!isComplete)
+  {
+    studies.resize(limit);
+  }
+
+  nextCursor.clear();
+
+  if (!isComplete)
+  {
+    Json::Value next;
+    next["Filters"] = filtersHash;
+
+    if (isKeyset)
+    {
+      const std::string lastDate = studies[limit - 1]["MainDicomTags"][STUDY_DATE].asString();
+
+      uint64_t skip = 0;
+      for (Json::Value::ArrayIndex i = limit; i > 0 && studies[i - 1]["MainDicomTags"][STUDY_DATE].asString() == lastDate; i--)
+      {
+        skip++;
+      }
+
+      if (lastDate == cursorDate)
+      {
+        skip += since;  // the whole page has the same date as the previous one
+      }
+
+      next["Date"] = lastDate;
+      next["Skip"] = static_cast<Json::UInt64>(skip);
+    }
+    else
+    {
+      next["Since"] = static_cast<Json::UInt64>(since + limit);
+    }
+
+    nextCursor = EncodeCursor(next);
+  }
+}
+
+
+bool HasKeysetCursor(const Json::Value& request)
+{
+  bool isAscending;
+  std::string lower, upper;
+  return (request.isObject() &&
+          IsStudyDateOrdering(isAscending, request["OrderBy"]) &&
+          request.isMember("Query") &&
+          ParseDateRange(lower, upper, request["Query"][STUDY_DATE]));
+}
+
+
+void FindStudiesColumnar(Json::Value& answer,
+                         const Json::Value& request,
+                         const OrthancPlugins::HttpHeaders& headers,
+                         const StudiesFinderIndexes& indexes)
+{
+  Json::Value studies;
+  std::string nextCursor;
+  FindStudiesWithCursor(studies, nextCursor, request, headers, indexes);
+
+  answer = Json::objectValue;
+  answer["Count"] = studies.size();
+  answer["IsComplete"] = nextCursor.empty();
+  answer["Cursor"] = (nextCursor.empty() ? Json::Value(Json::nullValue) : Json::Value(nextCursor));
+
+  ConvertToColumns(answer, studies);
+}
@@ -0,0 +1,93 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "LabelsIndex.h"
+#include "PredefinedFilters.h"
+#include "RecentStudiesIndex.h"
+#include "StudiesTextIndex.h"
+
+
+// The in-memory indexes that can speed up FindStudiesColumnar() (NULL if they are disabled)
+struct StudiesFinderIndexes
+{
+  StudiesTextIndex*    textIndex_;
+  size_t               maxIndexedStudies_;   // above this number of matches, the text index is not used
+  RecentStudiesIndex*  recentStudies_;
+  LabelsIndex*         labelsIndex_;
+  size_t               maxLabelsStudies_;    // above this number of matches, the labels index is not used
+  PredefinedFilters*   predefinedFilters_;
+
+  StudiesFinderIndexes() :
+    textIndex_(NULL),
+    maxIndexedStudies_(0),
+    recentStudies_(NULL),
+    labelsIndex_(NULL),
+    maxLabelsStudies_(0),
+    predefinedFilters_(NULL)
+  {
+  }
+};
+
+
+// Runs a study-level /tools/find on behalf of the study list and returns a compact
+// columnar answer: the tag names are listed once and their values are stored in one
+// array per tag.  Pagination is driven by an opaque 'Cursor'.  When the studies are
+// ordered by StudyDate and the 'Query' constrains StudyDate to a plain date or a date
+// range (see HasKeysetCursor()), the cursor is a keyset (the last StudyDate that has
+// been returned) such that deep pages are as cheap as the first one.  Otherwise, the
+// cursor falls back to an offset in the result set.  This notably includes the
+// default study list ordered by LastUpdate, whose deep pages are only cheap if they
+// are served by the index of the recent studies or by a predefined filter.
+//
+// The request contains the same filters as /tools/find: 'Query', 'Labels',
+// 'LabelsConstraint', 'OrderBy', 'RequestedTags', 'CaseSensitive', plus 'Limit'
+// and 'Cursor'.  The 'headers' are forwarded to Orthanc such that the authorization
+// plugin can filter the studies the user has access to.
+//
+// If the text index (resp. the labels index) resolves the text filters of the 'Query' (resp. the
+// 'Labels' constraint) to at most 'maxIndexedStudies_' (resp. 'maxLabelsStudies_') studies, the /tools/find is restricted to
+// these StudyInstanceUIDs.  If the request has no
+// filter and is ordered by LastUpdate (the default study list), the studies of the page are
+// taken from the index of the recent studies.  Likewise, if the request has the same filters as a
+// predefined filter and is ordered by LastUpdate, the studies of the page are taken from the result
+// set of this predefined filter.
+void FindStudiesColumnar(Json::Value& answer,
+                         const Json::Value& request,
+                         const OrthancPlugins::HttpHeaders& headers,
+                         const StudiesFinderIndexes& indexes);
+
+
+// Same as FindStudiesColumnar(), but provides the studies as returned by /tools/find and the
+// cursor of the next page ('nextCursor' is empty if there are no more studies)
+void FindStudiesWithCursor(Json::Value& studies,
+                           std::string& nextCursor,
+                           const Json::Value& request,
+                           const OrthancPlugins::HttpHeaders& headers,
+                           const StudiesFinderIndexes& indexes);
+
+
+// Whether FindStudiesWithCursor() pages the request with a keyset cursor (ordered by StudyDate and
+// constrained to a date range): its pages are not shifted by the studies that are updated meanwhile,
+// and only by the studies that are added or removed at the last returned StudyDate
+bool HasKeysetCursor(const Json::Value& request);
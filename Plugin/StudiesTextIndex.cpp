@@ -0,0 +1,455 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudiesTextIndex.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+
+
+static const size_t TRIGRAM_LENGTH = 3;
+
+static const char* const FIELD_TAGS[] = {
+  "PatientName",
+  "PatientID",
+  "AccessionNumber",
+  "StudyDescription"
+};
+
+
+static uint32_t GetTrigram(const std::string& value,
+                           size_t position)
+{
+  return ((static_cast<uint32_t>(static_cast<uint8_t>(value[position])) << 16) |
+          (static_cast<uint32_t>(static_cast<uint8_t>(value[position + 1])) << 8) |
+          static_cast<uint32_t>(static_cast<uint8_t>(value[position + 2])));
+}
+
+
+static void GetTrigrams(std::set<uint32_t>& trigrams,
+                        const std::string& value)
+{
+  for (size_t i = 0; i + TRIGRAM_LENGTH <= value.size(); i++)
+  {
+    trigrams.insert(GetTrigram(value, i));
+  }
+}
+
+
+// DICOM wildcard matching ('*' and '?') on normalized values
+static bool MatchWildcard(const std::string& value,
+                          const std::string& pattern)
+{
+  size_t v = 0, p = 0;
+  size_t star = std::string::npos, mark = 0;
+
+  while (v < value.size())
+  {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == value[v]))
+    {
+      v++;
+      p++;
+    }
+    else if (p < pattern.size() && pattern[p] == '*')
+    {
+      star = p++;
+      mark = v;
+    }
+    else if (star != std::string::npos)
+    {
+      p = star + 1;
+      v = ++mark;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+  {
+    p++;
+  }
+
+  return p == pattern.size();
+}
+
+
+static void Intersect(std::vector<uint32_t>& target,
+                      const std::vector<uint32_t>& other)
+{
+  std::vector<uint32_t> result;
+  std::set_intersection(target.begin(), target.end(), other.begin(), other.end(), std::back_inserter(result));
+  target.swap(result);
+}
+
+
+static std::string GetTagValue(const Json::Value& study,
+                               const char* tags,
+                               const char* tag)
+{
+  if (study.isMember(tags) &&
+      study[tags].isObject() &&
+      study[tags].isMember(tag) &&
+      study[tags][tag].isString())
+  {
+    return study[tags][tag].asString();
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+StudiesTextIndex::StudiesTextIndex() :
+  BackgroundStudiesIndex("studies text index", 1),
+  isReady_(false)
+{
+}
+
+
+StudiesTextIndex::~StudiesTextIndex()
+{
+  Stop();
+}
+
+
+bool StudiesTextIndex::LookupField(Field& field,
+                                   const std::string& tag)
+{
+  for (size_t i = 0; i < Field_Count; i++)
+  {
+    if (tag == FIELD_TAGS[i])
+    {
+      field = static_cast<Field>(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+std::string StudiesTextIndex::Normalize(const std::string& value)
+{
+  // same normalization as the identifier tags in the Orthanc database
+  std::string s = Orthanc::Toolbox::ConvertToAscii(value);
+  Orthanc::Toolbox::ToUpperCase(s);
+  return Orthanc::Toolbox::StripSpaces(s);
+}
+
+
+void StudiesTextIndex::Build()
+{
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  if (!ScanStudies(""))
+  {
+    return;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(indexMutex_);
+  isReady_ = true;
+
+  LOG(WARNING) << "OE2: The studies text index contains " << slots_.size() << " studies (built in "
+               << (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() << " ms)";
+}
+
+
+void StudiesTextIndex::ClearScannedStudies()
+{
+  boost::unique_lock<boost::shared_mutex> lock(indexMutex_);
+
+  studies_.clear();
+  freeSlots_.clear();
+  slots_.clear();
+
+  for (size_t field = 0; field < Field_Count; field++)
+  {
+    trigrams_[field].clear();
+  }
+}
+
+
+bool StudiesTextIndex::GetScannedStudiesCount(size_t& count)
+{
+  boost::shared_lock<boost::shared_mutex> lock(indexMutex_);
+  count = slots_.size();
+  return true;
+}
+
+
+void StudiesTextIndex::ApplyChange(const Change& change)
+{
+  if (change.isDeleted_)
+  {
+    RemoveStudy(change.studyId_);
+  }
+  else
+  {
+    Json::Value study;
+    if (OrthancPlugins::RestApiGet(study, "/studies/" + change.studyId_, false))
+    {
+      AddScannedStudy(change.studyId_, study);
+    }
+    else
+    {
+      // the study has been deleted in the meantime
+      RemoveStudy(change.studyId_);
+    }
+  }
+}
+
+
+void StudiesTextIndex::AddScannedStudy(const std::string& orthancId,
+                                       const Json::Value& study)
+{
+  boost::unique_lock<boost::shared_mutex> lock(indexMutex_);
+
+  // the tags of a study may have changed (e.g. new instances, modification) -> re-index it
+  RemoveStudyInternal(orthancId);
+
+  uint32_t slot;
+  if (freeSlots_.empty())
+  {
+    slot = static_cast<uint32_t>(studies_.size());
+    studies_.push_back(Study());
+  }
+  else
+  {
+    slot = freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+
+  Study& entry = studies_[slot];
+  entry.orthancId_ = orthancId;
+  entry.studyInstanceUid_ = GetTagValue(study, "MainDicomTags", "StudyInstanceUID");
+  entry.values_[Field_PatientName] = Normalize(GetTagValue(study, "PatientMainDicomTags", "PatientName"));
+  entry.values_[Field_PatientID] = Normalize(GetTagValue(study, "PatientMainDicomTags", "PatientID"));
+  entry.values_[Field_AccessionNumber] = Normalize(GetTagValue(study, "MainDicomTags", "AccessionNumber"));
+  entry.values_[Field_StudyDescription] = Normalize(GetTagValue(study, "MainDicomTags", "StudyDescription"));
+
+  slots_[orthancId] = slot;
+
+  for (size_t field = 0; field < Field_Count; field++)
+  {
+    std::set<uint32_t> trigrams;
+    GetTrigrams(trigrams, entry.values_[field]);
+
+    for (std::set<uint32_t>::const_iterator it = trigrams.begin(); it != trigrams.end(); ++it)
+    {
+      Postings& postings = trigrams_[field][*it];
+      postings.insert(std::lower_bound(postings.begin(), postings.end(), slot), slot);
+    }
+  }
+}
+
+
+void StudiesTextIndex::RemoveStudy(const std::string& orthancId)
+{
+  boost::unique_lock<boost::shared_mutex> lock(indexMutex_);
+  RemoveStudyInternal(orthancId);
+}
+
+
+void StudiesTextIndex::RemoveStudyInternal(const std::string& orthancId)
+{
+  // the index mutex must be locked by the caller
+  std::map<std::string, uint32_t>::iterator found = slots_.find(orthancId);
+  if (found == slots_.end())
+  {
+    return;
+  }
+
+  const uint32_t slot = found->second;
+  Study& entry = studies_[slot];
+
+  for (size_t field = 0; field < Field_Count; field++)
+  {
+    std::set<uint32_t> trigrams;
+    GetTrigrams(trigrams, entry.values_[field]);
+
+    for (std::set<uint32_t>::const_iterator it = trigrams.begin(); it != trigrams.end(); ++it)
+    {
+      Trigrams::iterator postings = trigrams_[field].find(*it);
+      if (postings != trigrams_[field].end())
+      {
+        Postings::iterator p = std::lower_bound(postings->second.begin(), postings->second.end(), slot);
+        if (p != postings->second.end() && *p == slot)
+        {
+          postings->second.erase(p);
+        }
+
+        if (postings->second.empty())
+        {
+          trigrams_[field].erase(postings);
+        }
+      }
+    }
+
+    entry.values_[field].clear();
+  }
+
+  entry.orthancId_.clear();
+  entry.studyInstanceUid_.clear();
+  freeSlots_.push_back(slot);
+  slots_.erase(found);
+}
+
+
+bool StudiesTextIndex::LookupCandidates(std::vector<uint32_t>& candidates,
+                                        Field field,
+                                        const std::string& pattern) const
+{
+  // the index mutex must be locked by the caller
+  bool hasTrigram = false;
+
+  size_t chunkStart = 0;
+  for (size_t i = 0; i <= pattern.size(); i++)
+  {
+    if (i == pattern.size() || pattern[i] == '*' || pattern[i] == '?')
+    {
+      // literal chunk [chunkStart, i)
+      for (size_t j = chunkStart; j + TRIGRAM_LENGTH <= i; j++)
+      {
+        Trigrams::const_iterator postings = trigrams_[field].find(GetTrigram(pattern, j));
+
+        if (postings == trigrams_[field].end())
+        {
+          candidates.clear();
+          return true;
+        }
+        else if (!hasTrigram)
+        {
+          candidates = postings->second;
+          hasTrigram = true;
+        }
+        else
+        {
+          Intersect(candidates, postings->second);
+        }
+      }
+
+      chunkStart = i + 1;
+    }
+  }
+
+  return hasTrigram;
+}
+
+
+bool StudiesTextIndex::LookupStudies(std::vector<std::string>& studyInstanceUids,
+                                     const Json::Value& query,
+                                     size_t maxResults)
+{
+  studyInstanceUids.clear();
+
+  boost::shared_lock<boost::shared_mutex> lock(indexMutex_);
+
+  if (!isReady_ ||
+      !query.isObject())
+  {
+    return false;
+  }
+
+  std::vector<std::pair<Field, std::string> > constraints;
+  std::vector<uint32_t> candidates;
+  bool hasCandidates = false;
+
+  const std::vector<std::string> tags = query.getMemberNames();
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    Field field;
+    if (!LookupField(field, tags[i]) ||
+        !query[tags[i]].isString() ||
+        query[tags[i]].asString().find('\\') != std::string::npos)  // lists of values are not indexed
+    {
+      continue;
+    }
+
+    // the normalization to ASCII may not give the same number of characters as in the database, which
+    // would break the matching of '?' and of the non-ASCII characters -> leave this query to Orthanc
+    const std::string& value = query[tags[i]].asString();
+    for (size_t j = 0; j < value.size(); j++)
+    {
+      if (value[j] == '?' ||
+          static_cast<uint8_t>(value[j]) >= 0x80)
+      {
+        return false;
+      }
+    }
+
+    const std::string pattern = Normalize(query[tags[i]].asString());
+    if (pattern.empty() || pattern == "*")
+    {
+      continue;
+    }
+
+    constraints.push_back(std::make_pair(field, pattern));
+
+    std::vector<uint32_t> fieldCandidates;
+    if (LookupCandidates(fieldCandidates, field, pattern))
+    {
+      if (!hasCandidates)
+      {
+        candidates.swap(fieldCandidates);
+        hasCandidates = true;
+      }
+      else
+      {
+        Intersect(candidates, fieldCandidates);
+      }
+    }
+  }
+
+  if (!hasCandidates)
+  {
+    return false;  // no constraint with at least 3 consecutive characters
+  }
+
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    const Study& study = studies_[candidates[i]];
+
+    bool isMatch = true;
+    for (size_t j = 0; isMatch && j < constraints.size(); j++)
+    {
+      isMatch = MatchWildcard(study.values_[constraints[j].first], constraints[j].second);
+    }
+
+    if (isMatch && !study.studyInstanceUid_.empty())
+    {
+      if (studyInstanceUids.size() >= maxResults)
+      {
+        studyInstanceUids.clear();
+        return false;
+      }
+
+      studyInstanceUids.push_back(study.studyInstanceUid_);
+    }
+  }
+
+  return true;
+}
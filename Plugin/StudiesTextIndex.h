@@ -0,0 +1,108 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BackgroundStudiesIndex.h"
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <map>
+#include <set>
+#include <vector>
+
+
+// In-memory trigram index over the PatientName, PatientID, AccessionNumber and StudyDescription
+// of all the studies, such that the substring filters of the study list ('*SMI*') can be resolved
+// without scanning the database.  The index is built by a background scan of the studies when
+// Orthanc starts, and is then updated from the changes (new, stable and deleted studies).
+//
+// The values are normalized like the Orthanc identifiers (ASCII, upper case) such that the index
+// returns a superset of the studies that Orthanc would match.
+class StudiesTextIndex : public BackgroundStudiesIndex
+{
+public:
+  enum Field
+  {
+    Field_PatientName,
+    Field_PatientID,
+    Field_AccessionNumber,
+    Field_StudyDescription,
+    Field_Count
+  };
+
+private:
+  struct Study
+  {
+    std::string  orthancId_;          // empty if the slot is free
+    std::string  studyInstanceUid_;
+    std::string  values_[Field_Count];  // normalized values
+  };
+
+  typedef std::vector<uint32_t>               Postings;   // sorted indexes in 'studies_'
+  typedef std::map<uint32_t, Postings>        Trigrams;
+
+  boost::shared_mutex                 indexMutex_;
+  std::vector<Study>                  studies_;
+  std::vector<uint32_t>               freeSlots_;
+  std::map<std::string, uint32_t>     slots_;      // Orthanc ID -> index in 'studies_'
+  Trigrams                            trigrams_[Field_Count];
+  bool                                isReady_;    // false until the initial scan is complete
+
+  void RemoveStudy(const std::string& orthancId);
+
+  void RemoveStudyInternal(const std::string& orthancId);
+
+  // returns false if the pattern has no literal chunk of at least 3 characters
+  bool LookupCandidates(std::vector<uint32_t>& candidates,
+                        Field field,
+                        const std::string& pattern) const;
+
+protected:
+  virtual void Build();
+
+  virtual void ApplyChange(const Change& change);
+
+  virtual void AddScannedStudy(const std::string& orthancId,
+                               const Json::Value& study);
+
+  virtual void ClearScannedStudies();
+
+  virtual bool GetScannedStudiesCount(size_t& count);
+
+public:
+  StudiesTextIndex();
+
+  virtual ~StudiesTextIndex();
+
+  static bool LookupField(Field& field,
+                          const std::string& tag);
+
+  static std::string Normalize(const std::string& value);
+
+  // Returns false if the index can not resolve this query (no constraint on an indexed field with
+  // at least 3 consecutive characters, or more than 'maxResults' matching studies).  Otherwise,
+  // 'studyInstanceUids' contains the studies that match the constraints on the indexed fields.
+  bool LookupStudies(std::vector<std::string>& studyInstanceUids,
+                     const Json::Value& query,
+                     size_t maxResults);
+};
@@ -0,0 +1,684 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudySummaries.h"
+
+#include <Logging.h>
+
+#include <string.h>
+
+
+static const char* const SOP_CLASS_PDF = "1.2.840.10008.5.1.4.1.1.104.1";
+static const char* const SOP_CLASS_SR_PREFIX = "1.2.840.10008.5.1.4.1.1.88.";
+static const char* const SOP_CLASS_KEY_OBJECT_SELECTION = "1.2.840.10008.5.1.4.1.1.88.59";
+static const char* const SOP_CLASS_WSI = "1.2.840.10008.5.1.4.1.1.77.1.6";
+
+static const char* const STORE_ID = "oe2-study-summaries";
+static const unsigned int STORE_FORMAT = 2;   // to increment each time the content of the summaries changes
+
+
+static bool IsStructuredReport(const std::string& sopClassUid)
+{
+  // the key object selections are not reports, they only reference other instances
+  return (sopClassUid.compare(0, strlen(SOP_CLASS_SR_PREFIX), SOP_CLASS_SR_PREFIX) == 0 &&
+          sopClassUid != SOP_CLASS_KEY_OBJECT_SELECTION);
+}
+
+
+static bool IsReport(const std::string& sopClassUid)
+{
+  return (sopClassUid == SOP_CLASS_PDF ||
+          IsStructuredReport(sopClassUid));
+}
+
+
+static std::string GetSopClassUid(const std::string& instanceId)
+{
+  std::string sopClassUid;
+  if (OrthancPlugins::RestApiGetString(sopClassUid, "/instances/" + instanceId + "/metadata/SopClassUid", false))
+  {
+    return sopClassUid;
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+// Gets the SOP class of all the instances of the study ('series' is the answer of '/studies/{id}/series?expand')
+static void GetSopClassUids(std::map<std::string, std::string>& sopClassUids,
+                            const std::string& studyId,
+                            const Json::Value& series,
+                            bool hasExtendedFind)
+{
+  sopClassUids.clear();
+
+  if (hasExtendedFind)
+  {
+    // a single query for the whole study
+    Json::Value find;
+    find["Level"] = "Instance";
+    find["Query"] = Json::objectValue;
+    find["ParentStudy"] = studyId;
+    find["ResponseContent"] = Json::arrayValue;
+    find["ResponseContent"].append("Metadata");
+
+    Json::Value instances;
+    if (OrthancPlugins::RestApiPost(instances, "/tools/find", find, false) &&
+        instances.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+      {
+        sopClassUids[instances[i]["ID"].asString()] = instances[i]["Metadata"]["SopClassUid"].asString();
+      }
+
+      return;
+    }
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    const Json::Value& instances = series[i]["Instances"];
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      sopClassUids[instances[j].asString()] = GetSopClassUid(instances[j].asString());
+    }
+  }
+}
+
+
+// Checks that the series and their number of instances still match the study, since
+// deleting a single instance does not modify the "LastUpdate" of its study
+static bool IsUpToDate(const Json::Value& summary,
+                       const std::string& studyId)
+{
+  Json::Value study;
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyId, false) ||
+      !OrthancPlugins::RestApiGet(series, "/studies/" + studyId + "/series?expand", false) ||
+      series.type() != Json::arrayValue ||
+      study["LastUpdate"] != summary["LastUpdate"] ||
+      series.size() != summary["Series"].size())
+  {
+    return false;
+  }
+
+  std::map<std::string, Json::ArrayIndex> instancesCounts;
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    instancesCounts[series[i]["ID"].asString()] = series[i]["Instances"].size();
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < summary["Series"].size(); i++)
+  {
+    std::map<std::string, Json::ArrayIndex>::const_iterator found = instancesCounts.find(summary["Series"][i]["ID"].asString());
+    if (found == instancesCounts.end() ||
+        found->second != summary["Series"][i]["InstancesCount"].asUInt())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+bool StudySummaries::Compute(Json::Value& summary,
+                             const std::string& studyId)
+{
+  Json::Value study;
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyId, false) ||
+      !OrthancPlugins::RestApiGet(series, "/studies/" + studyId + "/series?expand", false) ||
+      series.type() != Json::arrayValue)
+  {
+    return false;
+  }
+
+  // the SOP class of each instance is checked since some series mix SOP classes (e.g.
+  // reports, presentation states or secondary captures in an image series)
+  std::map<std::string, std::string> sopClassUids;
+  GetSopClassUids(sopClassUids, studyId, series, hasExtendedFind_);
+
+  std::set<std::string> sopClasses;
+  std::set<std::string> modalities;
+  unsigned int instancesCount = 0;
+  bool hasWsi = false;
+  bool hasVolume = false;
+  bool hasCtVolume = false;
+  bool hasPtVolume = false;
+
+  summary = Json::objectValue;
+  summary["ID"] = studyId;
+  summary["LastUpdate"] = study["LastUpdate"];   // to detect outdated summaries in the persistent store
+  summary["Series"] = Json::arrayValue;
+  summary["PdfReports"] = Json::arrayValue;
+  summary["StructuredReports"] = Json::arrayValue;
+
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    const Json::Value& instances = series[i]["Instances"];
+    const Json::Value& seriesTags = series[i]["MainDicomTags"];
+    const std::string modality = seriesTags["Modality"].asString();
+
+    std::string firstSopClassUid;
+
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      const std::string instanceId = instances[j].asString();
+      const std::string sopClassUid = sopClassUids[instanceId];
+
+      if (j == 0)
+      {
+        firstSopClassUid = sopClassUid;
+      }
+
+      if (sopClassUid.empty())
+      {
+        continue;
+      }
+
+      sopClasses.insert(sopClassUid);
+      hasWsi |= (sopClassUid == SOP_CLASS_WSI);
+
+      if (IsReport(sopClassUid))
+      {
+        Json::Value report;
+        report["ID"] = instanceId;
+        report["ParentSeries"] = series[i]["ID"];
+        report["SeriesDate"] = seriesTags["SeriesDate"];
+        report["SeriesDescription"] = seriesTags["SeriesDescription"];
+
+        if (sopClassUid == SOP_CLASS_PDF)
+        {
+          summary["PdfReports"].append(report);
+        }
+        else
+        {
+          summary["StructuredReports"].append(report);
+        }
+      }
+    }
+
+    Json::Value item;
+    item["ID"] = series[i]["ID"];
+    item["MainDicomTags"] = seriesTags;
+    item["InstancesCount"] = instances.size();
+    item["SOPClassUID"] = firstSopClassUid;
+    summary["Series"].append(item);
+
+    instancesCount += instances.size();
+
+    if (!modality.empty())
+    {
+      modalities.insert(modality);
+    }
+
+    hasWsi |= (modality == "SM");
+
+    if (instances.size() > 1 && (modality == "CT" || modality == "MR" || modality == "PT"))
+    {
+      hasVolume = true;
+      hasCtVolume |= (modality == "CT");
+      hasPtVolume |= (modality == "PT");
+    }
+  }
+
+  summary["InstancesCount"] = instancesCount;
+
+  summary["SOPClasses"] = Json::arrayValue;
+  for (std::set<std::string>::const_iterator it = sopClasses.begin(); it != sopClasses.end(); ++it)
+  {
+    summary["SOPClasses"].append(*it);
+  }
+
+  summary["Modalities"] = Json::arrayValue;
+  for (std::set<std::string>::const_iterator it = modalities.begin(); it != modalities.end(); ++it)
+  {
+    summary["Modalities"].append(*it);
+  }
+
+  Json::Value& viewers = summary["Viewers"];
+  viewers["HasWsi"] = hasWsi;
+  viewers["HasVolume"] = hasVolume;         // e.g. for MPR and volume rendering
+  viewers["HasPetCt"] = (hasCtVolume && hasPtVolume);   // e.g. for TMTV
+
+  return true;
+}
+
+
+StudySummaries::StudySummaries(size_t maxSize,
+                               unsigned int threadsCount,
+                               bool isPersistent) :
+  maxSize_(maxSize),
+  deletionsGeneration_(0),
+  hasExtendedFind_(false),
+  isRunning_(false),
+  threadsCount_(threadsCount)
+{
+  if (maxSize_ == 0 ||
+      threadsCount_ == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  if (isPersistent)
+  {
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+    store_.reset(new OrthancPlugins::KeyValueStore(STORE_ID));
+#else
+    LOG(WARNING) << "OE2: The study summaries can not be persisted since the plugin has been built with an Orthanc SDK that does not support key-value stores";
+#endif
+  }
+}
+
+
+StudySummaries::~StudySummaries()
+{
+  Stop();
+}
+
+
+void StudySummaries::Start()
+{
+  Json::Value system;
+  hasExtendedFind_ = (OrthancPlugins::RestApiGet(system, "/system", false) &&
+                      system["Capabilities"]["HasExtendedFind"].asBool());
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+}
+
+
+void StudySummaries::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRunning_ = false;
+  }
+
+  pendingChanged_.notify_all();
+
+  for (size_t i = 0; i < workers_.size(); i++)
+  {
+    if (workers_[i]->joinable())
+    {
+      workers_[i]->join();
+    }
+
+    delete workers_[i];
+  }
+
+  workers_.clear();
+}
+
+
+void StudySummaries::Worker(StudySummaries* that)
+{
+  for (;;)
+  {
+    std::string studyId;
+    bool isDeletion = false;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (that->isRunning_ && that->pending_.empty() && that->pendingDeletions_.empty())
+      {
+        that->pendingChanged_.wait(lock);
+      }
+
+      if (!that->isRunning_)
+      {
+        return;
+      }
+
+      if (!that->pendingDeletions_.empty())
+      {
+        studyId = *that->pendingDeletions_.begin();
+        that->pendingDeletions_.erase(that->pendingDeletions_.begin());
+        isDeletion = true;
+      }
+      else
+      {
+        studyId = that->pending_.front();
+        that->pending_.pop_front();
+        that->pendingSet_.erase(studyId);
+      }
+    }
+
+    try
+    {
+      if (isDeletion)
+      {
+        that->DeletePersistent(studyId);
+      }
+      else
+      {
+        Json::Value summary;
+        that->ComputeAndStore(summary, studyId);
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while updating the summary of study " << studyId << ": " << e.What();
+    }
+  }
+}
+
+
+bool StudySummaries::LookupPersistent(Json::Value& summary,
+                                      const std::string& studyId)
+{
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+  std::string value;
+  if (store_.get() == NULL ||
+      !store_->GetValue(value, studyId))
+  {
+    return false;
+  }
+
+  // the summary might have been computed by another Orthanc or before a modification
+  // whose change has not been received -> check it still matches the study
+  if (!OrthancPlugins::ReadJson(summary, value) ||
+      summary["Format"].asUInt() != STORE_FORMAT ||
+      !IsUpToDate(summary, studyId))
+  {
+    DeletePersistent(studyId);
+    return false;
+  }
+
+  summary.removeMember("Format");
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+void StudySummaries::StorePersistent(const std::string& studyId,
+                                     const Json::Value& summary)
+{
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+  if (store_.get() != NULL)
+  {
+    Json::Value value = summary;
+    value["Format"] = STORE_FORMAT;
+
+    std::string serialized;
+    OrthancPlugins::WriteFastJson(serialized, value);
+    store_->Store(studyId, serialized);
+  }
+#endif
+}
+
+
+void StudySummaries::DeletePersistent(const std::string& studyId)
+{
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+  if (store_.get() != NULL)
+  {
+    store_->DeleteKey(studyId);
+  }
+#endif
+}
+
+
+void StudySummaries::InvalidateInternal(const std::string& studyId)
+{
+  checkedGeneration_.erase(studyId);
+
+  Json::Value summary;
+  if (cache_.Invalidate(studyId, summary))
+  {
+    const Json::Value& series = summary["Series"];
+    for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+    {
+      seriesToStudy_.erase(series[i]["ID"].asString());
+    }
+  }
+
+  std::map<std::string, bool>::iterator found = computing_.find(studyId);
+  if (found != computing_.end())
+  {
+    found->second = false;
+  }
+}
+
+
+void StudySummaries::Store(const std::string& studyId,
+                           const Json::Value& summary)
+{
+  InvalidateInternal(studyId);
+
+  while (cache_.GetSize() >= maxSize_)
+  {
+    Json::Value oldest;
+    cache_.RemoveOldest(oldest);
+    checkedGeneration_.erase(oldest["ID"].asString());
+
+    const Json::Value& series = oldest["Series"];
+    for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+    {
+      seriesToStudy_.erase(series[i]["ID"].asString());
+    }
+  }
+
+  cache_.Add(studyId, summary);
+  checkedGeneration_[studyId] = deletionsGeneration_;
+
+  const Json::Value& series = summary["Series"];
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    seriesToStudy_[series[i]["ID"].asString()] = studyId;
+  }
+}
+
+
+bool StudySummaries::ComputeAndStore(Json::Value& summary,
+                                     const std::string& studyId)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    computing_[studyId] = true;
+  }
+
+  bool found = false;
+
+  try
+  {
+    found = Compute(summary, studyId);
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    computing_.erase(studyId);
+    throw;
+  }
+
+  bool isUpToDate;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // don't cache a summary if the study has been modified in the meantime
+    isUpToDate = (found && computing_[studyId]);
+    if (isUpToDate)
+    {
+      Store(studyId, summary);
+    }
+
+    computing_.erase(studyId);
+  }
+
+  if (isUpToDate)
+  {
+    StorePersistent(studyId, summary);
+  }
+
+  return found;
+}
+
+
+bool StudySummaries::Get(Json::Value& summary,
+                         const std::string& studyId)
+{
+  bool mustCheck = false;
+  uint64_t generation = 0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (cache_.Contains(studyId, summary))
+    {
+      cache_.MakeMostRecent(studyId);
+
+      if (checkedGeneration_[studyId] == deletionsGeneration_)
+      {
+        return true;
+      }
+
+      // instances have been deleted since the summary has been checked, maybe from this study
+      mustCheck = true;
+      generation = deletionsGeneration_;
+    }
+  }
+
+  if (mustCheck)
+  {
+    const bool isUpToDate = IsUpToDate(summary, studyId);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (isUpToDate)
+    {
+      if (cache_.Contains(studyId))
+      {
+        checkedGeneration_[studyId] = generation;
+      }
+
+      return true;
+    }
+    else
+    {
+      InvalidateInternal(studyId);
+    }
+  }
+
+  if (LookupPersistent(summary, studyId))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Store(studyId, summary);
+    return true;
+  }
+
+  return ComputeAndStore(summary, studyId);
+}
+
+
+void StudySummaries::Schedule(const std::string& studyId)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!pendingSet_.insert(studyId).second)
+    {
+      return;  // already scheduled
+    }
+
+    pending_.push_back(studyId);
+  }
+
+  pendingChanged_.notify_one();
+}
+
+
+void StudySummaries::SignalChange(OrthancPluginChangeType changeType,
+                                  OrthancPluginResourceType resourceType,
+                                  const std::string& resourceId)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::string studyId;
+
+  if (resourceType == OrthancPluginResourceType_Instance &&
+      changeType == OrthancPluginChangeType_Deleted)
+  {
+    // the parent study of a deleted instance is not known anymore -> all the cached
+    // summaries are checked against their study the next time they are used
+    deletionsGeneration_++;
+
+    for (std::map<std::string, bool>::iterator it = computing_.begin(); it != computing_.end(); ++it)
+    {
+      it->second = false;
+    }
+
+    return;
+  }
+  else if (resourceType == OrthancPluginResourceType_Study)
+  {
+    studyId = resourceId;
+  }
+  else if (resourceType == OrthancPluginResourceType_Series &&
+           changeType == OrthancPluginChangeType_Deleted)
+  {
+    std::map<std::string, std::string>::const_iterator found = seriesToStudy_.find(resourceId);
+    if (found != seriesToStudy_.end())
+    {
+      studyId = found->second;
+    }
+  }
+
+  if (studyId.empty())
+  {
+    return;
+  }
+
+  if (changeType == OrthancPluginChangeType_NewChildInstance ||
+      changeType == OrthancPluginChangeType_StableStudy)
+  {
+    // the persistent summary will be detected as outdated thanks to its "LastUpdate"
+    InvalidateInternal(studyId);
+  }
+  else if (changeType == OrthancPluginChangeType_Deleted)
+  {
+    InvalidateInternal(studyId);
+
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+    if (store_.get() != NULL)
+    {
+      pendingDeletions_.insert(studyId);
+      pendingChanged_.notify_one();
+    }
+#endif
+  }
+}
@@ -0,0 +1,114 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+
+// Caches a summary of the studies (series, instances counts, SOP classes, reports
+// and viewers eligibility) such that the UI does not need to list all the instances
+// of a study to decide which buttons to display.  The summaries are computed by a
+// pool of background threads when a study becomes stable, or on demand if they are
+// missing.  If persistence is enabled, the summaries are also stored in a key-value
+// store of the Orthanc database such that they survive restarts and are shared by
+// all the Orthanc instances connected to the same database.
+class StudySummaries : public boost::noncopyable
+{
+private:
+  typedef Orthanc::LeastRecentlyUsedIndex<std::string, Json::Value>  Cache;
+
+  boost::mutex                        mutex_;
+  boost::condition_variable           pendingChanged_;
+  Cache                               cache_;
+  size_t                              maxSize_;
+  std::map<std::string, std::string>  seriesToStudy_;   // to invalidate a study when one of its series is deleted
+  std::map<std::string, bool>         computing_;       // false if the study has been modified during the computation
+  std::map<std::string, uint64_t>     checkedGeneration_;  // the value of 'deletionsGeneration_' when each cached summary has been checked
+  uint64_t                            deletionsGeneration_;  // incremented each time an instance is deleted
+  bool                                hasExtendedFind_;
+  std::deque<std::string>             pending_;
+  std::set<std::string>               pendingSet_;
+  std::set<std::string>               pendingDeletions_;  // studies to remove from the persistent store
+  bool                                isRunning_;
+  unsigned int                        threadsCount_;
+  std::vector<boost::thread*>         workers_;
+
+#if HAS_ORTHANC_PLUGIN_KEY_VALUE_STORES == 1
+  std::unique_ptr<OrthancPlugins::KeyValueStore>  store_;
+#endif
+
+  static void Worker(StudySummaries* that);
+
+  // Returns false if the study does not exist
+  bool Compute(Json::Value& summary,
+               const std::string& studyId);
+
+  void Store(const std::string& studyId,
+             const Json::Value& summary);
+
+  void InvalidateInternal(const std::string& studyId);
+
+  bool ComputeAndStore(Json::Value& summary,
+                       const std::string& studyId);
+
+  bool LookupPersistent(Json::Value& summary,
+                        const std::string& studyId);
+
+  void StorePersistent(const std::string& studyId,
+                       const Json::Value& summary);
+
+  void DeletePersistent(const std::string& studyId);
+
+public:
+  StudySummaries(size_t maxSize,
+                 unsigned int threadsCount,
+                 bool isPersistent);
+
+  ~StudySummaries();
+
+  void Start();
+
+  void Stop();
+
+
+  // Returns the cached summary, or computes it if missing
+  bool Get(Json::Value& summary,
+           const std::string& studyId);
+
+  // Computes the summary in the background (called when the study becomes stable)
+  void Schedule(const std::string& studyId);
+
+  // Called when Orthanc reports a change on a resource
+  void SignalChange(OrthancPluginChangeType changeType,
+                    OrthancPluginResourceType resourceType,
+                    const std::string& resourceId);
+};
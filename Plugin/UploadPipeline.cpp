@@ -0,0 +1,587 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "UploadPipeline.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+
+static const size_t LOOKUP_BATCH_SIZE = 100;
+
+UploadPipeline::Report::Report() :
+  pendingCount_(0),
+  files_(Json::arrayValue)
+{
+}
+
+
+Json::ArrayIndex UploadPipeline::Report::AddPendingFile(const std::string& filename)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Json::Value file;
+  file["Filename"] = filename;
+
+  pendingCount_++;
+  files_.append(file);
+
+  return files_.size() - 1;
+}
+
+
+void UploadPipeline::Report::SetFileResult(Json::ArrayIndex index,
+                                           const Json::Value& result)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const Json::Value::Members members = result.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      files_[index][members[i]] = result[members[i]];
+    }
+
+    pendingCount_--;
+  }
+
+  completed_.notify_all();
+}
+
+
+void UploadPipeline::Report::AddFailedFile(const std::string& filename,
+                                           const std::string& error)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Json::Value file;
+  file["Filename"] = filename;
+  file["Success"] = false;
+  file["Error"] = error;
+
+  files_.append(file);
+}
+
+
+Json::ArrayIndex UploadPipeline::Report::GetProcessedFiles(Json::Value& files,
+                                                           Json::ArrayIndex since)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  files = Json::arrayValue;
+
+  Json::ArrayIndex i = since;
+  while (i < files_.size() &&
+         files_[i].isMember("Success"))
+  {
+    files.append(files_[i]);
+    i++;
+  }
+
+  return i;
+}
+
+
+void UploadPipeline::Report::WaitCompletion(Json::Value& report)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (pendingCount_ > 0)
+  {
+    completed_.wait(lock);
+  }
+
+  unsigned int successCount = 0;
+  unsigned int failedCount = 0;
+
+  for (Json::Value::ArrayIndex i = 0; i < files_.size(); i++)
+  {
+    if (files_[i]["Success"].asBool())
+    {
+      successCount++;
+    }
+    else
+    {
+      failedCount++;
+    }
+  }
+
+  report = Json::objectValue;
+  report["FilesCount"] = files_.size();
+  report["SuccessCount"] = successCount;
+  report["FailedCount"] = failedCount;
+  report["Files"] = files_;
+}
+
+
+UploadPipeline::UploadPipeline(unsigned int threadsCount,
+                               size_t maxQueueSize,
+                               uint64_t maxZipEntrySize) :
+  maxQueueSize_(maxQueueSize),
+  isRunning_(false),
+  threadsCount_(threadsCount),
+  maxZipEntrySize_(maxZipEntrySize)
+{
+  if (threadsCount_ == 0 ||
+      maxQueueSize_ == 0 ||
+      maxZipEntrySize_ == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+UploadPipeline::~UploadPipeline()
+{
+  Stop();
+}
+
+
+void UploadPipeline::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!isRunning_)
+  {
+    isRunning_ = true;
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+}
+
+
+void UploadPipeline::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRunning_ = false;
+  }
+
+  queueNotEmpty_.notify_all();
+  queueNotFull_.notify_all();
+
+  for (size_t i = 0; i < workers_.size(); i++)
+  {
+    if (workers_[i]->joinable())
+    {
+      workers_[i]->join();
+    }
+
+    delete workers_[i];
+  }
+
+  workers_.clear();
+
+  // the files that have not been stored yet are reported as failed to unblock the clients
+  Json::Value result;
+  result["Success"] = false;
+  result["Error"] = "Orthanc is stopping";
+
+  for (std::deque<Task*>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+  {
+    (*it)->report_->SetFileResult((*it)->index_, result);
+    delete *it;
+  }
+
+  queue_.clear();
+}
+
+
+void UploadPipeline::RegisterProgress(const std::string& progressId,
+                                      const boost::shared_ptr<Report>& report)
+{
+  // the identifiers are provided by the clients -> they must not be guessable
+  if (!Orthanc::Toolbox::IsUuid(progressId))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Invalid progress identifier: " + progressId);
+  }
+
+  boost::mutex::scoped_lock lock(progressMutex_);
+
+  std::map<std::string, boost::weak_ptr<Report> >::const_iterator found = progress_.find(progressId);
+  if (found != progress_.end() &&
+      !found->second.expired())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Another upload is running with this progress identifier");
+  }
+
+  progress_[progressId] = report;
+}
+
+
+void UploadPipeline::UnregisterProgress(const std::string& progressId)
+{
+  boost::mutex::scoped_lock lock(progressMutex_);
+  progress_.erase(progressId);
+}
+
+
+bool UploadPipeline::GetProgress(Json::Value& answer,
+                                 const std::string& progressId,
+                                 Json::ArrayIndex since)
+{
+  boost::shared_ptr<Report> report;
+
+  {
+    boost::mutex::scoped_lock lock(progressMutex_);
+
+    std::map<std::string, boost::weak_ptr<Report> >::const_iterator found = progress_.find(progressId);
+    if (found != progress_.end())
+    {
+      report = found->second.lock();
+    }
+  }
+
+  if (report.get() == NULL)
+  {
+    return false;
+  }
+
+  answer = Json::objectValue;
+  answer["Next"] = report->GetProcessedFiles(answer["Files"], since);
+  return true;
+}
+
+
+void UploadPipeline::Store(Json::Value& result,
+                           const std::string& content)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  // call the C API directly to get the error code of Orthanc
+  OrthancPluginMemoryBuffer answer;
+  OrthancPluginErrorCode code = OrthancPluginRestApiPost(context, &answer, "/instances",
+                                                         content.empty() ? NULL : content.c_str(), content.size());
+
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    result["Success"] = false;
+    result["Error"] = OrthancPluginGetErrorDescription(context, code);
+    return;
+  }
+
+  Json::Value instances;
+  bool isJson = OrthancPlugins::ReadJson(instances, answer.data, answer.size);
+  OrthancPluginFreeMemoryBuffer(context, &answer);
+
+  if (!isJson)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unexpected answer from /instances");
+  }
+
+  // a ZIP file contains multiple instances, a DICOM file only one
+  if (instances.isObject())
+  {
+    Json::Value single = instances;
+    instances = Json::arrayValue;
+    instances.append(single);
+  }
+
+  result["Success"] = (instances.size() > 0);
+  result["Instances"] = instances;
+
+  if (instances.size() == 0)
+  {
+    result["Error"] = "No valid DICOM files found in ZIP";
+  }
+}
+
+
+void UploadPipeline::LookupStoredInstances(Json::Value& answer,
+                                           const std::set<std::string>& sopInstanceUids)
+{
+  answer = Json::objectValue;
+
+  std::map<std::string, std::string> seriesToStudy;
+
+  // one tools/find per batch of UIDs (a list of values is matched like in C-FIND)
+  std::set<std::string>::const_iterator it = sopInstanceUids.begin();
+
+  while (it != sopInstanceUids.end())
+  {
+    std::string uids;
+
+    for (size_t count = 0; count < LOOKUP_BATCH_SIZE && it != sopInstanceUids.end(); ++it)
+    {
+      // a backslash or a wildcard would change the meaning of the query
+      if (!it->empty() &&
+          it->find_first_of("\\*?") == std::string::npos)
+      {
+        if (!uids.empty())
+        {
+          uids += "\\";
+        }
+
+        uids += *it;
+        count++;
+      }
+    }
+
+    if (uids.empty())
+    {
+      continue;
+    }
+
+    Json::Value query;
+    query["Level"] = "Instance";
+    query["Query"]["SOPInstanceUID"] = uids;
+    query["Expand"] = true;
+
+    Json::Value instances;
+    if (!OrthancPlugins::RestApiPost(instances, "/tools/find", query, false) ||
+        instances.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to look up the instances");
+    }
+
+    // note: if 'LimitFindInstances' truncates the answer, the missing instances are simply uploaded again
+    for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+    {
+      const Json::Value& instance = instances[i];
+      const std::string seriesId = instance["ParentSeries"].asString();
+
+      if (seriesToStudy.find(seriesId) == seriesToStudy.end())
+      {
+        Json::Value series;
+        if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false))
+        {
+          continue;  // deleted in the meantime
+        }
+
+        seriesToStudy[seriesId] = series["ParentStudy"].asString();
+      }
+
+      Json::Value& item = answer[instance["MainDicomTags"]["SOPInstanceUID"].asString()];
+      item["ID"] = instance["ID"];
+      item["ParentSeries"] = seriesId;
+      item["ParentStudy"] = seriesToStudy[seriesId];
+    }
+  }
+}
+
+
+void UploadPipeline::Worker(UploadPipeline* that)
+{
+  for (;;)
+  {
+    std::unique_ptr<Task> task;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (that->isRunning_ && that->queue_.empty())
+      {
+        that->queueNotEmpty_.wait(lock);
+      }
+
+      if (!that->isRunning_)
+      {
+        return;
+      }
+
+      task.reset(that->queue_.front());
+      that->queue_.pop_front();
+    }
+
+    that->queueNotFull_.notify_one();
+
+    Json::Value result;
+
+    try
+    {
+      Store(result, task->content_);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OE2: Error while storing an uploaded file: " << e.What();
+      result["Success"] = false;
+      result["Error"] = e.What();
+    }
+
+    task->report_->SetFileResult(task->index_, result);
+  }
+}
+
+
+void UploadPipeline::Enqueue(const boost::shared_ptr<Report>& report,
+                             const std::string& filename,
+                             const void* content,
+                             size_t size)
+{
+  std::unique_ptr<Task> task(new Task);
+  task->content_.assign(reinterpret_cast<const char*>(content), size);
+  task->report_ = report;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (isRunning_ && queue_.size() >= maxQueueSize_)
+  {
+    queueNotFull_.wait(lock);
+  }
+
+  if (!isRunning_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "Orthanc is stopping");
+  }
+
+  task->index_ = report->AddPendingFile(filename);
+  queue_.push_back(task.release());
+
+  queueNotEmpty_.notify_one();
+}
+
+
+MultipartUploadReader::MultipartUploadReader(UploadPipeline& pipeline,
+                                             const OrthancPluginHttpRequest* request) :
+  pipeline_(pipeline),
+  report_(new UploadPipeline::Report)
+{
+  std::string contentType, subType, boundary;
+
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    std::string key(request->headersKeys[i]);
+    Orthanc::Toolbox::ToLowerCase(key);
+
+    if (key == "content-type" &&
+        Orthanc::MultipartStreamReader::ParseMultipartContentType(contentType, subType, boundary, request->headersValues[i]))
+    {
+      parser_.reset(new Orthanc::MultipartStreamReader(boundary));
+      parser_->SetHandler(*this);
+    }
+  }
+
+  if (parser_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The body must be a multipart content");
+  }
+}
+
+
+void MultipartUploadReader::HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
+                                       const void* part,
+                                       size_t size)
+{
+  // the browsers provide the file name in the 'Content-Disposition' header of the 'multipart/form-data' parts
+  std::string filename;
+
+  Orthanc::MultipartStreamReader::HttpHeaders::const_iterator disposition = headers.find("content-disposition");
+  if (disposition != headers.end())
+  {
+    std::string main;
+    std::map<std::string, std::string> arguments;
+
+    if (Orthanc::MultipartStreamReader::ParseHeaderArguments(main, arguments, disposition->second) &&
+        arguments.find("filename") != arguments.end())
+    {
+      filename = arguments["filename"];
+
+      if (filename.size() >= 2 &&
+          filename[0] == '"' &&
+          filename[filename.size() - 1] == '"')
+      {
+        filename = filename.substr(1, filename.size() - 2);
+      }
+    }
+  }
+
+  pipeline_.Enqueue(report_, filename, part, size);
+}
+
+
+void MultipartUploadReader::AddChunk(const void* data,
+                                     size_t size)
+{
+  parser_->AddChunk(data, size);
+}
+
+
+void MultipartUploadReader::Execute(OrthancPluginRestOutput* output)
+{
+  parser_->CloseStream();
+
+  Json::Value report;
+  report_->WaitCompletion(report);
+
+  OrthancPlugins::AnswerJson(report, output);
+}
+
+
+ZipUploadReader::ZipUploadReader(UploadPipeline& pipeline,
+                                 const std::string& progressId) :
+  pipeline_(pipeline),
+  report_(new UploadPipeline::Report),
+  progressId_(progressId),
+  parser_(*this, pipeline.GetMaxZipEntrySize())
+{
+  if (!progressId_.empty())
+  {
+    pipeline_.RegisterProgress(progressId_, report_);
+  }
+}
+
+
+ZipUploadReader::~ZipUploadReader()
+{
+  if (!progressId_.empty())
+  {
+    pipeline_.UnregisterProgress(progressId_);
+  }
+}
+
+
+void ZipUploadReader::HandleEntry(const std::string& filename,
+                                  const void* content,
+                                  size_t size)
+{
+  // the non-DICOM entries (DICOMDIR, README, ...) are reported as failures by Orthanc
+  pipeline_.Enqueue(report_, filename, content, size);
+}
+
+
+void ZipUploadReader::HandleRejectedEntry(const std::string& filename,
+                                          const std::string& error)
+{
+  LOG(WARNING) << "OE2: Rejecting an entry of an uploaded ZIP archive (" << filename << "): " << error;
+  report_->AddFailedFile(filename, error);
+}
+
+
+void ZipUploadReader::AddChunk(const void* data,
+                               size_t size)
+{
+  parser_.AddChunk(data, size);
+}
+
+
+void ZipUploadReader::Execute(OrthancPluginRestOutput* output)
+{
+  parser_.CloseStream();
+
+  Json::Value report;
+  report_->WaitCompletion(report);
+
+  OrthancPlugins::AnswerJson(report, output);
+}
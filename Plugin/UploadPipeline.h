@@ -0,0 +1,201 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "ZipStreamReader.h"
+
+#include <HttpServer/MultipartStreamReader.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+
+// Stores the uploaded files in Orthanc with a pool of threads.  The queue of
+// pending files is bounded such that a fast client is slowed down to the
+// ingestion speed of Orthanc instead of filling the memory.
+class UploadPipeline : public boost::noncopyable
+{
+public:
+  // The aggregated report of one upload request
+  class Report : public boost::noncopyable
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  completed_;
+    size_t                     pendingCount_;
+    Json::Value                files_;
+
+  public:
+    Report();
+
+    // returns the index of the file in the report
+    Json::ArrayIndex AddPendingFile(const std::string& filename);
+
+    void SetFileResult(Json::ArrayIndex index,
+                       const Json::Value& result);
+
+    // reports a file that has been rejected before reaching the pipeline
+    void AddFailedFile(const std::string& filename,
+                       const std::string& error);
+
+    // Fills 'files' with the results of the files that have been processed from the
+    // index 'since' up to the first pending one, and returns the index of the latter
+    Json::ArrayIndex GetProcessedFiles(Json::Value& files,
+                                       Json::ArrayIndex since);
+
+    void WaitCompletion(Json::Value& report);
+  };
+
+private:
+  struct Task
+  {
+    std::string                 content_;
+    Json::ArrayIndex            index_;
+    boost::shared_ptr<Report>   report_;
+  };
+
+  boost::mutex                 mutex_;
+  boost::condition_variable    queueNotEmpty_;
+  boost::condition_variable    queueNotFull_;
+  std::deque<Task*>            queue_;
+  size_t                       maxQueueSize_;
+  bool                         isRunning_;
+  unsigned int                 threadsCount_;
+  std::vector<boost::thread*>  workers_;
+  uint64_t                     maxZipEntrySize_;
+
+  // the reports of the running uploads whose progress is followed by the clients
+  boost::mutex                                          progressMutex_;
+  std::map<std::string, boost::weak_ptr<Report> >       progress_;
+
+  static void Worker(UploadPipeline* that);
+
+public:
+  UploadPipeline(unsigned int threadsCount,
+                 size_t maxQueueSize,
+                 uint64_t maxZipEntrySize);
+
+  ~UploadPipeline();
+
+  void Start();
+
+  void Stop();
+
+  // Blocks while the queue is full
+  void Enqueue(const boost::shared_ptr<Report>& report,
+               const std::string& filename,
+               const void* content,
+               size_t size);
+
+  uint64_t GetMaxZipEntrySize() const
+  {
+    return maxZipEntrySize_;
+  }
+
+  void RegisterProgress(const std::string& progressId,
+                        const boost::shared_ptr<Report>& report);
+
+  void UnregisterProgress(const std::string& progressId);
+
+  // returns false if there is no running upload with this identifier
+  bool GetProgress(Json::Value& answer,
+                   const std::string& progressId,
+                   Json::ArrayIndex since);
+
+  // Stores one file (DICOM or ZIP) in Orthanc and fills 'result' with its entry of the report
+  static void Store(Json::Value& result,
+                    const std::string& content);
+
+  // Fills 'answer' with the SOPInstanceUIDs that are already stored in Orthanc, mapped to
+  // their Orthanc identifiers (and parent study).  The UIDs are looked up in batches such
+  // that the clients can skip the known files before sending them.
+  static void LookupStoredInstances(Json::Value& answer,
+                                    const std::set<std::string>& sopInstanceUids);
+};
+
+
+// Parses a multipart body (e.g. a 'multipart/form-data' from a browser) as it is
+// received and forwards each part to the upload pipeline as soon as it is complete.
+class MultipartUploadReader :
+  public OrthancPlugins::IChunkedRequestReader,
+  private Orthanc::MultipartStreamReader::IHandler
+{
+private:
+  UploadPipeline&                           pipeline_;
+  boost::shared_ptr<UploadPipeline::Report>  report_;
+  std::unique_ptr<Orthanc::MultipartStreamReader>  parser_;
+
+  virtual void HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
+                          const void* part,
+                          size_t size);
+
+public:
+  MultipartUploadReader(UploadPipeline& pipeline,
+                        const OrthancPluginHttpRequest* request);
+
+  virtual void AddChunk(const void* data,
+                        size_t size);
+
+  virtual void Execute(OrthancPluginRestOutput* output);
+};
+
+
+// Inflates a ZIP archive as it is received and forwards each entry to the upload
+// pipeline as soon as it is complete, such that the archive is never buffered as
+// a whole.  If a progress identifier is provided, the results of the entries can be
+// retrieved while the archive is still being received.
+class ZipUploadReader :
+  public OrthancPlugins::IChunkedRequestReader,
+  private ZipStreamReader::IHandler
+{
+private:
+  UploadPipeline&                            pipeline_;
+  boost::shared_ptr<UploadPipeline::Report>  report_;
+  std::string                                progressId_;
+  ZipStreamReader                            parser_;
+
+  virtual void HandleEntry(const std::string& filename,
+                           const void* content,
+                           size_t size);
+
+  virtual void HandleRejectedEntry(const std::string& filename,
+                                   const std::string& error);
+
+public:
+  ZipUploadReader(UploadPipeline& pipeline,
+                  const std::string& progressId);
+
+  virtual ~ZipUploadReader();
+
+  virtual void AddChunk(const void* data,
+                        size_t size);
+
+  virtual void Execute(OrthancPluginRestOutput* output);
+};
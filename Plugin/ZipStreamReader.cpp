@@ -0,0 +1,423 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "ZipStreamReader.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <string.h>
+
+
+static const uint32_t LOCAL_FILE_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t CENTRAL_DIRECTORY_SIGNATURE = 0x02014b50;
+static const uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+static const uint32_t DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+
+static const size_t LOCAL_FILE_HEADER_SIZE = 30;
+static const size_t INFLATE_BLOCK_SIZE = 65536;
+
+static const uint16_t FLAG_DATA_DESCRIPTOR = 0x0008;
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATED = 8;
+static const uint16_t EXTRA_ZIP64 = 0x0001;
+
+
+ZipStreamReader::ZipStreamReader(IHandler& handler,
+                                 uint64_t maxEntrySize) :
+  handler_(handler),
+  maxEntrySize_(maxEntrySize),
+  state_(State_Header),
+  position_(0),
+  remaining_(0),
+  declaredSize_(0),
+  hasDeclaredSize_(false),
+  isRejected_(false),
+  hasDataDescriptor_(false),
+  isZip64_(false),
+  isInflating_(false)
+{
+  memset(&inflater_, 0, sizeof(inflater_));
+}
+
+
+ZipStreamReader::~ZipStreamReader()
+{
+  if (isInflating_)
+  {
+    inflateEnd(&inflater_);
+  }
+}
+
+
+uint16_t ZipStreamReader::ReadUInt16(size_t offset) const
+{
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer_.c_str()) + position_ + offset;
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+
+uint32_t ZipStreamReader::ReadUInt32(size_t offset) const
+{
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer_.c_str()) + position_ + offset;
+  return (static_cast<uint32_t>(p[0]) |
+          (static_cast<uint32_t>(p[1]) << 8) |
+          (static_cast<uint32_t>(p[2]) << 16) |
+          (static_cast<uint32_t>(p[3]) << 24));
+}
+
+
+bool ZipStreamReader::ReadHeader()
+{
+  if (GetAvailable() < 4)
+  {
+    return false;
+  }
+
+  const uint32_t signature = ReadUInt32(0);
+
+  if (signature == CENTRAL_DIRECTORY_SIGNATURE ||
+      signature == END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+  {
+    state_ = State_Done;   // all the entries have been read
+    return true;
+  }
+  else if (signature != LOCAL_FILE_HEADER_SIGNATURE)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Not a ZIP archive or corrupted ZIP archive");
+  }
+
+  if (GetAvailable() < LOCAL_FILE_HEADER_SIZE)
+  {
+    return false;
+  }
+
+  const uint16_t flags = ReadUInt16(6);
+  const uint16_t method = ReadUInt16(8);
+  const uint32_t compressedSize = ReadUInt32(18);
+  const uint32_t uncompressedSize = ReadUInt32(22);
+  const uint16_t filenameLength = ReadUInt16(26);
+  const uint16_t extraLength = ReadUInt16(28);
+
+  if (GetAvailable() < LOCAL_FILE_HEADER_SIZE + filenameLength + extraLength)
+  {
+    return false;
+  }
+
+  filename_ = buffer_.substr(position_ + LOCAL_FILE_HEADER_SIZE, filenameLength);
+  hasDataDescriptor_ = ((flags & FLAG_DATA_DESCRIPTOR) != 0);
+  isZip64_ = false;
+  remaining_ = compressedSize;
+  declaredSize_ = uncompressedSize;
+
+  // look for the ZIP64 extended information that contains the actual sizes
+  for (size_t extra = LOCAL_FILE_HEADER_SIZE + filenameLength; extra + 4 <= LOCAL_FILE_HEADER_SIZE + filenameLength + extraLength; )
+  {
+    const uint16_t id = ReadUInt16(extra);
+    const uint16_t size = ReadUInt16(extra + 2);
+
+    if (id == EXTRA_ZIP64)
+    {
+      isZip64_ = true;
+
+      if (size >= 8 && uncompressedSize == 0xffffffff)
+      {
+        declaredSize_ = (static_cast<uint64_t>(ReadUInt32(extra + 4)) |
+                         (static_cast<uint64_t>(ReadUInt32(extra + 8)) << 32));
+      }
+
+      if (size >= 16 && compressedSize == 0xffffffff)
+      {
+        remaining_ = (static_cast<uint64_t>(ReadUInt32(extra + 12)) |
+                      (static_cast<uint64_t>(ReadUInt32(extra + 16)) << 32));
+      }
+    }
+
+    extra += 4 + size;
+  }
+
+  position_ += LOCAL_FILE_HEADER_SIZE + filenameLength + extraLength;
+  entry_.clear();
+
+  // with a data descriptor, the sizes in the local file header are zero
+  hasDeclaredSize_ = !(hasDataDescriptor_ && declaredSize_ == 0);
+  isRejected_ = false;
+  rejection_.clear();
+
+  if ((hasDeclaredSize_ && declaredSize_ > maxEntrySize_) ||
+      (method == METHOD_STORED && remaining_ > maxEntrySize_))
+  {
+    Reject("The ZIP entry is larger than the maximum allowed size");
+  }
+
+  if (method == METHOD_STORED)
+  {
+    if (hasDataDescriptor_ && remaining_ == 0 && (filename_.empty() || filename_[filename_.size() - 1] != '/'))
+    {
+      // the end of the entry could only be found from the central directory
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "Uncompressed ZIP entries of unknown size are not supported: " + filename_);
+    }
+
+    state_ = State_Stored;
+  }
+  else if (method == METHOD_DEFLATED)
+  {
+    memset(&inflater_, 0, sizeof(inflater_));
+
+    // raw deflate stream (no zlib header)
+    if (inflateInit2(&inflater_, -MAX_WBITS) != Z_OK)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+
+    isInflating_ = true;
+    state_ = State_Deflated;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                    "Unsupported compression method in ZIP entry: " + filename_);
+  }
+
+  return true;
+}
+
+
+bool ZipStreamReader::ReadStored()
+{
+  const size_t count = static_cast<size_t>(std::min(remaining_, static_cast<uint64_t>(GetAvailable())));
+
+  if (!isRejected_)
+  {
+    entry_.append(buffer_, position_, count);
+  }
+
+  position_ += count;
+  remaining_ -= count;
+
+  if (remaining_ == 0)
+  {
+    EndEntry();
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+bool ZipStreamReader::ReadDeflated()
+{
+  if (GetAvailable() == 0)
+  {
+    return false;
+  }
+
+  inflater_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(buffer_.c_str() + position_));
+  inflater_.avail_in = static_cast<uInt>(GetAvailable());
+
+  int code;
+  std::string discarded;
+
+  do
+  {
+    size_t offset = 0;
+
+    if (isRejected_)
+    {
+      // the deflate stream must still be decoded to find the end of the entry
+      discarded.resize(INFLATE_BLOCK_SIZE);
+      inflater_.next_out = reinterpret_cast<Bytef*>(&discarded[0]);
+    }
+    else
+    {
+      offset = entry_.size();
+      entry_.resize(offset + INFLATE_BLOCK_SIZE);
+      inflater_.next_out = reinterpret_cast<Bytef*>(&entry_[offset]);
+    }
+
+    inflater_.avail_out = static_cast<uInt>(INFLATE_BLOCK_SIZE);
+
+    code = inflate(&inflater_, Z_NO_FLUSH);
+
+    if (!isRejected_)
+    {
+      entry_.resize(offset + INFLATE_BLOCK_SIZE - inflater_.avail_out);
+      CheckEntrySize();
+    }
+
+    if (code != Z_OK &&
+        code != Z_STREAM_END &&
+        code != Z_BUF_ERROR)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Corrupted ZIP entry: " + filename_);
+    }
+  }
+  while (code == Z_OK && inflater_.avail_out == 0);
+
+  position_ = buffer_.size() - inflater_.avail_in;
+
+  if (code == Z_STREAM_END)
+  {
+    inflateEnd(&inflater_);
+    isInflating_ = false;
+
+    EndEntry();
+    return true;
+  }
+  else
+  {
+    return false;  // need more input
+  }
+}
+
+
+bool ZipStreamReader::ReadDataDescriptor()
+{
+  // the signature of the data descriptor is optional
+  const size_t sizesLength = (isZip64_ ? 16 : 8);
+
+  if (GetAvailable() < 4)
+  {
+    return false;
+  }
+
+  const size_t length = (ReadUInt32(0) == DATA_DESCRIPTOR_SIGNATURE ? 8 : 4) + sizesLength;
+
+  if (GetAvailable() < length)
+  {
+    return false;
+  }
+
+  position_ += length;
+  state_ = State_Header;
+  return true;
+}
+
+
+void ZipStreamReader::Reject(const std::string& error)
+{
+  isRejected_ = true;
+  rejection_ = error;
+
+  // release the memory that has been allocated for the entry
+  std::string().swap(entry_);
+}
+
+
+void ZipStreamReader::CheckEntrySize()
+{
+  if (entry_.size() > maxEntrySize_)
+  {
+    Reject("The ZIP entry is larger than the maximum allowed size");
+  }
+  else if (hasDeclaredSize_ &&
+           entry_.size() > declaredSize_)
+  {
+    Reject("The ZIP entry is larger than its declared size");
+  }
+}
+
+
+void ZipStreamReader::EndEntry()
+{
+  state_ = (hasDataDescriptor_ ? State_DataDescriptor : State_Header);
+
+  // ignore the folders
+  if (!filename_.empty() &&
+      filename_[filename_.size() - 1] != '/')
+  {
+    if (isRejected_)
+    {
+      handler_.HandleRejectedEntry(filename_, rejection_);
+    }
+    else
+    {
+      handler_.HandleEntry(filename_, entry_.empty() ? NULL : entry_.c_str(), entry_.size());
+    }
+  }
+
+  entry_.clear();
+  isRejected_ = false;
+}
+
+
+void ZipStreamReader::AddChunk(const void* data,
+                               size_t size)
+{
+  if (state_ == State_Done)
+  {
+    return;
+  }
+
+  // drop the bytes that have already been processed
+  if (position_ > 0)
+  {
+    buffer_.erase(0, position_);
+    position_ = 0;
+  }
+
+  buffer_.append(reinterpret_cast<const char*>(data), size);
+
+  bool progress = true;
+
+  while (progress)
+  {
+    switch (state_)
+    {
+      case State_Header:
+        progress = ReadHeader();
+        break;
+
+      case State_Stored:
+        progress = ReadStored();
+        break;
+
+      case State_Deflated:
+        progress = ReadDeflated();
+        break;
+
+      case State_DataDescriptor:
+        progress = ReadDataDescriptor();
+        break;
+
+      case State_Done:
+        progress = false;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+}
+
+
+void ZipStreamReader::CloseStream()
+{
+  if (state_ != State_Done &&
+      !(state_ == State_Header && GetAvailable() == 0))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Truncated ZIP archive");
+  }
+}
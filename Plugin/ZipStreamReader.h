@@ -0,0 +1,115 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <zlib.h>
+
+
+// Extracts the entries of a ZIP archive as its bytes are received, by reading the
+// local file headers sequentially (the central directory at the end of the archive
+// is ignored).  Only one entry is kept in memory at a time, and an entry whose
+// inflated size exceeds its declared size or the configured maximum is rejected
+// instead of being inflated in memory (protection against the "ZIP bombs").
+class ZipStreamReader : public boost::noncopyable
+{
+public:
+  class IHandler : public boost::noncopyable
+  {
+  public:
+    virtual ~IHandler()
+    {
+    }
+
+    virtual void HandleEntry(const std::string& filename,
+                             const void* content,
+                             size_t size) = 0;
+
+    virtual void HandleRejectedEntry(const std::string& filename,
+                                     const std::string& error) = 0;
+  };
+
+private:
+  enum State
+  {
+    State_Header,
+    State_Stored,
+    State_Deflated,
+    State_DataDescriptor,
+    State_Done
+  };
+
+  IHandler&    handler_;
+  uint64_t     maxEntrySize_;
+  State        state_;
+  std::string  buffer_;
+  size_t       position_;          // the bytes before this position in 'buffer_' have been processed
+  std::string  filename_;
+  std::string  entry_;
+  uint64_t     remaining_;         // for the stored entries
+  uint64_t     declaredSize_;      // the uncompressed size from the local file header
+  bool         hasDeclaredSize_;   // false if the sizes are only provided by the data descriptor
+  bool         isRejected_;        // the rest of the entry is skipped
+  std::string  rejection_;
+  bool         hasDataDescriptor_;
+  bool         isZip64_;
+  z_stream     inflater_;
+  bool         isInflating_;
+
+  size_t GetAvailable() const
+  {
+    return buffer_.size() - position_;
+  }
+
+  uint16_t ReadUInt16(size_t offset) const;
+
+  uint32_t ReadUInt32(size_t offset) const;
+
+  bool ReadHeader();
+
+  bool ReadStored();
+
+  bool ReadDeflated();
+
+  bool ReadDataDescriptor();
+
+  void Reject(const std::string& error);
+
+  void CheckEntrySize();
+
+  void EndEntry();
+
+public:
+  ZipStreamReader(IHandler& handler,
+                  uint64_t maxEntrySize);
+
+  ~ZipStreamReader();
+
+  void AddChunk(const void* data,
+                size_t size);
+
+  void CloseStream();
+};
@@ -0,0 +1,269 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../Plugin/RoaringBitmap.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+
+
+// Checks the bitmap against a reference set
+static void CheckValues(const RoaringBitmap& bitmap,
+                        const std::set<uint32_t>& expected)
+{
+  ASSERT_EQ(expected.size(), bitmap.GetCardinality());
+  ASSERT_EQ(expected.empty(), bitmap.IsEmpty());
+
+  std::vector<uint32_t> values;
+  bitmap.GetValues(values);
+  ASSERT_EQ(std::vector<uint32_t>(expected.begin(), expected.end()), values);
+
+  for (std::set<uint32_t>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+  {
+    ASSERT_TRUE(bitmap.Contains(*it));
+  }
+}
+
+
+// Adds the values "first, first + step, ..." below "end"
+static void AddRange(RoaringBitmap& bitmap,
+                     std::set<uint32_t>& reference,
+                     uint32_t first,
+                     uint32_t end,
+                     uint32_t step)
+{
+  for (uint32_t value = first; value < end; value += step)
+  {
+    bitmap.Add(value);
+    reference.insert(value);
+  }
+}
+
+
+TEST(RoaringBitmap, Basic)
+{
+  RoaringBitmap bitmap;
+  std::set<uint32_t> reference;
+  CheckValues(bitmap, reference);
+
+  bitmap.Add(42);
+  bitmap.Add(42);
+  bitmap.Add(0);
+  bitmap.Add(0xffffffff);
+  bitmap.Add(65536);  // in the second container
+  reference.insert(42);
+  reference.insert(0);
+  reference.insert(0xffffffff);
+  reference.insert(65536);
+  CheckValues(bitmap, reference);
+
+  ASSERT_FALSE(bitmap.Contains(43));
+  ASSERT_FALSE(bitmap.Contains(65537));
+  ASSERT_FALSE(bitmap.Contains(42 + 65536));
+
+  bitmap.Remove(43);  // absent
+  bitmap.Remove(65536);
+  reference.erase(65536);
+  CheckValues(bitmap, reference);
+
+  bitmap.Clear();
+  reference.clear();
+  CheckValues(bitmap, reference);
+}
+
+
+TEST(RoaringBitmap, ArrayToBitmap)
+{
+  // a container switches to a bitmap above 4096 values, and back to an array at 4096 values
+  RoaringBitmap bitmap;
+  std::set<uint32_t> reference;
+
+  AddRange(bitmap, reference, 0, 4096 * 2, 2);
+  ASSERT_EQ(4096u, bitmap.GetCardinality());
+  CheckValues(bitmap, reference);
+
+  bitmap.Add(1);
+  reference.insert(1);
+  CheckValues(bitmap, reference);
+
+  bitmap.Add(1);  // already present in the bitmap
+  CheckValues(bitmap, reference);
+
+  bitmap.Remove(1);
+  reference.erase(1);
+  CheckValues(bitmap, reference);
+
+  bitmap.Remove(0);
+  reference.erase(0);
+  CheckValues(bitmap, reference);
+
+  bitmap.Add(3);
+  bitmap.Add(5);
+  reference.insert(3);
+  reference.insert(5);
+  CheckValues(bitmap, reference);
+
+  for (uint32_t value = 0; value < 4096 * 2; value++)
+  {
+    bitmap.Remove(value);
+  }
+
+  reference.clear();
+  CheckValues(bitmap, reference);
+}
+
+
+TEST(RoaringBitmap, FullContainer)
+{
+  RoaringBitmap bitmap;
+  std::set<uint32_t> reference;
+
+  AddRange(bitmap, reference, 65536, 2 * 65536, 1);
+  CheckValues(bitmap, reference);
+  ASSERT_FALSE(bitmap.Contains(65535));
+  ASSERT_FALSE(bitmap.Contains(2 * 65536));
+}
+
+
+enum ContainerType
+{
+  ContainerType_Empty,
+  ContainerType_Array,
+  ContainerType_Bitmap
+};
+
+
+// Fills the containers 0, 1 and 2 with the given types, such that the two operands overlap
+static void Fill(RoaringBitmap& bitmap,
+                 std::set<uint32_t>& reference,
+                 ContainerType type,
+                 uint32_t offset)
+{
+  for (uint32_t high = 0; high < 3; high++)
+  {
+    switch (type)
+    {
+      case ContainerType_Array:
+        AddRange(bitmap, reference, (high << 16) + offset, (high << 16) + 3000, 3);
+        break;
+
+      case ContainerType_Bitmap:
+        AddRange(bitmap, reference, (high << 16) + offset, (high << 16) + 30000, 5);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+
+TEST(RoaringBitmap, SetOperations)
+{
+  // all the combinations of container types for And(), Or() and AndNot()
+  const ContainerType types[] = { ContainerType_Empty, ContainerType_Array, ContainerType_Bitmap };
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (size_t j = 0; j < 3; j++)
+    {
+      for (unsigned int operation = 0; operation < 3; operation++)
+      {
+        RoaringBitmap a, b;
+        std::set<uint32_t> referenceA, referenceB;
+        Fill(a, referenceA, types[i], 0);
+        Fill(b, referenceB, types[j], 1);
+
+        std::set<uint32_t> expected;
+
+        switch (operation)
+        {
+          case 0:
+            a.And(b);
+            std::set_intersection(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+                                  std::inserter(expected, expected.end()));
+            break;
+
+          case 1:
+            a.Or(b);
+            std::set_union(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+                           std::inserter(expected, expected.end()));
+            break;
+
+          case 2:
+            a.AndNot(b);
+            std::set_difference(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+                                std::inserter(expected, expected.end()));
+            break;
+
+          default:
+            break;
+        }
+
+        CheckValues(a, expected);
+        CheckValues(b, referenceB);  // the operand is not modified
+      }
+    }
+  }
+}
+
+
+TEST(RoaringBitmap, ResultsCrossingTheThreshold)
+{
+  // the intersection of two bitmaps is small enough to be an array
+  RoaringBitmap a, b;
+  std::set<uint32_t> referenceA, referenceB;
+  AddRange(a, referenceA, 0, 20000, 2);
+  AddRange(b, referenceB, 0, 20000, 3);
+
+  a.And(b);
+  RoaringBitmap scratch;
+  std::set<uint32_t> expected;
+  AddRange(scratch, expected, 0, 20000, 6);
+  CheckValues(a, expected);
+
+  // the union of two arrays is too large to be an array
+  RoaringBitmap c, d;
+  std::set<uint32_t> referenceC, referenceD;
+  AddRange(c, referenceC, 0, 6000, 2);
+  AddRange(d, referenceD, 1, 6000, 2);
+  ASSERT_EQ(3000u, c.GetCardinality());
+  ASSERT_EQ(3000u, d.GetCardinality());
+
+  c.Or(d);
+  expected.clear();
+  AddRange(scratch, expected, 0, 6000, 1);
+  CheckValues(c, expected);
+
+  // removing most of a bitmap brings it back to an array
+  RoaringBitmap e;
+  expected.clear();
+  AddRange(e, expected, 0, 10000, 1);
+  e.AndNot(c);
+  expected.clear();
+  AddRange(scratch, expected, 6000, 10000, 1);
+  CheckValues(e, expected);
+}
@@ -0,0 +1,382 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../Plugin/ZipStreamReader.h"
+
+#include <OrthancException.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <string.h>
+
+
+namespace
+{
+  enum Descriptor
+  {
+    Descriptor_None,
+    Descriptor_WithSignature,
+    Descriptor_WithoutSignature
+  };
+
+
+  class Handler : public ZipStreamReader::IHandler
+  {
+  public:
+    std::vector<std::string>            filenames_;  // in the order of the archive
+    std::map<std::string, std::string>  entries_;
+    std::map<std::string, std::string>  rejected_;
+
+    virtual void HandleEntry(const std::string& filename,
+                             const void* content,
+                             size_t size)
+    {
+      filenames_.push_back(filename);
+      entries_[filename] = (size == 0 ? std::string() : std::string(reinterpret_cast<const char*>(content), size));
+    }
+
+    virtual void HandleRejectedEntry(const std::string& filename,
+                                     const std::string& error)
+    {
+      filenames_.push_back(filename);
+      rejected_[filename] = error;
+    }
+  };
+}
+
+
+static void AppendUInt16(std::string& target,
+                         uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void AppendUInt32(std::string& target,
+                         uint32_t value)
+{
+  AppendUInt16(target, static_cast<uint16_t>(value & 0xffff));
+  AppendUInt16(target, static_cast<uint16_t>(value >> 16));
+}
+
+
+static void AppendUInt64(std::string& target,
+                         uint64_t value)
+{
+  AppendUInt32(target, static_cast<uint32_t>(value & 0xffffffff));
+  AppendUInt32(target, static_cast<uint32_t>(value >> 32));
+}
+
+
+// Raw deflate stream, as stored in the ZIP archives
+static std::string Deflate(const std::string& content)
+{
+  z_stream deflater;
+  memset(&deflater, 0, sizeof(deflater));
+  EXPECT_EQ(Z_OK, deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY));
+
+  std::string compressed;
+  compressed.resize(deflateBound(&deflater, static_cast<uLong>(content.size())));
+
+  deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.c_str()));
+  deflater.avail_in = static_cast<uInt>(content.size());
+  deflater.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  deflater.avail_out = static_cast<uInt>(compressed.size());
+
+  EXPECT_EQ(Z_STREAM_END, deflate(&deflater, Z_FINISH));
+  compressed.resize(compressed.size() - deflater.avail_out);
+  deflateEnd(&deflater);
+
+  return compressed;
+}
+
+
+// Appends a local file header, the data and the optional data descriptor.  The uncompressed
+// size in the header is 'declaredSize' (the actual size is in the data descriptor if any).
+static void AppendEntry(std::string& zip,
+                        const std::string& filename,
+                        const std::string& content,
+                        bool isDeflated,
+                        Descriptor descriptor,
+                        bool isZip64,
+                        uint64_t declaredSize)
+{
+  const std::string data = (isDeflated ? Deflate(content) : content);
+  const uint32_t crc = static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(content.c_str()),
+                                                   static_cast<uInt>(content.size())));
+
+  const uint64_t compressedSize = (descriptor == Descriptor_None ? data.size() : 0);
+  const uint64_t uncompressedSize = (descriptor == Descriptor_None ? declaredSize : 0);
+
+  std::string extra;
+  if (isZip64)
+  {
+    AppendUInt16(extra, 0x0001);
+    AppendUInt16(extra, 16);
+    AppendUInt64(extra, uncompressedSize);
+    AppendUInt64(extra, compressedSize);
+  }
+
+  AppendUInt32(zip, 0x04034b50);
+  AppendUInt16(zip, isZip64 ? 45 : 20);
+  AppendUInt16(zip, descriptor == Descriptor_None ? 0 : 0x0008);
+  AppendUInt16(zip, isDeflated ? 8 : 0);
+  AppendUInt16(zip, 0);  // time
+  AppendUInt16(zip, 0);  // date
+  AppendUInt32(zip, descriptor == Descriptor_None ? crc : 0);
+  AppendUInt32(zip, isZip64 ? 0xffffffff : static_cast<uint32_t>(compressedSize));
+  AppendUInt32(zip, isZip64 ? 0xffffffff : static_cast<uint32_t>(uncompressedSize));
+  AppendUInt16(zip, static_cast<uint16_t>(filename.size()));
+  AppendUInt16(zip, static_cast<uint16_t>(extra.size()));
+  zip += filename;
+  zip += extra;
+  zip += data;
+
+  if (descriptor != Descriptor_None)
+  {
+    if (descriptor == Descriptor_WithSignature)
+    {
+      AppendUInt32(zip, 0x08074b50);
+    }
+
+    AppendUInt32(zip, crc);
+
+    if (isZip64)
+    {
+      AppendUInt64(zip, data.size());
+      AppendUInt64(zip, content.size());
+    }
+    else
+    {
+      AppendUInt32(zip, static_cast<uint32_t>(data.size()));
+      AppendUInt32(zip, static_cast<uint32_t>(content.size()));
+    }
+  }
+}
+
+
+static void AppendEntry(std::string& zip,
+                        const std::string& filename,
+                        const std::string& content,
+                        bool isDeflated,
+                        Descriptor descriptor,
+                        bool isZip64)
+{
+  AppendEntry(zip, filename, content, isDeflated, descriptor, isZip64, content.size());
+}
+
+
+// The central directory is ignored by the reader: only its signature is needed
+static void AppendEnd(std::string& zip)
+{
+  AppendUInt32(zip, 0x06054b50);
+  zip.append(18, '\0');
+}
+
+
+static std::string GenerateContent(size_t size,
+                                   unsigned int seed)
+{
+  // compressible, but not trivially
+  std::string content;
+  content.reserve(size);
+
+  uint32_t state = seed;
+  for (size_t i = 0; i < size; i++)
+  {
+    state = state * 1103515245 + 12345;
+    content.push_back(static_cast<char>('a' + (state >> 16) % 8));
+  }
+
+  return content;
+}
+
+
+static void Read(Handler& handler,
+                 const std::string& zip,
+                 uint64_t maxEntrySize,
+                 size_t chunkSize)
+{
+  ZipStreamReader reader(handler, maxEntrySize);
+
+  for (size_t i = 0; i < zip.size(); i += chunkSize)
+  {
+    reader.AddChunk(zip.c_str() + i, std::min(chunkSize, zip.size() - i));
+  }
+
+  reader.CloseStream();
+}
+
+
+static const size_t CHUNK_SIZES[] = { 1, 7, 4096, 1000000 };
+static const size_t CHUNK_SIZES_COUNT = sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]);
+
+
+TEST(ZipStreamReader, StoredAndDeflated)
+{
+  const std::string large = GenerateContent(200000, 1);  // more than one inflate block
+
+  std::string zip;
+  AppendEntry(zip, "stored.dcm", "hello", false, Descriptor_None, false);
+  AppendEntry(zip, "folder/", "", false, Descriptor_None, false);
+  AppendEntry(zip, "folder/deflated.dcm", large, true, Descriptor_None, false);
+  AppendEntry(zip, "empty.dcm", "", false, Descriptor_None, false);
+  AppendEnd(zip);
+
+  for (size_t i = 0; i < CHUNK_SIZES_COUNT; i++)
+  {
+    Handler handler;
+    Read(handler, zip, 1024 * 1024, CHUNK_SIZES[i]);
+
+    ASSERT_EQ(3u, handler.filenames_.size());  // the folder is ignored
+    ASSERT_EQ("stored.dcm", handler.filenames_[0]);
+    ASSERT_EQ("folder/deflated.dcm", handler.filenames_[1]);
+    ASSERT_EQ("empty.dcm", handler.filenames_[2]);
+    ASSERT_EQ("hello", handler.entries_["stored.dcm"]);
+    ASSERT_EQ(large, handler.entries_["folder/deflated.dcm"]);
+    ASSERT_TRUE(handler.entries_["empty.dcm"].empty());
+    ASSERT_TRUE(handler.rejected_.empty());
+  }
+}
+
+
+TEST(ZipStreamReader, DataDescriptors)
+{
+  // the archives written to a stream have the sizes after the data, with or without signature
+  const std::string a = GenerateContent(100000, 2);
+  const std::string b = GenerateContent(1000, 3);
+
+  std::string zip;
+  AppendEntry(zip, "a.dcm", a, true, Descriptor_WithSignature, false);
+  AppendEntry(zip, "b.dcm", b, true, Descriptor_WithoutSignature, false);
+  AppendEntry(zip, "c.dcm", "c", false, Descriptor_None, false);
+  AppendEnd(zip);
+
+  for (size_t i = 0; i < CHUNK_SIZES_COUNT; i++)
+  {
+    Handler handler;
+    Read(handler, zip, 1024 * 1024, CHUNK_SIZES[i]);
+
+    ASSERT_EQ(3u, handler.entries_.size());
+    ASSERT_EQ(a, handler.entries_["a.dcm"]);
+    ASSERT_EQ(b, handler.entries_["b.dcm"]);
+    ASSERT_EQ("c", handler.entries_["c.dcm"]);
+    ASSERT_TRUE(handler.rejected_.empty());
+  }
+}
+
+
+TEST(ZipStreamReader, Zip64)
+{
+  const std::string a = GenerateContent(100000, 4);
+  const std::string b = GenerateContent(70000, 5);
+
+  std::string zip;
+  AppendEntry(zip, "stored.dcm", "stored", false, Descriptor_None, true);
+  AppendEntry(zip, "deflated.dcm", a, true, Descriptor_None, true);
+  AppendEntry(zip, "signature.dcm", b, true, Descriptor_WithSignature, true);
+  AppendEntry(zip, "no-signature.dcm", a, true, Descriptor_WithoutSignature, true);
+  AppendEntry(zip, "last.dcm", "last", false, Descriptor_None, false);
+  AppendEnd(zip);
+
+  for (size_t i = 0; i < CHUNK_SIZES_COUNT; i++)
+  {
+    Handler handler;
+    Read(handler, zip, 1024 * 1024, CHUNK_SIZES[i]);
+
+    ASSERT_EQ(5u, handler.entries_.size());
+    ASSERT_EQ("stored", handler.entries_["stored.dcm"]);
+    ASSERT_EQ(a, handler.entries_["deflated.dcm"]);
+    ASSERT_EQ(b, handler.entries_["signature.dcm"]);
+    ASSERT_EQ(a, handler.entries_["no-signature.dcm"]);
+    ASSERT_EQ("last", handler.entries_["last.dcm"]);
+    ASSERT_TRUE(handler.rejected_.empty());
+  }
+}
+
+
+TEST(ZipStreamReader, OversizedEntries)
+{
+  const uint64_t maxEntrySize = 10000;
+  const std::string small = GenerateContent(100, 6);
+  const std::string large = GenerateContent(50000, 7);
+
+  std::string zip;
+  AppendEntry(zip, "stored.dcm", large, false, Descriptor_None, false);
+  AppendEntry(zip, "deflated.dcm", large, true, Descriptor_None, false);
+  AppendEntry(zip, "zip64.dcm", large, true, Descriptor_None, true);
+  AppendEntry(zip, "descriptor.dcm", large, true, Descriptor_WithSignature, false);
+  AppendEntry(zip, "understated.dcm", small + small, true, Descriptor_None, false, small.size());  // ZIP bomb
+  AppendEntry(zip, "small.dcm", small, true, Descriptor_None, false);
+  AppendEnd(zip);
+
+  for (size_t i = 0; i < CHUNK_SIZES_COUNT; i++)
+  {
+    Handler handler;
+    Read(handler, zip, maxEntrySize, CHUNK_SIZES[i]);
+
+    // the rejected entries are skipped, and the following entries are still read
+    ASSERT_EQ(6u, handler.filenames_.size());
+    ASSERT_EQ(1u, handler.entries_.size());
+    ASSERT_EQ(small, handler.entries_["small.dcm"]);
+
+    ASSERT_EQ(5u, handler.rejected_.size());
+    ASSERT_EQ("The ZIP entry is larger than the maximum allowed size", handler.rejected_["stored.dcm"]);
+    ASSERT_EQ("The ZIP entry is larger than the maximum allowed size", handler.rejected_["deflated.dcm"]);
+    ASSERT_EQ("The ZIP entry is larger than the maximum allowed size", handler.rejected_["zip64.dcm"]);
+    ASSERT_EQ("The ZIP entry is larger than the maximum allowed size", handler.rejected_["descriptor.dcm"]);
+    ASSERT_EQ("The ZIP entry is larger than its declared size", handler.rejected_["understated.dcm"]);
+  }
+}
+
+
+TEST(ZipStreamReader, Errors)
+{
+  {
+    Handler handler;
+    ASSERT_THROW(Read(handler, "This is not a ZIP archive", 1000, 1000), Orthanc::OrthancException);
+  }
+
+  {
+    // truncated in the middle of an entry
+    std::string zip;
+    AppendEntry(zip, "a.dcm", GenerateContent(1000, 8), true, Descriptor_None, false);
+
+    Handler handler;
+    ASSERT_THROW(Read(handler, zip.substr(0, zip.size() / 2), 10000, 1000), Orthanc::OrthancException);
+    ASSERT_TRUE(handler.filenames_.empty());
+  }
+
+  {
+    // the end of an uncompressed entry of unknown size could only be found from the central directory
+    std::string zip;
+    AppendEntry(zip, "a.dcm", "hello", false, Descriptor_WithSignature, false);
+    AppendEnd(zip);
+
+    Handler handler;
+    ASSERT_THROW(Read(handler, zip, 10000, 1000), Orthanc::OrthancException);
+  }
+}
@@ -0,0 +1,51 @@
+// Minimal parsing of the DICOM files in the browser: only the File Meta Information
+// (group 0x0002, always encoded in Explicit VR Little Endian) is read.
+
+const META_HEADER_MAX_SIZE = 16384;
+const LONG_LENGTH_VRS = ["OB", "OD", "OF", "OL", "OV", "OW", "SQ", "UC", "UN", "UR", "UT"];
+
+const textDecoder = new TextDecoder();
+
+export default {
+    // returns the MediaStorageSOPInstanceUID (0002,0003) of a DICOM file, or null if the file is not a DICOM file
+    async readSopInstanceUid(file) {
+        const bytes = new Uint8Array(await file.slice(0, META_HEADER_MAX_SIZE).arrayBuffer());
+        if (bytes.length < 132 || textDecoder.decode(bytes.subarray(128, 132)) != "DICM") {
+            return null;
+        }
+
+        const view = new DataView(bytes.buffer);
+        let position = 132;
+
+        while (position + 8 <= bytes.length) {
+            const group = view.getUint16(position, true);
+            const element = view.getUint16(position + 2, true);
+            if (group != 0x0002) {
+                break;
+            }
+
+            const vr = textDecoder.decode(bytes.subarray(position + 4, position + 6));
+            let length, offset;
+            if (LONG_LENGTH_VRS.includes(vr)) {
+                if (position + 12 > bytes.length) {
+                    break;
+                }
+                length = view.getUint32(position + 8, true);
+                offset = position + 12;
+            } else {
+                length = view.getUint16(position + 6, true);
+                offset = position + 8;
+            }
+
+            if (element == 0x0003) {
+                if (offset + length > bytes.length) {
+                    break;
+                }
+                return textDecoder.decode(bytes.subarray(offset, offset + length)).replace(/[\0 ]+$/, "");
+            }
+            position = offset + length;
+        }
+
+        return null;
+    }
+}
@@ -0,0 +1,133 @@
+import api from "../orthancApi"
+import store from "../store"
+
+// All the components that monitor jobs share a single 'jobs/events' request to the OE2 plugin.
+// If the plugin does not provide this route, each job is polled individually (as before).
+
+const ALL_JOBS = "*";
+const EVENTS_WAIT = 20;     // seconds (the plugin limits it to its 'MaxWait')
+const EVENTS_MIN_PERIOD = 1000;  // milliseconds
+
+let jobListeners = {};      // jobId -> [callback(jobStatus)], ALL_JOBS -> [callback({reset, jobs, removed})]
+let since = 0;
+let abortController = null;
+let isLoopRunning = false;
+
+function hasJobsEvents() {
+    return store.state.configuration.oe2Capabilities.HasJobsEvents;
+}
+
+function notify(jobId, payload) {
+    if (jobId in jobListeners) {
+        for (const callback of [...jobListeners[jobId]]) {
+            callback(payload);
+        }
+    }
+}
+
+async function eventsLoop() {
+    isLoopRunning = true;
+
+    while (Object.keys(jobListeners).length > 0) {
+        const jobsIds = ALL_JOBS in jobListeners ? [] : Object.keys(jobListeners);
+        abortController = new AbortController();
+
+        try {
+            const start = Date.now();
+            const events = await api.getJobsEvents(since, jobsIds, EVENTS_WAIT, abortController);
+            since = events.Sequence;
+
+            for (const job of events.Jobs) {
+                notify(job.ID, job);
+            }
+            notify(ALL_JOBS, { reset: events.Reset, jobs: events.Jobs, removed: events.Removed });
+
+            // the plugin answers at once when too many clients are already waiting -> do not poll in a tight loop
+            const isEmpty = !events.Reset && events.Jobs.length == 0 && events.Removed.length == 0;
+            if (isEmpty && Date.now() - start < EVENTS_MIN_PERIOD) {
+                await new Promise(resolve => setTimeout(resolve, EVENTS_MIN_PERIOD));
+            }
+        } catch (err) {
+            if (!abortController.signal.aborted) {
+                console.log("Error while monitoring jobs:", err);
+                await new Promise(resolve => setTimeout(resolve, 2000));
+            }
+        }
+    }
+
+    abortController = null;
+    isLoopRunning = false;
+}
+
+function restartEventsLoop() {
+    if (isLoopRunning) {
+        abortController.abort();  // the loop will restart with the new list of jobs
+    } else {
+        eventsLoop();
+    }
+}
+
+function addListener(jobId, callback) {
+    if (!(jobId in jobListeners)) {
+        jobListeners[jobId] = [];
+    }
+    jobListeners[jobId].push(callback);
+}
+
+function removeListener(jobId, callback) {
+    if (jobId in jobListeners) {
+        jobListeners[jobId] = jobListeners[jobId].filter(c => c !== callback);
+        if (jobListeners[jobId].length == 0) {
+            delete jobListeners[jobId];
+        }
+    }
+
+    if (Object.keys(jobListeners).length == 0 && abortController) {
+        abortController.abort();
+    }
+}
+
+export default {
+    // callback(jobStatus) is called each time the job is updated, until unwatchJob is called
+    watchJob(jobId, callback) {
+        if (hasJobsEvents()) {
+            addListener(jobId, callback);
+            api.getJobStatus(jobId).then(callback);  // the events only contain the changes -> get the current status first
+            restartEventsLoop();
+        } else {
+            let refreshTimeout = 200;  // refresh quickly at the beginnning !
+            const poll = async () => {
+                if (jobId in jobListeners && jobListeners[jobId].includes(callback)) {
+                    callback(await api.getJobStatus(jobId));
+                    refreshTimeout = Math.min(refreshTimeout + 200, 2000);
+                    setTimeout(poll, refreshTimeout);
+                }
+            };
+            addListener(jobId, callback);
+            setTimeout(poll, refreshTimeout);
+        }
+    },
+    unwatchJob(jobId, callback) {
+        removeListener(jobId, callback);
+    },
+    // callback({reset, jobs, removed}) is called each time a job is updated.  If 'reset' is true, 'jobs' contains all the jobs.
+    watchAllJobs(callback) {
+        addListener(ALL_JOBS, callback);
+
+        if (hasJobsEvents()) {
+            since = 0;  // we need a full snapshot for this new listener
+            restartEventsLoop();
+        } else {
+            const poll = async () => {
+                if (ALL_JOBS in jobListeners && jobListeners[ALL_JOBS].includes(callback)) {
+                    callback({ reset: true, jobs: await api.getAllJobs(), removed: [] });
+                    setTimeout(poll, 3000);
+                }
+            };
+            poll();
+        }
+    },
+    unwatchAllJobs(callback) {
+        removeListener(ALL_JOBS, callback);
+    }
+}
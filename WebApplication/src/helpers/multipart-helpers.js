@@ -0,0 +1,111 @@
+// Incremental parsing of a multipart answer (e.g. 'multipart/related') such that each part
+// can be handled as soon as it has been received, without waiting for the whole answer.
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+function findBytes(haystack, needle, from) {
+    for (let i = from; i <= haystack.length - needle.length; i++) {
+        let j = 0;
+        while (j < needle.length && haystack[i + j] == needle[j]) {
+            j++;
+        }
+        if (j == needle.length) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+function concatBytes(a, b) {
+    let result = new Uint8Array(a.length + b.length);
+    result.set(a, 0);
+    result.set(b, a.length);
+    return result;
+}
+
+function parseHeaders(text) {
+    let headers = {};
+    for (const line of text.split("\r\n")) {
+        const separator = line.indexOf(":");
+        if (separator > 0) {
+            headers[line.substring(0, separator).trim().toLowerCase()] = line.substring(separator + 1).trim();
+        }
+    }
+    return headers;
+}
+
+export default {
+    getBoundary(contentType) {
+        const match = contentType.match(/boundary="?([^";]+)"?/);
+        return match ? match[1] : null;
+    },
+    // onPart(headers, body) is called for each part; the headers names are lower case, the body is a Uint8Array.
+    // A part is handed over as soon as its body is complete (thanks to its Content-Length, or else when the next
+    // delimiter is received).  Throws if the answer ends without its closing delimiter (i.e. it has been truncated).
+    async readMultipartStream(response, onPart) {
+        const boundary = this.getBoundary(response.headers.get("content-type") || "");
+        if (!boundary) {
+            throw new Error("Not a multipart answer");
+        }
+
+        const delimiter = textEncoder.encode("--" + boundary);
+        const headersEnd = textEncoder.encode("\r\n\r\n");
+        const reader = response.body.getReader();
+        let buffer = new Uint8Array(0);
+        let isClosed = false;
+
+        while (!isClosed) {
+            const { done, value } = await reader.read();
+            if (done) {
+                break;
+            }
+            buffer = concatBytes(buffer, value);
+
+            for (; ;) {
+                const start = findBytes(buffer, delimiter, 0);
+                const afterDelimiter = start + delimiter.length;
+                if (start < 0 || buffer.length < afterDelimiter + 2) {
+                    break;  // the delimiter is not complete yet
+                }
+
+                if (buffer[afterDelimiter] == 0x2d && buffer[afterDelimiter + 1] == 0x2d) {  // "--": closing delimiter
+                    isClosed = true;
+                    break;
+                }
+
+                const bodyStart = findBytes(buffer, headersEnd, afterDelimiter);
+                if (bodyStart < 0) {
+                    break;  // the headers are not complete yet
+                }
+
+                const headers = parseHeaders(textDecoder.decode(buffer.subarray(afterDelimiter, bodyStart)));
+                const bodyOffset = bodyStart + headersEnd.length;
+
+                let body;
+                if ("content-length" in headers) {
+                    const bodyEnd = bodyOffset + parseInt(headers["content-length"]);
+                    if (buffer.length < bodyEnd) {
+                        break;  // the body is not complete yet
+                    }
+                    body = buffer.slice(bodyOffset, bodyEnd);
+                    buffer = buffer.slice(bodyEnd);  // the CRLF before the next delimiter is skipped when searching the delimiter
+                } else {
+                    const next = findBytes(buffer, delimiter, bodyOffset);
+                    if (next < 0) {
+                        break;  // the part is not complete yet
+                    }
+                    body = buffer.slice(bodyOffset, next - 2);  // -2: the CRLF before the next delimiter
+                    buffer = buffer.slice(next);
+                }
+
+                onPart(headers, body);
+            }
+        }
+
+        if (!isClosed) {
+            reader.cancel();
+            throw new Error("The multipart answer is truncated");
+        }
+    }
+}
@@ -0,0 +1,74 @@
+import api from "../orthancApi"
+import store from "../store"
+
+// Each StudyItem of the local study list requests the number of studies of its patient on the remote archive.
+// The requests made while the list is rendered are grouped in a single call to the OE2 plugin that computes
+// the counts in the background; the counts that are not ready yet are requested again (with a long-polling wait).
+
+const BATCH_DELAY = 100;    // ms
+const COUNTS_WAIT = 10;     // seconds
+const MAX_ATTEMPTS = 6;
+const MAX_PATIENTS_PER_REQUEST = 500;  // the plugin rejects more than 1000 PatientIDs per request
+
+let listeners = {};         // patientId -> [callback(count, archive)]
+let batchTimeout = null;
+
+function isEnabled() {
+    const configuration = store.state.configuration;
+    return configuration.oe2Capabilities.HasRemoteStudiesCount &&
+        (configuration.uiOptions.EnableDicomModalities || configuration.uiOptions.EnableDicomWebServers);
+}
+
+function notify(patientId, count, archive) {
+    if (patientId in listeners) {
+        for (const callback of listeners[patientId]) {
+            callback(count, archive);
+        }
+        delete listeners[patientId];
+    }
+}
+
+async function loadCounts() {
+    batchTimeout = null;
+    let pending = Object.keys(listeners);
+
+    for (let attempt = 0; attempt < MAX_ATTEMPTS && pending.length > 0; attempt++) {
+        try {
+            let stillPending = [];
+            for (let i = 0; i < pending.length; i += MAX_PATIENTS_PER_REQUEST) {
+                const response = await api.getRemoteStudiesCount(pending.slice(i, i + MAX_PATIENTS_PER_REQUEST), COUNTS_WAIT);
+                for (const [patientId, count] of Object.entries(response.Counts)) {
+                    notify(patientId, count, response.Archive);
+                }
+                stillPending.push(...response.Pending);
+            }
+            pending = stillPending.filter(patientId => patientId in listeners);
+        } catch (err) {
+            console.log("Error while counting the remote studies:", err);
+            break;
+        }
+    }
+
+    // give up for this time, the next StudyItems will request them again
+    for (const patientId of pending) {
+        delete listeners[patientId];
+    }
+}
+
+export default {
+    // callback(count, archive) is called once the count is known (count is null if the archive could not be queried)
+    getCount(patientId, callback) {
+        if (!isEnabled() || !patientId) {
+            return;
+        }
+
+        if (!(patientId in listeners)) {
+            listeners[patientId] = [];
+        }
+        listeners[patientId].push(callback);
+
+        if (batchTimeout == null) {
+            batchTimeout = setTimeout(loadCounts, BATCH_DELAY);
+        }
+    }
+}
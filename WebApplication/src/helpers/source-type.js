@@ -1,7 +1,9 @@
 const SourceType = Object.freeze({
     LOCAL_ORTHANC: 0,
     REMOTE_DICOM: 1,
-    REMOTE_DICOM_WEB: 2
+    REMOTE_DICOM_WEB: 2,
+    REMOTE_MULTI: 3,     // all the remote modalities and DICOMweb servers at once
+    ORTHANC_PEERS: 4     // the local Orthanc and all the Orthanc peers at once
 });
 
 export default SourceType;
\ No newline at end of file
@@ -2,7 +2,9 @@ import axios from "axios"
 import store from "./store"
 import mime from "mime-types";
 import resourceHelpers from "./helpers/resource-helpers"
+import multipartHelpers from "./helpers/multipart-helpers"
 import { showSaveFilePicker } from "native-file-system-adapter";
+import { v4 as uuidv4 } from "uuid"
 
 
 import { orthancApiUrl, oe2ApiUrl } from "./globalConfigurations";
@@ -68,6 +70,14 @@ export default {
         const response = (await axios.get(orthancApiUrl + "jobs?expand"));
         return response.data;
     },
+    async getJobsEvents(since, jobsIds, wait, abortController) {
+        let url = oe2ApiUrl + "jobs/events?since=" + since + "&wait=" + wait;
+        if (jobsIds && jobsIds.length > 0) {
+            url += "&jobs=" + jobsIds.join(",");
+        }
+        const response = (await axios.get(url, { signal: abortController.signal }));
+        return response.data;
+    },
     async pauseJob(jobId) {
         return (await axios.post(orthancApiUrl + "jobs/" + jobId + "/pause", "")).data;
     },
@@ -143,6 +153,63 @@ export default {
         response["is-complete"] = response["studies"].length < limit; // we have received all available studies
         return response;
     },
+    async findStudiesColumnar(filterQuery, labels, labelsConstraint, orderBy, cursor) {
+        await this.cancelFindStudies();
+        window.axiosFindStudiesAbortController = new AbortController();
+
+        let payload = {
+            "Limit": store.state.configuration.uiOptions.PageLoadSize,
+            "Query": filterQuery,
+            "RequestedTags": store.state.configuration.requestedTagsForStudyList
+        };
+
+        if (labels && labels.length > 0) {
+            payload["Labels"] = labels;
+            payload["LabelsConstraint"] = labelsConstraint;
+        } else if (labelsConstraint == 'None') {
+            payload["Labels"] = [];
+            payload["LabelsConstraint"] = 'None';
+        }
+
+        if (orderBy && orderBy.length > 0) {
+            payload["OrderBy"] = orderBy;
+        }
+
+        if (cursor) {
+            payload["Cursor"] = cursor;
+        }
+
+        const answer = (await axios.post(oe2ApiUrl + "studies/find", payload,
+            {
+                signal: window.axiosFindStudiesAbortController.signal
+            })).data;
+
+        // rebuild the studies as returned by tools/find from the columns
+        let studies = [];
+        for (let i = 0; i < answer["Count"]; i++) {
+            let study = { "MainDicomTags": {}, "PatientMainDicomTags": {}, "RequestedTags": {} };
+            for (const [column, values] of Object.entries(answer["Columns"])) {
+                if (values[i] !== null) {
+                    study[column] = values[i];
+                }
+            }
+            for (const [t, tag] of answer["Tags"].entries()) {
+                const value = answer["Values"][t][i];
+                if (value !== null) {
+                    for (const group of tag["Groups"]) {
+                        study[group][tag["Name"]] = value;
+                    }
+                }
+            }
+            studies.push(study);
+        }
+
+        return {
+            "studies": studies,
+            "is-complete": answer["IsComplete"],
+            "cursor": answer["Cursor"]
+        };
+    },
     async getMostRecentStudiesExtended(label) {
         await this.cancelFindStudies();
         window.axiosFindStudiesAbortController = new AbortController();
@@ -256,7 +323,21 @@ export default {
             window.axiosRemoteDicomFindAbortController = null;
         }
     },
-    async remoteDicomFind(level, remoteModality, filterQuery, isUnique) {
+    // the remote queries go through the OE2 plugin that caches their answers during a short time (unless 'refresh' is true)
+    async remoteQuery(level, sourceType, remoteSource, filterQuery, axiosOptions, refresh) {
+        const response = (await axios.post(oe2ApiUrl + "remote/query", {
+            "Type": sourceType,
+            "Name": remoteSource,
+            "Level": level,
+            "Query": filterQuery,
+            "Limit": store.state.configuration.uiOptions.MaxStudiesDisplayed,
+            "Refresh": refresh
+        },
+            axiosOptions
+        )).data;
+        return response["Answers"];
+    },
+    async remoteDicomFind(level, remoteModality, filterQuery, isUnique, refresh = false) {
         if (isUnique) {
             await this.cancelRemoteDicomFind();
             window.axiosRemoteDicomFindAbortController = new AbortController();
@@ -267,6 +348,10 @@ export default {
             if (isUnique) {
                 axiosOptions['signal'] = window.axiosRemoteDicomFindAbortController.signal
             }
+            if (store.state.configuration.oe2Capabilities.HasRemoteQueriesCache) {
+                return (await this.remoteQuery(level, "dicom", remoteModality, filterQuery, axiosOptions, refresh));
+            }
+
             const queryResponse = (await axios.post(orthancApiUrl + "modalities/" + remoteModality + "/query", {
                 "Level": level,
                 "Query": filterQuery
@@ -282,7 +367,7 @@ export default {
             return {};
         }
     },
-    async qidoRs(level, remoteServer, filterQuery, isUnique) {
+    async qidoRs(level, remoteServer, filterQuery, isUnique, refresh = false) {
         if (isUnique) {
             await this.cancelQidoRs();
             window.axiosQidoRsAbortController = new AbortController();
@@ -293,6 +378,10 @@ export default {
             if (isUnique) {
                 axiosOptions['signal'] = window.axiosQidoRsAbortController.signal
             }
+            if (store.state.configuration.oe2Capabilities.HasRemoteQueriesCache) {
+                return (await this.remoteQuery(level, "dicom-web", remoteServer, filterQuery, axiosOptions, refresh));
+            }
+
             let uri = null;
             if (level == "Study") {
                 uri = "/studies";
@@ -337,6 +426,143 @@ export default {
             window.axiosQidoRsAbortController = null;
         }
     },
+    async getRemoteStudiesCount(patientIds, wait) {
+        return (await axios.post(oe2ApiUrl + "patients/remote-studies-count", {
+            "PatientIDs": patientIds,
+            "Wait": wait
+        })).data;
+    },
+    async getStudiesFacets(filterQuery, labels, labelsConstraint, dateRanges) {
+        let payload = {
+            "Query": filterQuery,
+            "DateRanges": dateRanges
+        };
+
+        if (labels && labels.length > 0) {
+            payload["Labels"] = labels;
+            payload["LabelsConstraint"] = labelsConstraint;
+        } else if (labelsConstraint == 'None') {
+            payload["Labels"] = [];
+            payload["LabelsConstraint"] = 'None';
+        }
+
+        return (await axios.post(oe2ApiUrl + "studies/facets", payload)).data;
+    },
+    // saves all the studies that match the filters in a 'csv' or 'ndjson' file.  The OE2 plugin streams the
+    // studies page by page and each page is written to the file as soon as it is received.
+    async exportStudies(format, filterQuery, labels, labelsConstraint, orderBy) {
+        let payload = {
+            "Query": filterQuery
+        };
+
+        if (labels && labels.length > 0) {
+            payload["Labels"] = labels;
+            payload["LabelsConstraint"] = labelsConstraint;
+        } else if (labelsConstraint == 'None') {
+            payload["Labels"] = [];
+            payload["LabelsConstraint"] = 'None';
+        }
+
+        if (orderBy && orderBy.length > 0) {
+            payload["OrderBy"] = orderBy;
+        }
+
+        const fileHandle = await showSaveFilePicker({
+            _preferPolyfill: true,
+            suggestedName: "studies." + format,
+            types: [{ accept: { [format == "csv" ? "text/csv" : "application/x-ndjson"]: ["." + format] } }],
+            excludeAcceptAllOption: false,
+        });
+
+        // axios does not stream the answers -> use fetch with the same authorization headers
+        let headers = { "Accept": "multipart/mixed", "Content-Type": "application/json" };
+        for (const [k, v] of Object.entries(axios.defaults.headers.common)) {
+            if (typeof v === "string" && k.toLowerCase() != "accept") {
+                headers[k] = v;
+            }
+        }
+
+        const response = await fetch(oe2ApiUrl + "studies/export?format=" + format, {
+            method: "POST",
+            headers: headers,
+            body: JSON.stringify(payload)
+        });
+        if (!response.ok) {
+            throw new Error("Unable to export the studies");
+        }
+
+        await this.saveMultipartExport(response, fileHandle);
+    },
+    // writes each part of an export of the OE2 plugin to the file as soon as it is received.  The plugin
+    // reports the errors that happen once the answer has started in a part with an 'X-Export-Error' header.
+    async saveMultipartExport(response, fileHandle) {
+        const writableStream = await fileHandle.createWritable();
+        let writes = Promise.resolve();
+        let error = null;
+        await multipartHelpers.readMultipartStream(response, (partHeaders, body) => {
+            if ("x-export-error" in partHeaders) {
+                error = partHeaders["x-export-error"];
+            } else {
+                writes = writes.then(() => writableStream.write(body));
+            }
+        });
+        await writes;
+
+        if (error) {
+            await writableStream.abort();
+            throw new Error("The export is incomplete: " + error);
+        }
+        await writableStream.close();
+    },
+    async getStudiesAutocomplete(dicomTagName, value) {
+        return (await axios.get(oe2ApiUrl + "studies/autocomplete", {
+            params: {
+                "tag": dicomTagName,
+                "value": value,
+                "limit": 10
+            }
+        })).data;
+    },
+    async cancelFederatedFind() {
+        if (window.federatedFindAbortController) {
+            window.federatedFindAbortController.abort();
+            window.federatedFindAbortController = null;
+        }
+    },
+    // queries all the targets ([{Type: 'dicom'|'dicom-web'|'peer', Name}]) at once through the OE2 plugin.
+    // onAnswers({Type, Name, Answers, Duplicates, Error}) is called as soon as each target has answered.
+    async federatedFind(level, targets, filterQuery, onAnswers, refresh = false) {
+        await this.cancelFederatedFind();
+        window.federatedFindAbortController = new AbortController();
+
+        // axios does not stream the answers -> use fetch with the same authorization headers
+        let headers = { "Accept": "multipart/mixed", "Content-Type": "application/json" };
+        for (const [k, v] of Object.entries(axios.defaults.headers.common)) {
+            if (typeof v === "string" && k.toLowerCase() != "accept") {
+                headers[k] = v;
+            }
+        }
+
+        const response = await fetch(oe2ApiUrl + "remote/find", {
+            method: "POST",
+            headers: headers,
+            signal: window.federatedFindAbortController.signal,
+            body: JSON.stringify({
+                "Level": level,
+                "Query": filterQuery,
+                "Targets": targets,
+                "Limit": store.state.configuration.uiOptions.MaxStudiesDisplayed,
+                "Refresh": refresh
+            })
+        });
+        if (!response.ok) {
+            throw new Error("Unable to query the remote sources");
+        }
+
+        await multipartHelpers.readMultipartStream(response, (partHeaders, body) => {
+            onAnswers(JSON.parse(new TextDecoder().decode(body)));
+        });
+    },
     async wadoRsRetrieve(remoteServer, resources) {
         const retrieveJob = (await axios.post(orthancApiUrl + "dicom-web/servers/" + remoteServer + "/retrieve", {
             "Resources": resources,
@@ -373,6 +599,77 @@ export default {
     async uploadFile(filecontent) {
         return (await axios.post(orthancApiUrl + "instances", filecontent)).data;
     },
+    async uploadFilesBatch(files) {
+        // the browser streams the files from the disk, the plugin stores them as soon as they are received
+        let formData = new FormData();
+        for (let file of files) {
+            formData.append("file", file, file.webkitRelativePath || file.name);
+        }
+        return (await axios.post(oe2ApiUrl + "instances", formData)).data;
+    },
+    async lookupStoredInstances(sopInstanceUids) {
+        // returns the SOPInstanceUIDs that are already stored -> { uid: { ID, ParentSeries, ParentStudy } }
+        return (await axios.post(oe2ApiUrl + "instances/lookup", {
+            "SOPInstanceUIDs": sopInstanceUids
+        })).data.Instances;
+    },
+    async createResumableUpload(size, filename) {
+        return (await axios.post(oe2ApiUrl + "uploads", {
+            "Size": size,
+            "Filename": filename
+        })).data;
+    },
+    async getResumableUpload(uploadId) {
+        // returns the offset from which the upload must be resumed
+        return (await axios.get(oe2ApiUrl + "uploads/" + uploadId)).data;
+    },
+    async appendResumableUpload(uploadId, offset, chunk) {
+        // throws a 409 error whose data contains the actual offset if 'offset' is outdated
+        return (await axios.post(oe2ApiUrl + "uploads/" + uploadId, chunk, {
+            headers: {
+                'Content-Type': 'application/octet-stream',
+                'Upload-Offset': offset
+            }
+        })).data;
+    },
+    async uploadZipFile(file, onEntriesProcessed) {
+        // the plugin inflates the archive while it is received and stores each entry.  The results
+        // of the entries are polled during the upload and 'onEntriesProcessed' is called with each
+        // new batch of results; the final report only contains the entries that have not been reported yet.
+        const progressId = uuidv4();
+        let next = 0;
+        let isUploading = true;
+
+        const pollProgress = async () => {
+            while (isUploading) {
+                await new Promise(resolve => setTimeout(resolve, 1000));
+                try {
+                    const progress = (await axios.get(oe2ApiUrl + "instances/progress/" + progressId + "?since=" + next)).data;
+                    if (isUploading && progress.Next > next) {
+                        next = progress.Next;
+                        onEntriesProcessed(progress.Files);
+                    }
+                } catch (error) {
+                    // the upload has not started yet or is complete
+                }
+            }
+        };
+        const polling = pollProgress();
+
+        try {
+            const report = (await axios.post(oe2ApiUrl + "instances?progress=" + progressId, file, {
+                headers: {
+                    'Content-Type': 'application/zip'
+                }
+            })).data;
+            isUploading = false;
+            await polling;
+            onEntriesProcessed(report.Files.slice(next));
+            return report;
+        } finally {
+            isUploading = false;
+        }
+    },
     async createDicom(parentId, content, tags) {
         return (await axios.post(orthancApiUrl + "tools/create-dicom", {
             "Parent": parentId,
@@ -380,6 +677,18 @@ export default {
             "Content": content
         })).data
     },
+    async addEncapsulatedSeries(studyId, file, mimeType, tags) {
+        // the file is sent as a raw body, the tags in a header (base64 of the JSON in UTF-8)
+        const tagsBytes = new TextEncoder().encode(JSON.stringify(tags));
+        const tagsHeader = btoa(Array.from(tagsBytes, b => String.fromCharCode(b)).join(""));
+
+        return (await axios.post(oe2ApiUrl + "studies/" + studyId + "/series", file, {
+            headers: {
+                'Content-Type': mimeType,
+                'X-Series-Tags': tagsHeader
+            }
+        })).data;
+    },
     async getPatient(orthancId) {
         return (await axios.get(orthancApiUrl + "patients/" + orthancId)).data;
     },
@@ -431,6 +740,33 @@ export default {
         }
         return (await axios.get(url)).data;
     },
+    async getStudySummary(orthancId) {
+        return (await axios.get(oe2ApiUrl + "studies/" + orthancId + "/summary")).data;
+    },
+    async getSeriesThumbnail(orthancId) {
+        // fetched through axios (and not through an <img> src) to include the authorization headers
+        const response = (await axios.get(oe2ApiUrl + "series/" + orthancId + "/thumbnail", { responseType: 'blob' }));
+        return URL.createObjectURL(response.data);
+    },
+    // onThumbnail(seriesId, url) is called as soon as each thumbnail is received (ordered by SeriesNumber)
+    async getStudyThumbnails(orthancId, onThumbnail) {
+        // axios does not stream the answers -> use fetch with the same authorization headers
+        let headers = { "Accept": "multipart/related" };
+        for (const [k, v] of Object.entries(axios.defaults.headers.common)) {
+            if (typeof v === "string" && k.toLowerCase() != "accept") {
+                headers[k] = v;
+            }
+        }
+
+        const response = await fetch(oe2ApiUrl + "studies/" + orthancId + "/thumbnails", { headers: headers });
+        if (!response.ok) {
+            throw new Error("Unable to get the thumbnails of study " + orthancId);
+        }
+
+        await multipartHelpers.readMultipartStream(response, (partHeaders, body) => {
+            onThumbnail(partHeaders["content-location"], URL.createObjectURL(new Blob([body], { type: "image/jpeg" })));
+        });
+    },
     async getSeriesParentStudy(orthancId) {
         return (await axios.get(orthancApiUrl + "series/" + orthancId + "/study")).data;
     },
@@ -664,6 +1000,15 @@ export default {
 
         return response.data;
     },
+    async getSamePatientStudiesCounts(studiesIds) {
+        return (await axios.post(oe2ApiUrl + "studies/same-patient-count", { "Studies": studiesIds })).data;
+    },
+    async getPredefinedFilters() {
+        return (await axios.get(oe2ApiUrl + "predefined-filters")).data;
+    },
+    async getLabelsStudiesCount() {
+        return (await axios.get(oe2ApiUrl + "labels/studies-count")).data;
+    },
     async getLabelStudyCount(label) {
         let query = {
             "Level": "Study",
@@ -748,6 +1093,44 @@ export default {
             return (await axios.get(orthancApiUrl + "auth/audit-logs?" + getArguments.toString())).data;
         }
     },
+    // gets a page of the audit logs through the OE2 plugin: {Logs, Cursor}.  'Cursor' is absent once all the logs have been loaded.
+    async getAuditLogsPage(filters, cursor) {
+        let params = { ...filters };
+        if (cursor) {
+            params["cursor"] = cursor;
+        }
+        return (await axios.get(oe2ApiUrl + "audit-logs", { params: params })).data;
+    },
+    // saves all the audit logs that match the filters in a CSV file, streamed page by page by the OE2 plugin
+    async exportAuditLogs(filters) {
+        const fileHandle = await showSaveFilePicker({
+            _preferPolyfill: true,
+            suggestedName: "audit-logs.csv",
+            types: [{ accept: { "text/csv": [".csv"] } }],
+            excludeAcceptAllOption: false,
+        });
+
+        const getArguments = new URLSearchParams(filters || {});
+        getArguments.append("format", "csv");
+
+        // axios does not stream the answers -> use fetch with the same authorization headers
+        let headers = { "Accept": "multipart/mixed" };
+        for (const [k, v] of Object.entries(axios.defaults.headers.common)) {
+            if (typeof v === "string" && k.toLowerCase() != "accept") {
+                headers[k] = v;
+            }
+        }
+
+        const response = await fetch(oe2ApiUrl + "audit-logs?" + getArguments.toString(), {
+            method: "GET",
+            headers: headers
+        });
+        if (!response.ok) {
+            throw new Error("Unable to export the audit logs");
+        }
+
+        await this.saveMultipartExport(response, fileHandle);
+    },
     async getWorklists() {
         return (await axios.get(orthancApiUrl + "worklists?format=Full")).data;
     },
@@ -22,7 +22,8 @@ const state = () => ({
     requestedTagsForStudyList: [],
     hasExtendedFind: false,
     hasExtendedChanges: false,
-    advancedOptions: {}
+    advancedOptions: {},
+    oe2Capabilities: {}     // the optional routes provided by the OE2 plugin
 })
 
 ///////////////////////////// GETTERS
@@ -85,6 +86,9 @@ const mutations = {
     },
     setAdvancedOptions(state, { advancedOptions }) {
         state.advancedOptions = advancedOptions;
+    },
+    setOe2Capabilities(state, { capabilities }) {
+        state.oe2Capabilities = capabilities;
     }
 
 }
@@ -127,6 +131,10 @@ const actions = {
         commit('setTokens', { tokens: oe2Config['Tokens'] });
         commit('setAdvancedOptions', { advancedOptions: oe2Config['AdvancedOptions'] });
 
+        if ('Capabilities' in oe2Config) {
+            commit('setOe2Capabilities', { capabilities: oe2Config['Capabilities'] });
+        }
+
         if ('Profile' in oe2Config) {
             commit('setUserProfile', { profile: oe2Config['Profile'] });
         }
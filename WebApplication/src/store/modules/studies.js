@@ -18,6 +18,7 @@ const state = () => ({
     studies: [],  // studies as returned by tools/find
     studiesIds: [],
     isStudiesComplete: false, // true if we have received all studies
+    studiesCursor: null,  // to load the next page from the OE2 plugin 'studies/find' route
     dicomTagsFilters: { ..._clearedFilter },
     labelFilters: [],
     labelsContraint: "All",
@@ -26,6 +27,9 @@ const state = () => ({
     isSearching: false,
     sourceType: SourceType.LOCAL_ORTHANC,
     remoteSource: null,
+    remoteSourcesStatus: {},  // source name -> {error, duration, count} (REMOTE_MULTI and ORTHANC_PEERS only)
+    bypassRemoteCache: false, // true to ignore the answers cached by the plugin for the next remote query
+    samePatientStudiesCounts: {},  // study ID -> number of studies of its patient (from the OE2 plugin index, for the loaded studies)
 })
 
 function insert_wildcards(initialValue) {
@@ -37,6 +41,27 @@ function insert_wildcards(initialValue) {
     return finalValue.replaceAll('**', '');
 }
 
+function get_peers_targets() {
+    return store.state.configuration.orthancPeers.map(peer => { return { "Type": "peer", "Name": peer } });
+}
+
+function get_remote_targets() {
+    const configuration = store.state.configuration;
+    let targets = [];
+
+    if (configuration.uiOptions.EnableDicomModalities) {
+        for (const modality of Object.keys(configuration.queryableDicomModalities)) {
+            targets.push({ "Type": "dicom", "Name": modality });
+        }
+    }
+    if (configuration.uiOptions.EnableDicomWebServers) {
+        for (const server of configuration.queryableDicomWebServers) {
+            targets.push({ "Type": "dicom-web", "Name": server });
+        }
+    }
+    return targets;
+}
+
 async function get_studies_shared(context, append) {
     const commit = context.commit;
     const state = context.state;
@@ -50,21 +75,29 @@ async function get_studies_shared(context, append) {
         commit('setIsSearching', { isSearching: true });
         let studies = [];
         let isComplete = false;
+        let cursor = null;
 
         if (state.sourceType == SourceType.LOCAL_ORTHANC) {
             let orderBy = [...state.orderByFilters];
             if (state.orderByFilters.length == 0) {
                 orderBy.push({ 'Type': 'Metadata', 'Key': 'LastUpdate', 'Direction': 'DESC' })
             }
-            let since = (append ? state.studiesIds.length : null);
+            if (store.state.configuration.hasExtendedFind && store.state.configuration.oe2Capabilities.HasStudiesFind) {
+                let response = (await api.findStudiesColumnar(getters.filterQuery, state.labelFilters, state.labelsContraint, orderBy, (append ? state.studiesCursor : null)));
+                studies = response['studies'];
+                isComplete = response['is-complete'];
+                cursor = response['cursor'];
+            } else {
+                let since = (append ? state.studiesIds.length : null);
 
-            if (!store.state.configuration.hasExtendedFind) {
-                orderBy = null;
+                if (!store.state.configuration.hasExtendedFind) {
+                    orderBy = null;
+                }
+                let response = (await api.findStudies(getters.filterQuery, state.labelFilters, state.labelsContraint, orderBy, since));
+                studies = response['studies'];
+                isComplete = response['is-complete'];
             }
-            let response = (await api.findStudies(getters.filterQuery, state.labelFilters, state.labelsContraint, orderBy, since));
-            studies = response['studies'];
-            isComplete = response['is-complete'];
-        } else if (state.sourceType == SourceType.REMOTE_DICOM || state.sourceType == SourceType.REMOTE_DICOM_WEB) {
+        } else if (state.sourceType == SourceType.REMOTE_DICOM || state.sourceType == SourceType.REMOTE_DICOM_WEB || state.sourceType == SourceType.REMOTE_MULTI || state.sourceType == SourceType.ORTHANC_PEERS) {
             // make sure to fill all columns of the StudyList
             let filters = {
                 "PatientBirthDate": "",
@@ -86,11 +119,77 @@ async function get_studies_shared(context, append) {
                 filters[k] = v;
             }
 
+            const refresh = state.bypassRemoteCache;
+            commit('setBypassRemoteCache', { bypass: false });
+
             let remoteStudies;
-            if (state.sourceType == SourceType.REMOTE_DICOM) {
-                remoteStudies = (await api.remoteDicomFind("Study", state.remoteSource, filters, true /* isUnique */));
+            if (state.sourceType == SourceType.REMOTE_MULTI || state.sourceType == SourceType.ORTHANC_PEERS) {
+                // all sources are queried in parallel by the plugin, display the answers of each source as soon as they are received
+                commit('setRemoteSourcesStatus', { status: {} });
+                remoteStudies = [];
+
+                let displayedStudies = new Set();  // the StudyInstanceUIDs that are already in the list
+                let isLocalDisplayed = (state.sourceType != SourceType.ORTHANC_PEERS);
+                let pendingParts = [];
+
+                const addSourceStudies = (remoteSource, sourceStudies, duplicates) => {
+                    let newStudies = [];
+                    for (const study of sourceStudies) {
+                        const studyInstanceUid = study["MainDicomTags"]["StudyInstanceUID"];
+                        if (displayedStudies.has(studyInstanceUid)) {
+                            duplicates.push(studyInstanceUid);
+                        } else {
+                            displayedStudies.add(studyInstanceUid);
+                            newStudies.push(study);
+                        }
+                    }
+                    for (const studyInstanceUid of duplicates) {
+                        commit('addStudyRemoteSource', { studyInstanceUid: studyInstanceUid, remoteSource: remoteSource });
+                    }
+                    commit('extendStudies', { studiesIds: newStudies.map(s => s["ID"]), studies: newStudies, isComplete: false });
+                };
+
+                const handlePart = (part) => {
+                    const remoteSource = { "Type": part["Type"], "Name": part["Name"] };
+                    commit('setRemoteSourceStatus', { remoteSource: part["Name"], status: { "error": part["Error"], "duration": part["Duration"], "count": part["Answers"].length + part["Duplicates"].length } });
+
+                    const partStudies = part["Answers"].map(s => { return { "MainDicomTags": s, "PatientMainDicomTags": s, "RequestedTags": s, "ID": s["StudyInstanceUID"], "sourceType": state.sourceType, "remoteSources": [remoteSource] } });
+                    addSourceStudies(remoteSource, partStudies, [...part["Duplicates"]]);
+                };
+
+                const targets = (state.sourceType == SourceType.ORTHANC_PEERS ? get_peers_targets() : get_remote_targets());
+                const remoteFind = api.federatedFind("Study", targets, filters, (part) => {
+                    if (isLocalDisplayed) {
+                        handlePart(part);
+                    } else {
+                        pendingParts.push(part);
+                    }
+                }, refresh);
+
+                if (state.sourceType == SourceType.ORTHANC_PEERS) {
+                    // the local studies are always displayed first, whatever the time the peers take to answer
+                    const localSource = { "Type": "local", "Name": store.state.configuration.system.Name };
+                    const start = Date.now();
+                    try {
+                        const localStudies = (await api.findStudies(getters.filterQuery, [], 'All', null, null))['studies'];
+                        commit('setRemoteSourceStatus', { remoteSource: localSource["Name"], status: { "duration": Date.now() - start, "count": localStudies.length } });
+                        addSourceStudies(localSource, localStudies.map(s => { return { ...s, "sourceType": SourceType.LOCAL_ORTHANC, "remoteSources": [localSource] } }), []);
+                    } catch (err) {
+                        commit('setRemoteSourceStatus', { remoteSource: localSource["Name"], status: { "error": String(err) } });
+                    }
+
+                    isLocalDisplayed = true;
+                    for (const part of pendingParts) {
+                        handlePart(part);
+                    }
+                }
+
+                await remoteFind;
+                append = true;  // the studies have already been added to the list while streaming
+            } else if (state.sourceType == SourceType.REMOTE_DICOM) {
+                remoteStudies = (await api.remoteDicomFind("Study", state.remoteSource, filters, true /* isUnique */, refresh));
             } else if (state.sourceType == SourceType.REMOTE_DICOM_WEB) {
-                remoteStudies = (await api.qidoRs("Study", state.remoteSource, filters, true /* isUnique */));
+                remoteStudies = (await api.qidoRs("Study", state.remoteSource, filters, true /* isUnique */, refresh));
             }
 
             // copy the tags in MainDicomTags, ... to have a common study structure between local and remote studies
@@ -106,6 +205,16 @@ async function get_studies_shared(context, append) {
         } else {
             commit('extendStudies', { studiesIds: studiesIds, studies: studies, isComplete: isComplete });
         }
+        commit('setStudiesCursor', { cursor: cursor });
+
+        if (state.sourceType == SourceType.LOCAL_ORTHANC && store.state.configuration.oe2Capabilities.HasPatientStudiesIndex && studiesIds.length > 0) {
+            // one call for the whole page instead of one tools/find per expanded study
+            api.getSamePatientStudiesCounts(studiesIds).then((counts) => {
+                commit('addSamePatientStudiesCounts', { counts: counts, reset: !append });
+            }).catch((err) => {
+                console.log("Unable to get the same patient studies counts", err);
+            });
+        }
     } catch (err) {
         console.log("Find studies cancelled", err);
     } finally {
@@ -185,6 +294,17 @@ const mutations = {
         state.studies.push(...studies);
         state.isStudiesComplete = isComplete;
     },
+    setStudiesCursor(state, { cursor }) {
+        state.studiesCursor = cursor;
+    },
+    addSamePatientStudiesCounts(state, { counts, reset }) {
+        if (reset) {
+            state.samePatientStudiesCounts = {};
+        }
+        for (const [studyId, count] of Object.entries(counts)) {
+            state.samePatientStudiesCounts[studyId] = count;
+        }
+    },
     addStudy(state, { studyId, study }) {
         if (!state.studiesIds.includes(studyId)) {
             state.studiesIds.push(studyId);
@@ -244,6 +364,22 @@ const mutations = {
     setIsSearching(state, { isSearching }) {
         state.isSearching = isSearching;
     },
+    setBypassRemoteCache(state, { bypass }) {
+        state.bypassRemoteCache = bypass;
+    },
+    setRemoteSourcesStatus(state, { status }) {
+        state.remoteSourcesStatus = status;
+    },
+    setRemoteSourceStatus(state, { remoteSource, status }) {
+        state.remoteSourcesStatus[remoteSource] = status;
+    },
+    addStudyRemoteSource(state, { studyInstanceUid, remoteSource }) {
+        for (const study of state.studies) {
+            if (study.MainDicomTags.StudyInstanceUID == studyInstanceUid && study.remoteSources) {
+                study.remoteSources.push(remoteSource);
+            }
+        }
+    },
 }
 
 ///////////////////////////// ACTIONS
@@ -305,6 +441,10 @@ const actions = {
     async reloadFilteredStudies({ commit, getters, state }) {
         get_studies_shared({ commit, getters, state }, false);
     },
+    async refreshRemoteStudies({ commit, getters, state }) {
+        commit('setBypassRemoteCache', { bypass: true });
+        get_studies_shared({ commit, getters, state }, false);
+    },
     async cancelSearch() {
         await api.cancelFindStudies();
     },